@@ -0,0 +1,551 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// cl_demo.c  -- demo recording
+
+#include "client.h"
+
+/*
+==============================================================================
+
+Demos are recorded the way the client decoded the game rather than the
+way the server sent it.  The rest of each server message is copied as
+it came, but its frame is written again as a legacy svc_packetentities
+delta from the last frame recorded.  So a frame never needs more than
+the one before it, whatever extensions the connection used.
+
+Every cl_demokeyframes seconds the frame is written in full instead,
+preceded by every configstring, baseline, the layout and the
+inventory.  Playback can start at any of these keyframes, and after
+the end mark the demo lists where they are
+(demoindex_t in qcommon.h) for the server's demoseek.  Players that
+don't know about the index stop at the end mark.
+
+No message is bigger than MAX_MSGLEN, which is all older players take.
+A keyframe too big for that waits for a frame that fits, and a frame
+that doesn't fit even as a delta is left out, as a server leaves out an
+overflowed message.
+
+democonvert writes an indexed copy of an older demo by parsing it
+here, with nothing drawn, as fast as it can be read.
+
+==============================================================================
+*/
+
+static byte            demo_buf[MAX_MSGLEN];
+static sizebuf_t    demo_msg;                // this server message, as recorded
+
+static int            demo_lastframe;            // the frame recorded last, -1 for none
+static int            demo_lastkey;            // serverframe of the last keyframe
+static qboolean        demo_indexing;            // only the first level is indexed
+static demoindex_t    *demo_index;
+static int            demo_numindex, demo_maxindex;
+static qboolean        demo_keypending;        // the last keyframe's frame isn't written yet
+static qboolean        demo_msgframe;            // demo_msg holds a frame
+static qboolean        demo_csset[MAX_CONFIGSTRINGS];    // keyframes have to clear these
+
+static FILE            *demo_convert;            // democonvert's input
+
+/*
+====================
+CL_DemoFlush
+
+Writes out what has been put together so far
+====================
+*/
+static void CL_DemoFlush (void)
+{
+    if (!demo_msg.cursize)
+        return;
+
+    if (!Demo_WriteMessage (cls.demofile, demo_msg.data, demo_msg.cursize))
+    {    // the next frame can't be a delta, and a keyframe being written is gone
+        demo_lastframe = -1;
+        if (demo_keypending)
+            demo_numindex--;
+        demo_keypending = false;
+    }
+    else if (demo_msgframe)
+        demo_keypending = false;
+    SZ_Clear (&demo_msg);
+    demo_msgframe = false;
+}
+
+/*
+====================
+CL_DemoWrite
+
+Adds to the message, splitting it only if it would be too big to send
+====================
+*/
+static void CL_DemoWrite (void *data, int len)
+{
+    if (demo_msg.cursize + len > demo_msg.maxsize)
+        CL_DemoFlush ();
+    if (len > demo_msg.maxsize)
+    {
+        Com_DPrintf ("CL_DemoWrite: %i bytes left out\n", len);
+        demo_lastframe = -1;
+        return;
+    }
+    SZ_Write (&demo_msg, data, len);
+}
+
+/*
+====================
+CL_DemoWriteState
+
+Everything playback needs besides a full frame to start from here
+====================
+*/
+static void CL_DemoWriteState (void)
+{
+    byte        buf_data[MAX_MSGLEN];
+    sizebuf_t    buf;
+    int            i;
+    entity_state_t    nullstate;
+
+    SZ_Init (&buf, buf_data, sizeof(buf_data));
+
+    // configstrings, and the ones emptied since recording began
+    for (i=0 ; i<MAX_CONFIGSTRINGS ; i++)
+    {
+        if (cl.configstrings[i][0])
+            demo_csset[i] = true;
+        else if (!demo_csset[i])
+            continue;
+
+        if (buf.cursize + strlen (cl.configstrings[i]) + 32 > buf.maxsize)
+        {
+            CL_DemoWrite (buf.data, buf.cursize);
+            SZ_Clear (&buf);
+        }
+        MSG_WriteByte (&buf, svc_configstring);
+        MSG_WriteShort (&buf, i);
+        MSG_WriteString (&buf, cl.configstrings[i]);
+    }
+
+    // baselines
+    memset (&nullstate, 0, sizeof(nullstate));
+    for (i=0 ; i<MAX_EDICTS ; i++)
+    {
+        if (!cl_entities[i].baseline.modelindex)
+            continue;
+
+        if (buf.cursize + 64 > buf.maxsize)
+        {
+            CL_DemoWrite (buf.data, buf.cursize);
+            SZ_Clear (&buf);
+        }
+        MSG_WriteByte (&buf, svc_spawnbaseline);
+        MSG_WriteDeltaEntity (&nullstate, &cl_entities[i].baseline, &buf, true, true);
+    }
+    CL_DemoWrite (buf.data, buf.cursize);
+    SZ_Clear (&buf);
+
+    MSG_WriteByte (&buf, svc_layout);
+    MSG_WriteString (&buf, cl.layout);
+    MSG_WriteByte (&buf, svc_inventory);
+    for (i=0 ; i<MAX_ITEMS ; i++)
+        MSG_WriteShort (&buf, cl.inventory[i]);
+    CL_DemoWrite (buf.data, buf.cursize);
+}
+
+/*
+====================
+CL_DemoGrowIndex
+====================
+*/
+static void CL_DemoGrowIndex (void)
+{
+    demoindex_t    *index;
+
+    demo_maxindex = demo_maxindex ? demo_maxindex*2 : 256;
+    index = Z_Malloc (demo_maxindex * sizeof(*index));
+    if (demo_index)
+    {
+        memcpy (index, demo_index, demo_numindex * sizeof(*index));
+        Z_Free (demo_index);
+    }
+    demo_index = index;
+}
+
+/*
+====================
+CL_DemoEncodeFrame
+
+Writes frame as a delta from old, or in full without one
+====================
+*/
+static void CL_DemoEncodeFrame (frame_t *frame, frame_t *old, sizebuf_t *buf)
+{
+    int            len;
+
+    SZ_Clear (buf);
+    MSG_WriteByte (buf, svc_frame);
+    MSG_WriteLong (buf, frame->serverframe);
+    MSG_WriteLong (buf, old ? demo_lastframe : -1);
+    MSG_WriteByte (buf, 0);
+
+    // the areabits were zero past what came
+    for (len = sizeof(frame->areabits) ; len > 0 && !frame->areabits[len-1] ; len--)
+        ;
+    MSG_WriteByte (buf, len);
+    SZ_Write (buf, frame->areabits, len);
+
+    MSG_WriteDeltaPlayerstate (old ? &old->playerstate : NULL, &frame->playerstate, buf);
+    CL_EncodePacketEntities (old, frame, buf);
+}
+
+/*
+====================
+CL_DemoWriteFrame
+
+Records cl.frame as a delta from the last frame recorded, or in full as
+a keyframe
+====================
+*/
+static void CL_DemoWriteFrame (void)
+{
+    byte        buf_data[MAX_MSGLEN];
+    sizebuf_t    buf;
+    frame_t        *frame, *old;
+    qboolean    key;
+
+    frame = &cl.frame;
+    if (!frame->valid)
+    {
+        demo_lastframe = -1;
+        return;
+    }
+
+    old = NULL;
+    if (demo_lastframe > 0)
+    {
+        old = &cl.frames[demo_lastframe & UPDATE_MASK];
+        if (!old->valid || old->serverframe != demo_lastframe
+            || cl.parse_entities - old->parse_entities > cl_max_parse_entities - cl_max_parse_entities/8)
+            old = NULL;
+    }
+
+    SZ_Init (&buf, buf_data, sizeof(buf_data));
+    buf.allowoverflow = true;
+    buf.quietoverflow = true;
+
+    key = !old || (cl_demokeyframes->value > 0
+        && frame->serverframe - demo_lastkey >= cl_demokeyframes->value*10);
+    if (key)
+    {
+        CL_DemoEncodeFrame (frame, NULL, &buf);
+        if (buf.overflowed && old)
+            key = false;        // try again next frame
+    }
+    if (!key)
+        CL_DemoEncodeFrame (frame, old, &buf);
+
+    if (buf.overflowed)
+    {
+        Com_DPrintf ("CL_DemoWriteFrame: frame %i left out\n", frame->serverframe);
+        demo_lastframe = -1;
+        return;
+    }
+
+    if (key)
+    {
+        if (demo_indexing)
+        {
+            if (demo_numindex == demo_maxindex)
+                CL_DemoGrowIndex ();
+            if (!demo_numindex || frame->serverframe > demo_index[demo_numindex-1].serverframe)
+            {
+                demo_index[demo_numindex].serverframe = frame->serverframe;
+                demo_index[demo_numindex].offset = Demo_Tell (cls.demofile);
+                demo_numindex++;
+                demo_keypending = true;
+            }
+        }
+        CL_DemoWriteState ();
+        demo_lastkey = frame->serverframe;
+    }
+
+    // a frame has to be whole in one message
+    if (demo_msg.cursize + buf.cursize > demo_msg.maxsize)
+        CL_DemoFlush ();
+    SZ_Write (&demo_msg, buf.data, buf.cursize);
+    demo_msgframe = true;
+    demo_lastframe = frame->serverframe;
+}
+
+/*
+====================
+CL_DemoCommand
+
+Called by CL_ParseServerMessage after each command, starting at start
+in net_message
+====================
+*/
+void CL_DemoCommand (int cmd, int start)
+{
+    int        i;
+
+    switch (cmd)
+    {
+    case svc_nop:
+    case svc_reconnect:
+    case svc_download:
+        return;
+
+    case svc_frame:
+        CL_DemoWriteFrame ();
+        return;
+
+    case svc_serverdata:
+        // a new level, whose frames don't follow on
+        demo_lastframe = -1;
+        memset (demo_csset, 0, sizeof(demo_csset));
+        if (demo_numindex)
+            demo_indexing = false;
+        break;
+
+    case svc_configstring:
+        i = net_message.data[start+1] + (net_message.data[start+2]<<8);
+        if (i >= 0 && i < MAX_CONFIGSTRINGS)
+            demo_csset[i] = true;
+        break;
+    }
+
+    CL_DemoWrite (net_message.data + start, net_message.readcount - start);
+}
+
+/*
+====================
+CL_DemoEndMessage
+
+Called by CL_ParseServerMessage once it's done, to write the message
+====================
+*/
+void CL_DemoEndMessage (void)
+{
+    CL_DemoFlush ();
+}
+
+/*
+====================
+CL_DemoStart
+====================
+*/
+static void CL_DemoStart (demofile_t *demo)
+{
+    cls.demofile = demo;
+    cls.demorecording = true;
+
+    SZ_Init (&demo_msg, demo_buf, sizeof(demo_buf));
+    demo_lastframe = -1;
+    demo_lastkey = 0;
+    demo_indexing = true;
+    demo_numindex = 0;
+    demo_keypending = demo_msgframe = false;
+    memset (demo_csset, 0, sizeof(demo_csset));
+}
+
+
+/*
+====================
+CL_Stop_f
+
+stop recording a demo
+====================
+*/
+void CL_Stop_f (void)
+{
+    if (!cls.demorecording)
+    {
+        Com_Printf ("Not recording a demo.\n");
+        return;
+    }
+
+// finish up
+    CL_DemoFlush ();
+    Demo_WriteMessage (cls.demofile, NULL, -1);
+    if (demo_numindex)
+        Demo_WriteIndex (cls.demofile, demo_index, demo_numindex);
+    Demo_Close (cls.demofile);
+    cls.demofile = NULL;
+    cls.demorecording = false;
+
+    if (demo_convert)
+    {
+        fclose (demo_convert);
+        demo_convert = NULL;
+        cls.democonverting = false;
+    }
+    Com_Printf ("Stopped demo, %i keyframes.\n", demo_numindex);
+}
+
+/*
+====================
+CL_Record_f
+
+record <demoname>
+
+Begins recording a demo from the current position
+====================
+*/
+void CL_Record_f (void)
+{
+    char    name[MAX_OSPATH];
+    demofile_t    *demo;
+
+    if (Cmd_Argc() != 2)
+    {
+        Com_Printf ("record <demoname>\n");
+        return;
+    }
+
+    if (cls.demorecording)
+    {
+        Com_Printf ("Already recording.\n");
+        return;
+    }
+
+    if (cls.state != ca_active)
+    {
+        Com_Printf ("You must be in a level to record.\n");
+        return;
+    }
+
+    //
+    // open the demo file
+    //
+    Com_sprintf (name, sizeof(name), "%s/demos/%s.dm2", FS_Gamedir(), Cmd_Argv(1));
+
+    FS_CreatePath (name);
+    demo = Demo_Open (name);
+    if (!demo)
+    {
+        Com_Printf ("ERROR: couldn't open %s.\n", name);
+        return;
+    }
+    Com_Printf ("recording to %s.\n", name);
+    CL_DemoStart (demo);
+
+    //
+    // write out messages to hold the startup information
+    //
+
+    // send the serverdata
+    MSG_WriteByte (&demo_msg, svc_serverdata);
+    MSG_WriteLong (&demo_msg, PROTOCOL_VERSION);
+    MSG_WriteLong (&demo_msg, 0x10000 + cl.servercount);
+    MSG_WriteByte (&demo_msg, 1);    // demos are always attract loops
+    MSG_WriteString (&demo_msg, cl.gamedir);
+    MSG_WriteShort (&demo_msg, cl.playernum);
+
+    MSG_WriteString (&demo_msg, cl.configstrings[CS_NAME]);
+
+    CL_DemoWriteState ();
+
+    MSG_WriteByte (&demo_msg, svc_stufftext);
+    MSG_WriteString (&demo_msg, "precache\n");
+
+    // the rest of the demo file will be individual frames,
+    // starting with a keyframe
+    CL_DemoFlush ();
+}
+
+/*
+====================
+CL_DemoConvert_f
+
+democonvert <demo> <newname>
+
+Plays a demo through the parser with nothing drawn, recording it again
+====================
+*/
+void CL_DemoConvert_f (void)
+{
+    char    name[MAX_OSPATH];
+    demofile_t    *demo;
+    int        len, msglen, frames, time;
+
+    if (Cmd_Argc() != 3)
+    {
+        Com_Printf ("democonvert <demo> <newname>\n");
+        return;
+    }
+
+    if (cls.state != ca_disconnected || cls.demorecording)
+    {
+        Com_Printf ("Disconnect before converting a demo.\n");
+        return;
+    }
+
+    Com_sprintf (name, sizeof(name), "demos/%s", Cmd_Argv(1));
+    if (!strstr (name, "."))
+        strcat (name, ".dm2");
+    len = FS_FOpenFile (name, &demo_convert);
+    if (!demo_convert)
+    {
+        Com_Printf ("Couldn't open %s\n", name);
+        return;
+    }
+
+    Com_sprintf (name, sizeof(name), "%s/demos/%s.dm2", FS_Gamedir(), Cmd_Argv(2));
+    FS_CreatePath (name);
+    demo = Demo_Open (name);
+    if (!demo)
+    {
+        Com_Printf ("ERROR: couldn't open %s.\n", name);
+        fclose (demo_convert);
+        demo_convert = NULL;
+        return;
+    }
+    Com_Printf ("converting to %s.\n", name);
+    CL_DemoStart (demo);
+    cls.democonverting = true;
+
+    frames = 0;
+    time = Sys_Milliseconds ();
+    while (len >= 4 && fread (&msglen, 4, 1, demo_convert) == 1)
+    {
+        len -= 4;
+        msglen = LittleLong (msglen);
+        if (msglen == -1)
+            break;
+        if (msglen < 0 || msglen > len || msglen > net_message.maxsize)
+        {
+            Com_Printf ("Bad message length %i, stopping.\n", msglen);
+            break;
+        }
+        if (fread (net_message.data, msglen, 1, demo_convert) != 1)
+            break;
+        len -= msglen;
+
+        net_message.cursize = msglen;
+        net_message.readcount = 0;
+        CL_ParseServerMessage ();
+        frames++;
+    }
+    time = Sys_Milliseconds () - time;
+
+    Com_Printf ("%i messages in %.1f seconds, %.0f a second\n", frames,
+        time / 1000.0, time ? frames * 1000.0 / time : 0);
+    CL_Stop_f ();
+    CL_Disconnect ();
+}
@@ -36,161 +36,6 @@ FRAME PARSING
 =========================================================================
 */
 
-#if 0
-
-typedef struct
-{
-    int        modelindex;
-    int        num; // entity number
-    int        effects;
-    vec3_t    origin;
-    vec3_t    oldorigin;
-    vec3_t    angles;
-    qboolean present;
-} projectile_t;
-
-#define    MAX_PROJECTILES    64
-projectile_t    cl_projectiles[MAX_PROJECTILES];
-
-void CL_ClearProjectiles (void)
-{
-    int i;
-
-    for (i = 0; i < MAX_PROJECTILES; i++) {
-//        if (cl_projectiles[i].present)
-//            Com_DPrintf("PROJ: %d CLEARED\n", cl_projectiles[i].num);
-        cl_projectiles[i].present = false;
-    }
-}
-
-/*
-=====================
-CL_ParseProjectiles
-
-Flechettes are passed as efficient temporary entities
-=====================
-*/
-void CL_ParseProjectiles (void)
-{
-    int        i, c, j;
-    byte    bits[8];
-    byte    b;
-    projectile_t    pr;
-    int lastempty = -1;
-    qboolean old = false;
-
-    c = MSG_ReadByte (&net_message);
-    for (i=0 ; i<c ; i++)
-    {
-        bits[0] = MSG_ReadByte (&net_message);
-        bits[1] = MSG_ReadByte (&net_message);
-        bits[2] = MSG_ReadByte (&net_message);
-        bits[3] = MSG_ReadByte (&net_message);
-        bits[4] = MSG_ReadByte (&net_message);
-        pr.origin[0] = ( ( bits[0] + ((bits[1]&15)<<8) ) <<1) - 4096;
-        pr.origin[1] = ( ( (bits[1]>>4) + (bits[2]<<4) ) <<1) - 4096;
-        pr.origin[2] = ( ( bits[3] + ((bits[4]&15)<<8) ) <<1) - 4096;
-        VectorCopy(pr.origin, pr.oldorigin);
-
-        if (bits[4] & 64)
-            pr.effects = EF_BLASTER;
-        else
-            pr.effects = 0;
-
-        if (bits[4] & 128) {
-            old = true;
-            bits[0] = MSG_ReadByte (&net_message);
-            bits[1] = MSG_ReadByte (&net_message);
-            bits[2] = MSG_ReadByte (&net_message);
-            bits[3] = MSG_ReadByte (&net_message);
-            bits[4] = MSG_ReadByte (&net_message);
-            pr.oldorigin[0] = ( ( bits[0] + ((bits[1]&15)<<8) ) <<1) - 4096;
-            pr.oldorigin[1] = ( ( (bits[1]>>4) + (bits[2]<<4) ) <<1) - 4096;
-            pr.oldorigin[2] = ( ( bits[3] + ((bits[4]&15)<<8) ) <<1) - 4096;
-        }
-
-        bits[0] = MSG_ReadByte (&net_message);
-        bits[1] = MSG_ReadByte (&net_message);
-        bits[2] = MSG_ReadByte (&net_message);
-
-        pr.angles[0] = 360*bits[0]/256;
-        pr.angles[1] = 360*bits[1]/256;
-        pr.modelindex = bits[2];
-
-        b = MSG_ReadByte (&net_message);
-        pr.num = (b & 0x7f);
-        if (b & 128) // extra entity number byte
-            pr.num |= (MSG_ReadByte (&net_message) << 7);
-
-        pr.present = true;
-
-        // find if this projectile already exists from previous frame 
-        for (j = 0; j < MAX_PROJECTILES; j++) {
-            if (cl_projectiles[j].modelindex) {
-                if (cl_projectiles[j].num == pr.num) {
-                    // already present, set up oldorigin for interpolation
-                    if (!old)
-                        VectorCopy(cl_projectiles[j].origin, pr.oldorigin);
-                    cl_projectiles[j] = pr;
-                    break;
-                }
-            } else
-                lastempty = j;
-        }
-
-        // not present previous frame, add it
-        if (j == MAX_PROJECTILES) {
-            if (lastempty != -1) {
-                cl_projectiles[lastempty] = pr;
-            }
-        }
-    }
-}
-
-/*
-=============
-CL_LinkProjectiles
-
-=============
-*/
-void CL_AddProjectiles (void)
-{
-    int        i, j;
-    projectile_t    *pr;
-    entity_t        ent;
-
-    memset (&ent, 0, sizeof(ent));
-
-    for (i=0, pr=cl_projectiles ; i < MAX_PROJECTILES ; i++, pr++)
-    {
-        // grab an entity to fill in
-        if (pr->modelindex < 1)
-            continue;
-        if (!pr->present) {
-            pr->modelindex = 0;
-            continue; // not present this frame (it was in the previous frame)
-        }
-
-        ent.model = cl.model_draw[pr->modelindex];
-
-        // interpolate origin
-        for (j=0 ; j<3 ; j++)
-        {
-            ent.origin[j] = ent.oldorigin[j] = pr->oldorigin[j] + cl.lerpfrac * 
-                (pr->origin[j] - pr->oldorigin[j]);
-
-        }
-
-        if (pr->effects & EF_BLASTER)
-            CL_BlasterTrail (pr->oldorigin, ent.origin);
-        V_AddLight (pr->origin, 200, 1, 1, 0);
-
-        VectorCopy (pr->angles, ent.angles);
-        V_AddEntity (&ent);
-    }
-}
-#endif
-
 /*
 =================
 CL_ParseEntityBits
@@ -301,159 +146,788 @@ void CL_ParseDelta (entity_state_t *from, entity_state_t *to, int number, int bi
     if (bits & U_ANGLE3)
         to->angles[2] = MSG_ReadAngle(&net_message);
 
-    if (bits & U_OLDORIGIN)
-        MSG_ReadPos (&net_message, to->old_origin);
+    if (bits & U_OLDORIGIN)
+        MSG_ReadPos (&net_message, to->old_origin);
+
+    if (bits & U_SOUND)
+        to->sound = MSG_ReadByte (&net_message);
+
+    if (bits & U_EVENT)
+        to->event = MSG_ReadByte (&net_message);
+    else
+        to->event = 0;
+
+    if (bits & U_SOLID)
+        to->solid = MSG_ReadShort (&net_message);
+}
+
+void CL_EntityArrived (int newnum, entity_state_t *state);
+
+static void    *cl_retired_entities;        // rings replaced during this frame
+static void    *cl_retired_projectiles;
+
+/*
+==================
+CL_GrowRing
+
+Doubles a ring of count-indexed elements, keeping every element of the
+old one at its index.  The old ring is returned in retired instead of
+being freed, because the frame being parsed can still have pointers
+into it.
+==================
+*/
+static void *CL_GrowRing (void *ring, int *size, int elemsize, int count, void **retired)
+{
+    byte    *newring;
+    int        i, oldsize;
+
+    oldsize = *size;
+    *size = oldsize*2;
+    newring = Z_Malloc (*size * elemsize);
+    for (i = count - oldsize ; i < count ; i++)
+        if (i >= 0)
+            memcpy (newring + (i & (*size-1))*elemsize, (byte *)ring + (i & (oldsize-1))*elemsize, elemsize);
+
+    if (*retired)
+        Z_Free (*retired);
+    *retired = ring;
+    return newring;
+}
+
+/*
+==================
+CL_NextParseEntity
+
+Returns the next cl_parse_entities slot for the frame whose states start
+at first.  The ring is doubled whenever one frame takes 1/(BE_MAXBASE+1)
+of it, so big frames still leave every frame an svc_bitentities base can
+be in, which is what the connect string promises the server.
+==================
+*/
+static entity_state_t *CL_NextParseEntity (int first)
+{
+    int        i, oldsize;
+    frame_t    *frame;
+
+    if ((cl.parse_entities - first)*(BE_MAXBASE+1) >= cl_max_parse_entities
+        && cl_max_parse_entities < MAX_EDICTS*2*UPDATE_BACKUP)
+    {
+        oldsize = cl_max_parse_entities;
+        cl_parse_entities = CL_GrowRing (cl_parse_entities, &cl_max_parse_entities,
+            sizeof(entity_state_t), cl.parse_entities, &cl_retired_entities);
+        Com_DPrintf ("cl_parse_entities grown to %i\n", cl_max_parse_entities);
+
+        // frames that were already overwritten don't come back
+        for (i=0, frame=cl.frames ; i<UPDATE_BACKUP ; i++, frame++)
+            if (cl.parse_entities - frame->parse_packetentities > oldsize
+                || cl.parse_entities - frame->parse_entities > oldsize)
+                frame->valid = false;
+    }
+
+    return &cl_parse_entities[cl.parse_entities++ & (cl_max_parse_entities-1)];
+}
+
+/*
+==================
+CL_NextParseProjectile
+
+CL_NextParseEntity for cl_parse_projectiles
+==================
+*/
+static projectile_t *CL_NextParseProjectile (int first)
+{
+    int        i, oldsize;
+    frame_t    *frame;
+
+    if ((cl.parse_projectiles - first)*8 >= cl_max_parse_projectiles
+        && cl_max_parse_projectiles < MAX_EDICTS*UPDATE_BACKUP)
+    {
+        oldsize = cl_max_parse_projectiles;
+        cl_parse_projectiles = CL_GrowRing (cl_parse_projectiles, &cl_max_parse_projectiles,
+            sizeof(projectile_t), cl.parse_projectiles, &cl_retired_projectiles);
+        Com_DPrintf ("cl_parse_projectiles grown to %i\n", cl_max_parse_projectiles);
+
+        for (i=0, frame=cl.frames ; i<UPDATE_BACKUP ; i++, frame++)
+            if (cl.parse_projectiles - frame->parse_projectiles > oldsize)
+                frame->valid = false;
+    }
+
+    return &cl_parse_projectiles[cl.parse_projectiles++ & (cl_max_parse_projectiles-1)];
+}
+
+/*
+==================
+CL_DeltaEntity
+
+Parses deltas from the given base and adds the resulting entity
+to the current frame
+==================
+*/
+void CL_DeltaEntity (frame_t *frame, int newnum, entity_state_t *old, int bits)
+{
+    entity_state_t    *state;
+
+    state = CL_NextParseEntity (frame->parse_entities);
+    frame->num_entities++;
+
+    CL_ParseDelta (old, state, newnum, bits);
+    CL_EntityArrived (newnum, state);
+}
+
+/*
+==================
+CL_EntityArrived
+
+Sets up lerping for an entity that has just been parsed
+==================
+*/
+void CL_EntityArrived (int newnum, entity_state_t *state)
+{
+    centity_t    *ent;
+
+    ent = &cl_entities[newnum];
+
+    // some data changes will force no lerping
+    if (state->modelindex != ent->current.modelindex
+        || state->modelindex2 != ent->current.modelindex2
+        || state->modelindex3 != ent->current.modelindex3
+        || state->modelindex4 != ent->current.modelindex4
+        || fabsf(state->origin[0] - ent->current.origin[0]) > 512
+        || fabsf(state->origin[1] - ent->current.origin[1]) > 512
+        || fabsf(state->origin[2] - ent->current.origin[2]) > 512
+        || state->event == EV_PLAYER_TELEPORT
+        || state->event == EV_OTHER_TELEPORT
+        )
+    {
+        ent->serverframe = -99;
+    }
+
+    if (ent->serverframe != cl.frame.serverframe - 1)
+    {    // wasn't in last update, so initialize some things
+        ent->trailcount = 1024;        // for diminishing rocket / grenade trails
+        // duplicate the current state so lerping doesn't hurt anything
+        ent->prev = *state;
+        if (state->event == EV_OTHER_TELEPORT)
+        {
+            VectorCopy (state->origin, ent->prev.origin);
+            VectorCopy (state->origin, ent->lerp_origin);
+        }
+        else
+        {
+            VectorCopy (state->old_origin, ent->prev.origin);
+            VectorCopy (state->old_origin, ent->lerp_origin);
+        }
+    }
+    else
+    {    // shuffle the last state to previous
+        ent->prev = ent->current;
+    }
+
+    ent->serverframe = cl.frame.serverframe;
+    ent->current = *state;
+}
+
+/*
+==================
+CL_ParsePacketEntities
+
+An svc_packetentities has just been parsed, deal with the
+rest of the data stream.
+==================
+*/
+void CL_ParsePacketEntities (frame_t *oldframe, frame_t *newframe)
+{
+    int            newnum;
+    unsigned        bits;
+    entity_state_t    *oldstate = NULL;
+    int            oldindex, oldnum;
+
+    newframe->parse_entities = cl.parse_entities;
+    newframe->num_entities = 0;
+
+    // delta from the entities present in oldframe
+    oldindex = 0;
+    if (!oldframe)
+        oldnum = 99999;
+    else
+    {
+        if (oldindex >= oldframe->num_packetentities)
+            oldnum = 99999;
+        else
+        {
+            oldstate = &cl_parse_entities[(oldframe->parse_packetentities+oldindex) & (cl_max_parse_entities-1)];
+            oldnum = oldstate->number;
+        }
+    }
+
+    while (1)
+    {
+        newnum = CL_ParseEntityBits (&bits);
+        if (newnum >= MAX_EDICTS)
+            Com_Error (ERR_DROP,"CL_ParsePacketEntities: bad number:%i", newnum);
+
+        if (net_message.readcount > net_message.cursize)
+            Com_Error (ERR_DROP,"CL_ParsePacketEntities: end of message");
+
+        if (!newnum)
+            break;
+
+        while (oldnum < newnum)
+        {    // one or more entities from the old packet are unchanged
+            if (cl_shownet->value == 3)
+                Com_Printf ("   unchanged: %i\n", oldnum);
+            CL_DeltaEntity (newframe, oldnum, oldstate, 0);
+            
+            oldindex++;
+
+            if (oldindex >= oldframe->num_packetentities)
+                oldnum = 99999;
+            else
+            {
+                oldstate = &cl_parse_entities[(oldframe->parse_packetentities+oldindex) & (cl_max_parse_entities-1)];
+                oldnum = oldstate->number;
+            }
+        }
+
+        if (bits & U_REMOVE)
+        {    // the entity present in oldframe is not in the current frame
+            if (cl_shownet->value == 3)
+                Com_Printf ("   remove: %i\n", newnum);
+            if (oldnum != newnum)
+                Com_Printf ("U_REMOVE: oldnum != newnum\n");
+
+            oldindex++;
+
+            if (oldindex >= oldframe->num_packetentities)
+                oldnum = 99999;
+            else
+            {
+                oldstate = &cl_parse_entities[(oldframe->parse_packetentities+oldindex) & (cl_max_parse_entities-1)];
+                oldnum = oldstate->number;
+            }
+            continue;
+        }
+
+        if (oldnum == newnum)
+        {    // delta from previous state
+            if (cl_shownet->value == 3)
+                Com_Printf ("   delta: %i\n", newnum);
+            CL_DeltaEntity (newframe, newnum, oldstate, bits);
+
+            oldindex++;
+
+            if (oldindex >= oldframe->num_packetentities)
+                oldnum = 99999;
+            else
+            {
+                oldstate = &cl_parse_entities[(oldframe->parse_packetentities+oldindex) & (cl_max_parse_entities-1)];
+                oldnum = oldstate->number;
+            }
+            continue;
+        }
+
+        if (oldnum > newnum)
+        {    // delta from baseline
+            if (cl_shownet->value == 3)
+                Com_Printf ("   baseline: %i\n", newnum);
+            CL_DeltaEntity (newframe, newnum, &cl_entities[newnum].baseline, bits);
+            continue;
+        }
+
+    }
+
+    // any remaining entities in the old frame are copied over
+    while (oldnum != 99999)
+    {    // one or more entities from the old packet are unchanged
+        if (cl_shownet->value == 3)
+            Com_Printf ("   unchanged: %i\n", oldnum);
+        CL_DeltaEntity (newframe, oldnum, oldstate, 0);
+        
+        oldindex++;
+
+        if (oldindex >= oldframe->num_packetentities)
+            oldnum = 99999;
+        else
+        {
+            oldstate = &cl_parse_entities[(oldframe->parse_packetentities+oldindex) & (cl_max_parse_entities-1)];
+            oldnum = oldstate->number;
+        }
+    }
+}
+
+
+/*
+=============================================================================
+
+BIT PACKED ENTITIES
+
+=============================================================================
+*/
+
+#define    UNZIGZAG(u)    ((int)((u) >> 1) ^ -(int)((u) & 1))
+
+static int    be_coordbits, be_anglebits, be_coordk;
+
+/*
+==================
+CL_ParseBitDelta
+
+CL_ParseDelta for svc_bitentities, undoing MSG_BitDelta
+==================
+*/
+void CL_ParseBitDelta (entity_state_t *from, entity_state_t *to, int number, int mask)
+{
+    float    scale;
+    unsigned    u;
+    int        i, q;
+
+    // set everything to the state we are delta'ing from
+    *to = *from;
+
+    VectorCopy (from->origin, to->old_origin);
+    to->number = number;
+    to->event = 0;
+
+    if (mask & BE_MODEL)
+        to->modelindex = MSG_ReadBits (&net_message, 8);
+    if (mask & BE_MODEL2)
+        to->modelindex2 = MSG_ReadBits (&net_message, 8);
+    if (mask & BE_MODEL3)
+        to->modelindex3 = MSG_ReadBits (&net_message, 8);
+    if (mask & BE_MODEL4)
+        to->modelindex4 = MSG_ReadBits (&net_message, 8);
+    if (mask & BE_FRAME)
+    {
+        u = MSG_ReadGolomb (&net_message, 0);
+        to->frame += UNZIGZAG(u);
+    }
+    if (mask & BE_SKIN)
+        to->skinnum = MSG_ReadVarBits (&net_message);
+    if (mask & BE_EFFECTS)
+        to->effects ^= MSG_ReadVarBits (&net_message);
+    if (mask & BE_RENDERFX)
+        to->renderfx ^= MSG_ReadVarBits (&net_message);
+
+    // the same arithmetic as the server, so both have the same floats
+    scale = 1<<be_coordbits;
+    for (i=0 ; i<3 ; i++)
+    {
+        if (!(mask & (BE_ORIGIN1<<i)))
+            continue;
+        u = MSG_ReadGolomb (&net_message, be_coordk);
+        q = (int)floor (from->origin[i]*scale) + UNZIGZAG(u);
+        to->origin[i] = q * (1.0f/scale);
+    }
+    for (i=0 ; i<3 ; i++)
+        if (mask & (BE_ANGLE1<<i))
+            to->angles[i] = MSG_ReadBits (&net_message, be_anglebits) * (360.0 / (1<<be_anglebits));
+    if (mask & BE_OLDORIGIN)
+    {
+        for (i=0 ; i<3 ; i++)
+        {
+            u = MSG_ReadGolomb (&net_message, be_coordk);
+            q = (int)floor (to->origin[i]*scale) + UNZIGZAG(u);
+            to->old_origin[i] = q * (1.0f/scale);
+        }
+    }
+
+    if (mask & BE_SOUND)
+        to->sound = MSG_ReadBits (&net_message, 8);
+    if (mask & BE_EVENT)
+        to->event = MSG_ReadBits (&net_message, 8);
+    if (mask & BE_SOLID)
+        to->solid = (short)MSG_ReadBits (&net_message, 16);
+}
+
+/*
+==================
+CL_FindEntity
+
+Binary search of count entities from first, which are in number order
+==================
+*/
+static entity_state_t *CL_FindEntity (int first, int count, int number)
+{
+    entity_state_t    *state;
+    int        lo, hi, mid;
+
+    lo = 0;
+    hi = count - 1;
+    while (lo <= hi)
+    {
+        mid = (lo + hi) / 2;
+        state = &cl_parse_entities[(first+mid) & (cl_max_parse_entities-1)];
+        if (state->number == number)
+            return state;
+        if (state->number < number)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return NULL;
+}
+
+/*
+==================
+CL_BitEntityBase
+
+The state a new entity is delta'd from: the baseline, or its state base
+frames back.  The server only picks frames the client must have, so
+if it is missing the frame is marked invalid, which gets an
+uncompressed one sent.
+==================
+*/
+static entity_state_t *CL_BitEntityBase (int number, int base)
+{
+    frame_t            *frame;
+    entity_state_t    *state;
+    int        framenum;
+
+    if (!base)
+        return &cl_entities[number].baseline;
+
+    framenum = cl.frame.serverframe - base;
+    frame = &cl.frames[framenum & UPDATE_MASK];
+    state = NULL;
+    if (frame->valid && frame->serverframe == framenum
+        && cl.parse_entities - frame->parse_packetentities <= cl_max_parse_entities)
+        state = CL_FindEntity (frame->parse_packetentities, frame->num_packetentities, number);
+    if (!state)
+    {
+        Com_Printf ("Bit entity %i base %i frames back is missing.\n", number, base);
+        cl.frame.valid = false;
+        return &cl_entities[number].baseline;
+    }
+    return state;
+}
+
+/*
+==================
+CL_BitDeltaEntity
+
+CL_DeltaEntity for svc_bitentities
+==================
+*/
+void CL_BitDeltaEntity (frame_t *frame, int newnum, entity_state_t *old, int mask)
+{
+    entity_state_t    *state;
+
+    state = CL_NextParseEntity (frame->parse_entities);
+    frame->num_entities++;
+
+    CL_ParseBitDelta (old, state, newnum, mask);
+    CL_EntityArrived (newnum, state);
+}
+
+/*
+==================
+CL_ParseBitEntities
+
+An svc_bitentities has just been parsed, deal with the rest of the
+bit stream.  The same as CL_ParsePacketEntities otherwise.
+==================
+*/
+void CL_ParseBitEntities (frame_t *oldframe, frame_t *newframe)
+{
+    int            masks[BE_MAXMASKS];
+    int            nummasks, count, gapk;
+    int            i, j, mask, base;
+    int            newnum;
+    entity_state_t    *oldstate = NULL;
+    int            oldindex, oldnum;
+
+    newframe->parse_entities = cl.parse_entities;
+    newframe->num_entities = 0;
+
+    be_coordbits = MSG_ReadBits (&net_message, 3);
+    be_anglebits = MSG_ReadBits (&net_message, 4) + 1;
+    be_coordk = MSG_ReadBits (&net_message, 4);
+    gapk = MSG_ReadBits (&net_message, 3);
+    nummasks = MSG_ReadBits (&net_message, 4);
+    if (nummasks > BE_MAXMASKS)
+        Com_Error (ERR_DROP, "CL_ParseBitEntities: %i masks", nummasks);
+    for (i=0 ; i<nummasks ; i++)
+        masks[i] = MSG_ReadBits (&net_message, BE_BITS);
+    count = MSG_ReadGolomb (&net_message, 2);
+
+    // delta from the entities present in oldframe
+    oldindex = 0;
+    if (!oldframe || oldindex >= oldframe->num_packetentities)
+        oldnum = 99999;
+    else
+    {
+        oldstate = &cl_parse_entities[(oldframe->parse_packetentities+oldindex) & (cl_max_parse_entities-1)];
+        oldnum = oldstate->number;
+    }
+
+    newnum = 0;
+    for (i=0 ; i<count ; i++)
+    {
+        newnum += MSG_ReadGolomb (&net_message, gapk) + 1;
+        j = MSG_ReadGolomb (&net_message, 0);
+        mask = j < nummasks ? masks[j] : MSG_ReadBits (&net_message, BE_BITS);
+
+        if (newnum >= MAX_EDICTS)
+            Com_Error (ERR_DROP,"CL_ParseBitEntities: bad number:%i", newnum);
+        if (net_message.readcount > net_message.cursize)
+            Com_Error (ERR_DROP,"CL_ParseBitEntities: end of message");
+
+        while (oldnum < newnum)
+        {    // one or more entities from the old packet are unchanged
+            if (cl_shownet->value == 3)
+                Com_Printf ("   unchanged: %i\n", oldnum);
+            CL_DeltaEntity (newframe, oldnum, oldstate, 0);
+
+            oldindex++;
+
+            if (oldindex >= oldframe->num_packetentities)
+                oldnum = 99999;
+            else
+            {
+                oldstate = &cl_parse_entities[(oldframe->parse_packetentities+oldindex) & (cl_max_parse_entities-1)];
+                oldnum = oldstate->number;
+            }
+        }
+
+        if (mask & BE_NEW)
+        {    // delta from the baseline or an older frame
+            base = MSG_ReadBits (&net_message, 1) ? MSG_ReadBits (&net_message, 4) : 0;
+            if (cl_shownet->value == 3)
+                Com_Printf ("   base %i: %i\n", base, newnum);
+            CL_BitDeltaEntity (newframe, newnum, CL_BitEntityBase (newnum, base), mask);
+            if (oldnum != newnum)
+                continue;
+            Com_Printf ("BE_NEW: entity %i was in the old frame\n", newnum);
+        }
+        else if (oldnum != newnum)
+        {    // only from a frame that is no good anyway, but the bits
+            // still have to be read
+            Com_Printf ("%s: oldnum != newnum\n", (mask & BE_REMOVE) ? "BE_REMOVE" : "Bit delta");
+            if (!(mask & BE_REMOVE))
+                CL_BitDeltaEntity (newframe, newnum, &cl_entities[newnum].baseline, mask);
+            continue;
+        }
+        else if (mask & BE_REMOVE)
+        {    // the entity present in oldframe is not in the current frame
+            if (cl_shownet->value == 3)
+                Com_Printf ("   remove: %i\n", newnum);
+        }
+        else
+        {    // delta from previous state
+            if (cl_shownet->value == 3)
+                Com_Printf ("   delta: %i\n", newnum);
+            CL_BitDeltaEntity (newframe, newnum, oldstate, mask);
+        }
+
+        oldindex++;
+
+        if (oldindex >= oldframe->num_packetentities)
+            oldnum = 99999;
+        else
+        {
+            oldstate = &cl_parse_entities[(oldframe->parse_packetentities+oldindex) & (cl_max_parse_entities-1)];
+            oldnum = oldstate->number;
+        }
+    }
+    MSG_ReadAlign (&net_message);
+
+    // any remaining entities in the old frame are copied over
+    while (oldnum != 99999)
+    {    // one or more entities from the old packet are unchanged
+        if (cl_shownet->value == 3)
+            Com_Printf ("   unchanged: %i\n", oldnum);
+        CL_DeltaEntity (newframe, oldnum, oldstate, 0);
+
+        oldindex++;
+
+        if (oldindex >= oldframe->num_packetentities)
+            oldnum = 99999;
+        else
+        {
+            oldstate = &cl_parse_entities[(oldframe->parse_packetentities+oldindex) & (cl_max_parse_entities-1)];
+            oldnum = oldstate->number;
+        }
+    }
+}
+
+
+/*
+=============================================================================
+
+PROJECTILES
+
+svc_projectiles carries the trajectories of the entities the server
+flagged SVF_PROJECTILE, for clients that connected with "projectiles".
+Each frame they are turned into ordinary entity states at where they
+are on their trajectories, and merged in with the frame's entities, so
+everything else handles them like any other entity.
+
+=============================================================================
+*/
+
+/*
+=================
+CL_ParseProjectileBits
+
+Returns the entity number and the header bits
+=================
+*/
+static int CL_ParseProjectileBits (unsigned *bits)
+{
+    unsigned    total;
+    int            number;
+
+    total = MSG_ReadByte (&net_message);
+    if (total & PR_MOREBITS)
+        total |= MSG_ReadByte (&net_message) << 8;
+
+    if (total & PR_NUMBER16)
+        number = MSG_ReadShort (&net_message);
+    else
+        number = MSG_ReadByte (&net_message);
+
+    *bits = total;
+
+    return number;
+}
+
+/*
+==================
+CL_ParseDeltaProjectile
+
+Can go from either a projectile in the old frame or nothing
+==================
+*/
+static void CL_ParseDeltaProjectile (projectile_t *from, projectile_t *to, int number, int bits)
+{
+    // set everything to the state we are delta'ing from
+    *to = *from;
+    to->number = number;
+
+    if (bits & PR_MODEL)
+        to->modelindex = MSG_ReadByte (&net_message);
+    if (bits & PR_EFFECTS)
+        to->effects = MSG_ReadLong (&net_message);
+
+    if (bits & PR_TRAJECTORY)
+    {
+        MSG_ReadPos (&net_message, to->origin);
+        MSG_ReadPos (&net_message, to->velocity);
+        if (bits & PR_GRAVITY)
+            to->gravity = MSG_ReadShort (&net_message);
+        else
+            to->gravity = 0;
+        to->basetime = cl.frame.serverframe;
+    }
+
+    if (bits & PR_ANGLES)
+    {
+        to->angles[0] = MSG_ReadAngle (&net_message);
+        to->angles[1] = MSG_ReadAngle (&net_message);
+        to->angles[2] = MSG_ReadAngle (&net_message);
+    }
 
-    if (bits & U_SOUND)
+    if (bits & PR_FRAME)
+        to->frame = MSG_ReadShort (&net_message);
+    if (bits & PR_SKIN)
+        to->skinnum = MSG_ReadLong (&net_message);
+    if (bits & PR_RENDERFX)
+        to->renderfx = MSG_ReadLong (&net_message);
+    if (bits & PR_SOUND)
         to->sound = MSG_ReadByte (&net_message);
-
-    if (bits & U_EVENT)
-        to->event = MSG_ReadByte (&net_message);
-    else
-        to->event = 0;
-
-    if (bits & U_SOLID)
-        to->solid = MSG_ReadShort (&net_message);
 }
 
 /*
 ==================
-CL_DeltaEntity
+CL_DeltaProjectile
 
-Parses deltas from the given base and adds the resulting entity
+Parses deltas from the given base and adds the resulting projectile
 to the current frame
 ==================
 */
-void CL_DeltaEntity (frame_t *frame, int newnum, entity_state_t *old, int bits)
+static void CL_DeltaProjectile (frame_t *frame, int newnum, projectile_t *old, int bits)
 {
-    centity_t    *ent;
-    entity_state_t    *state;
-
-    ent = &cl_entities[newnum];
-
-    state = &cl_parse_entities[cl.parse_entities & (MAX_PARSE_ENTITIES-1)];
-    cl.parse_entities++;
-    frame->num_entities++;
-
-    CL_ParseDelta (old, state, newnum, bits);
-
-    // some data changes will force no lerping
-    if (state->modelindex != ent->current.modelindex
-        || state->modelindex2 != ent->current.modelindex2
-        || state->modelindex3 != ent->current.modelindex3
-        || state->modelindex4 != ent->current.modelindex4
-        || fabsf(state->origin[0] - ent->current.origin[0]) > 512
-        || fabsf(state->origin[1] - ent->current.origin[1]) > 512
-        || fabsf(state->origin[2] - ent->current.origin[2]) > 512
-        || state->event == EV_PLAYER_TELEPORT
-        || state->event == EV_OTHER_TELEPORT
-        )
-    {
-        ent->serverframe = -99;
-    }
+    projectile_t    *p;
 
-    if (ent->serverframe != cl.frame.serverframe - 1)
-    {    // wasn't in last update, so initialize some things
-        ent->trailcount = 1024;        // for diminishing rocket / grenade trails
-        // duplicate the current state so lerping doesn't hurt anything
-        ent->prev = *state;
-        if (state->event == EV_OTHER_TELEPORT)
-        {
-            VectorCopy (state->origin, ent->prev.origin);
-            VectorCopy (state->origin, ent->lerp_origin);
-        }
-        else
-        {
-            VectorCopy (state->old_origin, ent->prev.origin);
-            VectorCopy (state->old_origin, ent->lerp_origin);
-        }
-    }
-    else
-    {    // shuffle the last state to previous
-        ent->prev = ent->current;
-    }
+    p = CL_NextParseProjectile (frame->parse_projectiles);
+    frame->num_projectiles++;
 
-    ent->serverframe = cl.frame.serverframe;
-    ent->current = *state;
+    CL_ParseDeltaProjectile (old, p, newnum, bits);
 }
 
 /*
 ==================
-CL_ParsePacketEntities
+CL_ParseProjectiles
 
-An svc_packetentities has just been parsed, deal with the
-rest of the data stream.
+An svc_projectiles has just been parsed, deal with the rest of the
+data stream.
 ==================
 */
-void CL_ParsePacketEntities (frame_t *oldframe, frame_t *newframe)
+void CL_ParseProjectiles (frame_t *oldframe, frame_t *newframe)
 {
+    static projectile_t    nullprojectile;
     int            newnum;
-    unsigned        bits;
-    entity_state_t    *oldstate = NULL;
+    unsigned    bits;
+    projectile_t    *oldp = NULL;
     int            oldindex, oldnum;
 
-    newframe->parse_entities = cl.parse_entities;
-    newframe->num_entities = 0;
+    newframe->parse_projectiles = cl.parse_projectiles;
+    newframe->num_projectiles = 0;
 
-    // delta from the entities present in oldframe
+    // delta from the projectiles present in oldframe
     oldindex = 0;
-    if (!oldframe)
+    if (!oldframe || oldindex >= oldframe->num_projectiles)
         oldnum = 99999;
     else
     {
-        if (oldindex >= oldframe->num_entities)
-            oldnum = 99999;
-        else
-        {
-            oldstate = &cl_parse_entities[(oldframe->parse_entities+oldindex) & (MAX_PARSE_ENTITIES-1)];
-            oldnum = oldstate->number;
-        }
+        oldp = &cl_parse_projectiles[(oldframe->parse_projectiles+oldindex) & (cl_max_parse_projectiles-1)];
+        oldnum = oldp->number;
     }
 
     while (1)
     {
-        newnum = CL_ParseEntityBits (&bits);
+        newnum = CL_ParseProjectileBits (&bits);
         if (newnum >= MAX_EDICTS)
-            Com_Error (ERR_DROP,"CL_ParsePacketEntities: bad number:%i", newnum);
+            Com_Error (ERR_DROP,"CL_ParseProjectiles: bad number:%i", newnum);
 
         if (net_message.readcount > net_message.cursize)
-            Com_Error (ERR_DROP,"CL_ParsePacketEntities: end of message");
+            Com_Error (ERR_DROP,"CL_ParseProjectiles: end of message");
 
         if (!newnum)
             break;
 
         while (oldnum < newnum)
-        {    // one or more entities from the old packet are unchanged
+        {    // one or more projectiles from the old packet are unchanged
             if (cl_shownet->value == 3)
-                Com_Printf ("   unchanged: %i\n", oldnum);
-            CL_DeltaEntity (newframe, oldnum, oldstate, 0);
-            
+                Com_Printf ("   unchanged projectile: %i\n", oldnum);
+            CL_DeltaProjectile (newframe, oldnum, oldp, 0);
+
             oldindex++;
 
-            if (oldindex >= oldframe->num_entities)
+            if (oldindex >= oldframe->num_projectiles)
                 oldnum = 99999;
             else
             {
-                oldstate = &cl_parse_entities[(oldframe->parse_entities+oldindex) & (MAX_PARSE_ENTITIES-1)];
-                oldnum = oldstate->number;
+                oldp = &cl_parse_projectiles[(oldframe->parse_projectiles+oldindex) & (cl_max_parse_projectiles-1)];
+                oldnum = oldp->number;
             }
         }
 
-        if (bits & U_REMOVE)
-        {    // the entity present in oldframe is not in the current frame
+        if (bits & PR_REMOVE)
+        {    // the projectile present in oldframe is not in the current frame
             if (cl_shownet->value == 3)
-                Com_Printf ("   remove: %i\n", newnum);
+                Com_Printf ("   remove projectile: %i\n", newnum);
             if (oldnum != newnum)
-                Com_Printf ("U_REMOVE: oldnum != newnum\n");
+                Com_Printf ("PR_REMOVE: oldnum != newnum\n");
 
             oldindex++;
 
-            if (oldindex >= oldframe->num_entities)
+            if (oldindex >= oldframe->num_projectiles)
                 oldnum = 99999;
             else
             {
-                oldstate = &cl_parse_entities[(oldframe->parse_entities+oldindex) & (MAX_PARSE_ENTITIES-1)];
-                oldnum = oldstate->number;
+                oldp = &cl_parse_projectiles[(oldframe->parse_projectiles+oldindex) & (cl_max_parse_projectiles-1)];
+                oldnum = oldp->number;
             }
             continue;
         }
@@ -461,48 +935,407 @@ void CL_ParsePacketEntities (frame_t *oldframe, frame_t *newframe)
         if (oldnum == newnum)
         {    // delta from previous state
             if (cl_shownet->value == 3)
-                Com_Printf ("   delta: %i\n", newnum);
-            CL_DeltaEntity (newframe, newnum, oldstate, bits);
+                Com_Printf ("   delta projectile: %i\n", newnum);
+            CL_DeltaProjectile (newframe, newnum, oldp, bits);
 
             oldindex++;
 
-            if (oldindex >= oldframe->num_entities)
+            if (oldindex >= oldframe->num_projectiles)
                 oldnum = 99999;
             else
             {
-                oldstate = &cl_parse_entities[(oldframe->parse_entities+oldindex) & (MAX_PARSE_ENTITIES-1)];
-                oldnum = oldstate->number;
+                oldp = &cl_parse_projectiles[(oldframe->parse_projectiles+oldindex) & (cl_max_parse_projectiles-1)];
+                oldnum = oldp->number;
             }
             continue;
         }
 
         if (oldnum > newnum)
-        {    // delta from baseline
+        {    // new projectile, sent from scratch
             if (cl_shownet->value == 3)
-                Com_Printf ("   baseline: %i\n", newnum);
-            CL_DeltaEntity (newframe, newnum, &cl_entities[newnum].baseline, bits);
+                Com_Printf ("   new projectile: %i\n", newnum);
+            CL_DeltaProjectile (newframe, newnum, &nullprojectile, bits);
             continue;
         }
-
     }
 
-    // any remaining entities in the old frame are copied over
+    // any remaining projectiles in the old frame are copied over
     while (oldnum != 99999)
-    {    // one or more entities from the old packet are unchanged
+    {    // one or more projectiles from the old packet are unchanged
         if (cl_shownet->value == 3)
-            Com_Printf ("   unchanged: %i\n", oldnum);
-        CL_DeltaEntity (newframe, oldnum, oldstate, 0);
-        
+            Com_Printf ("   unchanged projectile: %i\n", oldnum);
+        CL_DeltaProjectile (newframe, oldnum, oldp, 0);
+
         oldindex++;
 
-        if (oldindex >= oldframe->num_entities)
+        if (oldindex >= oldframe->num_projectiles)
             oldnum = 99999;
         else
         {
-            oldstate = &cl_parse_entities[(oldframe->parse_entities+oldindex) & (MAX_PARSE_ENTITIES-1)];
-            oldnum = oldstate->number;
+            oldp = &cl_parse_projectiles[(oldframe->parse_projectiles+oldindex) & (cl_max_parse_projectiles-1)];
+            oldnum = oldp->number;
+        }
+    }
+}
+
+/*
+==================
+CL_AddFrameProjectiles
+
+Gives the frame a new run of entities with the projectiles merged in at
+where their trajectories have them, leaving the entities as the server
+sent them in the packetentities fields for later deltas.  Between
+frames the projectiles are lerped like the rest.
+==================
+*/
+void CL_AddFrameProjectiles (frame_t *frame)
+{
+    entity_state_t    *ent, *state;
+    projectile_t    *p;
+    int        entindex, pindex;
+    int        entnum, pnum;
+
+    frame->parse_entities = cl.parse_entities;
+    frame->num_entities = 0;
+
+    entindex = pindex = 0;
+    ent = NULL;
+    p = NULL;
+    while (entindex < frame->num_packetentities || pindex < frame->num_projectiles)
+    {
+        if (entindex >= frame->num_packetentities)
+            entnum = 99999;
+        else
+        {
+            ent = &cl_parse_entities[(frame->parse_packetentities+entindex) & (cl_max_parse_entities-1)];
+            entnum = ent->number;
+        }
+        if (pindex >= frame->num_projectiles)
+            pnum = 99999;
+        else
+        {
+            p = &cl_parse_projectiles[(frame->parse_projectiles+pindex) & (cl_max_parse_projectiles-1)];
+            pnum = p->number;
+        }
+
+        state = CL_NextParseEntity (frame->parse_packetentities);
+        frame->num_entities++;
+
+        if (entnum <= pnum)
+        {    // already through CL_EntityArrived
+            *state = *ent;
+            entindex++;
+            if (entnum == pnum)
+                pindex++;    // can't be both
+            continue;
+        }
+
+        memset (state, 0, sizeof(*state));
+        state->number = p->number;
+        state->modelindex = p->modelindex;
+        state->frame = p->frame;
+        state->skinnum = p->skinnum;
+        state->effects = p->effects;
+        state->renderfx = p->renderfx;
+        state->sound = p->sound;
+        VectorCopy (p->angles, state->angles);
+        MSG_ProjectileOrigin (p, frame->serverframe, state->origin);
+        MSG_ProjectileOrigin (p, frame->serverframe - 1, state->old_origin);
+        CL_EntityArrived (p->number, state);
+        pindex++;
+    }
+}
+
+
+/*
+=============================================================================
+
+ENTITY STATISTICS
+
+With cl_entstats set, every frame's entities are encoded both ways,
+whichever way they came, so playing back a demo shows what
+svc_bitentities saves over svc_packetentities.  Projectiles are counted
+as entities there, and what actually came is counted separately, which
+shows what svc_projectiles saves.  The frames a client at its rate
+would lose to SV_RateDrop are counted for each as well.
+
+=============================================================================
+*/
+
+#define    RATE_MESSAGES    10        // as the server keeps
+
+typedef struct
+{
+    int        bytes;                    // of entities
+    int        sizes[RATE_MESSAGES];    // whole frames, as SV_RateDrop sees them
+    int        dropped;
+} entstream_t;
+
+static int            es_frames;
+static entstream_t    es_packet, es_bit, es_received;
+
+/*
+==================
+CL_EncodePacketEntities
+
+What SV_EmitPacketEntities would have sent for the frame, which demos
+are recorded with too
+==================
+*/
+void CL_EncodePacketEntities (frame_t *oldframe, frame_t *newframe, sizebuf_t *msg)
+{
+    entity_state_t    *oldent, *newent;
+    int        oldindex, newindex;
+    int        oldnum, newnum;
+    int        from_num_entities;
+    int        maxclients;
+    int        bits;
+
+    maxclients = atoi (cl.configstrings[CS_MAXCLIENTS]);
+    from_num_entities = oldframe ? oldframe->num_entities : 0;
+
+    MSG_WriteByte (msg, svc_packetentities);
+    newindex = oldindex = 0;
+    newent = oldent = NULL;
+    while (newindex < newframe->num_entities || oldindex < from_num_entities)
+    {
+        if (newindex >= newframe->num_entities)
+            newnum = 9999;
+        else
+        {
+            newent = &cl_parse_entities[(newframe->parse_entities+newindex) & (cl_max_parse_entities-1)];
+            newnum = newent->number;
+        }
+        if (oldindex >= from_num_entities)
+            oldnum = 9999;
+        else
+        {
+            oldent = &cl_parse_entities[(oldframe->parse_entities+oldindex) & (cl_max_parse_entities-1)];
+            oldnum = oldent->number;
+        }
+
+        if (newnum == oldnum)
+        {
+            MSG_WriteDeltaEntity (oldent, newent, msg, false, newnum <= maxclients);
+            oldindex++;
+            newindex++;
+        }
+        else if (newnum < oldnum)
+        {
+            MSG_WriteDeltaEntity (&cl_entities[newnum].baseline, newent, msg, true, true);
+            newindex++;
+        }
+        else
+        {    // the old entity isn't present in the new frame
+            bits = U_REMOVE;
+            if (oldnum >= 256)
+                bits |= U_NUMBER16 | U_MOREBITS1;
+
+            MSG_WriteByte (msg, bits&255);
+            if (bits & 0x0000ff00)
+                MSG_WriteByte (msg, (bits>>8)&255);
+
+            if (bits & U_NUMBER16)
+                MSG_WriteShort (msg, oldnum);
+            else
+                MSG_WriteByte (msg, oldnum);
+            oldindex++;
+        }
+    }
+    MSG_WriteShort (msg, 0);
+}
+
+/*
+==================
+CL_EncodeBitEntities
+
+What SV_EmitBitEntities would have sent for the frame, at the precision
+svc_packetentities has
+==================
+*/
+static void CL_EncodeBitEntities (frame_t *oldframe, frame_t *newframe, sizebuf_t *msg)
+{
+    static bitdelta_t        deltas[MAX_EDICTS];
+    static entity_state_t    states[MAX_EDICTS];
+    bitdelta_t        *d;
+    frame_t            *frame;
+    entity_state_t    *oldent, *newent;
+    int        oldindex, newindex;
+    int        oldnum, newnum;
+    int        from_num_entities;
+    int        maxclients;
+    int        count, framenum;
+
+    maxclients = atoi (cl.configstrings[CS_MAXCLIENTS]);
+    from_num_entities = oldframe ? oldframe->num_entities : 0;
+
+    newindex = oldindex = 0;
+    newent = oldent = NULL;
+    count = 0;
+    while (newindex < newframe->num_entities || oldindex < from_num_entities)
+    {
+        if (newindex >= newframe->num_entities)
+            newnum = 9999;
+        else
+        {
+            newent = &cl_parse_entities[(newframe->parse_entities+newindex) & (cl_max_parse_entities-1)];
+            newnum = newent->number;
+        }
+        if (oldindex >= from_num_entities)
+            oldnum = 9999;
+        else
+        {
+            oldent = &cl_parse_entities[(oldframe->parse_entities+oldindex) & (cl_max_parse_entities-1)];
+            oldnum = oldent->number;
+        }
+
+        d = &deltas[count];
+        d->newentity = false;
+        d->base = 0;
+        if (newnum <= oldnum)
+        {    // MSG_WriteBitEntities writes over to
+            states[count] = *newent;
+            d->number = newnum;
+            d->to = &states[count];
+            newindex++;
+        }
+        else
+        {
+            d->number = oldnum;
+            d->to = NULL;
+        }
+
+        if (newnum == oldnum || newnum > oldnum)
+        {
+            d->from = oldent;
+            d->oldorigin = newnum <= maxclients;
+            oldindex++;
+        }
+        else
+        {    // the last state in a frame oldframe was delta'd from
+            d->from = &cl_entities[newnum].baseline;
+            d->newentity = d->oldorigin = true;
+            for (framenum = oldframe ? oldframe->deltaframe : 0 ; framenum > 0 ; framenum = frame->deltaframe)
+            {
+                if (newframe->serverframe - framenum > BE_MAXBASE
+                    || newframe->serverframe - framenum >= UPDATE_BACKUP - 3)
+                    break;
+                frame = &cl.frames[framenum & UPDATE_MASK];
+                if (!frame->valid || frame->serverframe != framenum
+                    || cl.parse_entities - frame->parse_entities > cl_max_parse_entities)
+                    break;
+                oldent = CL_FindEntity (frame->parse_entities, frame->num_entities, newnum);
+                if (oldent)
+                {
+                    d->from = oldent;
+                    d->base = newframe->serverframe - framenum;
+                    break;
+                }
+            }
         }
+        count++;
+    }
+
+    MSG_WriteBitEntities (msg, deltas, count, 3, 8);
+}
+
+/*
+==================
+CL_RateDrop
+
+SV_RateDrop for a stream of frame sizes
+==================
+*/
+static void CL_RateDrop (entstream_t *es, int size)
+{
+    int        rate, total, i;
+
+    rate = Cvar_VariableValue ("rate");
+    if (!rate)
+        rate = 5000;
+    else if (rate < 100)
+        rate = 100;
+    else if (rate > 15000)
+        rate = 15000;
+
+    total = 0;
+    for (i=0 ; i<RATE_MESSAGES ; i++)
+        total += es->sizes[i];
+    if (total > rate)
+    {
+        es->dropped++;
+        size = 0;
+    }
+    es->sizes[es_frames % RATE_MESSAGES] = size;
+}
+
+/*
+==================
+CL_EntityStats
+
+Called for every good frame with cl_entstats set, with the bytes the
+entities and projectiles took in net_message
+==================
+*/
+static void CL_EntityStats (frame_t *oldframe, int bytes)
+{
+    static byte    buf[MAX_FRAGMSGLEN*2];
+    sizebuf_t    msg;
+    int            rest;
+
+    rest = net_message.cursize - bytes;
+    SZ_Init (&msg, buf, sizeof(buf));
+    msg.allowoverflow = true;
+
+    CL_EncodePacketEntities (oldframe, &cl.frame, &msg);
+    es_packet.bytes += msg.cursize;
+    CL_RateDrop (&es_packet, rest + msg.cursize);
+
+    SZ_Clear (&msg);
+    CL_EncodeBitEntities (oldframe, &cl.frame, &msg);
+    es_bit.bytes += msg.cursize;
+    CL_RateDrop (&es_bit, rest + msg.cursize);
+
+    es_received.bytes += bytes;
+    CL_RateDrop (&es_received, net_message.cursize);
+
+    es_frames++;
+}
+
+/*
+==================
+CL_EntStats_f
+
+entstats [reset]
+==================
+*/
+void CL_EntStats_f (void)
+{
+    float    seconds;
+
+    if (!strcmp (Cmd_Argv(1), "reset"))
+    {
+        es_frames = 0;
+        memset (&es_packet, 0, sizeof(es_packet));
+        memset (&es_bit, 0, sizeof(es_bit));
+        memset (&es_received, 0, sizeof(es_received));
+        return;
+    }
+
+    if (!es_frames)
+    {
+        Com_Printf ("No frames counted, set cl_entstats 1\n");
+        return;
     }
+
+    seconds = es_frames * 0.1;
+    Com_Printf ("%i frames, %.1f seconds, rate %s\n", es_frames, seconds, Cvar_VariableString ("rate"));
+    Com_Printf ("svc_packetentities: %6.0f bytes/sec, %i frames rate dropped\n",
+        es_packet.bytes / seconds, es_packet.dropped);
+    Com_Printf ("svc_bitentities:    %6.0f bytes/sec, %i frames rate dropped, %.0f%% of the size\n",
+        es_bit.bytes / seconds, es_bit.dropped, es_packet.bytes ? 100.0 * es_bit.bytes / es_packet.bytes : 0);
+    Com_Printf ("as received:        %6.0f bytes/sec, %i frames rate dropped, %.0f%% of the size\n",
+        es_received.bytes / seconds, es_received.dropped, es_packet.bytes ? 100.0 * es_received.bytes / es_packet.bytes : 0);
 }
 
 
@@ -643,7 +1476,7 @@ void CL_FireEntityEvents (frame_t *frame)
 
     for (pnum = 0 ; pnum<frame->num_entities ; pnum++)
     {
-        num = (frame->parse_entities + pnum)&(MAX_PARSE_ENTITIES-1);
+        num = (frame->parse_entities + pnum)&(cl_max_parse_entities-1);
         s1 = &cl_parse_entities[num];
         if (s1->event)
             CL_EntityEvent (s1);
@@ -677,13 +1510,22 @@ void CL_ParseFrame (void)
 {
     int            cmd;
     int            len;
+    int            start;
     frame_t        *old;
 
     memset (&cl.frame, 0, sizeof(cl.frame));
 
-#if 0
-    CL_ClearProjectiles(); // clear projectiles for new frame
-#endif
+    // nothing points into the rings replaced while parsing the last frame
+    if (cl_retired_entities)
+    {
+        Z_Free (cl_retired_entities);
+        cl_retired_entities = NULL;
+    }
+    if (cl_retired_projectiles)
+    {
+        Z_Free (cl_retired_projectiles);
+        cl_retired_projectiles = NULL;
+    }
 
     cl.frame.serverframe = MSG_ReadLong (&net_message);
     cl.frame.deltaframe = MSG_ReadLong (&net_message);
@@ -705,7 +1547,6 @@ void CL_ParseFrame (void)
     {
         cl.frame.valid = true;        // uncompressed frame
         old = NULL;
-        cls.demowaiting = false;    // we can start recording now
     }
     else
     {
@@ -719,10 +1560,14 @@ void CL_ParseFrame (void)
             // is too old, so we can't reconstruct it properly.
             Com_Printf ("Delta frame too old.\n");
         }
-        else if (cl.parse_entities - old->parse_entities > MAX_PARSE_ENTITIES-128)
+        else if (cl.parse_entities - old->parse_packetentities > cl_max_parse_entities - cl_max_parse_entities/8)
         {
             Com_Printf ("Delta parse_entities too old.\n");
         }
+        else if (cl.parse_projectiles - old->parse_projectiles > cl_max_parse_projectiles - cl_max_parse_projectiles/8)
+        {
+            Com_Printf ("Delta parse_projectiles too old.\n");
+        }
         else
             cl.frame.valid = true;    // valid delta parse
     }
@@ -745,16 +1590,32 @@ void CL_ParseFrame (void)
     CL_ParsePlayerstate (old, &cl.frame);
 
     // read packet entities
+    start = net_message.readcount;
     cmd = MSG_ReadByte (&net_message);
     SHOWNET(svc_strings[cmd]);
-    if (cmd != svc_packetentities)
+    if (cmd == svc_bitentities)
+        CL_ParseBitEntities (old, &cl.frame);
+    else if (cmd == svc_packetentities)
+        CL_ParsePacketEntities (old, &cl.frame);
+    else
         Com_Error (ERR_DROP, "CL_ParseFrame: not packetentities");
-    CL_ParsePacketEntities (old, &cl.frame);
+    cl.frame.parse_packetentities = cl.frame.parse_entities;
+    cl.frame.num_packetentities = cl.frame.num_entities;
 
-#if 0
-    if (cmd == svc_packetentities2)
-        CL_ParseProjectiles();
-#endif
+    // projectiles, if the server sent any
+    cl.frame.parse_projectiles = cl.parse_projectiles;
+    if (net_message.readcount < net_message.cursize
+        && net_message.data[net_message.readcount] == svc_projectiles)
+    {
+        cmd = MSG_ReadByte (&net_message);
+        SHOWNET(svc_strings[cmd]);
+        CL_ParseProjectiles (old, &cl.frame);
+    }
+    if (cl.frame.num_projectiles)
+        CL_AddFrameProjectiles (&cl.frame);
+
+    if (cl_entstats->value && cl.frame.valid)
+        CL_EntityStats (old, net_message.readcount - start);
 
     // save the frame off in the backup array for later delta comparisons
     cl.frames[cl.frame.serverframe & UPDATE_MASK] = cl.frame;
@@ -869,7 +1730,7 @@ void CL_AddPacketEntities (frame_t *frame)
 
     for (pnum = 0 ; pnum<frame->num_entities ; pnum++)
     {
-        s1 = &cl_parse_entities[(frame->parse_entities+pnum)&(MAX_PARSE_ENTITIES-1)];
+        s1 = &cl_parse_entities[(frame->parse_entities+pnum)&(cl_max_parse_entities-1)];
 
         cent = &cl_entities[s1->number];
 
@@ -1526,9 +2387,6 @@ void CL_AddEntities (void)
     CL_CalcViewValues ();
     // PMM - moved this here so the heat beam has the right values for the vieworg, and can lock the beam to the gun
     CL_AddPacketEntities (&cl.frame);
-#if 0
-    CL_AddProjectiles ();
-#endif
     CL_AddTEnts ();
     CL_AddParticles ();
     CL_AddDLights ();
@@ -512,7 +512,7 @@ void CL_SendCmd (void)
 
     // let the server know what the last frame we
     // got was, so the next message can be delta compressed
-    if (cl_nodelta->value || !cl.frame.valid || cls.demowaiting)
+    if (cl_nodelta->value || !cl.frame.valid)
         MSG_WriteLong (&buf, -1);    // no compression
     else
         MSG_WriteLong (&buf, cl.frame.serverframe);
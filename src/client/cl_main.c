@@ -69,6 +69,11 @@ cvar_t    *cl_add_entities;
 cvar_t    *cl_add_blend;
 
 cvar_t    *cl_shownet;
+cvar_t    *cl_bitents;
+cvar_t    *cl_entstats;
+cvar_t    *cl_demokeyframes;
+cvar_t    *cl_projectiles;
+cvar_t    *cl_bigedicts;
 cvar_t    *cl_showmiss;
 cvar_t    *cl_showclamp;
 
@@ -107,7 +112,10 @@ client_state_t    cl;
 
 centity_t        cl_entities[MAX_EDICTS];
 
-entity_state_t    cl_parse_entities[MAX_PARSE_ENTITIES];
+int                cl_max_parse_entities;
+entity_state_t    *cl_parse_entities;
+int                cl_max_parse_projectiles;
+projectile_t    *cl_parse_projectiles;
 
 extern    cvar_t *allow_download;
 extern    cvar_t *allow_download_players;
@@ -117,176 +125,6 @@ extern    cvar_t *allow_download_maps;
 
 //======================================================================
 
-
-/*
-====================
-CL_WriteDemoMessage
-
-Dumps the current net message, prefixed by the length
-====================
-*/
-void CL_WriteDemoMessage (void)
-{
-    int        len, swlen;
-
-    // the first eight bytes are just packet sequencing stuff
-    len = net_message.cursize-8;
-    swlen = LittleLong(len);
-    fwrite (&swlen, 4, 1, cls.demofile);
-    fwrite (net_message.data+8,    len, 1, cls.demofile);
-}
-
-
-/*
-====================
-CL_Stop_f
-
-stop recording a demo
-====================
-*/
-void CL_Stop_f (void)
-{
-    int        len;
-
-    if (!cls.demorecording)
-    {
-        Com_Printf ("Not recording a demo.\n");
-        return;
-    }
-
-// finish up
-    len = -1;
-    fwrite (&len, 4, 1, cls.demofile);
-    fclose (cls.demofile);
-    cls.demofile = NULL;
-    cls.demorecording = false;
-    Com_Printf ("Stopped demo.\n");
-}
-
-/*
-====================
-CL_Record_f
-
-record <demoname>
-
-Begins recording a demo from the current position
-====================
-*/
-void CL_Record_f (void)
-{
-    char    name[MAX_OSPATH];
-    byte    buf_data[MAX_MSGLEN];
-    sizebuf_t    buf;
-    int        i;
-    int        len;
-    entity_state_t    *ent;
-    entity_state_t    nullstate;
-
-    if (Cmd_Argc() != 2)
-    {
-        Com_Printf ("record <demoname>\n");
-        return;
-    }
-
-    if (cls.demorecording)
-    {
-        Com_Printf ("Already recording.\n");
-        return;
-    }
-
-    if (cls.state != ca_active)
-    {
-        Com_Printf ("You must be in a level to record.\n");
-        return;
-    }
-
-    //
-    // open the demo file
-    //
-    Com_sprintf (name, sizeof(name), "%s/demos/%s.dm2", FS_Gamedir(), Cmd_Argv(1));
-
-    Com_Printf ("recording to %s.\n", name);
-    FS_CreatePath (name);
-    cls.demofile = fopen (name, "wb");
-    if (!cls.demofile)
-    {
-        Com_Printf ("ERROR: couldn't open.\n");
-        return;
-    }
-    cls.demorecording = true;
-
-    // don't start saving messages until a non-delta compressed message is received
-    cls.demowaiting = true;
-
-    //
-    // write out messages to hold the startup information
-    //
-    SZ_Init (&buf, buf_data, sizeof(buf_data));
-
-    // send the serverdata
-    MSG_WriteByte (&buf, svc_serverdata);
-    MSG_WriteLong (&buf, PROTOCOL_VERSION);
-    MSG_WriteLong (&buf, 0x10000 + cl.servercount);
-    MSG_WriteByte (&buf, 1);    // demos are always attract loops
-    MSG_WriteString (&buf, cl.gamedir);
-    MSG_WriteShort (&buf, cl.playernum);
-
-    MSG_WriteString (&buf, cl.configstrings[CS_NAME]);
-
-    // configstrings
-    for (i=0 ; i<MAX_CONFIGSTRINGS ; i++)
-    {
-        if (cl.configstrings[i][0])
-        {
-            if (buf.cursize + strlen (cl.configstrings[i]) + 32 > buf.maxsize)
-            {    // write it out
-                len = LittleLong (buf.cursize);
-                fwrite (&len, 4, 1, cls.demofile);
-                fwrite (buf.data, buf.cursize, 1, cls.demofile);
-                buf.cursize = 0;
-            }
-
-            MSG_WriteByte (&buf, svc_configstring);
-            MSG_WriteShort (&buf, i);
-            MSG_WriteString (&buf, cl.configstrings[i]);
-        }
-
-    }
-
-    // baselines
-    memset (&nullstate, 0, sizeof(nullstate));
-    for (i=0; i<MAX_EDICTS ; i++)
-    {
-        ent = &cl_entities[i].baseline;
-        if (!ent->modelindex)
-            continue;
-
-        if (buf.cursize + 64 > buf.maxsize)
-        {    // write it out
-            len = LittleLong (buf.cursize);
-            fwrite (&len, 4, 1, cls.demofile);
-            fwrite (buf.data, buf.cursize, 1, cls.demofile);
-            buf.cursize = 0;
-        }
-
-        MSG_WriteByte (&buf, svc_spawnbaseline);        
-        MSG_WriteDeltaEntity (&nullstate, &cl_entities[i].baseline, &buf, true, true);
-    }
-
-    MSG_WriteByte (&buf, svc_stufftext);
-    MSG_WriteString (&buf, "precache\n");
-
-    // write it to the demo file
-
-    len = LittleLong (buf.cursize);
-    fwrite (&len, 4, 1, cls.demofile);
-    fwrite (buf.data, buf.cursize, 1, cls.demofile);
-
-    // the rest of the demo file will be individual frames
-}
-
-//======================================================================
-
 /*
 ===================
 Cmd_ForwardToServer
@@ -411,6 +249,9 @@ Called after an ERR_DROP was thrown
 */
 void CL_Drop (void)
 {
+    if (cls.democonverting)
+        CL_Stop_f ();
+
     if (cls.state == ca_uninitialized)
         return;
     if (cls.state == ca_disconnected)
@@ -451,8 +292,13 @@ void CL_SendConnectPacket (void)
     port = Cvar_VariableValue ("qport");
     userinfo_modified = false;
 
-    Netchan_OutOfBandPrint (NS_CLIENT, adr, "connect %i %i %i \"%s\"\n",
-        PROTOCOL_VERSION, port, cls.challenge, Cvar_Userinfo() );
+    // servers that don't know the protocol extensions ignore them
+    Netchan_OutOfBandPrint (NS_CLIENT, adr, "connect %i %i %i \"%s\"%s%s%s%s\n",
+        PROTOCOL_VERSION, port, cls.challenge, Cvar_Userinfo(),
+        net_fragments->value ? " fragments" : "",
+        cl_bitents->value ? va(" bitents bitbase %i", BE_MAXBASE) : "",
+        cl_projectiles->value ? " projectiles" : "",
+        cl_bigedicts->value ? " bigedicts" : "" );
 }
 
 /*
@@ -905,6 +751,7 @@ void CL_ConnectionlessPacket (void)
 {
     char    *s;
     char    *c;
+    int        i;
     
     MSG_BeginReading (&net_message);
     MSG_ReadLong (&net_message);    // skip the -1
@@ -926,6 +773,9 @@ void CL_ConnectionlessPacket (void)
             return;
         }
         Netchan_Setup (NS_CLIENT, &cls.netchan, net_from, cls.quakePort);
+        for (i=1 ; i<Cmd_Argc() ; i++)
+            if (!strcmp (Cmd_Argv(i), "fragments"))
+                cls.netchan.fragments = true;
         MSG_WriteChar (&cls.netchan.message, clc_stringcmd);
         MSG_WriteString (&cls.netchan.message, "new");    
         cls.state = ca_connected;
@@ -1334,7 +1184,9 @@ void CL_RequestNextDownload (void)
     if (precache_check == ENV_CNT) {
         precache_check = ENV_CNT + 1;
 
+        CL_LoadPhase (LOAD_CMODEL);
         CM_LoadMap (cl.configstrings[CS_MODELS+1], true, &map_checksum);
+        CL_LoadPhase (LOAD_NONE);
 
         if (map_checksum != atoi(cl.configstrings[CS_MAPCHECKSUM])) {
             Com_Error (ERR_DROP, "Local map version differs from server: %i != '%s'\n",
@@ -1402,11 +1254,15 @@ before allowing the client into the server
 */
 void CL_Precache_f (void)
 {
+    CL_BeginLoad ();
+    FS_PrefetchConfigstrings (cl.configstrings);
+
     //Yet another hack to let old demos work
     //the old precache sequence
     if (Cmd_Argc() < 2) {
         unsigned    map_checksum;        // for detecting cheater maps
 
+        CL_LoadPhase (LOAD_CMODEL);
         CM_LoadMap (cl.configstrings[CS_MODELS+1], true, &map_checksum);
         CL_RegisterSounds ();
         CL_PrepRefresh ();
@@ -1432,6 +1288,11 @@ void CL_InitLocal (void)
     cls.state = ca_disconnected;
     cls.realtime = Sys_Milliseconds ();
 
+    cl_max_parse_entities = MIN_PARSE_ENTITIES;
+    cl_parse_entities = Z_Malloc (cl_max_parse_entities * sizeof(entity_state_t));
+    cl_max_parse_projectiles = MIN_PARSE_PROJECTILES;
+    cl_parse_projectiles = Z_Malloc (cl_max_parse_projectiles * sizeof(projectile_t));
+
     CL_InitInput ();
 
     adr0 = Cvar_Get( "adr0", "", CVAR_ARCHIVE );
@@ -1500,6 +1361,11 @@ void CL_InitLocal (void)
     m_side = Cvar_Get ("m_side", "1", 0);
 
     cl_shownet = Cvar_Get ("cl_shownet", "0", 0);
+    cl_bitents = Cvar_Get ("cl_bitents", "1", 0);
+    cl_entstats = Cvar_Get ("cl_entstats", "0", 0);
+    cl_demokeyframes = Cvar_Get ("cl_demokeyframes", "10", 0);
+    cl_projectiles = Cvar_Get ("cl_projectiles", "1", 0);
+    cl_bigedicts = Cvar_Get ("cl_bigedicts", "1", 0);
     cl_showmiss = Cvar_Get ("cl_showmiss", "0", 0);
     cl_showclamp = Cvar_Get ("showclamp", "0", 0);
     cl_timeout = Cvar_Get ("cl_timeout", "120", 0);
@@ -1538,12 +1404,14 @@ void CL_InitLocal (void)
     Cmd_AddCommand ("skins", CL_Skins_f);
 
     Cmd_AddCommand ("userinfo", CL_Userinfo_f);
+    Cmd_AddCommand ("entstats", CL_EntStats_f);
     Cmd_AddCommand ("snd_restart", CL_Snd_Restart_f);
 
     Cmd_AddCommand ("changing", CL_Changing_f);
     Cmd_AddCommand ("disconnect", CL_Disconnect_f);
     Cmd_AddCommand ("record", CL_Record_f);
     Cmd_AddCommand ("stop", CL_Stop_f);
+    Cmd_AddCommand ("democonvert", CL_DemoConvert_f);
 
     Cmd_AddCommand ("quit", CL_Quit_f);
 
@@ -1773,9 +1641,12 @@ void CL_Frame (int msec)
     // update the screen
     if (host_speeds->value)
         time_before_ref = Sys_Milliseconds ();
+    Prof_Begin (PROF_REFRESH);
     SCR_UpdateScreen ();
+    Prof_End (PROF_REFRESH);
     if (host_speeds->value)
         time_after_ref = Sys_Milliseconds ();
+    CL_LoadFrame ();
 
     // update audio
     S_Update (cl.refdef.vieworg, cl.v_forward, cl.v_right, cl.v_up);
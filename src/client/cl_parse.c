@@ -45,7 +45,9 @@ char *svc_strings[256] =
     "svc_playerinfo",
     "svc_packetentities",
     "svc_deltapacketentities",
-    "svc_frame"
+    "svc_frame",
+    "svc_bitentities",
+    "svc_projectiles"
 };
 
 //=============================================================================
@@ -184,6 +186,7 @@ void CL_RegisterSounds (void)
 {
     int        i;
 
+    CL_LoadPhase (LOAD_SOUNDS);
     S_BeginRegistration ();
     CL_RegisterTEntSounds ();
     for (i=1 ; i<MAX_SOUNDS ; i++)
@@ -194,6 +197,7 @@ void CL_RegisterSounds (void)
         Sys_SendKeyEvents ();    // pump message loop
     }
     S_EndRegistration ();
+    CL_LoadPhase (LOAD_NONE);
 }
 
 
@@ -626,9 +630,9 @@ void CL_ParseStartSoundPacket(void)
 
     if (flags & SND_ENT)
     {    // entity reletive
-        channel = MSG_ReadShort(&net_message); 
+        channel = MSG_ReadShort(&net_message) & 0xffff;    // entities past 4095 set the sign bit
         ent = channel>>3;
-        if (ent > MAX_EDICTS)
+        if (ent >= MAX_EDICTS)
             Com_Error (ERR_DROP,"CL_ParseStartSoundPacket: ent = %i", ent);
 
         channel &= 7;
@@ -671,6 +675,7 @@ void CL_ParseServerMessage (void)
     int            cmd;
     char        *s;
     int            i;
+    int            start;
 
 //
 // if recording demos, copy the message out
@@ -692,6 +697,7 @@ void CL_ParseServerMessage (void)
             break;
         }
 
+        start = net_message.readcount;
         cmd = MSG_ReadByte (&net_message);
 
         if (cmd == -1)
@@ -752,11 +758,13 @@ void CL_ParseServerMessage (void)
         case svc_stufftext:
             s = MSG_ReadString (&net_message);
             Com_DPrintf ("stufftext: %s\n", s);
-            Cbuf_AddText (s);
+            if (!cls.democonverting)
+                Cbuf_AddText (s);
             break;
             
         case svc_serverdata:
-            Cbuf_Execute ();        // make sure any stuffed commands are done
+            if (!cls.democonverting)
+                Cbuf_Execute ();        // make sure any stuffed commands are done
             CL_ParseServerData ();
             break;
             
@@ -807,16 +815,15 @@ void CL_ParseServerMessage (void)
             Com_Error (ERR_DROP, "Out of place frame data");
             break;
         }
+
+        if (cls.demorecording)
+            CL_DemoCommand (cmd, start);
     }
 
     CL_AddNetgraph ();
 
-    //
-    // we don't know if it is ok to save a demo message until
-    // after we have parsed the frame
-    //
-    if (cls.demorecording && !cls.demowaiting)
-        CL_WriteDemoMessage ();
+    if (cls.demorecording)
+        CL_DemoEndMessage ();
 
 }
 
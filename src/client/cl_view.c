@@ -286,6 +286,146 @@ void V_TestLights (void)
 
 //===================================================================
 
+/*
+=============================================================================
+
+LOAD TIMES
+
+=============================================================================
+*/
+
+typedef struct
+{
+    char    *name;
+    double    time;            // seconds in this phase
+    double    io;                // of that, in FS_LoadFile
+    int        files;
+    int        bytes;
+} loadphase_t;
+
+static loadphase_t    load_phases[NUM_LOAD_PHASES] = {
+    {"collision"}, {"sounds"}, {"map"}, {"pics"}, {"models"},
+    {"images"}, {"clients"}, {"sky"}, {"free"}
+};
+
+static qboolean        load_active;        // between CL_BeginLoad and the first frame
+static int            load_phase = LOAD_NONE;
+static double        load_start, load_firstframe;
+static double        load_phasestart;
+static fsloadstats_t    load_fsstart;        // fs_loadstats at CL_BeginLoad
+static fsloadstats_t    load_fsphase;        // fs_loadstats at the start of the phase
+
+/*
+=================
+CL_BeginLoad
+
+Starts timing a level load, from the server's precache command to the
+first frame drawn
+=================
+*/
+void CL_BeginLoad (void)
+{
+    int        i;
+
+    for (i=0 ; i<NUM_LOAD_PHASES ; i++)
+    {
+        load_phases[i].time = load_phases[i].io = 0;
+        load_phases[i].files = load_phases[i].bytes = 0;
+    }
+    load_active = true;
+    load_phase = LOAD_NONE;
+    load_firstframe = 0;
+    load_start = Sys_FloatTime ();
+    load_fsstart = fs_loadstats;
+}
+
+/*
+=================
+CL_LoadPhase
+
+Ends the current phase and starts the next one, or none with LOAD_NONE
+=================
+*/
+void CL_LoadPhase (int phase)
+{
+    loadphase_t    *lp;
+    double        now;
+
+    if (!load_active)
+        return;        // vid_restart or snd_restart
+
+    now = Sys_FloatTime ();
+    if (load_phase != LOAD_NONE)
+    {
+        lp = &load_phases[load_phase];
+        lp->time += now - load_phasestart;
+        lp->io += fs_loadstats.time - load_fsphase.time;
+        lp->files += fs_loadstats.files - load_fsphase.files;
+        lp->bytes += fs_loadstats.bytes - load_fsphase.bytes;
+    }
+
+    load_phase = phase;
+    load_phasestart = now;
+    load_fsphase = fs_loadstats;
+}
+
+/*
+=================
+CL_LoadFrame
+
+Called after every screen update, to catch the first frame of a level
+=================
+*/
+void CL_LoadFrame (void)
+{
+    if (!load_active || cls.state != ca_active || !cl.refresh_prepped)
+        return;
+
+    CL_LoadPhase (LOAD_NONE);
+    load_firstframe = Sys_FloatTime () - load_start;
+    load_active = false;
+}
+
+/*
+=================
+CL_LoadTimes_f
+=================
+*/
+void CL_LoadTimes_f (void)
+{
+    loadphase_t    *lp;
+    loadphase_t    total;
+    int            i;
+
+    if (!load_firstframe)
+    {
+        Com_Printf ("No level load has finished yet\n");
+        return;
+    }
+
+    memset (&total, 0, sizeof(total));
+    Com_Printf ("phase         ms    i/o ms  parse/upload  files      KB\n");
+    for (i=0, lp=load_phases ; i<NUM_LOAD_PHASES ; i++, lp++)
+    {
+        Com_Printf ("%-9s %7.1f %9.1f %13.1f %6i %7i\n", lp->name,
+            lp->time*1000, lp->io*1000, (lp->time - lp->io)*1000,
+            lp->files, lp->bytes/1024);
+        total.time += lp->time;
+        total.io += lp->io;
+        total.files += lp->files;
+        total.bytes += lp->bytes;
+    }
+    Com_Printf ("%-9s %7.1f %9.1f %13.1f %6i %7i\n", "total",
+        total.time*1000, total.io*1000, (total.time - total.io)*1000,
+        total.files, total.bytes/1024);
+
+    Com_Printf ("%.1f ms from precache to the first frame\n", load_firstframe*1000);
+    Com_Printf ("prefetch: %i files handed over, %i warmed, %i missed\n",
+        fs_loadstats.prefetched - load_fsstart.prefetched,
+        fs_loadstats.warmed - load_fsstart.warmed,
+        fs_loadstats.missed - load_fsstart.missed);
+}
+
 /*
 =================
 CL_PrepRefresh
@@ -314,15 +454,18 @@ void CL_PrepRefresh (void)
     // register models, pics, and skins
     Com_Printf ("Map: %s\r", mapname); 
     SCR_UpdateScreen ();
+    CL_LoadPhase (LOAD_MAP);
     re.BeginRegistration (mapname);
     Com_Printf ("                                     \r");
 
     // precache status bar pics
     Com_Printf ("pics\r"); 
     SCR_UpdateScreen ();
+    CL_LoadPhase (LOAD_PICS);
     SCR_TouchPics ();
     Com_Printf ("                                     \r");
 
+    CL_LoadPhase (LOAD_MODELS);
     CL_RegisterTEntModels ();
 
     num_cl_weaponmodels = 1;
@@ -360,6 +503,7 @@ void CL_PrepRefresh (void)
 
     Com_Printf ("images\r", i); 
     SCR_UpdateScreen ();
+    CL_LoadPhase (LOAD_IMAGES);
     for (i=1 ; i<MAX_IMAGES && cl.configstrings[CS_IMAGES+i][0] ; i++)
     {
         cl.image_precache[i] = re.RegisterPic (cl.configstrings[CS_IMAGES+i]);
@@ -367,6 +511,7 @@ void CL_PrepRefresh (void)
     }
     
     Com_Printf ("                                     \r");
+    CL_LoadPhase (LOAD_CLIENTS);
     for (i=0 ; i<MAX_CLIENTS ; i++)
     {
         if (!cl.configstrings[CS_PLAYERSKINS+i][0])
@@ -383,6 +528,7 @@ void CL_PrepRefresh (void)
     // set sky textures and speed
     Com_Printf ("sky\r", i); 
     SCR_UpdateScreen ();
+    CL_LoadPhase (LOAD_SKY);
     rotate = atof (cl.configstrings[CS_SKYROTATE]);
     sscanf (cl.configstrings[CS_SKYAXIS], "%f %f %f", 
         &axis[0], &axis[1], &axis[2]);
@@ -390,7 +536,12 @@ void CL_PrepRefresh (void)
     Com_Printf ("                                     \r");
 
     // the renderer can now free unneeded stuff
+    CL_LoadPhase (LOAD_FREE);
     re.EndRegistration ();
+    CL_LoadPhase (LOAD_NONE);
+
+    // anything read ahead and still unused won't be
+    FS_PrefetchFlush ();
 
     // clear any lines of console text
     Con_ClearNotify ();
@@ -638,6 +789,7 @@ void V_Init (void)
     Cmd_AddCommand ("gun_model", V_Gun_Model_f);
 
     Cmd_AddCommand ("viewpos", V_Viewpos_f);
+    Cmd_AddCommand ("loadtimes", CL_LoadTimes_f);
 
     crosshair = Cvar_Get ("crosshair", "0", CVAR_ARCHIVE);
     crosshair_scale = Cvar_Get ("crosshair_scale", "1", CVAR_ARCHIVE);
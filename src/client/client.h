@@ -69,6 +69,10 @@ typedef struct
     player_state_t    playerstate;
     int                num_entities;
     int                parse_entities;    // non-masked index into cl_parse_entities array
+    int                num_packetentities;        // as the server sent them, without the
+    int                parse_packetentities;    // projectiles, for deltas
+    int                num_projectiles;
+    int                parse_projectiles;    // non-masked index into cl_parse_projectiles array
 } frame_t;
 
 typedef struct
@@ -119,6 +123,7 @@ typedef struct
     qboolean    force_refdef;        // vid has changed, so we can't use a paused refdef
 
     int            parse_entities;        // index (not anded off) into cl_parse_entities[]
+    int            parse_projectiles;    // index (not anded off) into cl_parse_projectiles[]
 
     usercmd_t    cmd;
     usercmd_t    cmds[CMD_BACKUP];    // each mesage will send several old cmds
@@ -254,8 +259,8 @@ typedef struct
 
 // demo recording info must be here, so it isn't cleared on level change
     qboolean    demorecording;
-    qboolean    demowaiting;    // don't record until a non-delta message is received
-    FILE        *demofile;
+    qboolean    democonverting;    // democonvert is parsing a demo
+    demofile_t    *demofile;
 } client_static_t;
 
 extern client_static_t    cls;
@@ -309,6 +314,11 @@ extern    cvar_t    *cl_run;
 extern    cvar_t    *cl_anglespeedkey;
 
 extern    cvar_t    *cl_shownet;
+extern    cvar_t    *cl_bitents;
+extern    cvar_t    *cl_entstats;
+extern    cvar_t    *cl_demokeyframes;
+extern    cvar_t    *cl_projectiles;
+extern    cvar_t    *cl_bigedicts;
 extern    cvar_t    *cl_showmiss;
 extern    cvar_t    *cl_showclamp;
 
@@ -346,9 +356,17 @@ extern    cdlight_t    cl_dlights[MAX_DLIGHTS];
 
 // the cl_parse_entities must be large enough to hold UPDATE_BACKUP frames of
 // entities, so that when a delta compressed message arives from the server
-// it can be un-deltad from the original 
-#define    MAX_PARSE_ENTITIES    1024
-extern    entity_state_t    cl_parse_entities[MAX_PARSE_ENTITIES];
+// it can be un-deltad from the original, and svc_bitentities can reach
+// back past that to older frames.  It starts at MIN_PARSE_ENTITIES and is
+// doubled by CL_NextParseEntity when the frames get bigger.
+#define    MIN_PARSE_ENTITIES    4096
+extern    int                cl_max_parse_entities;    // power of two
+extern    entity_state_t    *cl_parse_entities;        // [cl_max_parse_entities]
+
+// the same for the trajectories in svc_projectiles
+#define    MIN_PARSE_PROJECTILES    1024
+extern    int                cl_max_parse_projectiles;
+extern    projectile_t    *cl_parse_projectiles;    // [cl_max_parse_projectiles]
 
 //=============================================================================
 
@@ -501,6 +519,8 @@ void CL_WidowSplash (vec3_t org);
 int CL_ParseEntityBits (unsigned *bits);
 void CL_ParseDelta (entity_state_t *from, entity_state_t *to, int number, int bits);
 void CL_ParseFrame (void);
+void CL_EntStats_f (void);
+void CL_EncodePacketEntities (frame_t *oldframe, frame_t *newframe, sizebuf_t *msg);
 
 void CL_ParseTEnt (void);
 void CL_ParseConfigString (void);
@@ -524,6 +544,23 @@ void CL_AddLightStyles (void);
 void CL_PrepRefresh (void);
 void CL_RegisterSounds (void);
 
+// level load phases, timed for loadtimes
+#define    LOAD_NONE        -1
+#define    LOAD_CMODEL        0
+#define    LOAD_SOUNDS        1
+#define    LOAD_MAP        2
+#define    LOAD_PICS        3
+#define    LOAD_MODELS        4
+#define    LOAD_IMAGES        5
+#define    LOAD_CLIENTS    6
+#define    LOAD_SKY        7
+#define    LOAD_FREE        8
+#define    NUM_LOAD_PHASES    9
+
+void CL_BeginLoad (void);
+void CL_LoadPhase (int phase);
+void CL_LoadFrame (void);
+
 void CL_Quit_f (void);
 
 void IN_Accumulate (void);
@@ -581,9 +618,11 @@ char *Key_KeynumToString (int keynum);
 //
 // cl_demo.c
 //
-void CL_WriteDemoMessage (void);
+void CL_DemoCommand (int cmd, int start);
+void CL_DemoEndMessage (void);
 void CL_Stop_f (void);
 void CL_Record_f (void);
+void CL_DemoConvert_f (void);
 
 //
 // cl_parse.c
@@ -849,7 +849,7 @@ void S_AddLoopSounds (void)
 
     for (i=0 ; i<cl.frame.num_entities ; i++)
     {
-        num = (cl.frame.parse_entities + i)&(MAX_PARSE_ENTITIES-1);
+        num = (cl.frame.parse_entities + i)&(cl_max_parse_entities-1);
         ent = &cl_parse_entities[num];
         sounds[i] = ent->sound;
     }
@@ -866,7 +866,7 @@ void S_AddLoopSounds (void)
         if (!sc)
             continue;
 
-        num = (cl.frame.parse_entities + i)&(MAX_PARSE_ENTITIES-1);
+        num = (cl.frame.parse_entities + i)&(cl_max_parse_entities-1);
         ent = &cl_parse_entities[num];
 
         // find the total contribution of all sounds of this type
@@ -878,7 +878,7 @@ void S_AddLoopSounds (void)
                 continue;
             sounds[j] = 0;    // don't check this again later
 
-            num = (cl.frame.parse_entities + j)&(MAX_PARSE_ENTITIES-1);
+            num = (cl.frame.parse_entities + j)&(cl_max_parse_entities-1);
             ent = &cl_parse_entities[num];
 
             S_SpatializeOrigin (ent->origin, 255.0, SOUND_LOOPATTENUATE, 
@@ -34,6 +34,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // the "gameversion" client command will print this plus compile date
 #define    GAMEVERSION    "baseq2"
 
+// bumped whenever edict_t or gclient_t change, so older saves are refused
+#define    SAVEGAME_VERSION    2
+
 // protocol bytes that can be directly added to messages
 #define    svc_muzzleflash        1
 #define    svc_muzzleflash2    2
@@ -642,6 +645,7 @@ void    G_SetMovedir (vec3_t angles, vec3_t movedir);
 void    G_InitEdict (edict_t *e);
 edict_t    *G_Spawn (void);
 void    G_FreeEdict (edict_t *e);
+void    G_BuildFreeEdicts (void);
 
 void    G_TouchTriggers (edict_t *ent);
 void    G_TouchSolids (edict_t *ent);
@@ -1029,6 +1033,7 @@ struct edict_s
 
     char        *model;
     float        freetime;            // sv.time when the object was freed
+    edict_t        *freechain;            // next one freed after this, for G_Spawn
     
     //
     // only used locally in game, not by server
@@ -361,6 +361,31 @@ void ExitLevel (void)
     }
 }
 
+/*
+================
+G_MovetypeZone
+
+Profiler zone for running entities of a movetype
+================
+*/
+int G_MovetypeZone (int movetype)
+{
+    static char    *names[MOVETYPE_BOUNCE+1] = {
+        "G_RunEntity MOVETYPE_NONE", "G_RunEntity MOVETYPE_NOCLIP",
+        "G_RunEntity MOVETYPE_PUSH", "G_RunEntity MOVETYPE_STOP",
+        "G_RunEntity MOVETYPE_WALK", "G_RunEntity MOVETYPE_STEP",
+        "G_RunEntity MOVETYPE_FLY", "G_RunEntity MOVETYPE_TOSS",
+        "G_RunEntity MOVETYPE_FLYMISSILE", "G_RunEntity MOVETYPE_BOUNCE"
+    };
+    static int    zones[MOVETYPE_BOUNCE+1];
+
+    if (movetype < 0 || movetype > MOVETYPE_BOUNCE)
+        return 0;
+    if (!zones[movetype])
+        zones[movetype] = gi.ProfZone (names[movetype]);
+    return zones[movetype];
+}
+
 /*
 ================
 G_RunFrame
@@ -372,6 +397,7 @@ void G_RunFrame (void)
 {
     int        i;
     edict_t    *ent;
+    int        zone;
 
     level.framenum++;
     level.time = level.framenum*FRAMETIME;
@@ -417,7 +443,10 @@ void G_RunFrame (void)
             continue;
         }
 
+        zone = G_MovetypeZone (ent->movetype);
+        gi.ProfBegin (zone);
         G_RunEntity (ent);
+        gi.ProfEnd (zone);
     }
 
     // see if it is time to end a deathmatch
@@ -451,7 +451,7 @@ void WriteGame (char *filename, qboolean autosave)
         gi.error ("Couldn't open %s", filename);
 
     memset (str, 0, sizeof(str));
-    strcpy (str, __DATE__);
+    Com_sprintf (str, sizeof(str), "%s v%i", __DATE__, SAVEGAME_VERSION);
     fwrite (str, sizeof(str), 1, f);
 
     game.autosaved = autosave;
@@ -468,7 +468,7 @@ void ReadGame (char *filename)
 {
     FILE    *f;
     int        i;
-    char    str[16];
+    char    str[16], version[16];
 
     gi.FreeTags (TAG_GAME);
 
@@ -476,8 +476,10 @@ void ReadGame (char *filename)
     if (!f)
         gi.error ("Couldn't open %s", filename);
 
+    Com_sprintf (version, sizeof(version), "%s v%i", __DATE__, SAVEGAME_VERSION);
     fread (str, sizeof(str), 1, f);
-    if (strcmp (str, __DATE__))
+    str[sizeof(str)-1] = 0;
+    if (strcmp (str, version))
     {
         fclose (f);
         gi.error ("Savegame from an older version.\n");
@@ -721,6 +723,8 @@ void ReadLevel (char *filename)
 
     fclose (f);
 
+    G_BuildFreeEdicts ();
+
     // mark all clients as unconnected
     for (i=0 ; i<maxclients->value ; i++)
     {
@@ -568,6 +568,7 @@ void SpawnEntities (char *mapname, char *entities, char *spawnpoint)
     // set client fields on player ents
     for (i=0 ; i<game.maxclients ; i++)
         g_edicts[i+1].client = game.clients + i;
+    G_BuildFreeEdicts ();
 
     ent = NULL;
     inhibit = 0;
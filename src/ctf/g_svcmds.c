@@ -19,6 +19,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
 #include "g_local.h"
+#include <time.h>
 
 
 void    Svcmd_Test_f (void)
@@ -26,6 +27,68 @@ void    Svcmd_Test_f (void)
     gi.cprintf (NULL, PRINT_HIGH, "Svcmd_Test_f()\n");
 }
 
+/*
+=================
+Svcmd_SpawnBench_f
+
+sv spawnbench [count] [rounds]
+
+Spawns count edicts and frees them again, like an explosion throwing
+gibs and debris, rounds times in the same frame.  Nothing freed in the
+storm can be reused until half a second later, so every round has to
+get past all the edicts freed by the ones before.  The edicts it takes
+stay allocated to the level, as they would after a real storm.
+=================
+*/
+void Svcmd_SpawnBench_f (void)
+{
+    int        count, rounds;
+    int        i, r;
+    int        old_edicts;
+    clock_t    start, spawning, freeing;
+    edict_t    **list;
+
+    count = gi.argc() > 2 ? atoi (gi.argv(2)) : 256;
+    rounds = gi.argc() > 3 ? atoi (gi.argv(3)) : 4;
+    if (count < 1)
+        count = 1;
+    if (rounds < 1)
+        rounds = 1;
+
+    // each round needs edicts that haven't been used yet
+    if (count*rounds > game.maxentities - globals.num_edicts - 64)
+    {
+        gi.cprintf (NULL, PRINT_HIGH, "only %i edicts left for the storm\n",
+            game.maxentities - globals.num_edicts - 64);
+        return;
+    }
+
+    list = gi.TagMalloc (count * sizeof(*list), TAG_LEVEL);
+    old_edicts = globals.num_edicts;
+    spawning = freeing = 0;
+
+    for (r=0 ; r<rounds ; r++)
+    {
+        start = clock ();
+        for (i=0 ; i<count ; i++)
+            list[i] = G_Spawn ();
+        spawning += clock () - start;
+
+        start = clock ();
+        for (i=0 ; i<count ; i++)
+            G_FreeEdict (list[i]);
+        freeing += clock () - start;
+    }
+
+    gi.TagFree (list);
+
+    gi.cprintf (NULL, PRINT_HIGH, "%i spawns: %.2f ms, %.3f usec each\n", count*rounds,
+        spawning * 1000.0 / CLOCKS_PER_SEC, spawning * 1000000.0 / CLOCKS_PER_SEC / (count*rounds));
+    gi.cprintf (NULL, PRINT_HIGH, "%i frees: %.2f ms, %.3f usec each\n", count*rounds,
+        freeing * 1000.0 / CLOCKS_PER_SEC, freeing * 1000000.0 / CLOCKS_PER_SEC / (count*rounds));
+    gi.cprintf (NULL, PRINT_HIGH, "num_edicts %i -> %i\n", old_edicts, globals.num_edicts);
+}
+
 /*
 ==============================================================================
 
@@ -294,6 +357,8 @@ void    ServerCommand (void)
         SVCmd_ListIP_f ();
     else if (Q_stricmp (cmd, "writeip") == 0)
         SVCmd_WriteIP_f ();
+    else if (Q_stricmp (cmd, "spawnbench") == 0)
+        Svcmd_SpawnBench_f ();
     else
         gi.cprintf (NULL, PRINT_HIGH, "Unknown server command \"%s\"\n", cmd);
 }
@@ -180,6 +180,14 @@ typedef struct
     void    (*AddCommandString) (char *text);
 
     void    (*DebugGraph) (float value, int color);
+
+    // profiler zones, appended so older game dlls still line up
+    int        (*ProfZone) (char *name);
+    void    (*ProfBegin) (int zone);
+    void    (*ProfEnd) (int zone);
+
+    // trace from one start to each of ends[numtraces], appended like the zones
+    void    (*tracemany) (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t *ends, int numtraces, edict_t *passent, int contentmask, trace_t *traces);
 } game_import_t;
 
 //
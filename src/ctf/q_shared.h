@@ -67,7 +67,8 @@ typedef enum {false, true}    qboolean;
 // per-level limits
 //
 #define    MAX_CLIENTS            256        // absolute limit
-#define    MAX_EDICTS            1024    // must change protocol to increase more
+#define    MAX_EDICTS            8192    // sound packets can't address more
+#define    MAX_EDICTS_OLD        1024    // for clients without the "bigedicts" extension
 #define    MAX_LIGHTSTYLES        256
 #define    MAX_MODELS            256        // these are sent over the net as bytes
 #define    MAX_SOUNDS            256        // so they cannot be blindly increased
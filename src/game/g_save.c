@@ -478,7 +478,7 @@ void WriteGame (char *filename, qboolean autosave)
         gi.error ("Couldn't open %s", filename);
 
     memset (str, 0, sizeof(str));
-    strcpy (str, __DATE__);
+    Com_sprintf (str, sizeof(str), "%s v%i", __DATE__, SAVEGAME_VERSION);
     fwrite (str, sizeof(str), 1, f);
 
     game.autosaved = autosave;
@@ -495,7 +495,7 @@ void ReadGame (char *filename)
 {
     FILE    *f;
     int        i;
-    char    str[16];
+    char    str[16], version[16];
 
     gi.FreeTags (TAG_GAME);
 
@@ -503,8 +503,10 @@ void ReadGame (char *filename)
     if (!f)
         gi.error ("Couldn't open %s", filename);
 
+    Com_sprintf (version, sizeof(version), "%s v%i", __DATE__, SAVEGAME_VERSION);
     fread (str, sizeof(str), 1, f);
-    if (strcmp (str, __DATE__))
+    str[sizeof(str)-1] = 0;
+    if (strcmp (str, version))
     {
         fclose (f);
         gi.error ("Savegame from an older version.\n");
@@ -752,6 +754,8 @@ void ReadLevel (char *filename)
 
     fclose (f);
 
+    G_BuildFreeEdicts ();
+
     // mark all clients as unconnected
     for (i=0 ; i<maxclients->value ; i++)
     {
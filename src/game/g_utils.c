@@ -406,6 +406,54 @@ void G_InitEdict (edict_t *e)
     e->s.number = e - g_edicts;
 }
 
+static edict_t    *g_freehead, *g_freetail;    // in G_FreeEdict order, so oldest first
+
+static int G_FreeTimeSort (void const *a, void const *b)
+{
+    edict_t    *ea = *(edict_t **)a;
+    edict_t    *eb = *(edict_t **)b;
+
+    if (ea->freetime != eb->freetime)
+        return ea->freetime < eb->freetime ? -1 : 1;
+    return ea - eb;
+}
+
+/*
+=================
+G_BuildFreeEdicts
+
+Puts every free edict past the clients on the freelist, after the
+edicts have been wiped for a new or loaded level.  They are queued by
+freetime, since G_Spawn only looks at the head.
+=================
+*/
+void G_BuildFreeEdicts (void)
+{
+    int            i, count;
+    edict_t        *e, **list;
+
+    list = gi.TagMalloc (game.maxentities * sizeof(*list), TAG_LEVEL);
+    count = 0;
+    for (i=maxclients->value+1, e=&g_edicts[i] ; i<globals.num_edicts ; i++, e++)
+        if (!e->inuse)
+            list[count++] = e;
+    qsort (list, count, sizeof(*list), G_FreeTimeSort);
+
+    g_freehead = g_freetail = NULL;
+    for (i=0 ; i<count ; i++)
+    {
+        e = list[i];
+        e->freechain = NULL;
+        if (g_freetail)
+            g_freetail->freechain = e;
+        else
+            g_freehead = e;
+        g_freetail = e;
+    }
+
+    gi.TagFree (list);
+}
+
 /*
 =================
 G_Spawn
@@ -415,28 +463,32 @@ Try to avoid reusing an entity that was recently freed, because it
 can cause the client to think the entity morphed into something else
 instead of being removed and recreated, which can cause interpolated
 angles and bad trails.
+
+The free edicts are queued in the order they were freed, so if the
+oldest one can't be reused yet none of them can.
 =================
 */
 edict_t *G_Spawn (void)
 {
-    int            i;
     edict_t        *e;
 
-    e = &g_edicts[(int)maxclients->value+1];
-    for ( i=maxclients->value+1 ; i<globals.num_edicts ; i++, e++)
+    // the first couple seconds of server time can involve a lot of
+    // freeing and allocating, so relax the replacement policy
+    e = g_freehead;
+    if (e && ( e->freetime < 2 || level.time - e->freetime > 0.5 ) )
     {
-        // the first couple seconds of server time can involve a lot of
-        // freeing and allocating, so relax the replacement policy
-        if (!e->inuse && ( e->freetime < 2 || level.time - e->freetime > 0.5 ) )
-        {
-            G_InitEdict (e);
-            return e;
-        }
+        g_freehead = e->freechain;
+        if (!g_freehead)
+            g_freetail = NULL;
+        e->freechain = NULL;
+        G_InitEdict (e);
+        return e;
     }
     
-    if (i == game.maxentities)
+    if (globals.num_edicts == game.maxentities)
         gi.error ("ED_Alloc: no free edicts");
         
+    e = &g_edicts[globals.num_edicts];
     globals.num_edicts++;
     G_InitEdict (e);
     return e;
@@ -459,10 +511,20 @@ void G_FreeEdict (edict_t *ed)
         return;
     }
 
+    if (!ed->inuse)
+        return;        // already queued
+
     memset (ed, 0, sizeof(*ed));
     ed->classname = "freed";
     ed->freetime = level.time;
     ed->inuse = false;
+
+    // queue it behind everything freed before
+    if (g_freetail)
+        g_freetail->freechain = ed;
+    else
+        g_freehead = ed;
+    g_freetail = ed;
 }
 
 
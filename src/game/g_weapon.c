@@ -126,94 +126,82 @@ qboolean fire_hit (edict_t *self, vec3_t aim, int damage, int kick)
 
 /*
 =================
-fire_lead
+fire_lead_water
 
-This is an internal support routine used for bullet/pellet based weapons.
+If a bullet's trace went into water, splashes there, bends the bullet
+and traces on through the water.  Returns true with water_start set
+where it went in.
 =================
 */
-static void fire_lead (edict_t *self, vec3_t start, vec3_t aimdir, int damage, int kick, int te_impact, int hspread, int vspread, int mod)
+static qboolean fire_lead_water (edict_t *self, vec3_t start, vec3_t end, trace_t *tr, vec3_t water_start, int hspread, int vspread)
 {
-    trace_t        tr;
     vec3_t        dir;
     vec3_t        forward, right, up;
-    vec3_t        end;
     float        r;
     float        u;
-    vec3_t        water_start;
-    qboolean    water = false;
-    int            content_mask = MASK_SHOT | MASK_WATER;
+    int            color;
 
-    tr = gi.trace (self->s.origin, NULL, NULL, start, self, MASK_SHOT);
-    if (!(tr.fraction < 1.0))
-    {
-        vectoangles (aimdir, dir);
-        AngleVectors (dir, forward, right, up);
+    // see if we hit water
+    if (!(tr->contents & MASK_WATER))
+        return false;
 
-        r = crandom()*hspread;
-        u = crandom()*vspread;
-        VectorMA (start, 8192, forward, end);
-        VectorMA (end, r, right, end);
-        VectorMA (end, u, up, end);
+    VectorCopy (tr->endpos, water_start);
 
-        if (gi.pointcontents (start) & MASK_WATER)
+    if (!VectorCompare (start, tr->endpos))
+    {
+        if (tr->contents & CONTENTS_WATER)
         {
-            water = true;
-            VectorCopy (start, water_start);
-            content_mask &= ~MASK_WATER;
+            if (strcmp(tr->surface->name, "*brwater") == 0)
+                color = SPLASH_BROWN_WATER;
+            else
+                color = SPLASH_BLUE_WATER;
         }
+        else if (tr->contents & CONTENTS_SLIME)
+            color = SPLASH_SLIME;
+        else if (tr->contents & CONTENTS_LAVA)
+            color = SPLASH_LAVA;
+        else
+            color = SPLASH_UNKNOWN;
 
-        tr = gi.trace (start, NULL, NULL, end, self, content_mask);
-
-        // see if we hit water
-        if (tr.contents & MASK_WATER)
+        if (color != SPLASH_UNKNOWN)
         {
-            int        color;
+            gi.WriteByte (svc_temp_entity);
+            gi.WriteByte (TE_SPLASH);
+            gi.WriteByte (8);
+            gi.WritePosition (tr->endpos);
+            gi.WriteDir (tr->plane.normal);
+            gi.WriteByte (color);
+            gi.multicast (tr->endpos, MULTICAST_PVS);
+        }
 
-            water = true;
-            VectorCopy (tr.endpos, water_start);
+        // change bullet's course when it enters water
+        VectorSubtract (end, start, dir);
+        vectoangles (dir, dir);
+        AngleVectors (dir, forward, right, up);
+        r = crandom()*hspread*2;
+        u = crandom()*vspread*2;
+        VectorMA (water_start, 8192, forward, end);
+        VectorMA (end, r, right, end);
+        VectorMA (end, u, up, end);
+    }
 
-            if (!VectorCompare (start, tr.endpos))
-            {
-                if (tr.contents & CONTENTS_WATER)
-                {
-                    if (strcmp(tr.surface->name, "*brwater") == 0)
-                        color = SPLASH_BROWN_WATER;
-                    else
-                        color = SPLASH_BLUE_WATER;
-                }
-                else if (tr.contents & CONTENTS_SLIME)
-                    color = SPLASH_SLIME;
-                else if (tr.contents & CONTENTS_LAVA)
-                    color = SPLASH_LAVA;
-                else
-                    color = SPLASH_UNKNOWN;
-
-                if (color != SPLASH_UNKNOWN)
-                {
-                    gi.WriteByte (svc_temp_entity);
-                    gi.WriteByte (TE_SPLASH);
-                    gi.WriteByte (8);
-                    gi.WritePosition (tr.endpos);
-                    gi.WriteDir (tr.plane.normal);
-                    gi.WriteByte (color);
-                    gi.multicast (tr.endpos, MULTICAST_PVS);
-                }
+    // re-trace ignoring water this time
+    *tr = gi.trace (water_start, NULL, NULL, end, self, MASK_SHOT);
+    return true;
+}
 
-                // change bullet's course when it enters water
-                VectorSubtract (end, start, dir);
-                vectoangles (dir, dir);
-                AngleVectors (dir, forward, right, up);
-                r = crandom()*hspread*2;
-                u = crandom()*vspread*2;
-                VectorMA (water_start, 8192, forward, end);
-                VectorMA (end, r, right, end);
-                VectorMA (end, u, up, end);
-            }
+/*
+=================
+fire_lead_impact
 
-            // re-trace ignoring water this time
-            tr = gi.trace (water_start, NULL, NULL, end, self, MASK_SHOT);
-        }
-    }
+Damages what a bullet hit or puffs off the wall, and makes the bubble
+trail if it went through water.  Returns true if something was damaged.
+=================
+*/
+static qboolean fire_lead_impact (edict_t *self, vec3_t aimdir, trace_t tr, qboolean water, vec3_t water_start, int damage, int kick, int te_impact, int mod)
+{
+    vec3_t        dir;
+    qboolean    damaged = false;
 
     // send gun puff / flash
     if (!((tr.surface) && (tr.surface->flags & SURF_SKY)))
@@ -223,6 +211,7 @@ static void fire_lead (edict_t *self, vec3_t start, vec3_t aimdir, int damage, i
             if (tr.ent->takedamage)
             {
                 T_Damage (tr.ent, self, self, aimdir, tr.endpos, tr.plane.normal, damage, kick, DAMAGE_BULLET, mod);
+                damaged = true;
             }
             else
             {
@@ -263,6 +252,67 @@ static void fire_lead (edict_t *self, vec3_t start, vec3_t aimdir, int damage, i
         gi.WritePosition (tr.endpos);
         gi.multicast (pos, MULTICAST_PVS);
     }
+
+    return damaged;
+}
+
+/*
+=================
+fire_lead_end
+
+Picks where a bullet fired along aimdir would go with its spread
+=================
+*/
+static void fire_lead_end (vec3_t start, vec3_t aimdir, int hspread, int vspread, vec3_t end)
+{
+    vec3_t        dir;
+    vec3_t        forward, right, up;
+    float        r;
+    float        u;
+
+    vectoangles (aimdir, dir);
+    AngleVectors (dir, forward, right, up);
+
+    r = crandom()*hspread;
+    u = crandom()*vspread;
+    VectorMA (start, 8192, forward, end);
+    VectorMA (end, r, right, end);
+    VectorMA (end, u, up, end);
+}
+
+/*
+=================
+fire_lead
+
+This is an internal support routine used for bullet/pellet based weapons.
+=================
+*/
+static void fire_lead (edict_t *self, vec3_t start, vec3_t aimdir, int damage, int kick, int te_impact, int hspread, int vspread, int mod)
+{
+    trace_t        tr;
+    vec3_t        end;
+    vec3_t        water_start;
+    qboolean    water = false;
+    int            content_mask = MASK_SHOT | MASK_WATER;
+
+    tr = gi.trace (self->s.origin, NULL, NULL, start, self, MASK_SHOT);
+    if (!(tr.fraction < 1.0))
+    {
+        fire_lead_end (start, aimdir, hspread, vspread, end);
+
+        if (gi.pointcontents (start) & MASK_WATER)
+        {
+            water = true;
+            VectorCopy (start, water_start);
+            content_mask &= ~MASK_WATER;
+        }
+
+        tr = gi.trace (start, NULL, NULL, end, self, content_mask);
+        if (fire_lead_water (self, start, end, &tr, water_start, hspread, vspread))
+            water = true;
+    }
+
+    fire_lead_impact (self, aimdir, tr, water, water_start, damage, kick, te_impact, mod);
 }
 
 
@@ -285,14 +335,46 @@ void fire_bullet (edict_t *self, vec3_t start, vec3_t aimdir, int damage, int ki
 fire_shotgun
 
 Shoots shotgun pellets.  Used by shotgun and super shotgun.
+
+The pellets all leave from start, so when that is clear of the muzzle
+and out of water their traces are done together with gi.tracemany.
+A pellet is traced again on its own if it hit an entity after an
+earlier pellet damaged something, since that may have moved or gone.
 =================
 */
+#define    MAX_SHOTGUN_PELLETS    32
+
 void fire_shotgun (edict_t *self, vec3_t start, vec3_t aimdir, int damage, int kick, int hspread, int vspread, int count, int mod)
 {
-    int        i;
+    vec3_t        ends[MAX_SHOTGUN_PELLETS];
+    trace_t        traces[MAX_SHOTGUN_PELLETS];
+    vec3_t        water_start;
+    qboolean    water, damaged;
+    trace_t        tr;
+    int            i;
+
+    tr = gi.trace (self->s.origin, NULL, NULL, start, self, MASK_SHOT);
+    if (count > MAX_SHOTGUN_PELLETS || tr.fraction < 1.0
+        || (gi.pointcontents (start) & MASK_WATER))
+    {
+        for (i = 0; i < count; i++)
+            fire_lead (self, start, aimdir, damage, kick, TE_SHOTGUN, hspread, vspread, mod);
+        return;
+    }
 
     for (i = 0; i < count; i++)
-        fire_lead (self, start, aimdir, damage, kick, TE_SHOTGUN, hspread, vspread, mod);
+        fire_lead_end (start, aimdir, hspread, vspread, ends[i]);
+    gi.tracemany (start, NULL, NULL, ends, count, self, MASK_SHOT | MASK_WATER, traces);
+
+    damaged = false;
+    for (i = 0; i < count; i++)
+    {
+        if (damaged && traces[i].ent != g_edicts)
+            traces[i] = gi.trace (start, NULL, NULL, ends[i], self, MASK_SHOT | MASK_WATER);
+        water = fire_lead_water (self, start, ends[i], &traces[i], water_start, hspread, vspread);
+        if (fire_lead_impact (self, aimdir, traces[i], water, water_start, damage, kick, TE_SHOTGUN, mod))
+            damaged = true;
+    }
 }
 
 
@@ -350,7 +432,7 @@ void fire_blaster (edict_t *self, vec3_t start, vec3_t dir, int damage, int spee
     VectorNormalize (dir);
 
     bolt = G_Spawn();
-    bolt->svflags = SVF_DEADMONSTER;
+    bolt->svflags = SVF_DEADMONSTER | SVF_PROJECTILE;
     // yes, I know it looks weird that projectiles are deadmonsters
     // what this means is that when prediction is used against the object
     // (blaster/hyperblaster shots), the player won't be solid clipped against
@@ -501,6 +583,7 @@ void fire_grenade (edict_t *self, vec3_t start, vec3_t aimdir, int damage, int s
     grenade->movetype = MOVETYPE_BOUNCE;
     grenade->clipmask = MASK_SHOT;
     grenade->solid = SOLID_BBOX;
+    grenade->svflags |= SVF_PROJECTILE;
     grenade->s.effects |= EF_GRENADE;
     VectorClear (grenade->mins);
     VectorClear (grenade->maxs);
@@ -534,6 +617,7 @@ void fire_grenade2 (edict_t *self, vec3_t start, vec3_t aimdir, int damage, int
     grenade->movetype = MOVETYPE_BOUNCE;
     grenade->clipmask = MASK_SHOT;
     grenade->solid = SOLID_BBOX;
+    grenade->svflags |= SVF_PROJECTILE;
     grenade->s.effects |= EF_GRENADE;
     VectorClear (grenade->mins);
     VectorClear (grenade->maxs);
@@ -629,6 +713,7 @@ void fire_rocket (edict_t *self, vec3_t start, vec3_t dir, int damage, int speed
     rocket->movetype = MOVETYPE_FLYMISSILE;
     rocket->clipmask = MASK_SHOT;
     rocket->solid = SOLID_BBOX;
+    rocket->svflags |= SVF_PROJECTILE;
     rocket->s.effects |= EF_ROCKET;
     VectorClear (rocket->mins);
     VectorClear (rocket->maxs);
@@ -892,6 +977,7 @@ void fire_bfg (edict_t *self, vec3_t start, vec3_t dir, int damage, int speed, f
     bfg->movetype = MOVETYPE_FLYMISSILE;
     bfg->clipmask = MASK_SHOT;
     bfg->solid = SOLID_BBOX;
+    bfg->svflags |= SVF_PROJECTILE;
     bfg->s.effects |= EF_BFG | EF_ANIM_ALLFAST;
     VectorClear (bfg->mins);
     VectorClear (bfg->maxs);
@@ -27,6 +27,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define    SVF_NOCLIENT            0x00000001    // don't send entity to clients, even if it has effects
 #define    SVF_DEADMONSTER            0x00000002    // treat as CONTENTS_DEADMONSTER for collision
 #define    SVF_MONSTER                0x00000004    // treat as CONTENTS_MONSTER for collision
+#define    SVF_PROJECTILE            0x00000008    // entity is simple projectile, used for network optimization
 
 // edict->solid values
 
@@ -173,6 +174,14 @@ typedef struct
     void    (*AddCommandString) (char *text);
 
     void    (*DebugGraph) (float value, int color);
+
+    // profiler zones, appended so older game dlls still line up
+    int        (*ProfZone) (char *name);
+    void    (*ProfBegin) (int zone);
+    void    (*ProfEnd) (int zone);
+
+    // trace from one start to each of ends[numtraces], appended like the zones
+    void    (*tracemany) (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t *ends, int numtraces, edict_t *passent, int contentmask, trace_t *traces);
 } game_import_t;
 
 //
@@ -69,7 +69,8 @@ typedef enum {false, true}    qboolean;
 // per-level limits
 //
 #define    MAX_CLIENTS            256        // absolute limit
-#define    MAX_EDICTS            1024    // must change protocol to increase more
+#define    MAX_EDICTS            8192    // sound packets can't address more
+#define    MAX_EDICTS_OLD        1024    // for clients without the "bigedicts" extension
 #define    MAX_LIGHTSTYLES        256
 #define    MAX_MODELS            256        // these are sent over the net as bytes
 #define    MAX_SOUNDS            256        // so they cannot be blindly increased
@@ -252,8 +253,15 @@ SYSTEM SPECIFIC
 extern    int    curtime;        // time returned by last Sys_Milliseconds
 
 int        Sys_Milliseconds (void);
+double    Sys_FloatTime (void);    // seconds, high resolution
 void    Sys_Mkdir (char *path);
 
+// worker threads
+int        Sys_NumProcessors (void);
+void    Sys_RunJobs (void (*func) (int job, void *data), int numjobs, void *data, int numthreads);
+// runs func for every job in [0,numjobs) spread over numthreads threads,
+// including the caller, and returns when all of them are done
+
 // large block stack allocation routines
 void    *Hunk_Begin (int maxsize);
 void    *Hunk_Alloc (int size);
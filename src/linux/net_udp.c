@@ -19,6 +19,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // net_wins.c
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE        // recvmmsg / sendmmsg
+#endif
+
 #include "../qcommon/qcommon.h"
 
 #include <unistd.h>
@@ -29,6 +33,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <sys/param.h>
 #include <sys/ioctl.h>
 #include <sys/uio.h>
+#include <poll.h>
 #include <errno.h>
 #include <arpa/inet.h>
 
@@ -36,11 +41,16 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <libc.h>
 #endif
 
+// recvmmsg / sendmmsg move a whole batch of datagrams per system call
+#if defined(__linux__)
+#define    NET_MMSG
+#endif
+
 netadr_t    net_local_adr;
 
 #define    LOOPBACK    0x7f000001
 
-#define    MAX_LOOPBACK    4
+#define    MAX_LOOPBACK    32        // a whole fragmented message
 
 typedef struct
 {
@@ -58,8 +68,37 @@ loopback_t    loopbacks[2];
 int            ip_sockets[2];
 int            ipx_sockets[2];
 
+#define    NET_BATCH    64        // datagrams per recvmmsg / sendmmsg
+
+typedef struct
+{
+    int        socket;
+    int        count;            // received or queued
+    int        next;            // next received one to hand out
+    byte    data[NET_BATCH][MAX_MSGLEN];
+    int        len[NET_BATCH];
+    struct sockaddr_in    addr[NET_BATCH];
+#ifdef NET_MMSG
+    struct iovec        iov[NET_BATCH];
+    struct mmsghdr        msgs[NET_BATCH];
+#endif
+} netbatch_t;
+
+netbatch_t    net_recv[2];        // received and not yet handed out, per netsrc
+netbatch_t    net_send;            // queued between NET_BeginPackets and NET_FlushPackets
+qboolean    net_queueing;
+
+cvar_t        *net_batch;
+
+// net_stats counters
+int            net_syscalls;
+int            net_packetsin, net_packetsout;
+
 int NET_Socket (char *net_interface, int port);
 char *NET_ErrorString (void);
+void NET_Stats_f (void);
+void NET_Bench_f (void);
+void NET_QueuePacket (int net_socket, struct sockaddr_in *addr, void *data, int length);
 
 //=============================================================================
 
@@ -276,6 +315,74 @@ void NET_SendLoopPacket (netsrc_t sock, int length, void *data, netadr_t to)
 
 //=============================================================================
 
+/*
+====================
+NET_RecvBatched
+
+Hands out the next datagram from a batch, reading a new batch when it
+runs out.  Returns the length like recvfrom, or -1 with errno set.
+====================
+*/
+int NET_RecvBatched (netbatch_t *b, int net_socket, sizebuf_t *net_message, struct sockaddr_in *from)
+{
+#ifdef NET_MMSG
+    int        i, len;
+
+    if (b->socket != net_socket)
+        b->count = b->next = 0;        // from a socket that has been closed
+
+    if (b->next >= b->count)
+    {
+        for (i=0 ; i<NET_BATCH ; i++)
+        {
+            b->iov[i].iov_base = b->data[i];
+            b->iov[i].iov_len = MAX_MSGLEN;
+            memset (&b->msgs[i].msg_hdr, 0, sizeof(b->msgs[i].msg_hdr));
+            b->msgs[i].msg_hdr.msg_name = &b->addr[i];
+            b->msgs[i].msg_hdr.msg_namelen = sizeof(b->addr[i]);
+            b->msgs[i].msg_hdr.msg_iov = &b->iov[i];
+            b->msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        b->socket = net_socket;
+        b->next = 0;
+        b->count = recvmmsg (net_socket, b->msgs, NET_BATCH, MSG_DONTWAIT, NULL);
+        net_syscalls++;
+        if (b->count <= 0)
+        {
+            if (!b->count)
+                errno = EWOULDBLOCK;
+            b->count = 0;
+            memset (from, 0, sizeof(*from));
+            return -1;
+        }
+
+        for (i=0 ; i<b->count ; i++)
+        {
+            b->len[i] = b->msgs[i].msg_len;
+            if (b->msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+                b->len[i] = MAX_MSGLEN;        // reported as oversize
+        }
+    }
+
+    i = b->next++;
+    *from = b->addr[i];
+    len = b->len[i];
+    if (len > net_message->maxsize)
+        len = net_message->maxsize;
+    memcpy (net_message->data, b->data[i], len);
+    return len;
+#else
+    socklen_t    fromlen;
+
+    fromlen = sizeof(*from);
+    net_syscalls++;
+    return recvfrom (net_socket, net_message->data
+        , net_message->maxsize < MAX_MSGLEN ? net_message->maxsize : MAX_MSGLEN
+        , 0, (struct sockaddr *)from, &fromlen);
+#endif
+}
+
 qboolean    NET_GetPacket (netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message)
 {
     int     ret;
@@ -284,10 +391,16 @@ qboolean    NET_GetPacket (netsrc_t sock, netadr_t *net_from, sizebuf_t *net_mes
     int        net_socket;
     int        protocol;
     int        err;
+    int        maxsize;
 
     if (NET_GetLoopPacket (sock, net_from, net_message))
         return true;
 
+    // net_message has room for a reassembled message, datagrams don't
+    maxsize = net_message->maxsize;
+    if (maxsize > MAX_MSGLEN)
+        maxsize = MAX_MSGLEN;
+
     for (protocol = 0 ; protocol < 2 ; protocol++)
     {
         if (protocol == 0)
@@ -298,9 +411,15 @@ qboolean    NET_GetPacket (netsrc_t sock, netadr_t *net_from, sizebuf_t *net_mes
         if (!net_socket)
             continue;
 
-        fromlen = sizeof(from);
-        ret = recvfrom (net_socket, net_message->data, net_message->maxsize
-            , 0, (struct sockaddr *)&from, &fromlen);
+        if (protocol == 0 && net_batch->value)
+            ret = NET_RecvBatched (&net_recv[sock], net_socket, net_message, &from);
+        else
+        {
+            fromlen = sizeof(from);
+            ret = recvfrom (net_socket, net_message->data, maxsize
+                , 0, (struct sockaddr *)&from, &fromlen);
+            net_syscalls++;
+        }
 
         SockadrToNetadr (&from, net_from);
 
@@ -315,21 +434,93 @@ qboolean    NET_GetPacket (netsrc_t sock, netadr_t *net_from, sizebuf_t *net_mes
             continue;
         }
 
-        if (ret == net_message->maxsize)
+        if (ret == maxsize)
         {
             Com_Printf ("Oversize packet from %s\n", NET_AdrToString (*net_from));
             continue;
         }
 
         net_message->cursize = ret;
+        net_packetsin++;
         return true;
     }
 
     return false;
 }
 
+/*
+====================
+NET_RecvFrom
+
+For a thread of its own: waits up to msec for a datagram on sock's IP
+socket.  Never looks at the loopback, queues or prints anything, so
+nothing else may read that socket meanwhile.  Returns the length, 0 if
+nothing came, or -1 for an error or oversize packet.
+====================
+*/
+int NET_RecvFrom (netsrc_t sock, netadr_t *net_from, byte *data, int maxsize, int msec)
+{
+    struct sockaddr_in    from;
+    socklen_t    fromlen;
+    struct pollfd    pfd;
+    sizebuf_t    msg;
+    int        net_socket;
+    int        ret;
+
+    net_socket = ip_sockets[sock];
+    if (!net_socket)
+        return -1;
+
+    if (!net_batch->value || net_recv[sock].next >= net_recv[sock].count)
+    {
+        pfd.fd = net_socket;
+        pfd.events = POLLIN;
+        if (poll (&pfd, 1, msec) <= 0)
+            return 0;
+    }
+
+    if (net_batch->value)
+    {
+        SZ_Init (&msg, data, maxsize);
+        ret = NET_RecvBatched (&net_recv[sock], net_socket, &msg, &from);
+    }
+    else
+    {
+        fromlen = sizeof(from);
+        ret = recvfrom (net_socket, data, maxsize, 0, (struct sockaddr *)&from, &fromlen);
+    }
+
+    if (ret == -1)
+        return (errno == EWOULDBLOCK || errno == ECONNREFUSED) ? 0 : -1;
+    if (ret == maxsize)
+        return -1;        // oversize
+
+    SockadrToNetadr (&from, net_from);
+    return ret;
+}
+
 //=============================================================================
 
+/*
+====================
+NET_SendTo
+
+The thread safe NET_SendPacket for IP addresses, sent right away
+====================
+*/
+int NET_SendTo (netsrc_t sock, netadr_t to, void *data, int length)
+{
+    struct sockaddr_in    addr;
+
+    if (to.type != NA_IP)
+        return -1;
+    if (!ip_sockets[sock])
+        return -1;
+
+    NetadrToSockadr (&to, &addr);
+    return sendto (ip_sockets[sock], data, length, 0, (struct sockaddr *)&addr, sizeof(addr));
+}
+
 void NET_SendPacket (netsrc_t sock, int length, void *data, netadr_t to)
 {
     int        ret;
@@ -373,8 +564,16 @@ void NET_SendPacket (netsrc_t sock, int length, void *data, netadr_t to)
     }    
 
     NetadrToSockadr (&to, &addr);
+    net_packetsout++;
+
+    if (net_queueing && length <= MAX_MSGLEN)
+    {
+        NET_QueuePacket (net_socket, &addr, data, length);
+        return;
+    }
 
     ret = sendto (net_socket, data, length, 0, (struct sockaddr *)&addr, sizeof(addr) );
+    net_syscalls++;
     if (ret == -1)
     {
         Com_Printf ("NET_SendPacket ERROR: %s to %s\n", NET_ErrorString(),
@@ -382,6 +581,103 @@ void NET_SendPacket (netsrc_t sock, int length, void *data, netadr_t to)
     }
 }
 
+/*
+====================
+NET_SendBatch
+
+Sends everything queued in a batch
+====================
+*/
+void NET_SendBatch (netbatch_t *b)
+{
+    int            sent, ret;
+    netadr_t    to;
+
+    for (sent = 0 ; sent < b->count ; )
+    {
+#ifdef NET_MMSG
+        ret = sendmmsg (b->socket, b->msgs + sent, b->count - sent, 0);
+        net_syscalls++;
+        if (ret > 0)
+        {
+            sent += ret;
+            continue;
+        }
+#else
+        ret = sendto (b->socket, b->data[sent], b->len[sent], 0,
+            (struct sockaddr *)&b->addr[sent], sizeof(b->addr[sent]));
+        net_syscalls++;
+        if (ret != -1)
+        {
+            sent++;
+            continue;
+        }
+#endif
+        // the first unsent one failed, skip it
+        SockadrToNetadr (&b->addr[sent], &to);
+        Com_Printf ("NET_SendPacket ERROR: %s to %s\n", NET_ErrorString(),
+                NET_AdrToString (to));
+        sent++;
+    }
+
+    b->count = 0;
+}
+
+/*
+====================
+NET_QueuePacket
+====================
+*/
+void NET_QueuePacket (int net_socket, struct sockaddr_in *addr, void *data, int length)
+{
+    netbatch_t    *b;
+    int            i;
+
+    b = &net_send;
+    if (b->count && (b->count == NET_BATCH || b->socket != net_socket))
+        NET_SendBatch (b);
+
+    i = b->count++;
+    b->socket = net_socket;
+    b->addr[i] = *addr;
+    b->len[i] = length;
+    memcpy (b->data[i], data, length);
+#ifdef NET_MMSG
+    b->iov[i].iov_base = b->data[i];
+    b->iov[i].iov_len = length;
+    memset (&b->msgs[i].msg_hdr, 0, sizeof(b->msgs[i].msg_hdr));
+    b->msgs[i].msg_hdr.msg_name = &b->addr[i];
+    b->msgs[i].msg_hdr.msg_namelen = sizeof(b->addr[i]);
+    b->msgs[i].msg_hdr.msg_iov = &b->iov[i];
+    b->msgs[i].msg_hdr.msg_iovlen = 1;
+#endif
+}
+
+/*
+====================
+NET_BeginPackets
+
+Holds on to outgoing datagrams until NET_FlushPackets, to send them
+with as few system calls as possible
+====================
+*/
+void NET_BeginPackets (void)
+{
+    net_queueing = net_batch->value != 0;
+}
+
+/*
+====================
+NET_FlushPackets
+====================
+*/
+void NET_FlushPackets (void)
+{
+    if (net_send.count)
+        NET_SendBatch (&net_send);
+    net_queueing = false;
+}
+
 
 //=============================================================================
 
@@ -429,8 +725,10 @@ void    NET_Config (qboolean multiplayer)
 
     if (!multiplayer)
     {    // shut down any existing sockets
+        NET_FlushPackets ();
         for (i=0 ; i<2 ; i++)
         {
+            net_recv[i].count = net_recv[i].next = 0;
             if (ip_sockets[i])
             {
                 close (ip_sockets[i]);
@@ -453,6 +751,119 @@ void    NET_Config (qboolean multiplayer)
 
 //===================================================================
 
+/*
+====================
+NET_Stats_f
+====================
+*/
+void NET_Stats_f (void)
+{
+    Com_Printf ("%i packets in, %i packets out, %i system calls\n",
+        net_packetsin, net_packetsout, net_syscalls);
+    if (!strcmp (Cmd_Argv(1), "reset"))
+        net_packetsin = net_packetsout = net_syscalls = 0;
+}
+
+/*
+====================
+NET_Bench_f
+
+net_bench [packets]
+
+Blasts datagrams between two loopback sockets, through the one at a
+time and the batched paths, and reports packets per second and system
+calls per 64 packets (a full server's worth of clients a frame)
+====================
+*/
+void NET_Bench_f (void)
+{
+    int                    src, dst;
+    struct sockaddr_in    addr, from;
+    socklen_t            addrlen;
+    static netbatch_t    bench;
+    sizebuf_t            msg;
+    byte                payload[MAX_MSGLEN], buf[MAX_MSGLEN];
+    int                    total, i, n, got, received, pass, calls;
+    double                start, recvtime, sendtime;
+    qboolean            batch;
+
+    total = Cmd_Argc() > 1 ? atoi (Cmd_Argv(1)) : 100000;
+    total = (total + NET_BATCH*2-1) & ~(NET_BATCH*2-1);    // whole bursts
+    if (total < NET_BATCH*2)
+        total = NET_BATCH*2;
+
+    src = NET_Socket ("localhost", PORT_ANY);
+    dst = NET_Socket ("localhost", PORT_ANY);
+    if (!src || !dst)
+    {
+        if (src)
+            close (src);
+        if (dst)
+            close (dst);
+        return;
+    }
+
+    addrlen = sizeof(addr);
+    getsockname (dst, (struct sockaddr *)&addr, &addrlen);
+    addr.sin_addr.s_addr = htonl (LOOPBACK);
+
+    memset (payload, 0x55, sizeof(payload));
+    SZ_Init (&msg, buf, sizeof(buf));
+
+    for (pass=0 ; pass<2 ; pass++)
+    {
+        batch = pass;
+        recvtime = sendtime = 0;
+        calls = net_syscalls;
+        received = 0;
+
+        // a bunch at a time, so the socket buffer doesn't drop any
+        for (n=0 ; n<total ; n+=NET_BATCH*2)
+        {
+            start = Sys_FloatTime ();
+            bench.count = bench.next = 0;
+            for (i=0 ; i<NET_BATCH*2 ; i++)
+            {
+                if (batch)
+                    NET_QueuePacket (src, &addr, payload, 200);
+                else
+                {
+                    sendto (src, payload, 200, 0, (struct sockaddr *)&addr, sizeof(addr));
+                    net_syscalls++;
+                }
+            }
+            if (batch)
+                NET_FlushPackets ();
+            sendtime += Sys_FloatTime () - start;
+
+            start = Sys_FloatTime ();
+            for (got=0 ; got<NET_BATCH*2 ; got++)
+            {
+                if (batch)
+                    i = NET_RecvBatched (&bench, dst, &msg, &from);
+                else
+                {
+                    addrlen = sizeof(from);
+                    i = recvfrom (dst, msg.data, msg.maxsize, 0, (struct sockaddr *)&from, &addrlen);
+                    net_syscalls++;
+                }
+                if (i == -1)
+                    break;        // lost some
+            }
+            recvtime += Sys_FloatTime () - start;
+            received += got;
+        }
+        calls = net_syscalls - calls;
+
+        Com_Printf ("%s: send %.0f packets/s, receive %.0f packets/s, %.1f system calls per %i packets, %i lost\n",
+            batch ? "batched" : "one at a time", total / sendtime, received / recvtime,
+            (float)calls * NET_BATCH / (total + received), NET_BATCH, total - received);
+    }
+
+    close (src);
+    close (dst);
+}
+
 
 /*
 ====================
@@ -461,6 +872,9 @@ NET_Init
 */
 void NET_Init (void)
 {
+    net_batch = Cvar_Get ("net_batch", "1", 0);
+    Cmd_AddCommand ("net_stats", NET_Stats_f);
+    Cmd_AddCommand ("net_bench", NET_Bench_f);
 }
 
 
@@ -553,6 +967,8 @@ void NET_Sleep(int msec)
 
     if (!ip_sockets[NS_SERVER] || (dedicated && !dedicated->value))
         return; // we're not a server, just run full speed
+    if (net_recv[NS_SERVER].next < net_recv[NS_SERVER].count)
+        return; // already read some
 
     FD_ZERO(&fdset);
     if (stdin_active)
@@ -40,7 +40,7 @@ netadr_t    net_local_adr;
 
 #define    LOOPBACK    0x7f000001
 
-#define    MAX_LOOPBACK    4
+#define    MAX_LOOPBACK    32        // a whole fragmented message
 
 #define QUAKE2MCAST "ff12::666"
 #include <net/if.h>
@@ -495,10 +495,16 @@ qboolean    NET_GetPacket (netsrc_t sock, netadr_t *net_from, sizebuf_t *net_mes
     int        net_socket;
     int        protocol;
     int        err;
+    int        maxsize;
 
     if (NET_GetLoopPacket (sock, net_from, net_message))
         return true;
 
+    // net_message has room for a reassembled message, datagrams don't
+    maxsize = net_message->maxsize;
+    if (maxsize > MAX_MSGLEN)
+        maxsize = MAX_MSGLEN;
+
     for (protocol = 0 ; protocol < 3 ; protocol++)
     {
         if (protocol == 0)
@@ -512,7 +518,7 @@ qboolean    NET_GetPacket (netsrc_t sock, netadr_t *net_from, sizebuf_t *net_mes
             continue;
 
         fromlen = sizeof(from);
-        ret = recvfrom (net_socket, net_message->data, net_message->maxsize,
+        ret = recvfrom (net_socket, net_message->data, maxsize,
                                 0, (struct sockaddr *)&from, &fromlen);
 
         SockadrToNetadr (&from, net_from);
@@ -528,7 +534,7 @@ qboolean    NET_GetPacket (netsrc_t sock, netadr_t *net_from, sizebuf_t *net_mes
             continue;
         }
 
-        if (ret == net_message->maxsize)
+        if (ret == maxsize)
         {
             Com_Printf ("Oversize packet from %s\n", NET_AdrToString (*net_from));
             continue;
@@ -658,6 +664,26 @@ void NET_SendPacket (netsrc_t sock, int length, void *data, netadr_t to)
 
 }
 
+/*
+====================
+NET_BeginPackets
+
+Sends are not batched here, every packet goes out as it is sent
+====================
+*/
+void NET_BeginPackets (void)
+{
+}
+
+/*
+====================
+NET_FlushPackets
+====================
+*/
+void NET_FlushPackets (void)
+{
+}
+
 
 
 //=============================================================================
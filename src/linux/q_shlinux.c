@@ -26,6 +26,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <unistd.h>
 #include <sys/mman.h>
 #include <sys/time.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "../linux/glob.h"
 
@@ -150,6 +152,161 @@ int Sys_Milliseconds (void)
     return curtime;
 }
 
+/*
+================
+Sys_FloatTime
+
+Seconds since the first call, for timing things that take well
+under a millisecond
+================
+*/
+double Sys_FloatTime (void)
+{
+    struct timespec    ts;
+    static time_t    secbase;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    if (!secbase)
+        secbase = ts.tv_sec;
+
+    return (ts.tv_sec - secbase) + ts.tv_nsec * 0.000000001;
+}
+
+//===============================================================================
+
+/*
+================
+Sys_NumProcessors
+================
+*/
+int Sys_NumProcessors (void)
+{
+    long    n;
+
+    n = sysconf (_SC_NPROCESSORS_ONLN);
+    if (n < 1)
+        return 1;
+    return n;
+}
+
+/*
+================
+Sys_RunJobs
+
+A lazily started pool of worker threads.  The calling thread works on
+the jobs too, and doesn't return until every job has finished.
+
+The job globals are only written while no worker can be reading them:
+a call doesn't return until every worker it woke has joined the batch
+and left it again, so none is still around when the next one starts.
+================
+*/
+#define MAX_JOB_THREADS    32
+
+static pthread_t        job_threads[MAX_JOB_THREADS];
+static int                job_numthreads;            // started workers, not counting the caller
+static pthread_mutex_t    job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t    job_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t    job_done = PTHREAD_COND_INITIALIZER;
+
+static void        (*job_func) (int job, void *data);
+static void        *job_data;
+static int        job_count;
+static int        job_next;                // next job to hand out
+static int        job_active;                // workers allowed on this batch
+static int        job_batch;                // bumped for every Sys_RunJobs call
+static int        job_joined;                // workers that have taken this batch
+static int        job_busy;                // workers still inside Sys_DoJobs
+
+static void Sys_DoJobs (void)
+{
+    int        job;
+
+    while (1)
+    {
+        job = __sync_fetch_and_add (&job_next, 1);
+        if (job >= job_count)
+            return;
+        job_func (job, job_data);
+    }
+}
+
+static void *Sys_JobThread (void *arg)
+{
+    int        index = (int)(size_t)arg;
+    int        batch = 0;
+
+    pthread_mutex_lock (&job_lock);
+    while (1)
+    {
+        while (batch == job_batch)
+            pthread_cond_wait (&job_wake, &job_lock);
+        batch = job_batch;
+        if (index >= job_active)
+            continue;        // not needed for this one
+        job_joined++;
+        job_busy++;
+        pthread_mutex_unlock (&job_lock);
+        Sys_DoJobs ();
+        pthread_mutex_lock (&job_lock);
+        if (!--job_busy)
+            pthread_cond_signal (&job_done);
+    }
+    return NULL;
+}
+
+void Sys_RunJobs (void (*func) (int job, void *data), int numjobs, void *data, int numthreads)
+{
+    if (numjobs <= 0)
+        return;
+
+    if (numthreads > MAX_JOB_THREADS+1)
+        numthreads = MAX_JOB_THREADS+1;
+    if (numthreads > numjobs)
+        numthreads = numjobs;
+
+    if (numthreads <= 1)
+    {    // nothing to hand out
+        int        i;
+
+        for (i=0 ; i<numjobs ; i++)
+            func (i, data);
+        return;
+    }
+
+    pthread_mutex_lock (&job_lock);
+    while (job_numthreads < numthreads-1)
+    {
+        if (pthread_create (&job_threads[job_numthreads], NULL,
+            Sys_JobThread, (void *)(size_t)job_numthreads))
+            break;
+        job_numthreads++;
+    }
+
+    job_func = func;
+    job_data = data;
+    job_count = numjobs;
+    job_next = 0;
+    job_active = numthreads-1;
+    if (job_active > job_numthreads)
+        job_active = job_numthreads;
+    job_joined = 0;
+    job_batch++;
+    pthread_cond_broadcast (&job_wake);
+    pthread_mutex_unlock (&job_lock);
+
+    Sys_DoJobs ();
+
+    // every job has been handed out, so once every worker woken for
+    // them has been through Sys_DoJobs they have all finished
+    pthread_mutex_lock (&job_lock);
+    while (job_busy || job_joined < job_active)
+        pthread_cond_wait (&job_done, &job_lock);
+    pthread_mutex_unlock (&job_lock);
+}
+
+//===============================================================================
+
 void Sys_Mkdir (char *path)
 {
     mkdir (path, 0777);
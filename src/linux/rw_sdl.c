@@ -22,6 +22,13 @@
 
 #include <SDL2/SDL.h>
 
+#if !defined(OPENGL) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SWIMP_AVX2 1
+#else
+#define SWIMP_AVX2 0
+#endif
+
 #ifdef OPENGL
 #include <GL/gl.h>
 #endif
@@ -54,6 +61,21 @@ static SDL_GLContext glcontext;
 
 #ifndef OPENGL
 static unsigned int sdl_palettemode;
+
+/*
+ * The 8-bit backbuffer is expanded straight into the locked streaming
+ * texture through sdl_palette, which holds each index already mapped to
+ * the texture's 32-bit format. It is rebuilt in SWimp_SetPalette.
+ */
+static SDL_PixelFormat *sdl_format;
+static Uint32 sdl_palette[256];
+static void (*SWimp_Expand) (const byte *src, Uint32 *dst, int count);
+
+/*
+ * With sw_truecolor the world is drawn into vid.buffer32 instead, and
+ * every TRUECOLOR_HOLE in the 8-bit backbuffer shows it through.
+ */
+static void (*SWimp_Compose) (const byte *src, const Uint32 *src32, Uint32 *dst, int count);
 #endif
 
 struct
@@ -507,6 +529,111 @@ static void SetSDLIcon()
 #endif
 }
 
+#ifndef OPENGL
+/*
+** SWimp_Expand8to32
+**
+** Expands count palette indices into 32-bit texels through sdl_palette.
+*/
+static void SWimp_Expand8to32 (const byte *src, Uint32 *dst, int count)
+{
+    const Uint32 *pal = sdl_palette;
+
+    for ( ; count >= 4; count -= 4, src += 4, dst += 4)
+    {
+        dst[0] = pal[src[0]];
+        dst[1] = pal[src[1]];
+        dst[2] = pal[src[2]];
+        dst[3] = pal[src[3]];
+    }
+    while (count--)
+        *dst++ = pal[*src++];
+}
+
+#if SWIMP_AVX2
+/*
+** SWimp_Expand8to32AVX2
+**
+** Same as SWimp_Expand8to32, sixteen pixels at a time: the indices are
+** widened to dwords and looked up with two gathers.
+*/
+__attribute__((target("avx2")))
+static void SWimp_Expand8to32AVX2 (const byte *src, Uint32 *dst, int count)
+{
+    const int *pal = (const int *)sdl_palette;
+    __m128i    in;
+    __m256i    lo, hi;
+
+    for ( ; count >= 16; count -= 16, src += 16, dst += 16)
+    {
+        in = _mm_loadu_si128 ((const __m128i *)src);
+        lo = _mm256_cvtepu8_epi32 (in);
+        hi = _mm256_cvtepu8_epi32 (_mm_srli_si128 (in, 8));
+        _mm256_storeu_si256 ((__m256i *)dst, _mm256_i32gather_epi32 (pal, lo, 4));
+        _mm256_storeu_si256 ((__m256i *)(dst + 8), _mm256_i32gather_epi32 (pal, hi, 4));
+    }
+    SWimp_Expand8to32 (src, dst, count);
+}
+#endif
+
+/*
+** SWimp_Compose8and32
+**
+** SWimp_Expand8to32 for truecolor, taking the world layer pixel wherever
+** the backbuffer has a hole.
+*/
+static void SWimp_Compose8and32 (const byte *src, const Uint32 *src32, Uint32 *dst, int count)
+{
+    const Uint32 *pal = sdl_palette;
+
+    while (count--)
+    {
+        *dst++ = *src == TRUECOLOR_HOLE ? *src32 | 0xff000000 : pal[*src];
+        src++;
+        src32++;
+    }
+}
+
+#if SWIMP_AVX2
+/*
+** SWimp_Compose8and32AVX2
+*/
+__attribute__((target("avx2")))
+static void SWimp_Compose8and32AVX2 (const byte *src, const Uint32 *src32, Uint32 *dst, int count)
+{
+    const int *pal = (const int *)sdl_palette;
+    __m256i    idx, hole, alpha, pix;
+
+    hole = _mm256_set1_epi32 (TRUECOLOR_HOLE);
+    alpha = _mm256_set1_epi32 (0xff000000);
+
+    for ( ; count >= 8; count -= 8, src += 8, src32 += 8, dst += 8)
+    {
+        idx = _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i *)src));
+        pix = _mm256_or_si256 (_mm256_loadu_si256 ((const __m256i *)src32), alpha);
+        pix = _mm256_blendv_epi8 (_mm256_i32gather_epi32 (pal, idx, 4), pix,
+                                  _mm256_cmpeq_epi32 (idx, hole));
+        _mm256_storeu_si256 ((__m256i *)dst, pix);
+    }
+    SWimp_Compose8and32 (src, src32, dst, count);
+}
+#endif
+
+static void SWimp_InitExpand (void)
+{
+    SWimp_Expand = SWimp_Expand8to32;
+    SWimp_Compose = SWimp_Compose8and32;
+#if SWIMP_AVX2
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx2"))
+    {
+        SWimp_Expand = SWimp_Expand8to32AVX2;
+        SWimp_Compose = SWimp_Compose8and32AVX2;
+    }
+#endif
+}
+#endif
+
 /*
 ** SWimp_InitGraphics
 **
@@ -520,7 +647,7 @@ static void SetSDLIcon()
 #ifndef OPENGL
 static qboolean SWimp_InitGraphics( qboolean fullscreen )
 {
-    Uint32 flags;
+    Uint32 flags, format;
     int w, h;
 
     /* Just toggle fullscreen if that's all that has been changed */
@@ -570,13 +697,26 @@ static qboolean SWimp_InitGraphics( qboolean fullscreen )
     SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
     SDL_RenderSetLogicalSize(renderer, vid.width, vid.height);
 
-    texture = SDL_CreateTexture (renderer, SDL_GetWindowPixelFormat (window),
+    format = SDL_GetWindowPixelFormat (window);
+    if (SDL_BYTESPERPIXEL (format) != 4 || SDL_ISPIXELFORMAT_INDEXED (format) ||
+        SDL_ISPIXELFORMAT_FOURCC (format) || r_truecolor)
+        format = SDL_PIXELFORMAT_ARGB8888;    // vid.buffer32 is xRGB
+
+    texture = SDL_CreateTexture (renderer, format,
                                  SDL_TEXTUREACCESS_STREAMING, vid.width, vid.height);
     if (texture == NULL) {
         Sys_Error("(SOFTSDL) SDL CreateTexture failed: %s\n", SDL_GetError());
         return false;
     }
 
+    if (sdl_format != NULL) SDL_FreeFormat (sdl_format);
+    sdl_format = SDL_AllocFormat (format);
+    if (sdl_format == NULL) {
+        Sys_Error("(SOFTSDL) SDL AllocFormat failed: %s\n", SDL_GetError());
+        return false;
+    }
+    SWimp_InitExpand ();
+
     surface = SDL_CreateRGBSurface (0, vid.width, vid.height, 8, 0, 0, 0, 0);
     if (surface == NULL) {
         Sys_Error("(SOFTSDL) SDL CreateRGBSurface failed: %s\n", SDL_GetError());
@@ -586,6 +726,17 @@ static qboolean SWimp_InitGraphics( qboolean fullscreen )
     vid.rowbytes = surface->pitch;
     vid.buffer = surface->pixels;
 
+    free (vid.buffer32);
+    vid.buffer32 = NULL;
+    if (r_truecolor)
+    {
+        vid.buffer32 = calloc (vid.rowbytes * vid.height, sizeof(*vid.buffer32));
+        if (vid.buffer32 == NULL) {
+            Sys_Error("(SOFTSDL) couldn't allocate the truecolor buffer\n");
+            return false;
+        }
+    }
+
     X11_active = true;
 
     
@@ -689,16 +840,34 @@ void GLimp_BeginFrame( float camera_seperation )
 #ifndef OPENGL
 void SWimp_EndFrame (void)
 {
+    Uint64 start;
+    byte *src, *dst;
+    unsigned *src32;
+    int pitch, y;
+
+    start = SDL_GetPerformanceCounter ();
+
     /*
-     * We need to convert surface to native pixel format, because
-     * textures cannot be with palette.
+     * Textures cannot be paletted, so expand the backbuffer into the
+     * streaming texture ourselves.
      */
-    SDL_Surface *tmp = SDL_ConvertSurfaceFormat (surface, SDL_GetWindowPixelFormat (window), 0);
+    if (SDL_LockTexture (texture, NULL, (void **)&dst, &pitch) == 0) {
+        src = surface->pixels;
+        src32 = vid.buffer32;
+        if (src32)
+            for (y = 0; y < vid.height; y++, src += surface->pitch, src32 += vid.rowbytes, dst += pitch)
+                SWimp_Compose (src, src32, (Uint32 *)dst, vid.width);
+        else
+            for (y = 0; y < vid.height; y++, src += surface->pitch, dst += pitch)
+                SWimp_Expand (src, (Uint32 *)dst, vid.width);
+        SDL_UnlockTexture (texture);
+    }
+
     SDL_RenderClear (renderer);
-    SDL_UpdateTexture (texture, NULL, tmp->pixels, tmp->pitch);
     SDL_RenderCopy (renderer, texture, NULL, NULL);
     SDL_RenderPresent (renderer);
-    SDL_FreeSurface (tmp);
+
+    sw_presenttime = (SDL_GetPerformanceCounter () - start) * 1000.0 / SDL_GetPerformanceFrequency ();
 }
 #else
 void GLimp_EndFrame (void)
@@ -766,8 +935,6 @@ int GLimp_SetMode( int *pwidth, int *pheight, int mode, qboolean fullscreen )
 #ifndef OPENGL
 void SWimp_SetPalette( const unsigned char *palette )
 {
-    SDL_Color colors[256];
-    
     int i;
 
     if (!X11_active)
@@ -776,15 +943,9 @@ void SWimp_SetPalette( const unsigned char *palette )
     if ( !palette )
             palette = ( const unsigned char * ) sw_state.currentpalette;
  
-    for (i = 0; i < 256; i++) {
-        colors[i].r = palette[i*4+0];
-        colors[i].g = palette[i*4+1];
-        colors[i].b = palette[i*4+2];
-        colors[i].a = 255; // Opaque
-    }
-
-    assert (surface->format->palette != NULL && surface->format->palette->ncolors >= 256);
-    SDL_SetPaletteColors (surface->format->palette, colors, 0, 256);
+    for (i = 0; i < 256; i++)
+        sdl_palette[i] = SDL_MapRGBA (sdl_format, palette[i*4+0], palette[i*4+1],
+                                      palette[i*4+2], 255);
 }
 #endif
 
@@ -802,6 +963,12 @@ void SWimp_Shutdown( void )
     if (texture != NULL) SDL_DestroyTexture (texture);
     if (glcontext != NULL) SDL_GL_DeleteContext (glcontext);
     if (window != NULL) SDL_DestroyWindow (window);
+#ifndef OPENGL
+    if (sdl_format != NULL) SDL_FreeFormat (sdl_format);
+    sdl_format = NULL;
+    free (vid.buffer32);
+    vid.buffer32 = NULL;
+#endif
 
     texture = NULL;
     renderer = NULL;
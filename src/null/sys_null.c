@@ -108,6 +108,11 @@ int        Sys_Milliseconds (void)
     return 0;
 }
 
+double    Sys_FloatTime (void)
+{
+    return 0;
+}
+
 void    Sys_Mkdir (char *path)
 {
 }
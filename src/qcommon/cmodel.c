@@ -21,6 +21,13 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "qcommon.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define    CM_SIMD    1
+#else
+#define    CM_SIMD    0
+#endif
+
 typedef struct
 {
     cplane_t    *plane;
@@ -65,6 +72,12 @@ char        map_name[MAX_QPATH];
 int            numbrushsides;
 cbrushside_t map_brushsides[MAX_MAP_BRUSHSIDES];
 
+// struct-of-arrays copy of the brushside planes for CM_BrushSideDists,
+// padded so four sides can always be loaded at once
+#define    SIDE_PAD    4
+float        side_normal[3][MAX_MAP_BRUSHSIDES+SIDE_PAD] __attribute__((aligned(16)));
+float        side_dist[MAX_MAP_BRUSHSIDES+SIDE_PAD] __attribute__((aligned(16)));
+
 int            numtexinfo;
 mapsurface_t    map_surfaces[MAX_MAP_TEXINFO];
 
@@ -110,13 +123,21 @@ qboolean    portalopen[MAX_MAP_AREAPORTALS];
 
 
 cvar_t        *map_noareas;
+cvar_t        *cm_tracecache;
+cvar_t        *cm_simd;
+cvar_t        *cm_vismatrix;
+cvar_t        *cm_vismatrix_max;
 
 void    CM_InitBoxHull (void);
 void    FloodAreaConnections (void);
+void    CM_BuildVisMatrix (void);
+void    CM_FreeVisMatrix (void);
 
 
 int        c_pointcontents;
 int        c_traces, c_brush_traces;
+int        c_trace_hits, c_trace_misses;    // CM_BoxTrace cache
+int        c_trace_batched;                // rays traced by CM_BoxTraceMany
 
 
 /*
@@ -400,6 +421,24 @@ void CMod_LoadLeafBrushes (lump_t *l)
         *out = LittleShort (*in);
 }
 
+/*
+=================
+CM_SetSidePlane
+
+Copies a brushside's plane into the side_normal / side_dist arrays
+=================
+*/
+void CM_SetSidePlane (int sidenum)
+{
+    cplane_t    *plane;
+
+    plane = map_brushsides[sidenum].plane;
+    side_normal[0][sidenum] = plane->normal[0];
+    side_normal[1][sidenum] = plane->normal[1];
+    side_normal[2][sidenum] = plane->normal[2];
+    side_dist[sidenum] = plane->dist;
+}
+
 /*
 =================
 CMod_LoadBrushSides
@@ -433,6 +472,7 @@ void CMod_LoadBrushSides (lump_t *l)
         if (j >= numtexinfo)
             Com_Error (ERR_DROP, "Bad brushside texinfo");
         out->surface = &map_surfaces[j];
+        CM_SetSidePlane (i);
     }
 }
 
@@ -554,6 +594,10 @@ cmodel_t *CM_LoadMap (char *name, qboolean clientload, unsigned *checksum)
     static unsigned    last_checksum;
 
     map_noareas = Cvar_Get ("map_noareas", "0", 0);
+    cm_tracecache = Cvar_Get ("cm_tracecache", "1", 0);
+    cm_simd = Cvar_Get ("cm_simd", "1", 0);
+    cm_vismatrix = Cvar_Get ("cm_vismatrix", "1", CVAR_LATCH);
+    cm_vismatrix_max = Cvar_Get ("cm_vismatrix_max", "32768", CVAR_LATCH);    // kilobytes
 
     if (  !strcmp (map_name, name) && (clientload || !Cvar_VariableValue ("flushmap")) )
     {
@@ -567,6 +611,8 @@ cmodel_t *CM_LoadMap (char *name, qboolean clientload, unsigned *checksum)
     }
 
     // free old stuff
+    CM_ClearTraceCache ();
+    CM_FreeVisMatrix ();
     numplanes = 0;
     numnodes = 0;
     numleafs = 0;
@@ -626,6 +672,8 @@ cmodel_t *CM_LoadMap (char *name, qboolean clientload, unsigned *checksum)
     memset (portalopen, 0, sizeof(portalopen));
     FloodAreaConnections ();
 
+    CM_BuildVisMatrix ();
+
     strcpy (map_name, name);
 
     return &map_cmodels[0];
@@ -761,6 +809,9 @@ void CM_InitBoxHull (void)
         VectorClear (p->normal);
         p->normal[i>>1] = -1;
     }    
+
+    for (i=0 ; i<6 ; i++)
+        CM_SetSidePlane (numbrushsides+i);
 }
 
 
@@ -787,6 +838,13 @@ int    CM_HeadnodeForBox (vec3_t mins, vec3_t maxs)
     box_planes[10].dist = mins[2];
     box_planes[11].dist = -mins[2];
 
+    side_dist[box_brush->firstbrushside+0] = box_planes[0].dist;
+    side_dist[box_brush->firstbrushside+1] = box_planes[3].dist;
+    side_dist[box_brush->firstbrushside+2] = box_planes[4].dist;
+    side_dist[box_brush->firstbrushside+3] = box_planes[7].dist;
+    side_dist[box_brush->firstbrushside+4] = box_planes[8].dist;
+    side_dist[box_brush->firstbrushside+5] = box_planes[11].dist;
+
     return box_headnode;
 }
 
@@ -981,6 +1039,115 @@ trace_t    trace_trace;
 int        trace_contents;
 qboolean    trace_ispoint;        // optimized case
 
+/*
+================
+CM_SideDists
+
+Finds how far p1 and p2 (if not NULL) are in front of four consecutive
+brushsides starting at firstside, with each plane pushed out for the
+mins/maxs box.  The SSE2 version does the same float operations in the
+same order as the scalar one, so the results are bit identical.
+================
+*/
+void CM_SideDists_Scalar (int firstside, int count, vec3_t mins, vec3_t maxs,
+                      vec3_t p1, vec3_t p2, float *d1, float *d2)
+{
+    int            i, j;
+    cplane_t    *plane;
+    float        dist;
+    vec3_t        ofs;
+
+    if (count > 4)
+        count = 4;
+
+    for (i=0 ; i<count ; i++)
+    {
+        plane = map_brushsides[firstside+i].plane;
+
+        if (!trace_ispoint)
+        {    // general box case
+
+            // push the plane out apropriately for mins/maxs
+            for (j=0 ; j<3 ; j++)
+            {
+                if (plane->normal[j] < 0)
+                    ofs[j] = maxs[j];
+                else
+                    ofs[j] = mins[j];
+            }
+            dist = DotProduct (ofs, plane->normal);
+            dist = plane->dist - dist;
+        }
+        else
+        {    // special point case
+            dist = plane->dist;
+        }
+
+        d1[i] = DotProduct (p1, plane->normal) - dist;
+        if (p2)
+            d2[i] = DotProduct (p2, plane->normal) - dist;
+    }
+}
+
+#if CM_SIMD
+void CM_SideDists_SSE2 (int firstside, int count, vec3_t mins, vec3_t maxs,
+                      vec3_t p1, vec3_t p2, float *d1, float *d2)
+{
+    __m128    nx, ny, nz, dist;
+    __m128    zero, neg;
+    __m128    ox, oy, oz;
+    __m128    d;
+
+    nx = _mm_loadu_ps (&side_normal[0][firstside]);
+    ny = _mm_loadu_ps (&side_normal[1][firstside]);
+    nz = _mm_loadu_ps (&side_normal[2][firstside]);
+    dist = _mm_loadu_ps (&side_dist[firstside]);
+
+    if (!trace_ispoint)
+    {
+        // pick maxs for negative normal components, mins for the rest
+        zero = _mm_setzero_ps ();
+        neg = _mm_cmplt_ps (nx, zero);
+        ox = _mm_or_ps (_mm_and_ps (neg, _mm_set1_ps (maxs[0])), _mm_andnot_ps (neg, _mm_set1_ps (mins[0])));
+        neg = _mm_cmplt_ps (ny, zero);
+        oy = _mm_or_ps (_mm_and_ps (neg, _mm_set1_ps (maxs[1])), _mm_andnot_ps (neg, _mm_set1_ps (mins[1])));
+        neg = _mm_cmplt_ps (nz, zero);
+        oz = _mm_or_ps (_mm_and_ps (neg, _mm_set1_ps (maxs[2])), _mm_andnot_ps (neg, _mm_set1_ps (mins[2])));
+
+        d = _mm_mul_ps (ox, nx);
+        d = _mm_add_ps (d, _mm_mul_ps (oy, ny));
+        d = _mm_add_ps (d, _mm_mul_ps (oz, nz));
+        dist = _mm_sub_ps (dist, d);
+    }
+
+    d = _mm_mul_ps (_mm_set1_ps (p1[0]), nx);
+    d = _mm_add_ps (d, _mm_mul_ps (_mm_set1_ps (p1[1]), ny));
+    d = _mm_add_ps (d, _mm_mul_ps (_mm_set1_ps (p1[2]), nz));
+    _mm_storeu_ps (d1, _mm_sub_ps (d, dist));
+
+    if (p2)
+    {
+        d = _mm_mul_ps (_mm_set1_ps (p2[0]), nx);
+        d = _mm_add_ps (d, _mm_mul_ps (_mm_set1_ps (p2[1]), ny));
+        d = _mm_add_ps (d, _mm_mul_ps (_mm_set1_ps (p2[2]), nz));
+        _mm_storeu_ps (d2, _mm_sub_ps (d, dist));
+    }
+}
+#endif
+
+static void CM_SideDists (int firstside, int count, vec3_t mins, vec3_t maxs,
+                      vec3_t p1, vec3_t p2, float *d1, float *d2)
+{
+#if CM_SIMD
+    if (!cm_simd || cm_simd->value)
+    {    // always does four, the side arrays are padded for it
+        CM_SideDists_SSE2 (firstside, count, mins, maxs, p1, p2, d1, d2);
+        return;
+    }
+#endif
+    CM_SideDists_Scalar (firstside, count, mins, maxs, p1, p2, d1, d2);
+}
+
 /*
 ================
 CM_ClipBoxToBrush
@@ -989,12 +1156,11 @@ CM_ClipBoxToBrush
 void CM_ClipBoxToBrush (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
                       trace_t *trace, cbrush_t *brush)
 {
-    int            i, j;
+    int            i;
     cplane_t    *plane, *clipplane;
-    float        dist;
     float        enterfrac, leavefrac;
-    vec3_t        ofs;
     float        d1, d2;
+    float        dists1[4], dists2[4];
     qboolean    getout, startout;
     float        f;
     cbrushside_t    *side, *leadside;
@@ -1019,29 +1185,11 @@ void CM_ClipBoxToBrush (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
 
         // FIXME: special case for axial
 
-        if (!trace_ispoint)
-        {    // general box case
-
-            // push the plane out apropriately for mins/maxs
-
-            // FIXME: use signbits into 8 way lookup for each mins/maxs
-            for (j=0 ; j<3 ; j++)
-            {
-                if (plane->normal[j] < 0)
-                    ofs[j] = maxs[j];
-                else
-                    ofs[j] = mins[j];
-            }
-            dist = DotProduct (ofs, plane->normal);
-            dist = plane->dist - dist;
-        }
-        else
-        {    // special point case
-            dist = plane->dist;
-        }
-
-        d1 = DotProduct (p1, plane->normal) - dist;
-        d2 = DotProduct (p2, plane->normal) - dist;
+        // four sides at a time
+        if (!(i&3))
+            CM_SideDists (brush->firstbrushside+i, brush->numsides-i, mins, maxs, p1, p2, dists1, dists2);
+        d1 = dists1[i&3];
+        d2 = dists2[i&3];
 
         if (d2 > 0)
             getout = true;    // endpoint is not in solid
@@ -1103,45 +1251,30 @@ CM_TestBoxInBrush
 void CM_TestBoxInBrush (vec3_t mins, vec3_t maxs, vec3_t p1,
                       trace_t *trace, cbrush_t *brush)
 {
-    int            i, j;
-    cplane_t    *plane;
-    float        dist;
-    vec3_t        ofs;
-    float        d1;
-    cbrushside_t    *side;
+    int            i;
+    float        dists1[4];
+    qboolean    ispoint;
 
     if (!brush->numsides)
         return;
 
+    // always the general box case
+    ispoint = trace_ispoint;
+    trace_ispoint = false;
+
     for (i=0 ; i<brush->numsides ; i++)
     {
-        side = &map_brushsides[brush->firstbrushside+i];
-        plane = side->plane;
-
-        // FIXME: special case for axial
-
-        // general box case
-
-        // push the plane out apropriately for mins/maxs
-
-        // FIXME: use signbits into 8 way lookup for each mins/maxs
-        for (j=0 ; j<3 ; j++)
-        {
-            if (plane->normal[j] < 0)
-                ofs[j] = maxs[j];
-            else
-                ofs[j] = mins[j];
-        }
-        dist = DotProduct (ofs, plane->normal);
-        dist = plane->dist - dist;
-
-        d1 = DotProduct (p1, plane->normal) - dist;
+        if (!(i&3))
+            CM_SideDists (brush->firstbrushside+i, brush->numsides-i, mins, maxs, p1, NULL, dists1, NULL);
 
         // if completely in front of face, no intersection
-        if (d1 > 0)
+        if (dists1[i&3] > 0)
+        {
+            trace_ispoint = ispoint;
             return;
-
+        }
     }
+    trace_ispoint = ispoint;
 
     // inside this brush
     trace->startsolid = trace->allsolid = true;
@@ -1340,6 +1473,68 @@ return;
 
 
 
+//======================================================================
+
+/*
+===============================================================================
+
+TRACE CACHE
+
+The world and inline models never change shape, so a trace with the
+same arguments always gets the same result.  Game code repeats a lot of
+traces within a frame, so remember the recent ones.  The temporary box
+hull is rebuilt for every entity and is never cached.
+
+===============================================================================
+*/
+
+#define    TRACE_CACHE_SIZE    1024        // must be a power of two
+
+typedef struct
+{
+    int        generation;            // valid if == tracecache_generation
+    vec3_t    start, end;
+    vec3_t    mins, maxs;
+    int        headnode;
+    int        brushmask;
+    trace_t    trace;
+} tracecache_t;
+
+tracecache_t    tracecache[TRACE_CACHE_SIZE];
+int                tracecache_generation = 1;
+
+/*
+==================
+CM_ClearTraceCache
+
+Called every server frame and on map changes
+==================
+*/
+void CM_ClearTraceCache (void)
+{
+    tracecache_generation++;
+}
+
+static tracecache_t *CM_TraceCacheSlot (vec3_t start, vec3_t end,
+                          vec3_t mins, vec3_t maxs,
+                          int headnode, int brushmask)
+{
+    unsigned    hash;
+    unsigned    *v;
+    int            i;
+
+    hash = headnode * 31 + brushmask;
+    for (i=0, v = (unsigned *)start ; i<3 ; i++)
+        hash = hash * 33 + v[i];
+    for (i=0, v = (unsigned *)end ; i<3 ; i++)
+        hash = hash * 33 + v[i];
+    for (i=0, v = (unsigned *)maxs ; i<3 ; i++)
+        hash = hash * 33 + v[i];
+    hash ^= hash >> 15;
+
+    return &tracecache[hash & (TRACE_CACHE_SIZE-1)];
+}
+
 //======================================================================
 
 /*
@@ -1347,16 +1542,65 @@ return;
 CM_BoxTrace
 ==================
 */
+trace_t        CM_BoxTraceUncached (vec3_t start, vec3_t end,
+                          vec3_t mins, vec3_t maxs,
+                          int headnode, int brushmask);
+
+trace_t        CM_BoxTraceCached (vec3_t start, vec3_t end,
+                          vec3_t mins, vec3_t maxs,
+                          int headnode, int brushmask)
+{
+    tracecache_t    *tc;
+
+    c_traces++;            // for statistics, may be zeroed
+
+    if (!cm_tracecache || !cm_tracecache->value || headnode == box_headnode)
+        return CM_BoxTraceUncached (start, end, mins, maxs, headnode, brushmask);
+
+    tc = CM_TraceCacheSlot (start, end, mins, maxs, headnode, brushmask);
+    if (tc->generation == tracecache_generation
+        && tc->headnode == headnode && tc->brushmask == brushmask
+        && VectorCompare (tc->start, start) && VectorCompare (tc->end, end)
+        && VectorCompare (tc->mins, mins) && VectorCompare (tc->maxs, maxs))
+    {
+        c_trace_hits++;
+        return tc->trace;
+    }
+
+    c_trace_misses++;
+    tc->trace = CM_BoxTraceUncached (start, end, mins, maxs, headnode, brushmask);
+    tc->generation = tracecache_generation;
+    tc->headnode = headnode;
+    tc->brushmask = brushmask;
+    VectorCopy (start, tc->start);
+    VectorCopy (end, tc->end);
+    VectorCopy (mins, tc->mins);
+    VectorCopy (maxs, tc->maxs);
+
+    return tc->trace;
+}
+
 trace_t        CM_BoxTrace (vec3_t start, vec3_t end,
                           vec3_t mins, vec3_t maxs,
                           int headnode, int brushmask)
+{
+    trace_t        trace;
+
+    Prof_Begin (PROF_BOXTRACE);
+    trace = CM_BoxTraceCached (start, end, mins, maxs, headnode, brushmask);
+    Prof_End (PROF_BOXTRACE);
+
+    return trace;
+}
+
+trace_t        CM_BoxTraceUncached (vec3_t start, vec3_t end,
+                          vec3_t mins, vec3_t maxs,
+                          int headnode, int brushmask)
 {
     int        i;
 
     checkcount++;        // for multi-check avoidance
 
-    c_traces++;            // for statistics, may be zeroed
-
     // fill in a default trace
     memset (&trace_trace, 0, sizeof(trace_trace));
     trace_trace.fraction = 1;
@@ -1435,6 +1679,121 @@ trace_t        CM_BoxTrace (vec3_t start, vec3_t end,
 }
 
 
+/*
+==================
+CM_BoxTraceMany
+
+Traces a box from one start point to each of numtraces end points.
+The BSP is only walked once, for the bounds of all the moves, and each
+move is then clipped against the brushes found there.  This gives the
+same fraction as a CM_BoxTrace of each move, but when two brushes are
+hit at exactly the same fraction either one may be reported.
+The game reaches it through gi.tracemany for shotgun pellets.
+==================
+*/
+#define    MAX_BATCH_LEAFS        1024
+#define    MAX_BATCH_BRUSHES    1024
+
+void        CM_BoxTraceMany (vec3_t start, vec3_t *ends, int numtraces,
+                          vec3_t mins, vec3_t maxs,
+                          int headnode, int brushmask, trace_t *traces)
+{
+    int            leafs[MAX_BATCH_LEAFS];
+    cbrush_t    *brushes[MAX_BATCH_BRUSHES];
+    int            numleafs, numbrushes;
+    int            i, j, k;
+    int            topnode;
+    vec3_t        bmins, bmaxs;
+    cleaf_t        *leaf;
+    cbrush_t    *b;
+    trace_t        *tr;
+
+    if (numtraces <= 0)
+        return;
+
+    // the bounds of every move, pushed out like SV_TraceBounds
+    VectorCopy (start, bmins);
+    VectorCopy (start, bmaxs);
+    for (i=0 ; i<numtraces ; i++)
+        AddPointToBounds (ends[i], bmins, bmaxs);
+    for (i=0 ; i<3 ; i++)
+    {
+        bmins[i] += mins[i] - 1;
+        bmaxs[i] += maxs[i] + 1;
+    }
+
+    numbrushes = 0;
+    numleafs = 0;
+    if (numnodes)
+        numleafs = CM_BoxLeafnums_headnode (bmins, bmaxs, leafs, MAX_BATCH_LEAFS, headnode, &topnode);
+
+    checkcount++;
+    for (i=0 ; i<numleafs && numbrushes < MAX_BATCH_BRUSHES ; i++)
+    {
+        leaf = &map_leafs[leafs[i]];
+        if ( !(leaf->contents & brushmask))
+            continue;
+        for (k=0 ; k<leaf->numleafbrushes ; k++)
+        {
+            b = &map_brushes[map_leafbrushes[leaf->firstleafbrush+k]];
+            if (b->checkcount == checkcount)
+                continue;    // already have this brush from another leaf
+            b->checkcount = checkcount;
+            if ( !(b->contents & brushmask))
+                continue;
+            if (numbrushes == MAX_BATCH_BRUSHES)
+                break;
+            brushes[numbrushes++] = b;
+        }
+    }
+
+    if (numleafs == MAX_BATCH_LEAFS || numbrushes == MAX_BATCH_BRUSHES)
+    {    // too spread out to batch, may have missed something
+        for (i=0 ; i<numtraces ; i++)
+            traces[i] = CM_BoxTrace (start, ends[i], mins, maxs, headnode, brushmask);
+        return;
+    }
+
+    for (i=0 ; i<numtraces ; i++)
+    {
+        tr = &traces[i];
+
+        if (VectorCompare (start, ends[i]))
+        {    // position tests go through the leafs around the point
+            *tr = CM_BoxTrace (start, ends[i], mins, maxs, headnode, brushmask);
+            continue;
+        }
+
+        c_traces++;
+        c_trace_batched++;
+
+        trace_ispoint = (mins[0] == 0 && mins[1] == 0 && mins[2] == 0
+            && maxs[0] == 0 && maxs[1] == 0 && maxs[2] == 0);
+
+        memset (tr, 0, sizeof(*tr));
+        tr->fraction = 1;
+        tr->surface = &(nullsurface.c);
+
+        for (j=0 ; j<numbrushes ; j++)
+        {
+            CM_ClipBoxToBrush (mins, maxs, start, ends[i], tr, brushes[j]);
+            if (!tr->fraction)
+                break;
+        }
+
+        if (tr->fraction == 1)
+        {
+            VectorCopy (ends[i], tr->endpos);
+        }
+        else
+        {
+            for (k=0 ; k<3 ; k++)
+                tr->endpos[k] = start[k] + tr->fraction * (ends[i][k] - start[k]);
+        }
+    }
+}
+
+
 /*
 ==================
 CM_TransformedBoxTrace
@@ -1513,6 +1872,110 @@ trace_t        CM_TransformedBoxTrace (vec3_t start, vec3_t end,
 #endif
 
 
+/*
+==================
+CM_ClipTest_f
+
+Traces a repeatable set of random boxes and points through the loaded
+map with both the scalar and the SSE2 brush clipping, and reports any
+trace that doesn't come out exactly the same.
+==================
+*/
+static unsigned    cliptest_seed;
+
+static float CM_ClipTestRandom (float lo, float hi)
+{
+    cliptest_seed = cliptest_seed * 1103515245 + 12345;
+    return lo + (hi - lo) * ((cliptest_seed >> 8) & 0xffff) / 65535.0f;
+}
+
+static qboolean CM_SameTrace (trace_t *a, trace_t *b)
+{
+    return a->allsolid == b->allsolid
+        && a->startsolid == b->startsolid
+        && !memcmp (&a->fraction, &b->fraction, sizeof(a->fraction))
+        && !memcmp (a->endpos, b->endpos, sizeof(a->endpos))
+        && !memcmp (a->plane.normal, b->plane.normal, sizeof(a->plane.normal))
+        && !memcmp (&a->plane.dist, &b->plane.dist, sizeof(a->plane.dist))
+        && a->surface == b->surface
+        && a->contents == b->contents;
+}
+
+void CM_ClipTest_f (void)
+{
+    int            i, j, count, bad;
+    vec3_t        start, end, mins, maxs;
+    vec3_t        wmins, wmaxs;
+    trace_t        scalar, simd;
+    char        oldsimd[32];
+
+    if (!numnodes)
+    {
+        Com_Printf ("no map loaded\n");
+        return;
+    }
+#if !CM_SIMD
+    Com_Printf ("built without SSE2, nothing to compare\n");
+    return;
+#endif
+
+    count = 100000;
+    if (Cmd_Argc () > 1)
+        count = atoi (Cmd_Argv (1));
+
+    VectorCopy (map_cmodels[0].mins, wmins);
+    VectorCopy (map_cmodels[0].maxs, wmaxs);
+
+    cliptest_seed = 1;
+    Com_sprintf (oldsimd, sizeof(oldsimd), "%s", cm_simd->string);
+    bad = 0;
+
+    for (i=0 ; i<count ; i++)
+    {
+        for (j=0 ; j<3 ; j++)
+        {
+            start[j] = CM_ClipTestRandom (wmins[j], wmaxs[j]);
+            if (i & 1)        // short moves, like pmove
+                end[j] = start[j] + CM_ClipTestRandom (-64, 64);
+            else
+                end[j] = CM_ClipTestRandom (wmins[j], wmaxs[j]);
+        }
+        if (i % 3 == 0)
+        {    // point trace
+            VectorClear (mins);
+            VectorClear (maxs);
+        }
+        else
+        {
+            for (j=0 ; j<3 ; j++)
+            {
+                mins[j] = -CM_ClipTestRandom (0, 32);
+                maxs[j] = CM_ClipTestRandom (0, 32);
+            }
+        }
+        if (i % 7 == 0)
+            VectorCopy (start, end);    // position test
+
+        Cvar_Set ("cm_simd", "0");
+        scalar = CM_BoxTraceUncached (start, end, mins, maxs, 0, MASK_ALL);
+        Cvar_Set ("cm_simd", "1");
+        simd = CM_BoxTraceUncached (start, end, mins, maxs, 0, MASK_ALL);
+
+        if (!CM_SameTrace (&scalar, &simd))
+        {
+            if (bad < 10)
+                Com_Printf ("mismatch %i: (%f %f %f) -> (%f %f %f) fraction %f / %f\n",
+                    i, start[0], start[1], start[2], end[0], end[1], end[2],
+                    scalar.fraction, simd.fraction);
+            bad++;
+        }
+    }
+
+    Cvar_Set ("cm_simd", oldsimd);
+    Com_Printf ("%i traces, %i mismatches\n", count, bad);
+}
+
+
 
 /*
 ===============================================================================
@@ -1572,10 +2035,67 @@ void CM_DecompressVis (byte *in, byte *out)
 byte    pvsrow[MAX_MAP_LEAFS/8];
 byte    phsrow[MAX_MAP_LEAFS/8];
 
+/*
+===================
+VIS MATRIX
+
+If it fits in cm_vismatrix_max kilobytes, every PVS and PHS row is
+decompressed once at load time, so CM_ClusterPVS and CM_ClusterPHS
+just return a pointer into it.  Rows are padded to 16 bytes and the
+matrix is cache line aligned, so CM_OrVis can work a vector at a time.
+Otherwise the compressed rows are expanded on every call as before.
+===================
+*/
+byte    *vis_matrix_base;        // for freeing
+byte    *vis_matrix;            // numclusters PVS rows, then numclusters PHS rows
+int        vis_rowbytes;
+
+void CM_FreeVisMatrix (void)
+{
+    if (vis_matrix_base)
+        Z_Free (vis_matrix_base);
+    vis_matrix_base = NULL;
+    vis_matrix = NULL;
+}
+
+void CM_BuildVisMatrix (void)
+{
+    int        i;
+    int        size;
+
+    CM_FreeVisMatrix ();
+
+    if (!cm_vismatrix->value || !numvisibility)
+        return;
+
+    vis_rowbytes = (((numclusters+7)>>3) + 15) & ~15;
+    size = vis_rowbytes * numclusters * 2;
+    if (size / 1024 > cm_vismatrix_max->value)
+    {
+        Com_DPrintf ("vis matrix would be %iK, using compressed vis\n", size / 1024);
+        return;
+    }
+
+    vis_matrix_base = Z_Malloc (size + 63);
+    vis_matrix = (byte *)(((size_t)vis_matrix_base + 63) & ~63);
+
+    for (i=0 ; i<numclusters ; i++)
+    {
+        CM_DecompressVis (map_visibility + map_vis->bitofs[i][DVIS_PVS],
+            vis_matrix + i*vis_rowbytes);
+        CM_DecompressVis (map_visibility + map_vis->bitofs[i][DVIS_PHS],
+            vis_matrix + (numclusters+i)*vis_rowbytes);
+    }
+
+    Com_DPrintf ("vis matrix: %i clusters, %iK\n", numclusters, size / 1024);
+}
+
 byte    *CM_ClusterPVS (int cluster)
 {
     if (cluster == -1)
         memset (pvsrow, 0, (numclusters+7)>>3);
+    else if (vis_matrix)
+        return vis_matrix + cluster*vis_rowbytes;
     else
         CM_DecompressVis (map_visibility + map_vis->bitofs[cluster][DVIS_PVS], pvsrow);
     return pvsrow;
@@ -1585,11 +2105,35 @@ byte    *CM_ClusterPHS (int cluster)
 {
     if (cluster == -1)
         memset (phsrow, 0, (numclusters+7)>>3);
+    else if (vis_matrix)
+        return vis_matrix + (numclusters+cluster)*vis_rowbytes;
     else
         CM_DecompressVis (map_visibility + map_vis->bitofs[cluster][DVIS_PHS], phsrow);
     return phsrow;
 }
 
+/*
+===================
+CM_OrVis
+
+Ors numbytes of src into dest, for building up fat PVS sets
+===================
+*/
+void CM_OrVis (byte *dest, byte *src, int numbytes)
+{
+    int        i;
+
+    i = 0;
+#if CM_SIMD
+    for ( ; i+16 <= numbytes ; i+=16)
+        _mm_storeu_si128 ((__m128i *)(dest+i), _mm_or_si128 (
+            _mm_loadu_si128 ((__m128i *)(dest+i)),
+            _mm_loadu_si128 ((__m128i *)(src+i))));
+#endif
+    for ( ; i<numbytes ; i++)
+        dest[i] |= src[i];
+}
+
 
 /*
 ===============================================================================
@@ -693,6 +693,764 @@ void MSG_WriteDeltaEntity (entity_state_t *from, entity_state_t *to, sizebuf_t *
         MSG_WriteShort (msg, to->solid);
 }
 
+/*
+==================
+MSG_WriteDeltaPlayerstate
+
+Writes a playerinfo message, from NULL for a full one
+==================
+*/
+void MSG_WriteDeltaPlayerstate (player_state_t *from, player_state_t *to, sizebuf_t *msg)
+{
+    int                i;
+    int                pflags;
+    player_state_t    *ps, *ops;
+    player_state_t    dummy;
+    int                statbits;
+
+    ps = to;
+    if (!from)
+    {
+        memset (&dummy, 0, sizeof(dummy));
+        ops = &dummy;
+    }
+    else
+        ops = from;
+
+    //
+    // determine what needs to be sent
+    //
+    pflags = 0;
+
+    if (ps->pmove.pm_type != ops->pmove.pm_type)
+        pflags |= PS_M_TYPE;
+
+    if (ps->pmove.origin[0] != ops->pmove.origin[0]
+        || ps->pmove.origin[1] != ops->pmove.origin[1]
+        || ps->pmove.origin[2] != ops->pmove.origin[2] )
+        pflags |= PS_M_ORIGIN;
+
+    if (ps->pmove.velocity[0] != ops->pmove.velocity[0]
+        || ps->pmove.velocity[1] != ops->pmove.velocity[1]
+        || ps->pmove.velocity[2] != ops->pmove.velocity[2] )
+        pflags |= PS_M_VELOCITY;
+
+    if (ps->pmove.pm_time != ops->pmove.pm_time)
+        pflags |= PS_M_TIME;
+
+    if (ps->pmove.pm_flags != ops->pmove.pm_flags)
+        pflags |= PS_M_FLAGS;
+
+    if (ps->pmove.gravity != ops->pmove.gravity)
+        pflags |= PS_M_GRAVITY;
+
+    if (ps->pmove.delta_angles[0] != ops->pmove.delta_angles[0]
+        || ps->pmove.delta_angles[1] != ops->pmove.delta_angles[1]
+        || ps->pmove.delta_angles[2] != ops->pmove.delta_angles[2] )
+        pflags |= PS_M_DELTA_ANGLES;
+
+
+    if (ps->viewoffset[0] != ops->viewoffset[0]
+        || ps->viewoffset[1] != ops->viewoffset[1]
+        || ps->viewoffset[2] != ops->viewoffset[2] )
+        pflags |= PS_VIEWOFFSET;
+
+    if (ps->viewangles[0] != ops->viewangles[0]
+        || ps->viewangles[1] != ops->viewangles[1]
+        || ps->viewangles[2] != ops->viewangles[2] )
+        pflags |= PS_VIEWANGLES;
+
+    if (ps->kick_angles[0] != ops->kick_angles[0]
+        || ps->kick_angles[1] != ops->kick_angles[1]
+        || ps->kick_angles[2] != ops->kick_angles[2] )
+        pflags |= PS_KICKANGLES;
+
+    if (ps->blend[0] != ops->blend[0]
+        || ps->blend[1] != ops->blend[1]
+        || ps->blend[2] != ops->blend[2]
+        || ps->blend[3] != ops->blend[3] )
+        pflags |= PS_BLEND;
+
+    if (ps->fov != ops->fov)
+        pflags |= PS_FOV;
+
+    if (ps->rdflags != ops->rdflags)
+        pflags |= PS_RDFLAGS;
+
+    if (ps->gunframe != ops->gunframe)
+        pflags |= PS_WEAPONFRAME;
+
+    pflags |= PS_WEAPONINDEX;
+
+    //
+    // write it
+    //
+    MSG_WriteByte (msg, svc_playerinfo);
+    MSG_WriteShort (msg, pflags);
+
+    //
+    // write the pmove_state_t
+    //
+    if (pflags & PS_M_TYPE)
+        MSG_WriteByte (msg, ps->pmove.pm_type);
+
+    if (pflags & PS_M_ORIGIN)
+    {
+        MSG_WriteShort (msg, ps->pmove.origin[0]);
+        MSG_WriteShort (msg, ps->pmove.origin[1]);
+        MSG_WriteShort (msg, ps->pmove.origin[2]);
+    }
+
+    if (pflags & PS_M_VELOCITY)
+    {
+        MSG_WriteShort (msg, ps->pmove.velocity[0]);
+        MSG_WriteShort (msg, ps->pmove.velocity[1]);
+        MSG_WriteShort (msg, ps->pmove.velocity[2]);
+    }
+
+    if (pflags & PS_M_TIME)
+        MSG_WriteByte (msg, ps->pmove.pm_time);
+
+    if (pflags & PS_M_FLAGS)
+        MSG_WriteByte (msg, ps->pmove.pm_flags);
+
+    if (pflags & PS_M_GRAVITY)
+        MSG_WriteShort (msg, ps->pmove.gravity);
+
+    if (pflags & PS_M_DELTA_ANGLES)
+    {
+        MSG_WriteShort (msg, ps->pmove.delta_angles[0]);
+        MSG_WriteShort (msg, ps->pmove.delta_angles[1]);
+        MSG_WriteShort (msg, ps->pmove.delta_angles[2]);
+    }
+
+    //
+    // write the rest of the player_state_t
+    //
+    if (pflags & PS_VIEWOFFSET)
+    {
+        MSG_WriteChar (msg, ps->viewoffset[0]*4);
+        MSG_WriteChar (msg, ps->viewoffset[1]*4);
+        MSG_WriteChar (msg, ps->viewoffset[2]*4);
+    }
+
+    if (pflags & PS_VIEWANGLES)
+    {
+        MSG_WriteAngle16 (msg, ps->viewangles[0]);
+        MSG_WriteAngle16 (msg, ps->viewangles[1]);
+        MSG_WriteAngle16 (msg, ps->viewangles[2]);
+    }
+
+    if (pflags & PS_KICKANGLES)
+    {
+        MSG_WriteChar (msg, ps->kick_angles[0]*4);
+        MSG_WriteChar (msg, ps->kick_angles[1]*4);
+        MSG_WriteChar (msg, ps->kick_angles[2]*4);
+    }
+
+    if (pflags & PS_WEAPONINDEX)
+    {
+        MSG_WriteByte (msg, ps->gunindex);
+    }
+
+    if (pflags & PS_WEAPONFRAME)
+    {
+        MSG_WriteByte (msg, ps->gunframe);
+        MSG_WriteChar (msg, ps->gunoffset[0]*4);
+        MSG_WriteChar (msg, ps->gunoffset[1]*4);
+        MSG_WriteChar (msg, ps->gunoffset[2]*4);
+        MSG_WriteChar (msg, ps->gunangles[0]*4);
+        MSG_WriteChar (msg, ps->gunangles[1]*4);
+        MSG_WriteChar (msg, ps->gunangles[2]*4);
+    }
+
+    if (pflags & PS_BLEND)
+    {
+        MSG_WriteByte (msg, ps->blend[0]*255);
+        MSG_WriteByte (msg, ps->blend[1]*255);
+        MSG_WriteByte (msg, ps->blend[2]*255);
+        MSG_WriteByte (msg, ps->blend[3]*255);
+    }
+    if (pflags & PS_FOV)
+        MSG_WriteByte (msg, ps->fov);
+    if (pflags & PS_RDFLAGS)
+        MSG_WriteByte (msg, ps->rdflags);
+
+    // send stats
+    statbits = 0;
+    for (i=0 ; i<MAX_STATS ; i++)
+        if (ps->stats[i] != ops->stats[i])
+            statbits |= 1<<i;
+    MSG_WriteLong (msg, statbits);
+    for (i=0 ; i<MAX_STATS ; i++)
+        if (statbits & (1<<i) )
+            MSG_WriteShort (msg, ps->stats[i]);
+}
+
+
+
+/*
+==================
+MSG_RoundProjectile
+
+Leaves a projectile the way MSG_WriteDeltaProjectile will deliver it
+==================
+*/
+void MSG_RoundProjectile (projectile_t *p)
+{
+    int        i;
+
+    for (i=0 ; i<3 ; i++)
+    {
+        p->origin[i] = (short)(int)(p->origin[i]*8) * (1.0/8);
+        p->velocity[i] = (short)(int)(p->velocity[i]*8) * (1.0/8);
+        p->angles[i] = (signed char)((int)(p->angles[i]*256/360) & 255) * (360.0/256);
+    }
+
+    p->modelindex &= 255;
+    p->frame = (short)p->frame;
+    p->sound &= 255;
+    p->gravity = (short)p->gravity;
+}
+
+/*
+==================
+MSG_ProjectileOrigin
+
+Where a projectile is at a (possibly fractional) server frame.  Gravity
+is added the way SV_Physics_Toss does it, a frame at a time before the
+move, so a falling projectile follows the server exactly.
+==================
+*/
+void MSG_ProjectileOrigin (projectile_t *p, float framenum, vec3_t origin)
+{
+    float    frames;
+
+    frames = framenum - p->basetime;
+    VectorMA (p->origin, frames*0.1, p->velocity, origin);
+    if (p->gravity)
+        origin[2] -= p->gravity * 0.01 * frames*(frames+1) * 0.5;
+}
+
+/*
+==================
+MSG_WriteDeltaProjectile
+
+Writes part of a svc_projectiles message.
+==================
+*/
+void MSG_WriteDeltaProjectile (projectile_t *from, projectile_t *to, sizebuf_t *msg, qboolean force)
+{
+    int        bits;
+
+    if (!to->number)
+        Com_Error (ERR_FATAL, "Unset projectile number");
+    if (to->number >= MAX_EDICTS)
+        Com_Error (ERR_FATAL, "Projectile number >= MAX_EDICTS");
+
+    bits = 0;
+
+    if (to->basetime != from->basetime || to->gravity != from->gravity
+        || !VectorCompare (to->origin, from->origin)
+        || !VectorCompare (to->velocity, from->velocity))
+    {
+        bits |= PR_TRAJECTORY;
+        if (to->gravity)
+            bits |= PR_GRAVITY;
+    }
+    if (!VectorCompare (to->angles, from->angles))
+        bits |= PR_ANGLES;
+    if (to->modelindex != from->modelindex)
+        bits |= PR_MODEL;
+    if (to->effects != from->effects)
+        bits |= PR_EFFECTS;
+    if (to->frame != from->frame)
+        bits |= PR_FRAME;
+    if (to->skinnum != from->skinnum)
+        bits |= PR_SKIN;
+    if (to->renderfx != from->renderfx)
+        bits |= PR_RENDERFX;
+    if (to->sound != from->sound)
+        bits |= PR_SOUND;
+
+    if (!bits && !force)
+        return;        // nothing to send!
+
+    if (to->number >= 256)
+        bits |= PR_NUMBER16;
+    if (bits & 0xff00)
+        bits |= PR_MOREBITS;
+
+    MSG_WriteByte (msg, bits&255);
+    if (bits & PR_MOREBITS)
+        MSG_WriteByte (msg, (bits>>8)&255);
+
+    if (bits & PR_NUMBER16)
+        MSG_WriteShort (msg, to->number);
+    else
+        MSG_WriteByte (msg, to->number);
+
+    if (bits & PR_MODEL)
+        MSG_WriteByte (msg, to->modelindex);
+    if (bits & PR_EFFECTS)
+        MSG_WriteLong (msg, to->effects);
+
+    if (bits & PR_TRAJECTORY)
+    {
+        MSG_WritePos (msg, to->origin);
+        MSG_WritePos (msg, to->velocity);
+        if (bits & PR_GRAVITY)
+            MSG_WriteShort (msg, to->gravity);
+    }
+
+    if (bits & PR_ANGLES)
+    {
+        MSG_WriteAngle (msg, to->angles[0]);
+        MSG_WriteAngle (msg, to->angles[1]);
+        MSG_WriteAngle (msg, to->angles[2]);
+    }
+
+    if (bits & PR_FRAME)
+        MSG_WriteShort (msg, to->frame);
+    if (bits & PR_SKIN)
+        MSG_WriteLong (msg, to->skinnum);
+    if (bits & PR_RENDERFX)
+        MSG_WriteLong (msg, to->renderfx);
+    if (bits & PR_SOUND)
+        MSG_WriteByte (msg, to->sound);
+}
+
+/*
+==============================================================================
+
+BIT PACKING
+
+Bits are packed from the low bit of each byte up.  Anything written with
+the byte functions after some bits starts on a fresh byte, and so does
+anything read after MSG_ReadAlign.
+
+==============================================================================
+*/
+
+void MSG_WriteBits (sizebuf_t *sb, unsigned value, int bits)
+{
+    byte    *b;
+    int        n;
+
+    while (bits > 0)
+    {
+        if (!sb->writebit)
+            *(byte *)SZ_GetSpace (sb, 1) = 0;
+        b = &sb->data[sb->cursize-1];
+
+        n = 8 - sb->writebit;
+        if (n > bits)
+            n = bits;
+        *b |= (value & ((1<<n)-1)) << sb->writebit;
+        sb->writebit = (sb->writebit + n) & 7;
+        value >>= n;
+        bits -= n;
+    }
+}
+
+/*
+==================
+MSG_WriteGolomb
+
+Exponential Golomb code of order k: small values take few bits, and each
+doubling past 1<<k costs two more.  The value must be below 0xffffffff.
+==================
+*/
+void MSG_WriteGolomb (sizebuf_t *sb, unsigned value, int k)
+{
+    unsigned    q;
+    int            n;
+
+    q = (value >> k) + 1;
+    for (n=0 ; q >> (n+1) ; n++)
+        ;
+    MSG_WriteBits (sb, 0, n);
+    MSG_WriteBits (sb, 1, 1);
+    MSG_WriteBits (sb, q, n);        // below the leading 1
+    MSG_WriteBits (sb, value, k);
+}
+
+static int MSG_GolombBits (unsigned value, int k)
+{
+    unsigned    q;
+    int            n;
+
+    q = (value >> k) + 1;
+    for (n=0 ; q >> (n+1) ; n++)
+        ;
+    return 2*n + 1 + k;
+}
+
+/*
+==================
+MSG_WriteVarBits
+
+Any 32 bit value as six bits of length and the bits below its top one,
+for flags that usually have only a few low bits set
+==================
+*/
+void MSG_WriteVarBits (sizebuf_t *sb, unsigned value)
+{
+    int        n;
+
+    for (n=0 ; n<32 && value >> n ; n++)
+        ;
+    MSG_WriteBits (sb, n, 6);
+    if (n > 1)
+        MSG_WriteBits (sb, value, n-1);
+}
+
+#define    ZIGZAG(i)    (((unsigned)(i) << 1) ^ (unsigned)((i) >> 31))
+
+/*
+==================
+MSG_RoundDeltaEntity
+
+Leaves a state the way it comes out of MSG_WriteDeltaEntity from a
+zeroed state and CL_ParseDelta, so the server knows exactly what a
+client has for an entity's baseline
+==================
+*/
+void MSG_RoundDeltaEntity (entity_state_t *s)
+{
+    int        i;
+
+    for (i=0 ; i<3 ; i++)
+    {
+        s->origin[i] = (short)(int)(s->origin[i]*8) * (1.0/8);
+        s->old_origin[i] = (short)(int)(s->old_origin[i]*8) * (1.0/8);
+        s->angles[i] = (signed char)((int)(s->angles[i]*256/360) & 255) * (360.0/256);
+    }
+
+    s->modelindex &= 255;
+    s->modelindex2 &= 255;
+    s->modelindex3 &= 255;
+    s->modelindex4 &= 255;
+    if (s->frame < 256)
+        s->frame &= 255;
+    else
+        s->frame = (short)s->frame;
+    if ((unsigned)s->skinnum >= 256 && (unsigned)s->skinnum < 0x10000)
+        s->skinnum = (short)s->skinnum;
+    if (s->renderfx < 256)
+        s->renderfx &= 255;
+    s->solid = (short)s->solid;
+    s->sound &= 255;
+    s->event &= 255;
+}
+
+/*
+==================
+MSG_BitDelta
+
+Works out what has to be sent for one entity, and leaves to as what the
+client will have once it has read it.  Returns the BE_* mask.
+==================
+*/
+static int MSG_BitDelta (bitdelta_t *d, int coordbits, int anglebits)
+{
+    entity_state_t    *from, *to, s;
+    float    scale, anglescale;
+    float    f;
+    int        mask, q, i;
+
+    from = d->from;
+    to = d->to;
+    if (!to)
+        return BE_REMOVE;
+
+    // what the client keeps of an entity that isn't sent
+    s = *from;
+    s.number = d->number;
+    VectorCopy (from->origin, s.old_origin);
+    s.event = 0;
+
+    mask = 0;
+    if (to->modelindex != from->modelindex)
+    {
+        mask |= BE_MODEL;
+        d->values[1] = s.modelindex = to->modelindex & 255;
+    }
+    if (to->modelindex2 != from->modelindex2)
+    {
+        mask |= BE_MODEL2;
+        d->values[2] = s.modelindex2 = to->modelindex2 & 255;
+    }
+    if (to->modelindex3 != from->modelindex3)
+    {
+        mask |= BE_MODEL3;
+        d->values[3] = s.modelindex3 = to->modelindex3 & 255;
+    }
+    if (to->modelindex4 != from->modelindex4)
+    {
+        mask |= BE_MODEL4;
+        d->values[4] = s.modelindex4 = to->modelindex4 & 255;
+    }
+    if (to->frame != from->frame)
+    {
+        mask |= BE_FRAME;
+        d->values[5] = ZIGZAG(to->frame - from->frame);
+        s.frame = to->frame;
+    }
+    if (to->skinnum != from->skinnum)
+    {
+        mask |= BE_SKIN;
+        d->values[6] = s.skinnum = to->skinnum;
+    }
+    if (to->effects != from->effects)
+    {
+        mask |= BE_EFFECTS;
+        d->values[7] = to->effects ^ from->effects;
+        s.effects = to->effects;
+    }
+    if (to->renderfx != from->renderfx)
+    {
+        mask |= BE_RENDERFX;
+        d->values[8] = to->renderfx ^ from->renderfx;
+        s.renderfx = to->renderfx;
+    }
+
+    // coordinates go as changes in units of 1/(1<<coordbits), from the
+    // base rounded down to that, which the client can work out exactly
+    scale = 1<<coordbits;
+    for (i=0 ; i<3 ; i++)
+    {
+        q = (int)floor (to->origin[i]*scale + 0.5);
+        f = q * (1.0f/scale);
+        if (f == from->origin[i])
+            continue;
+        mask |= BE_ORIGIN1<<i;
+        d->values[9+i] = ZIGZAG(q - (int)floor (from->origin[i]*scale));
+        s.origin[i] = f;
+    }
+
+    anglescale = (1<<anglebits) / 360.0;
+    for (i=0 ; i<3 ; i++)
+    {
+        q = (int)floor (to->angles[i]*anglescale + 0.5) & ((1<<anglebits)-1);
+        f = q * (360.0 / (1<<anglebits));
+        if (f == from->angles[i])
+            continue;
+        mask |= BE_ANGLE1<<i;
+        d->values[12+i] = q;
+        s.angles[i] = f;
+    }
+
+    if (d->oldorigin || (to->renderfx & RF_BEAM))
+    {
+        mask |= BE_OLDORIGIN;
+        for (i=0 ; i<3 ; i++)
+        {
+            q = (int)floor (to->old_origin[i]*scale + 0.5);
+            d->values[i ? BE_BITS+i-1 : 15] = ZIGZAG(q - (int)floor (s.origin[i]*scale));
+            s.old_origin[i] = q * (1.0f/scale);
+        }
+    }
+
+    if (to->sound != from->sound)
+    {
+        mask |= BE_SOUND;
+        d->values[16] = s.sound = to->sound & 255;
+    }
+    // event is not delta compressed, just 0 compressed
+    if (to->event)
+    {
+        mask |= BE_EVENT;
+        d->values[17] = s.event = to->event & 255;
+    }
+    if (to->solid != from->solid)
+    {
+        mask |= BE_SOLID;
+        d->values[18] = to->solid & 0xffff;
+        s.solid = (short)to->solid;
+    }
+
+    *to = s;
+    return mask;
+}
+
+/*
+==================
+MSG_WriteBitEntities
+
+Writes an svc_bitentities message with every change in deltas, which
+are in order of entity number.  Coordinates are rounded to 1/(1<<coordbits)
+and angles to 360/(1<<anglebits).  Each to is overwritten with exactly
+what the client will have after reading the message, so later frames
+can be delta'd from it.
+
+[3 coordbits] [4 anglebits-1] [4 coordinate k] [3 number k]
+[4 masks] [BE_BITS mask]... [golomb count]
+then for every entity sent:
+[golomb number - last number - 1]
+[golomb mask's place in the table, or the table size and BE_BITS mask]
+[1 base in an older frame] [4 frames back]    only with BE_NEW
+[the fields in BE_* order]
+
+The table holds the masks used more than once in the frame, most used
+first, so the usual few cost a bit or three each.
+==================
+*/
+void MSG_WriteBitEntities (sizebuf_t *msg, bitdelta_t *deltas, int count, int coordbits, int anglebits)
+{
+    int            masks[64], maskcounts[64];
+    int            nummasks, numtable;
+    int            coordcost[16], gapcost[8];
+    int            i, j, k, t, last, sent;
+    int            coordk, gapk;
+    bitdelta_t    *d;
+
+    if (coordbits < 0)
+        coordbits = 0;
+    else if (coordbits > 7)
+        coordbits = 7;
+    if (anglebits < 1)
+        anglebits = 1;
+    else if (anglebits > 16)
+        anglebits = 16;
+
+    memset (coordcost, 0, sizeof(coordcost));
+    memset (gapcost, 0, sizeof(gapcost));
+    nummasks = 0;
+    last = 0;
+    sent = 0;
+
+    for (i=0, d=deltas ; i<count ; i++, d++)
+    {
+        d->mask = MSG_BitDelta (d, coordbits, anglebits);
+        if (d->newentity)
+            d->mask |= BE_NEW;
+        if (!d->mask)
+            continue;        // the client already has it
+        sent++;
+
+        // count what the choices of k would cost
+        for (k=0 ; k<8 ; k++)
+            gapcost[k] += MSG_GolombBits (d->number - last - 1, k);
+        last = d->number;
+        for (j=0 ; j<3 ; j++)
+        {
+            if (d->mask & (BE_ORIGIN1<<j))
+                for (k=0 ; k<16 ; k++)
+                    coordcost[k] += MSG_GolombBits (d->values[9+j], k);
+        }
+        if (d->mask & BE_OLDORIGIN)
+        {
+            for (k=0 ; k<16 ; k++)
+                coordcost[k] += MSG_GolombBits (d->values[15], k)
+                    + MSG_GolombBits (d->values[BE_BITS], k)
+                    + MSG_GolombBits (d->values[BE_BITS+1], k);
+        }
+
+        for (j=0 ; j<nummasks ; j++)
+            if (masks[j] == d->mask)
+                break;
+        if (j == nummasks)
+        {
+            if (nummasks == 64)
+                continue;
+            masks[nummasks] = d->mask;
+            maskcounts[nummasks++] = 0;
+        }
+        maskcounts[j]++;
+    }
+
+    coordk = gapk = 0;
+    for (k=1 ; k<16 ; k++)
+        if (coordcost[k] < coordcost[coordk])
+            coordk = k;
+    for (k=1 ; k<8 ; k++)
+        if (gapcost[k] < gapcost[gapk])
+            gapk = k;
+
+    // most used masks first, dropping the ones only used once
+    for (i=1 ; i<nummasks ; i++)
+    {
+        for (j=i ; j>0 && maskcounts[j] > maskcounts[j-1] ; j--)
+        {
+            t = masks[j]; masks[j] = masks[j-1]; masks[j-1] = t;
+            t = maskcounts[j]; maskcounts[j] = maskcounts[j-1]; maskcounts[j-1] = t;
+        }
+    }
+    for (numtable=0 ; numtable<nummasks && numtable<BE_MAXMASKS ; numtable++)
+        if (maskcounts[numtable] < 2)
+            break;
+
+    MSG_WriteByte (msg, svc_bitentities);
+    MSG_WriteBits (msg, coordbits, 3);
+    MSG_WriteBits (msg, anglebits-1, 4);
+    MSG_WriteBits (msg, coordk, 4);
+    MSG_WriteBits (msg, gapk, 3);
+    MSG_WriteBits (msg, numtable, 4);
+    for (i=0 ; i<numtable ; i++)
+        MSG_WriteBits (msg, masks[i], BE_BITS);
+    MSG_WriteGolomb (msg, sent, 2);
+
+    last = 0;
+    for (i=0, d=deltas ; i<count ; i++, d++)
+    {
+        if (!d->mask)
+            continue;
+
+        MSG_WriteGolomb (msg, d->number - last - 1, gapk);
+        last = d->number;
+
+        for (j=0 ; j<numtable ; j++)
+            if (masks[j] == d->mask)
+                break;
+        MSG_WriteGolomb (msg, j, 0);
+        if (j == numtable)
+            MSG_WriteBits (msg, d->mask, BE_BITS);
+
+        if (d->mask & BE_NEW)
+        {
+            MSG_WriteBits (msg, d->base != 0, 1);
+            if (d->base)
+                MSG_WriteBits (msg, d->base, 4);
+        }
+
+        if (d->mask & BE_MODEL)
+            MSG_WriteBits (msg, d->values[1], 8);
+        if (d->mask & BE_MODEL2)
+            MSG_WriteBits (msg, d->values[2], 8);
+        if (d->mask & BE_MODEL3)
+            MSG_WriteBits (msg, d->values[3], 8);
+        if (d->mask & BE_MODEL4)
+            MSG_WriteBits (msg, d->values[4], 8);
+        if (d->mask & BE_FRAME)
+            MSG_WriteGolomb (msg, d->values[5], 0);
+        if (d->mask & BE_SKIN)
+            MSG_WriteVarBits (msg, d->values[6]);
+        if (d->mask & BE_EFFECTS)
+            MSG_WriteVarBits (msg, d->values[7]);
+        if (d->mask & BE_RENDERFX)
+            MSG_WriteVarBits (msg, d->values[8]);
+        for (j=0 ; j<3 ; j++)
+            if (d->mask & (BE_ORIGIN1<<j))
+                MSG_WriteGolomb (msg, d->values[9+j], coordk);
+        for (j=0 ; j<3 ; j++)
+            if (d->mask & (BE_ANGLE1<<j))
+                MSG_WriteBits (msg, d->values[12+j], anglebits);
+        if (d->mask & BE_OLDORIGIN)
+        {
+            MSG_WriteGolomb (msg, d->values[15], coordk);
+            MSG_WriteGolomb (msg, d->values[BE_BITS], coordk);
+            MSG_WriteGolomb (msg, d->values[BE_BITS+1], coordk);
+        }
+        if (d->mask & BE_SOUND)
+            MSG_WriteBits (msg, d->values[16], 8);
+        if (d->mask & BE_EVENT)
+            MSG_WriteBits (msg, d->values[17], 8);
+        if (d->mask & BE_SOLID)
+            MSG_WriteBits (msg, d->values[18], 16);
+    }
+}
+
 
 //============================================================
 
@@ -703,6 +1461,7 @@ void MSG_WriteDeltaEntity (entity_state_t *from, entity_state_t *to, sizebuf_t *
 void MSG_BeginReading (sizebuf_t *msg)
 {
     msg->readcount = 0;
+    msg->readbit = 0;
 }
 
 // returns -1 if no more characters are available
@@ -903,6 +1662,66 @@ void MSG_ReadData (sizebuf_t *msg_read, void *data, int len)
 }
 
 
+unsigned MSG_ReadBits (sizebuf_t *msg_read, int bits)
+{
+    unsigned    value, b;
+    int            n, got;
+
+    value = 0;
+    for (got=0 ; got<bits ; got+=n)
+    {
+        if (!msg_read->readbit)
+            msg_read->readcount++;
+        if (msg_read->readcount > msg_read->cursize)
+            b = 0;        // past the end, which the caller checks for
+        else
+            b = msg_read->data[msg_read->readcount-1];
+
+        n = 8 - msg_read->readbit;
+        if (n > bits - got)
+            n = bits - got;
+        value |= ((b >> msg_read->readbit) & ((1<<n)-1)) << got;
+        msg_read->readbit = (msg_read->readbit + n) & 7;
+    }
+
+    return value;
+}
+
+unsigned MSG_ReadGolomb (sizebuf_t *msg_read, int k)
+{
+    int        n;
+
+    for (n=0 ; !MSG_ReadBits (msg_read, 1) ; n++)
+    {
+        if (n == 31 || msg_read->readcount > msg_read->cursize)
+        {    // corrupt, make it look like the end for the caller
+            msg_read->readcount = msg_read->cursize+1;
+            return 0;
+        }
+    }
+
+    return ((((1u<<n) | MSG_ReadBits (msg_read, n)) - 1) << k) | MSG_ReadBits (msg_read, k);
+}
+
+unsigned MSG_ReadVarBits (sizebuf_t *msg_read)
+{
+    int        n;
+
+    n = MSG_ReadBits (msg_read, 6);
+    if (!n)
+        return 0;
+    if (n > 32)
+        n = 32;
+    return (1u<<(n-1)) | MSG_ReadBits (msg_read, n-1);
+}
+
+// byte reads after this start after the last byte bits came from
+void MSG_ReadAlign (sizebuf_t *msg_read)
+{
+    msg_read->readbit = 0;
+}
+
+
 //===========================================================================
 
 void SZ_Init (sizebuf_t *buf, byte *data, int length)
@@ -915,6 +1734,7 @@ void SZ_Init (sizebuf_t *buf, byte *data, int length)
 void SZ_Clear (sizebuf_t *buf)
 {
     buf->cursize = 0;
+    buf->writebit = 0;
     buf->overflowed = false;
 }
 
@@ -930,13 +1750,15 @@ void *SZ_GetSpace (sizebuf_t *buf, int length)
         if (length > buf->maxsize)
             Com_Error (ERR_FATAL, "SZ_GetSpace: %i is > full buffer size", length);
             
-        Com_Printf ("SZ_GetSpace: overflow\n");
+        if (!buf->quietoverflow)
+            Com_Printf ("SZ_GetSpace: overflow\n");
         SZ_Clear (buf); 
         buf->overflowed = true;
     }
 
     data = buf->data + buf->cursize;
     buf->cursize += length;
+    buf->writebit = 0;        // bits after this start a new byte
     
     return data;
 }
@@ -1118,24 +1940,89 @@ void Info_Print (char *s)
 
                         ZONE MEMORY ALLOCATION
 
-just cleared malloc with counters now...
+Every tag has its own arena.  Small blocks are carved out of big chunks
+and recycled through per size class freelists, so the game's constant
+little TagMalloc / TagFree calls don't touch malloc at all.  Anything
+bigger is malloc'd and kept on the tag's list.  Freeing a tag releases
+its chunks and big blocks without looking at any other tag's memory.
 
 ==============================================================================
 */
 
-#define    Z_MAGIC        0x1d1d
+#define    Z_MAGIC            0x1d1d        // malloc'd on its own
+#define    Z_SMALLMAGIC    0x1d1e        // carved from an arena chunk
+#define    Z_FREEMAGIC        0x1d1f        // on an arena freelist
+
+#define    Z_CLASSSIZE        16
+#define    Z_NUMCLASSES    32
+#define    Z_SMALLMAX        (Z_CLASSSIZE*Z_NUMCLASSES)    // header included
+#define    Z_CHUNKSIZE        0x10000
+#define    Z_MAXARENAS        64
 
 
 typedef struct zhead_s
 {
-    struct zhead_s    *prev, *next;
+    struct zhead_s    *prev, *next;    // tag list, or next free if small
     short    magic;
     short    tag;            // for group free
     int        size;
 } zhead_t;
 
-zhead_t        z_chain;
+typedef struct zchunk_s
+{
+    struct zchunk_s    *next;
+    int        used;
+} zchunk_t;
+
+// keep the blocks in a chunk aligned like malloc's
+#define    Z_CHUNKHEAD        ((sizeof(zchunk_t)+Z_CLASSSIZE-1) & ~(Z_CLASSSIZE-1))
+
+typedef struct
+{
+    int            tag;
+    zchunk_t    *chunks;        // the one being carved up first
+    zhead_t        *free[Z_NUMCLASSES];
+    zhead_t        large;            // sentinel for the malloc'd blocks
+    int            count, bytes;
+    int            numchunks;
+} zarena_t;
+
+zarena_t    z_arenas[Z_MAXARENAS];
+int            z_numarenas;
+zarena_t    *z_lastarena;
+
 int        z_count, z_bytes;
+int        z_mallocs;            // calls into malloc, for z_stats
+
+/*
+========================
+Z_Arena
+
+Finds the arena for a tag, creating it if needed
+========================
+*/
+zarena_t *Z_Arena (int tag, qboolean create)
+{
+    zarena_t    *a;
+    int            i;
+
+    if (z_lastarena && z_lastarena->tag == tag)
+        return z_lastarena;
+
+    for (i=0, a=z_arenas ; i<z_numarenas ; i++, a++)
+        if (a->tag == tag)
+            return z_lastarena = a;
+
+    if (!create)
+        return NULL;
+    if (z_numarenas == Z_MAXARENAS)
+        Com_Error (ERR_FATAL, "Z_Arena: too many tags");
+
+    a = &z_arenas[z_numarenas++];
+    a->tag = tag;
+    a->large.next = a->large.prev = &a->large;
+    return z_lastarena = a;
+}
 
 /*
 ========================
@@ -1144,10 +2031,24 @@ Z_Free
 */
 void Z_Free (void *ptr)
 {
-    zhead_t    *z;
+    zhead_t        *z;
+    zarena_t    *a;
 
     z = ((zhead_t *)ptr) - 1;
 
+    if (z->magic == Z_SMALLMAGIC)
+    {
+        a = Z_Arena (z->tag, false);
+        z->magic = Z_FREEMAGIC;
+        z->next = a->free[z->size/Z_CLASSSIZE - 1];
+        a->free[z->size/Z_CLASSSIZE - 1] = z;
+        a->count--;
+        a->bytes -= z->size;
+        z_count--;
+        z_bytes -= z->size;
+        return;
+    }
+
     if (z->magic != Z_MAGIC) {
       printf( "free: %p failed\n", ptr );
       abort();
@@ -1157,6 +2058,9 @@ void Z_Free (void *ptr)
     z->prev->next = z->next;
     z->next->prev = z->prev;
 
+    a = Z_Arena (z->tag, false);
+    a->count--;
+    a->bytes -= z->size;
     z_count--;
     z_bytes -= z->size;
     free (z);
@@ -1170,7 +2074,16 @@ Z_Stats_f
 */
 void Z_Stats_f (void)
 {
+    zarena_t    *a;
+    int            i;
+
     Com_Printf ("%i bytes in %i blocks\n", z_bytes, z_count);
+
+    for (i=0, a=z_arenas ; i<z_numarenas ; i++, a++)
+        if (a->count || a->numchunks)
+            Com_Printf ("tag %4i: %i bytes in %i blocks, %i chunks\n",
+                a->tag, a->bytes, a->count, a->numchunks);
+    Com_Printf ("%i mallocs\n", z_mallocs);
 }
 
 /*
@@ -1180,14 +2093,32 @@ Z_FreeTags
 */
 void Z_FreeTags (int tag)
 {
-    zhead_t    *z, *next;
+    zarena_t    *a;
+    zchunk_t    *c, *nextc;
+    zhead_t        *z, *next;
 
-    for (z=z_chain.next ; z != &z_chain ; z=next)
+    a = Z_Arena (tag, false);
+    if (!a)
+        return;
+
+    for (c=a->chunks ; c ; c=nextc)
+    {
+        nextc = c->next;
+        free (c);
+    }
+    for (z=a->large.next ; z != &a->large ; z=next)
     {
         next = z->next;
-        if (z->tag == tag)
-            Z_Free ((void *)(z+1));
+        free (z);
     }
+
+    z_count -= a->count;
+    z_bytes -= a->bytes;
+
+    a->chunks = NULL;
+    memset (a->free, 0, sizeof(a->free));
+    a->large.next = a->large.prev = &a->large;
+    a->count = a->bytes = a->numchunks = 0;
 }
 
 /*
@@ -1197,23 +2128,64 @@ Z_TagMalloc
 */
 void *Z_TagMalloc (int size, int tag)
 {
-    zhead_t    *z;
+    zhead_t        *z;
+    zarena_t    *a;
+    zchunk_t    *c;
+    int            cls;
     
+    a = Z_Arena (tag, true);
     size = size + sizeof(zhead_t);
-    z = malloc(size);
-    if (!z)
-        Com_Error (ERR_FATAL, "Z_Malloc: failed on allocation of %i bytes",size);
-    memset (z, 0, size);
-    z_count++;
-    z_bytes += size;
-    z->magic = Z_MAGIC;
+
+    if (size <= Z_SMALLMAX)
+    {
+        size = (size + Z_CLASSSIZE-1) & ~(Z_CLASSSIZE-1);
+        cls = size/Z_CLASSSIZE - 1;
+
+        z = a->free[cls];
+        if (z)
+        {
+            a->free[cls] = z->next;
+            memset (z, 0, size);
+        }
+        else
+        {
+            c = a->chunks;
+            if (!c || c->used + size > Z_CHUNKSIZE)
+            {    // whatever is left of the old chunk is wasted
+                c = calloc (1, Z_CHUNKHEAD + Z_CHUNKSIZE);
+                if (!c)
+                    Com_Error (ERR_FATAL, "Z_Malloc: failed on allocation of %i bytes", Z_CHUNKSIZE);
+                z_mallocs++;
+                c->next = a->chunks;
+                a->chunks = c;
+                a->numchunks++;
+            }
+            z = (zhead_t *)((byte *)c + Z_CHUNKHEAD + c->used);    // already cleared
+            c->used += size;
+        }
+        z->magic = Z_SMALLMAGIC;
+    }
+    else
+    {
+        z = malloc(size);
+        if (!z)
+            Com_Error (ERR_FATAL, "Z_Malloc: failed on allocation of %i bytes",size);
+        z_mallocs++;
+        memset (z, 0, size);
+        z->magic = Z_MAGIC;
+
+        z->next = a->large.next;
+        z->prev = &a->large;
+        a->large.next->prev = z;
+        a->large.next = z;
+    }
+
     z->tag = tag;
     z->size = size;
-
-    z->next = z_chain.next;
-    z->prev = &z_chain;
-    z_chain.next->prev = z;
-    z_chain.next = z;
+    a->count++;
+    a->bytes += size;
+    z_count++;
+    z_bytes += size;
 
     /*    printf( "returning pointer: %p\n", (z+1) );*/
     return (void *)(z+1);
@@ -1438,7 +2410,6 @@ void Qcommon_Init (int argc, char **argv)
     if (setjmp (abortframe) )
         Sys_Error ("Error during initialization");
 
-    z_chain.next = z_chain.prev = &z_chain;
 
     // prepare enough of the subsystems to handle
     // cvar and command buffer management
@@ -1471,6 +2442,9 @@ void Qcommon_Init (int argc, char **argv)
     // init commands and vars
     //
     Cmd_AddCommand ("z_stats", Z_Stats_f);
+    Cmd_AddCommand ("cm_cliptest", CM_ClipTest_f);
+    Prof_Init ();
+    Demo_Init ();
     Cmd_AddCommand ("error", Com_Error_f);
 
     host_speeds = Cvar_Get ("host_speeds", "0", 0);
@@ -1531,7 +2505,13 @@ void Qcommon_Frame (int msec)
     int        time_before, time_between, time_after;
 
     if (setjmp (abortframe) )
+    {
+        NET_FlushPackets ();    // in case it was in the middle of sending
         return;            // an ERR_DROP was thrown
+    }
+
+    Prof_Frame ();
+    Prof_Begin (PROF_FRAME);
 
     if ( log_stats->modified )
     {
@@ -1588,12 +2568,16 @@ void Qcommon_Frame (int msec)
     if (host_speeds->value)
         time_before = Sys_Milliseconds ();
 
+    Prof_Begin (PROF_SERVER);
     SV_Frame (msec);
+    Prof_End (PROF_SERVER);
 
     if (host_speeds->value)
         time_between = Sys_Milliseconds ();        
 
+    Prof_Begin (PROF_CLIENT);
     CL_Frame (msec);
+    Prof_End (PROF_CLIENT);
 
     if (host_speeds->value)
         time_after = Sys_Milliseconds ();        
@@ -1613,6 +2597,8 @@ void Qcommon_Frame (int msec)
         Com_Printf ("all:%3i sv:%3i gm:%3i cl:%3i rf:%3i\n",
             all, sv, gm, cl, rf);
     }    
+
+    Prof_End (PROF_FRAME);
 }
 
 /*
@@ -1622,4 +2608,5 @@ Qcommon_Shutdown
 */
 void Qcommon_Shutdown (void)
 {
+    Demo_Shutdown ();
 }
@@ -0,0 +1,637 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// demo.c -- demo file writing off the main thread
+
+#include "qcommon.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
+/*
+==============================================================================
+
+Demo messages are copied into blocks on the main thread, and a writer
+thread for each demo compresses and writes out the full ones, so a slow
+disk never stalls a frame.  There are demo_blocks blocks per demo, two
+for double buffering by default.  If the writer falls so far behind that
+the next block is still waiting to be written, messages are dropped and
+counted until it catches up, and the caller is told so it can get the
+demo back in sync.
+
+A block is also handed over once it has been filling for a second, and
+every block is written with whole messages and flushed, so a demo cut
+short by a crash still ends on a message boundary.  Demo_Shutdown
+drains everything on the way out, since Sys_Quit doesn't flush stdio.
+
+With demo_compress, demos are written as gzip streams, sync flushed at
+every block.
+
+==============================================================================
+*/
+
+#define    DEMO_BLOCKSIZE    0x20000        // more than the biggest message
+#define    MAX_DEMO_BLOCKS    16
+#define    MAX_DEMOS        4            // open at once
+#define    DEMO_HANDOFF    1.0            // seconds a block can hold messages
+
+typedef struct
+{
+    byte        data[DEMO_BLOCKSIZE];
+    int            len;
+    qboolean    queued;            // the writer owns it
+} demoblock_t;
+
+struct demofile_s
+{
+    char        name[MAX_OSPATH];
+    FILE        *f;
+    qboolean    failed;            // a write failed, the rest is dropped
+
+    int            numblocks;
+    demoblock_t    *blocks;        // [numblocks]
+    int            fill;            // the block messages are copied into
+    qboolean    filling;        // fill is taken back from the writer
+    int            next;            // the oldest queued block
+    double        filltime;        // when fill got its first message
+
+#ifdef USE_ZLIB
+    qboolean    compress;
+    z_stream    zs;
+    byte        zbuf[0x10000];
+#endif
+
+#ifndef _WIN32
+    pthread_t        thread;
+    pthread_mutex_t    lock;
+    pthread_cond_t    wake;        // a block was queued, or closing
+    pthread_cond_t    done;        // a block was written
+    qboolean        closing;
+#endif
+
+    int            messages;
+    int            dropped;        // messages that found no free block
+    int            handed;            // blocks handed to the writer
+    int            late;            // handed over with older blocks still queued
+    double        bytes;            // message bytes
+    double        written;        // file bytes
+    double        writetime;        // seconds in fwrite and deflate
+    double        maxwrite;        // the slowest block
+};
+
+static cvar_t        *demo_blocks;
+static cvar_t        *demo_compress;
+
+static demofile_t    *demo_open[MAX_DEMOS];
+
+/*
+============
+Demo_WriteBlock
+
+Compresses and writes one block.  Only the writer thread calls this
+while the demo is open, so it alone sets failed and the write counts,
+but the main thread reads them, so they are set under the lock.
+============
+*/
+static void Demo_WriteBlock (demofile_t *demo, demoblock_t *b)
+{
+    double    start, time;
+    int        len, written;
+    qboolean    failed;
+
+    if (demo->failed)
+        return;
+
+    start = Sys_FloatTime ();
+    failed = false;
+    written = 0;
+#ifdef USE_ZLIB
+    if (demo->compress)
+    {
+        demo->zs.next_in = b->data;
+        demo->zs.avail_in = b->len;
+        do
+        {
+            demo->zs.next_out = demo->zbuf;
+            demo->zs.avail_out = sizeof(demo->zbuf);
+            deflate (&demo->zs, Z_SYNC_FLUSH);
+            len = sizeof(demo->zbuf) - demo->zs.avail_out;
+            if (fwrite (demo->zbuf, 1, len, demo->f) != len)
+                failed = true;
+            written += len;
+        } while (!demo->zs.avail_out && !failed);
+    }
+    else
+#endif
+    {
+        len = fwrite (b->data, 1, b->len, demo->f);
+        if (len != b->len)
+            failed = true;
+        written += len;
+    }
+    if (fflush (demo->f))
+        failed = true;
+
+    time = Sys_FloatTime () - start;
+
+#ifndef _WIN32
+    pthread_mutex_lock (&demo->lock);
+#endif
+    if (failed)
+        demo->failed = true;
+    demo->written += written;
+    demo->writetime += time;
+    if (time > demo->maxwrite)
+        demo->maxwrite = time;
+#ifndef _WIN32
+    pthread_mutex_unlock (&demo->lock);
+#endif
+}
+
+#ifndef _WIN32
+/*
+============
+Demo_Thread
+============
+*/
+static void *Demo_Thread (void *arg)
+{
+    demofile_t    *demo;
+    demoblock_t    *b;
+
+    demo = arg;
+    pthread_mutex_lock (&demo->lock);
+    while (1)
+    {
+        b = &demo->blocks[demo->next];
+        if (!b->queued)
+        {
+            if (demo->closing)
+                break;
+            pthread_cond_wait (&demo->wake, &demo->lock);
+            continue;
+        }
+        pthread_mutex_unlock (&demo->lock);
+
+        Demo_WriteBlock (demo, b);
+
+        pthread_mutex_lock (&demo->lock);
+        b->queued = false;
+        pthread_cond_signal (&demo->done);
+        demo->next = (demo->next + 1) % demo->numblocks;
+    }
+    pthread_mutex_unlock (&demo->lock);
+    return NULL;
+}
+#endif
+
+/*
+============
+Demo_BlockFree
+
+True once the writer is done with a block, optionally waiting for it.
+False if a write has failed, since the rest of the demo is dropped.
+============
+*/
+static qboolean Demo_BlockFree (demofile_t *demo, demoblock_t *b, qboolean wait)
+{
+#ifndef _WIN32
+    qboolean    ready;
+
+    pthread_mutex_lock (&demo->lock);
+    while (wait && b->queued && !demo->failed)
+        pthread_cond_wait (&demo->done, &demo->lock);
+    ready = !b->queued && !demo->failed;
+    pthread_mutex_unlock (&demo->lock);
+    return ready;
+#else
+    return !demo->failed;
+#endif
+}
+
+/*
+============
+Demo_Queue
+
+Hands the block being filled to the writer and moves on to the next.
+============
+*/
+static void Demo_Queue (demofile_t *demo)
+{
+    demoblock_t    *b;
+
+    b = &demo->blocks[demo->fill];
+    if (!demo->filling || !b->len)
+        return;
+
+    demo->handed++;
+#ifndef _WIN32
+    pthread_mutex_lock (&demo->lock);
+    if (demo->next != demo->fill)
+        demo->late++;
+    b->queued = true;
+    pthread_cond_signal (&demo->wake);
+    pthread_mutex_unlock (&demo->lock);
+#else
+    Demo_WriteBlock (demo, b);
+#endif
+    demo->fill = (demo->fill + 1) % demo->numblocks;
+    demo->filling = false;
+}
+
+/*
+============
+Demo_Open
+
+Creates the file and starts its writer.  With demo_compress, ".gz" is
+added to name, which must hold MAX_OSPATH.
+============
+*/
+demofile_t *Demo_Open (char *name)
+{
+    demofile_t    *demo;
+    int            i, numblocks;
+
+    for (i=0 ; i<MAX_DEMOS ; i++)
+        if (!demo_open[i])
+            break;
+    if (i == MAX_DEMOS)
+    {
+        Com_Printf ("Too many demos open.\n");
+        return NULL;
+    }
+
+    demo = Z_Malloc (sizeof(*demo));
+#ifdef USE_ZLIB
+    if (demo_compress->value)
+    {
+        demo->compress = true;
+        strncat (name, ".gz", MAX_OSPATH - strlen(name) - 1);
+        if (deflateInit2 (&demo->zs, demo_compress->value > 9 ? 9 : (int)demo_compress->value,
+            Z_DEFLATED, MAX_WBITS+16, 8, Z_DEFAULT_STRATEGY) != Z_OK)    // +16 for a gzip header
+        {
+            Com_Printf ("Demo_Open: deflateInit2 failed\n");
+            Z_Free (demo);
+            return NULL;
+        }
+    }
+#else
+    if (demo_compress->value)
+        Com_Printf ("No zlib support, writing the demo uncompressed.\n");
+#endif
+
+    demo->f = fopen (name, "wb");
+    if (!demo->f)
+    {
+#ifdef USE_ZLIB
+        if (demo->compress)
+            deflateEnd (&demo->zs);
+#endif
+        Z_Free (demo);
+        return NULL;
+    }
+    strncpy (demo->name, name, sizeof(demo->name)-1);
+
+    numblocks = demo_blocks->value;
+    if (numblocks < 2)
+        numblocks = 2;
+    else if (numblocks > MAX_DEMO_BLOCKS)
+        numblocks = MAX_DEMO_BLOCKS;
+    demo->numblocks = numblocks;
+    demo->blocks = Z_Malloc (numblocks * sizeof(demoblock_t));
+
+#ifndef _WIN32
+    pthread_mutex_init (&demo->lock, NULL);
+    pthread_cond_init (&demo->wake, NULL);
+    pthread_cond_init (&demo->done, NULL);
+    if (pthread_create (&demo->thread, NULL, Demo_Thread, demo))
+        Com_Error (ERR_FATAL, "Demo_Open: couldn't start the writer thread");
+#endif
+
+    demo_open[i] = demo;
+    return demo;
+}
+
+/*
+============
+Demo_Block
+
+The block to add size bytes to, NULL if the writer is too far behind
+and wait is false
+============
+*/
+static demoblock_t *Demo_Block (demofile_t *demo, int size, qboolean wait)
+{
+    demoblock_t    *b;
+
+    b = &demo->blocks[demo->fill];
+    if (demo->filling && (b->len + size > DEMO_BLOCKSIZE || Sys_FloatTime () - demo->filltime > DEMO_HANDOFF))
+    {
+        Demo_Queue (demo);
+        b = &demo->blocks[demo->fill];
+    }
+
+    // the writer only touches queued blocks, so once fill is taken
+    // back it is the main thread's until queued again
+    if (!demo->filling)
+    {
+        if (!Demo_BlockFree (demo, b, wait))
+            return NULL;
+        b->len = 0;
+        demo->filling = true;
+        demo->filltime = Sys_FloatTime ();
+    }
+    return b;
+}
+
+/*
+============
+Demo_WriteMessage
+
+Adds a message prefixed by its length, or just a length of -1 to mark
+the end of the demo.  Returns false if the message was dropped because
+the writer is too far behind; the end mark waits for it instead.
+============
+*/
+qboolean Demo_WriteMessage (demofile_t *demo, void *data, int len)
+{
+    demoblock_t    *b;
+    int            swlen, size;
+
+    size = len < 0 ? 4 : len + 4;
+    if (size > DEMO_BLOCKSIZE)
+        Com_Error (ERR_DROP, "Demo_WriteMessage: %i bytes", len);
+
+    b = Demo_Block (demo, size, len < 0);
+    if (!b)
+    {
+        demo->dropped++;
+        return false;
+    }
+
+    swlen = LittleLong (len);
+    memcpy (b->data + b->len, &swlen, 4);
+    if (len > 0)
+        memcpy (b->data + b->len + 4, data, len);
+    b->len += size;
+
+    demo->messages++;
+    demo->bytes += size;
+    return true;
+}
+
+/*
+============
+Demo_Tell
+
+The offset the next message will be at, counting what was dropped out
+============
+*/
+int Demo_Tell (demofile_t *demo)
+{
+    return (int)demo->bytes;
+}
+
+/*
+============
+Demo_WriteIndex
+
+Goes after the end mark.  It waits for the writer, as the end mark does.
+============
+*/
+void Demo_WriteIndex (demofile_t *demo, demoindex_t *index, int count)
+{
+    demoblock_t    *b;
+    int            *data;
+    int            i, len, size;
+
+    size = (count*2 + 2) * 4;
+    data = Z_Malloc (size);
+    for (i=0 ; i<count ; i++)
+    {
+        data[i*2] = LittleLong (index[i].serverframe);
+        data[i*2+1] = LittleLong (index[i].offset);
+    }
+    data[count*2] = LittleLong (count);
+    data[count*2+1] = LittleLong (DEMO_INDEXID);
+
+    for (i=0 ; i<size ; i+=len)
+    {
+        len = size - i;
+        if (len > DEMO_BLOCKSIZE)
+            len = DEMO_BLOCKSIZE;
+        b = Demo_Block (demo, len, true);
+        if (!b)
+            break;        // write failed
+        memcpy (b->data + b->len, (byte *)data + i, len);
+        b->len += len;
+        demo->bytes += len;
+    }
+    Z_Free (data);
+}
+
+/*
+============
+Demo_ReadIndex
+============
+*/
+static demoindex_t *Demo_ReadIndex (FILE *f, int start, int length, int *count)
+{
+    demoindex_t    *index;
+    int            trailer[2];
+    int            i, n;
+
+    fseek (f, start + length - 8, SEEK_SET);
+    if (fread (trailer, 8, 1, f) != 1 || LittleLong (trailer[1]) != DEMO_INDEXID)
+        return NULL;
+    n = LittleLong (trailer[0]);
+    if (n <= 0 || n > (length - 8) / 8)
+        return NULL;
+
+    index = Z_Malloc (n * sizeof(*index));
+    fseek (f, start + length - 8 - n*8, SEEK_SET);
+    if (fread (index, 8, n, f) != n)
+        n = 0;
+    for (i=0 ; i<n ; i++)
+    {
+        index[i].serverframe = LittleLong (index[i].serverframe);
+        index[i].offset = LittleLong (index[i].offset);
+        if (index[i].offset < 0 || index[i].offset >= length
+            || (i && (index[i].offset <= index[i-1].offset || index[i].serverframe <= index[i-1].serverframe)))
+            n = 0;
+    }
+    if (!n)
+    {
+        Com_Printf ("Demo_ReadIndex: bad index\n");
+        Z_Free (index);
+        return NULL;
+    }
+
+    *count = n;
+    return index;
+}
+
+/*
+============
+Demo_LoadIndex
+
+f is at the start of a demo length bytes long, and is left there
+============
+*/
+demoindex_t *Demo_LoadIndex (FILE *f, int length, int *count)
+{
+    demoindex_t    *index;
+    int            start;
+
+    *count = 0;
+    if (length < 8)
+        return NULL;
+
+    start = ftell (f);
+    index = Demo_ReadIndex (f, start, length, count);
+    fseek (f, start, SEEK_SET);
+    return index;
+}
+
+/*
+============
+Demo_Stats
+============
+*/
+static void Demo_Stats (demofile_t *demo)
+{
+    Com_Printf ("%s: %i messages, %i dropped\n", demo->name, demo->messages, demo->dropped);
+    Com_Printf ("  %i blocks, %i late, %.1f ms writing, %.1f ms slowest\n", demo->handed,
+        demo->late, demo->writetime * 1000, demo->maxwrite * 1000);
+    Com_Printf ("  %.0fk in, %.0fk written%s\n", demo->bytes / 1024, demo->written / 1024,
+        demo->failed ? ", WRITE FAILED" : "");
+}
+
+/*
+============
+Demo_Close
+
+Writes out whatever is left and closes the file
+============
+*/
+void Demo_Close (demofile_t *demo)
+{
+    int        i;
+
+    Demo_Queue (demo);
+
+#ifndef _WIN32
+    pthread_mutex_lock (&demo->lock);
+    demo->closing = true;
+    pthread_cond_signal (&demo->wake);
+    pthread_mutex_unlock (&demo->lock);
+    pthread_join (demo->thread, NULL);
+    pthread_mutex_destroy (&demo->lock);
+    pthread_cond_destroy (&demo->wake);
+    pthread_cond_destroy (&demo->done);
+#endif
+
+#ifdef USE_ZLIB
+    if (demo->compress)
+    {
+        // the gzip trailer
+        demo->zs.avail_in = 0;
+        do
+        {
+            demo->zs.next_out = demo->zbuf;
+            demo->zs.avail_out = sizeof(demo->zbuf);
+            deflate (&demo->zs, Z_FINISH);
+            demo->written += fwrite (demo->zbuf, 1, sizeof(demo->zbuf) - demo->zs.avail_out, demo->f);
+        } while (!demo->zs.avail_out);
+        deflateEnd (&demo->zs);
+    }
+#endif
+    fclose (demo->f);
+
+    if (demo->dropped || demo->late || demo->failed)
+        Demo_Stats (demo);
+
+    for (i=0 ; i<MAX_DEMOS ; i++)
+        if (demo_open[i] == demo)
+            demo_open[i] = NULL;
+    Z_Free (demo->blocks);
+    Z_Free (demo);
+}
+
+/*
+============
+Demo_Stats_f
+============
+*/
+static void Demo_Stats_f (void)
+{
+    int        i, count;
+
+    count = 0;
+    for (i=0 ; i<MAX_DEMOS ; i++)
+    {
+        if (demo_open[i])
+        {
+            // the writer is still adding to the write counts
+#ifndef _WIN32
+            pthread_mutex_lock (&demo_open[i]->lock);
+#endif
+            Demo_Stats (demo_open[i]);
+#ifndef _WIN32
+            pthread_mutex_unlock (&demo_open[i]->lock);
+#endif
+            count++;
+        }
+    }
+    if (!count)
+        Com_Printf ("No demos being recorded.\n");
+}
+
+/*
+============
+Demo_Init
+============
+*/
+void Demo_Init (void)
+{
+    demo_blocks = Cvar_Get ("demo_blocks", "2", 0);
+    demo_compress = Cvar_Get ("demo_compress", "0", 0);
+    Cmd_AddCommand ("demostats", Demo_Stats_f);
+}
+
+/*
+============
+Demo_Shutdown
+
+Finishes every demo still being written, for Sys_Quit and Sys_Error
+============
+*/
+void Demo_Shutdown (void)
+{
+    int        i;
+
+    for (i=0 ; i<MAX_DEMOS ; i++)
+        if (demo_open[i])
+            Demo_Close (demo_open[i]);
+}
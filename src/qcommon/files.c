@@ -21,6 +21,16 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <q_resources.h>
 #include "qcommon.h"
 
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#endif
+
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
 // define this to dissalow any data but the demo pak file
 //#define    NO_ADDONS
 
@@ -45,10 +55,15 @@ QUAKE FILESYSTEM
 // in memory
 //
 
+#define    PACK_STORED        0        // zip compression methods
+#define    PACK_DEFLATED    8
+
 typedef struct
 {
     char    name[MAX_QPATH];
     int        filepos, filelen;
+    int        complen;        // bytes in the pak, != filelen if compressed
+    int        method;            // PACK_STORED or PACK_DEFLATED
 } packfile_t;
 
 typedef struct pack_s
@@ -57,8 +72,34 @@ typedef struct pack_s
     FILE    *handle;
     int        numfiles;
     packfile_t    *files;
+    int        *hash;            // [hashsize] indexes into files, -1 for empty
+    int        hashsize;        // power of two
+    byte    *mapped;        // whole pak mapped read only, or NULL
+    int        mapsize;
 } pack_t;
 
+// pak entries at least this big are returned from FS_LoadFile as
+// a private copy-on-write mapping instead of being copied
+#define    FS_MAP_MIN    0x10000
+
+// FS_LoadFile buffers that FS_FreeFile has to munmap or free instead
+// of Z_Free
+typedef struct mappedfile_s
+{
+    struct mappedfile_s    *next;
+    void    *buffer;        // what FS_LoadFile returned
+    void    *base;            // page aligned start of the mapping, NULL if malloc'd
+    int        size;
+} mappedfile_t;
+
+mappedfile_t    *fs_mappedfiles;
+
+// fs_stats counters
+int        fs_lookups;            // pak hash lookups
+int        fs_probes;            // hash slots looked at by those lookups
+int        fs_bytescopied;        // FS_LoadFile bytes read or copied into a buffer
+int        fs_bytesmapped;        // FS_LoadFile bytes returned as a mapping
+
 char    fs_gamedir[MAX_OSPATH];
 cvar_t    *fs_basedir;
 cvar_t    *fs_cddir;
@@ -84,6 +125,9 @@ typedef struct searchpath_s
 searchpath_t    *fs_searchpaths;
 searchpath_t    *fs_base_searchpaths;    // without gamedirs
 
+char **FS_ListFiles (char *findname, int *numfiles, unsigned musthave, unsigned canthave);
+qboolean FS_InflatePackFile (pack_t *pak, packfile_t *entry, byte *out);
+
 
 /*
 
@@ -192,28 +236,132 @@ int    Developer_searchpath (int who)
 }
 
 
+/*
+================
+FS_HashName
+
+Case insensitive, to match the Q_strcasecmp lookups
+================
+*/
+static unsigned FS_HashName (char *name)
+{
+    unsigned    hash;
+    int            c;
+
+    hash = 0;
+    while (*name)
+    {
+        c = *name++;
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        hash = hash * 33 + c;
+    }
+    return hash ^ (hash >> 16);
+}
+
+/*
+================
+FS_PackLookup
+
+Returns the pak entry for filename, or NULL
+================
+*/
+static packfile_t *FS_PackSearch (pack_t *pak, char *filename, int *probes)
+{
+    int        slot, i;
+
+    slot = FS_HashName (filename) & (pak->hashsize-1);
+    while (1)
+    {
+        (*probes)++;
+        i = pak->hash[slot];
+        if (i == -1)
+            return NULL;
+        if (!Q_strcasecmp (pak->files[i].name, filename))
+            return &pak->files[i];
+        slot = (slot+1) & (pak->hashsize-1);
+    }
+}
+
+packfile_t *FS_PackLookup (pack_t *pak, char *filename)
+{
+    fs_lookups++;
+    return FS_PackSearch (pak, filename, &fs_probes);
+}
+
+/*
+================
+FS_HashPack
+
+Builds the open addressed name index for a pak, at most half full
+================
+*/
+void FS_HashPack (pack_t *pak)
+{
+    int        i, slot;
+
+    pak->hashsize = 64;
+    while (pak->hashsize < pak->numfiles*2)
+        pak->hashsize <<= 1;
+
+    pak->hash = Z_Malloc (pak->hashsize * sizeof(int));
+    for (i=0 ; i<pak->hashsize ; i++)
+        pak->hash[i] = -1;
+
+    // insert backwards so the first of any duplicate names wins,
+    // like the old linear search
+    for (i=pak->numfiles-1 ; i>=0 ; i--)
+    {
+        slot = FS_HashName (pak->files[i].name) & (pak->hashsize-1);
+        while (pak->hash[slot] != -1)
+        {
+            if (!Q_strcasecmp (pak->files[pak->hash[slot]].name, pak->files[i].name))
+                break;        // replace the later duplicate
+            slot = (slot+1) & (pak->hashsize-1);
+        }
+        pak->hash[slot] = i;
+    }
+}
+
+/*
+================
+FS_FreePack
+================
+*/
+void FS_FreePack (pack_t *pak)
+{
+    fclose (pak->handle);
+#ifndef _WIN32
+    if (pak->mapped)
+        munmap (pak->mapped, pak->mapsize);
+#endif
+    Z_Free (pak->hash);
+    Z_Free (pak->files);
+    Z_Free (pak);
+}
+
+
 /*
 ===========
-FS_FOpenFile
+FS_FindFile
 
-Finds the file in the search path.
-returns filesize and an open FILE *
-Used for streaming data out of either a pak file or
-a seperate file.
+Finds the file in the search path.  Returns the length and either an
+open FILE * for a loose file, or the pak and entry it is in.
+Returns -1 if it isn't found.
 ===========
 */
-int file_from_pak = 0;
-#ifndef NO_ADDONS
-int FS_FOpenFile (char *filename, FILE **file)
+int FS_FindFile (char *filename, FILE **file, pack_t **pak, packfile_t **entry)
 {
     searchpath_t    *search;
     char            netpath[MAX_OSPATH];
-    pack_t            *pak;
-    int                i;
+    packfile_t        *pakfile;
     filelink_t        *link;
 
-    file_from_pak = 0;
+    *file = NULL;
+    *pak = NULL;
+    *entry = NULL;
 
+#ifndef NO_ADDONS
     // check for links first
     for (link = fs_links ; link ; link=link->next)
     {
@@ -238,20 +386,14 @@ int FS_FOpenFile (char *filename, FILE **file)
     // is the element a pak file?
         if (search->pack)
         {
-        // look through all the pak file elements
-            pak = search->pack;
-            for (i=0 ; i<pak->numfiles ; i++)
-                if (!Q_strcasecmp (pak->files[i].name, filename))
-                {    // found it!
-                    file_from_pak = 1;
-                    Com_DPrintf ("PackFile: %s : %s\n",pak->filename, filename);
-                // open a new file on the pakfile
-                    *file = fopen (pak->filename, "rb");
-                    if (!*file)
-                        Com_Error (ERR_FATAL, "Couldn't reopen %s", pak->filename);    
-                    fseek (*file, pak->files[i].filepos, SEEK_SET);
-                    return pak->files[i].filelen;
-                }
+            pakfile = FS_PackLookup (search->pack, filename);
+            if (pakfile)
+            {    // found it!
+                Com_DPrintf ("PackFile: %s : %s\n",search->pack->filename, filename);
+                *pak = search->pack;
+                *entry = pakfile;
+                return pakfile->filelen;
+            }
         }
         else
         {        
@@ -269,26 +411,10 @@ int FS_FOpenFile (char *filename, FILE **file)
         }
         
     }
-    
-    Com_DPrintf ("FindFile: can't find %s\n", filename);
-    
-    *file = NULL;
-    return -1;
-}
-
 #else
 
 // this is just for demos to prevent add on hacking
 
-int FS_FOpenFile (char *filename, FILE **file)
-{
-    searchpath_t    *search;
-    char            netpath[MAX_OSPATH];
-    pack_t            *pak;
-    int                i;
-
-    file_from_pak = 0;
-
     // get config from directory, everything else from pak
     if (!strcmp(filename, "config.cfg") || !strncmp(filename, "players/", 8))
     {
@@ -306,91 +432,776 @@ int FS_FOpenFile (char *filename, FILE **file)
     for (search = fs_searchpaths ; search ; search = search->next)
         if (search->pack)
             break;
-    if (!search)
+    if (search)
     {
-        *file = NULL;
-        return -1;
-    }
-
-    pak = search->pack;
-    for (i=0 ; i<pak->numfiles ; i++)
-        if (!Q_strcasecmp (pak->files[i].name, filename))
+        pakfile = FS_PackLookup (search->pack, filename);
+        if (pakfile)
         {    // found it!
-            file_from_pak = 1;
-            Com_DPrintf ("PackFile: %s : %s\n",pak->filename, filename);
-        // open a new file on the pakfile
-            *file = fopen (pak->filename, "rb");
-            if (!*file)
-                Com_Error (ERR_FATAL, "Couldn't reopen %s", pak->filename);    
-            fseek (*file, pak->files[i].filepos, SEEK_SET);
-            return pak->files[i].filelen;
+            Com_DPrintf ("PackFile: %s : %s\n",search->pack->filename, filename);
+            *pak = search->pack;
+            *entry = pakfile;
+            return pakfile->filelen;
         }
+    }
+#endif
     
     Com_DPrintf ("FindFile: can't find %s\n", filename);
     
-    *file = NULL;
     return -1;
 }
 
-#endif
 
+/*
+===========
+FS_FOpenFile
+
+Finds the file in the search path.
+returns filesize and an open FILE *
+Used for streaming data out of either a pak file or
+a seperate file.
+===========
+*/
+int file_from_pak = 0;
+int FS_FOpenFile (char *filename, FILE **file)
+{
+    pack_t            *pak;
+    packfile_t        *entry;
+    int                len;
+
+    file_from_pak = 0;
+
+    len = FS_FindFile (filename, file, &pak, &entry);
+    if (!pak)
+        return len;
+
+    file_from_pak = 1;
+
+    if (entry->method != PACK_STORED)
+    {    // callers want to fread it, so give them a decompressed copy
+        byte    *buf;
+
+        buf = Z_Malloc (len);
+        *file = FS_InflatePackFile (pak, entry, buf) ? tmpfile () : NULL;
+        if (*file)
+        {
+            fwrite (buf, 1, len, *file);
+            fseek (*file, 0, SEEK_SET);
+        }
+        Z_Free (buf);
+        return *file ? len : -1;
+    }
+
+// open a new file on the pakfile
+    *file = fopen (pak->filename, "rb");
+    if (!*file)
+        Com_Error (ERR_FATAL, "Couldn't reopen %s", pak->filename);    
+    fseek (*file, entry->filepos, SEEK_SET);
+    return len;
+}
+
+
+/*
+=================
+FS_ReadFile
+
+Properly handles partial reads
+=================
+*/
+#define    MAX_READ    0x10000        // read in blocks of 64k
+void FS_Read (void *buffer, int len, FILE *f)
+{
+    int        block, remaining;
+    int        read;
+    byte    *buf;
+
+    buf = (byte *)buffer;
+
+    // read in chunks for progress bar
+    remaining = len;
+    while (remaining)
+    {
+        block = remaining;
+        if (block > MAX_READ)
+            block = MAX_READ;
+        read = fread (buf, 1, block, f);
+        if (read == 0)
+            Com_Error (ERR_FATAL, "FS_Read: 0 bytes read");
+
+        if (read == -1)
+            Com_Error (ERR_FATAL, "FS_Read: -1 bytes read");
+
+        // do some progress bar thing here...
+
+        remaining -= read;
+        buf += read;
+    }
+}
+
+/*
+============
+FS_MapPackFile
+
+Returns a private, copy-on-write mapping of a pak entry, so callers
+that byte swap or otherwise scribble on their buffer can't affect
+anyone else.  Returns NULL if it can't be mapped.
+============
+*/
+void *FS_MapPackFile (pack_t *pak, packfile_t *entry)
+{
+#ifndef _WIN32
+    mappedfile_t    *mf;
+    long            pagesize;
+    int                pageofs;
+    byte            *base;
+
+    pagesize = sysconf (_SC_PAGESIZE);
+    pageofs = entry->filepos % pagesize;
+
+    base = mmap (NULL, entry->filelen + pageofs, PROT_READ|PROT_WRITE,
+        MAP_PRIVATE, fileno (pak->handle), entry->filepos - pageofs);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    mf = Z_Malloc (sizeof(*mf));
+    mf->buffer = base + pageofs;
+    mf->base = base;
+    mf->size = entry->filelen + pageofs;
+    mf->next = fs_mappedfiles;
+    fs_mappedfiles = mf;
+
+    return mf->buffer;
+#else
+    return NULL;
+#endif
+}
+
+/*
+============
+FS_InflatePackFile
+
+Decompresses a deflated zip entry straight into out, which must hold
+entry->filelen bytes.  The compressed data comes from the pak mapping,
+or is streamed from the file a block at a time.
+============
+*/
+qboolean FS_InflatePackFile (pack_t *pak, packfile_t *entry, byte *out)
+{
+#ifdef USE_ZLIB
+    z_stream    zs;
+    byte        block[MAX_READ];
+    int            remaining, chunk;
+    int            err;
+
+    if (entry->method != PACK_DEFLATED)
+        return false;
+
+    memset (&zs, 0, sizeof(zs));
+    if (inflateInit2 (&zs, -MAX_WBITS) != Z_OK)    // raw deflate, no zlib header
+        return false;
+
+    zs.next_out = out;
+    zs.avail_out = entry->filelen;
+
+    if (pak->mapped)
+    {
+        zs.next_in = pak->mapped + entry->filepos;
+        zs.avail_in = entry->complen;
+        err = inflate (&zs, Z_FINISH);
+    }
+    else
+    {
+        fseek (pak->handle, entry->filepos, SEEK_SET);
+        remaining = entry->complen;
+        err = Z_OK;
+        while (remaining && err == Z_OK)
+        {
+            chunk = remaining > sizeof(block) ? sizeof(block) : remaining;
+            FS_Read (block, chunk, pak->handle);
+            remaining -= chunk;
+            zs.next_in = block;
+            zs.avail_in = chunk;
+            err = inflate (&zs, remaining ? Z_NO_FLUSH : Z_FINISH);
+        }
+    }
+
+    inflateEnd (&zs);
+    return err == Z_STREAM_END && zs.total_out == entry->filelen;
+#else
+    return false;
+#endif
+}
+
+/*
+=============================================================================
+
+PREFETCHING
+
+While a level loads, a worker thread reads ahead through the files the
+client is about to register, so disk reads and inflating overlap the
+main thread parsing and uploading the files before them.  Stored pak
+entries are only touched, since FS_LoadFile maps or copies those from
+the pak mapping anyway; loose and compressed files are read into a
+malloc'd buffer that FS_LoadFile hands over as is.
+
+The worker never calls Com_Printf, Z_Malloc or anything else that
+isn't thread safe, and only reads from paks through their mapping.
+
+=============================================================================
+*/
+
+#if !defined(_WIN32) && !defined(NO_ADDONS)
+#define    FS_PREFETCH
+#endif
+
+#define    MAX_PREFETCH    4096
+#define    PREFETCH_HASH    (MAX_PREFETCH*2)
+
+#define    PF_QUEUED        0        // waiting for the worker
+#define    PF_LOADING        1        // the worker is reading it
+#define    PF_DONE            2        // data is ready, or NULL if it was only touched
+#define    PF_TAKEN        3        // FS_LoadFile has had it
+
+typedef struct
+{
+    char    name[MAX_QPATH];
+    int        state;
+    int        next;            // load order, -1 at the end
+    byte    *data;            // malloc'd, for FS_LoadFile to take
+    int        len;
+} prefetch_t;
+
+cvar_t    *fs_prefetch;
+
+#ifdef FS_PREFETCH
+
+static prefetch_t        pf_files[MAX_PREFETCH];
+static int                pf_hash[PREFETCH_HASH];    // indexes into pf_files, -1 for empty
+static int                pf_numfiles;
+static int                pf_head, pf_tail;        // load order, -1 when empty
+static int                pf_bytes;                // held in PF_DONE buffers
+static int                pf_maxbytes;
+static int                pf_generation;            // bumped by FS_PrefetchFlush
+static qboolean            pf_busy;                // the worker is loading something
+static qboolean            pf_started;
+
+static pthread_t        pf_thread;
+static pthread_mutex_t    pf_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t    pf_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t    pf_done = PTHREAD_COND_INITIALIZER;
+
+/*
+============
+FS_PrefetchFind
+
+Returns the pf_files index for name, or -1.  Call with pf_lock held.
+============
+*/
+static int FS_PrefetchFind (char *name, int *slot)
+{
+    int        i;
+
+    *slot = FS_HashName (name) & (PREFETCH_HASH-1);
+    while ((i = pf_hash[*slot]) != -1)
+    {
+        if (!Q_strcasecmp (pf_files[i].name, name))
+            return i;
+        *slot = (*slot+1) & (PREFETCH_HASH-1);
+    }
+    return -1;
+}
+
+/*
+============
+FS_PrefetchQueue
+
+Adds name to the load order after entry after, or at the end if after
+is -1, unless it is already queued.  Returns the new entry or after.
+Call with pf_lock held.
+============
+*/
+static int FS_PrefetchQueue (char *name, int after)
+{
+    prefetch_t    *pf;
+    int            i, slot;
+
+    if (strlen (name) >= MAX_QPATH || pf_numfiles == MAX_PREFETCH)
+        return after;
+    if (FS_PrefetchFind (name, &slot) != -1)
+        return after;
+
+    i = pf_numfiles++;
+    pf = &pf_files[i];
+    strcpy (pf->name, name);
+    pf->state = PF_QUEUED;
+    pf->data = NULL;
+    pf->len = 0;
+    pf_hash[slot] = i;
+
+    if (after == -1)
+    {
+        pf->next = -1;
+        if (pf_tail != -1)
+            pf_files[pf_tail].next = i;
+        pf_tail = i;
+        if (pf_head == -1)
+            pf_head = i;
+    }
+    else
+    {
+        pf->next = pf_files[after].next;
+        pf_files[after].next = i;
+        if (pf_tail == after)
+            pf_tail = i;
+    }
+    return i;
+}
+
+/*
+============
+FS_PrefetchDependencies
+
+Queues the textures of a bsp and the skins of an md2 or sp2 right after
+it, since they get loaded next.  Call with pf_lock held.
+============
+*/
+static void FS_PrefetchDependencies (int parent, char *name, byte *data, int len)
+{
+    char        *ext;
+    char        path[MAX_QPATH+16];
+    char        skin[MAX_SKINNAME];
+    int            i, ofs, count;
+    dheader_t    *bsp;
+    texinfo_t    *tex;
+    dmdl_t        *md2;
+    dsprite_t    *sp2;
+
+    ext = strrchr (name, '.');
+    if (!ext || len < 8)
+        return;
+
+    if (!Q_strcasecmp (ext, ".bsp") && len >= sizeof(dheader_t))
+    {
+        bsp = (dheader_t *)data;
+        if (LittleLong (bsp->ident) != IDBSPHEADER)
+            return;
+        ofs = LittleLong (bsp->lumps[LUMP_TEXINFO].fileofs);
+        count = LittleLong (bsp->lumps[LUMP_TEXINFO].filelen) / sizeof(texinfo_t);
+        if (ofs < 0 || count < 0 || ofs + count * sizeof(texinfo_t) > len)
+            return;
+        tex = (texinfo_t *)(data + ofs);
+        for (i=0 ; i<count ; i++, tex++)
+        {
+            snprintf (path, sizeof(path), "textures/%.*s.wal", (int)sizeof(tex->texture), tex->texture);
+            parent = FS_PrefetchQueue (path, parent);
+        }
+    }
+    else if (!Q_strcasecmp (ext, ".md2") && len >= sizeof(dmdl_t))
+    {
+        md2 = (dmdl_t *)data;
+        if (LittleLong (md2->ident) != IDALIASHEADER)
+            return;
+        ofs = LittleLong (md2->ofs_skins);
+        count = LittleLong (md2->num_skins);
+        if (ofs < 0 || count < 0 || ofs + count * MAX_SKINNAME > len)
+            return;
+        for (i=0 ; i<count ; i++)
+        {
+            memcpy (skin, data + ofs + i*MAX_SKINNAME, MAX_SKINNAME);
+            skin[MAX_SKINNAME-1] = 0;
+            parent = FS_PrefetchQueue (skin, parent);
+        }
+    }
+    else if (!Q_strcasecmp (ext, ".sp2") && len >= sizeof(dsprite_t))
+    {
+        sp2 = (dsprite_t *)data;
+        if (LittleLong (sp2->ident) != IDSPRITEHEADER)
+            return;
+        count = LittleLong (sp2->numframes);
+        ofs = (byte *)sp2->frames - data;
+        if (count < 0 || ofs + count * sizeof(dsprframe_t) > len)
+            return;
+        for (i=0 ; i<count ; i++)
+        {
+            memcpy (skin, sp2->frames[i].name, MAX_SKINNAME);
+            skin[MAX_SKINNAME-1] = 0;
+            parent = FS_PrefetchQueue (skin, parent);
+        }
+    }
+}
+
+/*
+============
+FS_PrefetchLoose
+
+Reads all of an opened loose file into a malloc'd buffer
+============
+*/
+static byte *FS_PrefetchLoose (FILE *f, byte **data, int *len)
+{
+    byte    *buf;
+
+    *len = FS_filelength (f);
+    buf = malloc (*len ? *len : 1);
+    if (buf && fread (buf, 1, *len, f) != *len)
+    {
+        free (buf);
+        buf = NULL;
+    }
+    fclose (f);
+
+    *data = buf;
+    return buf;
+}
+
+/*
+============
+FS_PrefetchLoad
+
+Finds name the same way FS_FindFile does, without printing anything.
+A stored pak entry has its pages touched and NULL is returned; anything
+else is read into a buffer for FS_LoadFile to take.  *data points at
+the contents either way, or NULL if they couldn't be read here.
+============
+*/
+static byte *FS_PrefetchLoad (char *name, byte **data, int *len)
+{
+    searchpath_t    *search;
+    filelink_t        *link;
+    packfile_t        *entry;
+    pack_t            *pak;
+    char            netpath[MAX_OSPATH+MAX_QPATH];
+    FILE            *f;
+    byte            *buf;
+    volatile byte    sum;
+    int                i, probes;
+    long            pagesize;
+    size_t            ofs;
+
+    *data = NULL;
+    *len = 0;
+    probes = 0;        // not counted in fs_stats, that isn't thread safe
+
+    for (link = fs_links ; link ; link=link->next)
+    {
+        if (!strncmp (name, link->from, link->fromlength))
+        {
+            // a truncated path could open some other file
+            if (snprintf (netpath, sizeof(netpath), "%s%s", link->to, name+link->fromlength) >= sizeof(netpath))
+                return NULL;
+            f = fopen (netpath, "rb");
+            return f ? FS_PrefetchLoose (f, data, len) : NULL;
+        }
+    }
+
+    for (search = fs_searchpaths ; search ; search = search->next)
+    {
+        pak = search->pack;
+        if (!pak)
+        {
+            if (snprintf (netpath, sizeof(netpath), "%s/%s", search->filename, name) >= sizeof(netpath))
+                continue;
+            f = fopen (netpath, "rb");
+            if (!f)
+                continue;
+            return FS_PrefetchLoose (f, data, len);
+        }
+
+        entry = FS_PackSearch (pak, name, &probes);
+        if (!entry)
+            continue;
+        if (!pak->mapped)
+            return NULL;        // would have to share the pak's FILE
+
+        *len = entry->filelen;
+        if (entry->method == PACK_STORED)
+        {
+            *data = pak->mapped + entry->filepos;
+
+            // start the readahead, then fault every page in
+            pagesize = sysconf (_SC_PAGESIZE);
+            ofs = entry->filepos & ~(pagesize-1);
+            madvise (pak->mapped + ofs, entry->filepos + entry->filelen - ofs, MADV_WILLNEED);
+            for (i=0, sum=0 ; i<entry->filelen ; i+=pagesize)
+                sum += (*data)[i];
+            return NULL;
+        }
+
+        buf = malloc (entry->filelen ? entry->filelen : 1);
+        if (buf && !FS_InflatePackFile (pak, entry, buf))
+        {
+            free (buf);
+            buf = NULL;
+        }
+        *data = buf;
+        return buf;
+    }
+
+    return NULL;
+}
+
+/*
+============
+FS_PrefetchThread
+============
+*/
+static void *FS_PrefetchThread (void *arg)
+{
+    prefetch_t    *pf;
+    char        name[MAX_QPATH];
+    byte        *buf, *data;
+    int            i, len, generation;
+
+    pthread_mutex_lock (&pf_lock);
+    while (1)
+    {
+        // skip anything FS_LoadFile got to first
+        while (pf_head != -1 && pf_files[pf_head].state != PF_QUEUED)
+            pf_head = pf_files[pf_head].next;
+        if (pf_head == -1 || pf_bytes >= pf_maxbytes)
+        {
+            pthread_cond_wait (&pf_wake, &pf_lock);
+            continue;
+        }
+
+        // pf_head stays on this entry while it loads, so anything
+        // queued meanwhile goes after it
+        i = pf_head;
+        pf = &pf_files[i];
+        pf->state = PF_LOADING;
+        strcpy (name, pf->name);
+        generation = pf_generation;
+        pf_busy = true;
+        pthread_mutex_unlock (&pf_lock);
+
+        buf = FS_PrefetchLoad (name, &data, &len);
+
+        pthread_mutex_lock (&pf_lock);
+        if (generation == pf_generation)
+        {
+            if (data)
+                FS_PrefetchDependencies (i, name, data, len);
+            pf->data = buf;
+            pf->len = len;
+            pf->state = PF_DONE;
+            if (buf)
+                pf_bytes += len;
+            pf_head = pf->next;
+        }
+        else if (buf)
+            free (buf);        // flushed while we were reading it
+        pf_busy = false;
+        pthread_cond_broadcast (&pf_done);
+    }
+    return NULL;
+}
+
+/*
+============
+FS_TakePrefetch
+
+If the prefetch thread has read path, hands its buffer over and returns
+the length.  Returns -1 to load it normally.
+============
+*/
+static int FS_TakePrefetch (char *path, void **buffer)
+{
+    prefetch_t    *pf;
+    int            i, slot, len;
+
+    *buffer = NULL;
+    if (!pf_started)
+        return -1;
+
+    pthread_mutex_lock (&pf_lock);
+    i = FS_PrefetchFind (path, &slot);
+    if (i == -1)
+    {
+        pthread_mutex_unlock (&pf_lock);
+        return -1;
+    }
+
+    pf = &pf_files[i];
+    while (pf->state == PF_LOADING)
+        pthread_cond_wait (&pf_done, &pf_lock);
+
+    len = -1;
+    if (pf->state == PF_QUEUED)
+        fs_loadstats.missed++;        // get it ourselves, the thread will skip it
+    else if (pf->state == PF_DONE)
+    {
+        if (pf->data)
+        {
+            mappedfile_t    *mf;
+
+            mf = Z_Malloc (sizeof(*mf));
+            mf->buffer = pf->data;
+            mf->next = fs_mappedfiles;
+            fs_mappedfiles = mf;
+
+            *buffer = pf->data;
+            len = pf->len;
+            pf_bytes -= len;
+            fs_loadstats.prefetched++;
+            pthread_cond_signal (&pf_wake);        // there's room again
+        }
+        else if (pf->len)
+            fs_loadstats.warmed++;
+        pf->data = NULL;
+    }
+    pf->state = PF_TAKEN;
+    pthread_mutex_unlock (&pf_lock);
+
+    return len;
+}
+
+/*
+============
+FS_PrefetchConfigstrings
+
+Queues everything the client will load for these configstrings, in the
+order CL_RegisterSounds and CL_PrepRefresh load them
+============
+*/
+void FS_PrefetchConfigstrings (char configstrings[][MAX_QPATH])
+{
+    static char    *suf[6] = {"rt", "bk", "lf", "ft", "up", "dn"};
+    char        name[MAX_QPATH+16];
+    char        *s;
+    int            i;
+
+    if (!fs_prefetch->value || (dedicated && dedicated->value))
+        return;
+
+    if (!pf_started)
+    {
+        pf_head = pf_tail = -1;
+        for (i=0 ; i<PREFETCH_HASH ; i++)
+            pf_hash[i] = -1;
+        if (pthread_create (&pf_thread, NULL, FS_PrefetchThread, NULL))
+            return;
+        pf_started = true;
+    }
+
+    pthread_mutex_lock (&pf_lock);
+    pf_maxbytes = fs_prefetch->value * 1024 * 1024;
+
+    for (i=1 ; i<MAX_SOUNDS && configstrings[CS_SOUNDS+i][0] ; i++)
+    {
+        s = configstrings[CS_SOUNDS+i];
+        if (s[0] == '*')
+            continue;        // sexed sounds depend on the player model
+        if (s[0] == '#')
+            FS_PrefetchQueue (s+1, -1);
+        else
+        {
+            Com_sprintf (name, sizeof(name), "sound/%s", s);
+            FS_PrefetchQueue (name, -1);
+        }
+    }
+
+    // the map comes first, so its textures are queued right behind it
+    for (i=1 ; i<MAX_MODELS && configstrings[CS_MODELS+i][0] ; i++)
+    {
+        s = configstrings[CS_MODELS+i];
+        if (s[0] != '*' && s[0] != '#')
+            FS_PrefetchQueue (s, -1);
+    }
+
+    for (i=1 ; i<MAX_IMAGES && configstrings[CS_IMAGES+i][0] ; i++)
+    {
+        s = configstrings[CS_IMAGES+i];
+        if (s[0] == '/' || s[0] == '\\')
+            FS_PrefetchQueue (s+1, -1);
+        else
+        {
+            Com_sprintf (name, sizeof(name), "pics/%s.pcx", s);
+            FS_PrefetchQueue (name, -1);
+        }
+    }
+
+    if (configstrings[CS_SKY][0])
+    {
+        for (i=0 ; i<6 ; i++)
+        {
+            Com_sprintf (name, sizeof(name), "env/%s%s.pcx", configstrings[CS_SKY], suf[i]);
+            FS_PrefetchQueue (name, -1);
+        }
+    }
+
+    pthread_cond_signal (&pf_wake);
+    pthread_mutex_unlock (&pf_lock);
+}
 
 /*
-=================
-FS_ReadFile
+============
+FS_PrefetchFlush
 
-Properly handles partial reads
-=================
+Frees anything that was read ahead but never loaded, and waits for the
+thread to stop using the search path, so it can be changed.
+============
 */
-#define    MAX_READ    0x10000        // read in blocks of 64k
-void FS_Read (void *buffer, int len, FILE *f)
+void FS_PrefetchFlush (void)
 {
-    int        block, remaining;
-    int        read;
-    byte    *buf;
+    int        i;
 
-    buf = (byte *)buffer;
+    if (!pf_started)
+        return;
 
-    // read in chunks for progress bar
-    remaining = len;
-    while (remaining)
-    {
-        block = remaining;
-        if (block > MAX_READ)
-            block = MAX_READ;
-        read = fread (buf, 1, block, f);
-        if (read == 0)
-            Com_Error (ERR_FATAL, "FS_Read: 0 bytes read");
+    pthread_mutex_lock (&pf_lock);
+    pf_generation++;
+    while (pf_busy)
+        pthread_cond_wait (&pf_done, &pf_lock);
+
+    for (i=0 ; i<pf_numfiles ; i++)
+        if (pf_files[i].data)
+            free (pf_files[i].data);
+    for (i=0 ; i<PREFETCH_HASH ; i++)
+        pf_hash[i] = -1;
+    pf_numfiles = 0;
+    pf_head = pf_tail = -1;
+    pf_bytes = 0;
+    pthread_mutex_unlock (&pf_lock);
+}
 
-        if (read == -1)
-            Com_Error (ERR_FATAL, "FS_Read: -1 bytes read");
+#else    // !FS_PREFETCH
 
-        // do some progress bar thing here...
+static int FS_TakePrefetch (char *path, void **buffer)
+{
+    *buffer = NULL;
+    return -1;
+}
 
-        remaining -= read;
-        buf += read;
-    }
+void FS_PrefetchConfigstrings (char configstrings[][MAX_QPATH])
+{
 }
 
+void FS_PrefetchFlush (void)
+{
+}
+
+#endif
+
 /*
 ============
-FS_LoadFile
+FS_LoadFileData
 
 Filename are reletive to the quake search path
 a null buffer will just return the file length without loading
 ============
 */
-int FS_LoadFile (char *path, void **buffer)
+static int FS_LoadFileData (char *path, void **buffer)
 {
     FILE    *h;
     byte    *buf;
     int        len;
+    pack_t    *pak;
+    packfile_t    *entry;
 
     buf = NULL;    // quiet compiler warning
 
 // look for it in the filesystem or pack files
-    len = FS_FOpenFile (path, &h);
-    if (!h)
+    len = FS_FindFile (path, &h, &pak, &entry);
+    if (len == -1)
     {
         if (buffer)
             *buffer = NULL;
@@ -399,12 +1210,60 @@ int FS_LoadFile (char *path, void **buffer)
     
     if (!buffer)
     {
-        fclose (h);
+        if (h)
+            fclose (h);
+        return len;
+    }
+
+    if (pak && entry->method != PACK_STORED)
+    {
+        buf = Z_Malloc(len);
+        *buffer = buf;
+        fs_bytescopied += len;
+        if (!FS_InflatePackFile (pak, entry, buf))
+        {
+            Com_Printf ("FS_LoadFile: couldn't decompress %s\n", path);
+            Z_Free (buf);
+            *buffer = NULL;
+            return -1;
+        }
         return len;
     }
 
-    buf = Z_Malloc(len);
-    *buffer = buf;
+    if (pak)
+    {
+        if (len >= FS_MAP_MIN)
+        {
+            buf = FS_MapPackFile (pak, entry);
+            if (buf)
+            {
+                fs_bytesmapped += len;
+                *buffer = buf;
+                return len;
+            }
+        }
+
+        buf = Z_Malloc(len);
+        *buffer = buf;
+        fs_bytescopied += len;
+
+        if (pak->mapped)
+        {
+            memcpy (buf, pak->mapped + entry->filepos, len);
+            return len;
+        }
+
+        h = fopen (pak->filename, "rb");
+        if (!h)
+            Com_Error (ERR_FATAL, "Couldn't reopen %s", pak->filename);    
+        fseek (h, entry->filepos, SEEK_SET);
+    }
+    else
+    {
+        buf = Z_Malloc(len);
+        *buffer = buf;
+        fs_bytescopied += len;
+    }
 
     FS_Read (buf, len, h);
 
@@ -414,6 +1273,37 @@ int FS_LoadFile (char *path, void **buffer)
 }
 
 
+/*
+============
+FS_LoadFile
+
+Takes the file from the prefetch thread if it has it ready
+============
+*/
+fsloadstats_t    fs_loadstats;
+
+int FS_LoadFile (char *path, void **buffer)
+{
+    double    start;
+    int        len;
+
+    if (!buffer)
+        return FS_LoadFileData (path, NULL);
+
+    start = Sys_FloatTime ();
+    len = FS_TakePrefetch (path, buffer);
+    if (len == -1)
+        len = FS_LoadFileData (path, buffer);
+    fs_loadstats.time += Sys_FloatTime () - start;
+
+    if (*buffer)
+    {
+        fs_loadstats.files++;
+        fs_loadstats.bytes += len;
+    }
+    return len;
+}
+
 /*
 =============
 FS_FreeFile
@@ -421,9 +1311,232 @@ FS_FreeFile
 */
 void FS_FreeFile (void *buffer)
 {
+    mappedfile_t    *mf, **prev;
+
+    prev = &fs_mappedfiles;
+    for (mf = fs_mappedfiles ; mf ; mf = mf->next)
+    {
+        if (mf->buffer == buffer)
+        {
+            if (!mf->base)
+                free (mf->buffer);        // handed over by the prefetch thread
+#ifndef _WIN32
+            else
+                munmap (mf->base, mf->size);
+#endif
+            *prev = mf->next;
+            Z_Free (mf);
+            return;
+        }
+        prev = &mf->next;
+    }
+
     Z_Free (buffer);
 }
 
+/*
+============
+FS_Stats_f
+============
+*/
+void FS_Stats_f (void)
+{
+    mappedfile_t    *mf;
+    int                count;
+
+    count = 0;
+    for (mf = fs_mappedfiles ; mf ; mf = mf->next)
+        if (mf->base)
+            count++;
+
+    Com_Printf ("%i pak lookups, %.2f probes per lookup\n", fs_lookups,
+        fs_lookups ? (float)fs_probes / fs_lookups : 0);
+    Com_Printf ("%i bytes copied, %i bytes mapped, %i mappings open\n",
+        fs_bytescopied, fs_bytesmapped, count);
+    Com_Printf ("%i files prefetched, %i warmed, %i missed\n",
+        fs_loadstats.prefetched, fs_loadstats.warmed, fs_loadstats.missed);
+}
+
+/*
+=================
+FS_NewPack
+
+Opens the mapping for a pak or pk3 whose directory is about to be read
+=================
+*/
+pack_t *FS_NewPack (char *packfile, FILE *packhandle)
+{
+    pack_t    *pack;
+
+    pack = Z_Malloc (sizeof (pack_t));
+    strcpy (pack->filename, packfile);
+    pack->handle = packhandle;
+    pack->mapsize = FS_filelength (packhandle);
+
+#ifndef _WIN32
+    // map the whole thing once, so small files are just a memcpy
+    pack->mapped = mmap (NULL, pack->mapsize, PROT_READ, MAP_PRIVATE, fileno (packhandle), 0);
+    if (pack->mapped == MAP_FAILED)
+        pack->mapped = NULL;
+#endif
+
+    return pack;
+}
+
+/*
+=================
+FS_FinishPack
+
+Checks the directory and builds its hash index
+=================
+*/
+void FS_FinishPack (pack_t *pack)
+{
+    int            i;
+    packfile_t    *f;
+
+    // don't trust the directory with reads past the end.  stored entries
+    // are read for filelen bytes, so that has to be what is in the pak,
+    // and the end is found by subtracting so a huge entry can't wrap
+    for (i=0, f=pack->files ; i<pack->numfiles ; i++, f++)
+        if (f->filepos < 0 || f->filelen < 0 || f->complen < 0
+            || f->filepos > pack->mapsize || f->complen > pack->mapsize - f->filepos
+            || (f->method == PACK_STORED && f->filelen != f->complen))
+            Com_Error (ERR_FATAL, "%s has a bad directory entry for %s", pack->filename, f->name);
+
+    FS_HashPack (pack);
+}
+
+/*
+=================
+FS_ReadPackBytes
+
+Reads from anywhere in a pak, through the mapping if there is one
+=================
+*/
+qboolean FS_ReadPackBytes (pack_t *pack, int ofs, void *out, int len)
+{
+    if (ofs < 0 || len < 0 || ofs > pack->mapsize || len > pack->mapsize - ofs)
+        return false;
+    if (pack->mapped)
+    {
+        memcpy (out, pack->mapped + ofs, len);
+        return true;
+    }
+    fseek (pack->handle, ofs, SEEK_SET);
+    return fread (out, 1, len, pack->handle) == len;
+}
+
+#define    ZIP_LOCAL_SIG        0x04034b50
+#define    ZIP_CENTRAL_SIG        0x02014b50
+#define    ZIP_END_SIG            0x06054b50
+#define    ZIP_LOCAL_SIZE        30
+#define    ZIP_CENTRAL_SIZE    46
+#define    ZIP_END_SIZE        22
+
+#define    ZIP_SHORT(p)    ((p)[0] | ((p)[1]<<8))
+#define    ZIP_LONG(p)        ((p)[0] | ((p)[1]<<8) | ((p)[2]<<16) | ((unsigned)(p)[3]<<24))
+
+/*
+=================
+FS_LoadZipFile
+
+Takes an explicit path to a pk3 (zip) file and indexes its central
+directory into a pack_t, so it is searched exactly like a pak.
+Entries must be stored or deflated; directories and names too long
+for MAX_QPATH are skipped.
+=================
+*/
+pack_t *FS_LoadZipFile (char *zipfile)
+{
+    FILE        *handle;
+    pack_t        *pack;
+    byte        tail[0x10000 + ZIP_END_SIZE];
+    byte        *end, *dir, *p;
+    int            taillen, tailofs;
+    int            dirofs, dirlen, numentries;
+    int            i, namelen, method;
+    byte        local[ZIP_LOCAL_SIZE];
+    packfile_t    *f;
+
+    handle = fopen (zipfile, "rb");
+    if (!handle)
+        return NULL;
+
+    pack = FS_NewPack (zipfile, handle);
+
+    // the end of central directory record is at the end, before a comment
+    taillen = pack->mapsize < sizeof(tail) ? pack->mapsize : sizeof(tail);
+    tailofs = pack->mapsize - taillen;
+    if (!FS_ReadPackBytes (pack, tailofs, tail, taillen))
+        Com_Error (ERR_FATAL, "%s is not a zip file", zipfile);
+
+    for (end = tail + taillen - ZIP_END_SIZE ; end >= tail ; end--)
+        if (ZIP_LONG(end) == ZIP_END_SIG)
+            break;
+    if (end < tail)
+        Com_Error (ERR_FATAL, "%s is not a zip file", zipfile);
+
+    numentries = ZIP_SHORT(end+10);
+    dirlen = ZIP_LONG(end+12);
+    dirofs = ZIP_LONG(end+16);
+    if (numentries > MAX_FILES_IN_PACK)
+        Com_Error (ERR_FATAL, "%s has %i files", zipfile, numentries);
+
+    dir = Z_Malloc (dirlen);
+    if (!FS_ReadPackBytes (pack, dirofs, dir, dirlen))
+        Com_Error (ERR_FATAL, "%s has a bad central directory", zipfile);
+
+    pack->files = Z_Malloc (numentries * sizeof(packfile_t));
+    f = pack->files;
+
+    for (i=0, p=dir ; i<numentries ; i++)
+    {
+        if (p + ZIP_CENTRAL_SIZE > dir + dirlen || ZIP_LONG(p) != ZIP_CENTRAL_SIG)
+            Com_Error (ERR_FATAL, "%s has a bad central directory", zipfile);
+
+        method = ZIP_SHORT(p+10);
+        namelen = ZIP_SHORT(p+28);
+        if (p + ZIP_CENTRAL_SIZE + namelen > dir + dirlen)
+            Com_Error (ERR_FATAL, "%s has a bad central directory", zipfile);
+
+        if (namelen > 0 && namelen < MAX_QPATH
+            && p[ZIP_CENTRAL_SIZE+namelen-1] != '/'
+            && (method == PACK_STORED || method == PACK_DEFLATED))
+        {
+            memcpy (f->name, p+ZIP_CENTRAL_SIZE, namelen);
+            f->name[namelen] = 0;
+            f->method = method;
+            f->complen = ZIP_LONG(p+20);
+            f->filelen = ZIP_LONG(p+24);
+
+            // the data starts after the local header, which can have
+            // a different extra field than the central one
+            f->filepos = ZIP_LONG(p+42);
+            if (!FS_ReadPackBytes (pack, f->filepos, local, ZIP_LOCAL_SIZE)
+                || ZIP_LONG(local) != ZIP_LOCAL_SIG)
+                Com_Error (ERR_FATAL, "%s has a bad local header for %s", zipfile, f->name);
+            f->filepos += ZIP_LOCAL_SIZE + ZIP_SHORT(local+26) + ZIP_SHORT(local+28);
+
+#ifndef USE_ZLIB
+            if (method == PACK_DEFLATED)
+                Com_DPrintf ("%s: %s is compressed, no zlib support\n", zipfile, f->name);
+#endif
+            f++;
+        }
+
+        p += ZIP_CENTRAL_SIZE + namelen + ZIP_SHORT(p+30) + ZIP_SHORT(p+32);
+    }
+
+    Z_Free (dir);
+
+    pack->numfiles = f - pack->files;
+    FS_FinishPack (pack);
+
+    Com_Printf ("Added zipfile %s (%i files)\n", zipfile, pack->numfiles);
+    return pack;
+}
+
 /*
 =================
 FS_LoadPackFile
@@ -442,35 +1555,45 @@ pack_t *FS_LoadPackFile (char *packfile)
     int                numpackfiles;
     pack_t            *pack;
     FILE            *packhandle;
-    dpackfile_t        info[MAX_FILES_IN_PACK];
+    dpackfile_t        *info;
     unsigned        checksum;
 
     packhandle = fopen(packfile, "rb");
     if (!packhandle)
         return NULL;
 
-    fread (&header, 1, sizeof(header), packhandle);
-    if (LittleLong(header.ident) != IDPAKHEADER)
+    if (fread (&header, 1, sizeof(header), packhandle) != sizeof(header)
+        || LittleLong(header.ident) != IDPAKHEADER)
         Com_Error (ERR_FATAL, "%s is not a packfile", packfile);
     header.dirofs = LittleLong (header.dirofs);
     header.dirlen = LittleLong (header.dirlen);
 
+    // the directory is a whole number of entries
+    if (header.dirlen < 0 || header.dirlen % sizeof(dpackfile_t))
+        Com_Error (ERR_FATAL, "%s has a bad directory", packfile);
     numpackfiles = header.dirlen / sizeof(dpackfile_t);
 
     if (numpackfiles > MAX_FILES_IN_PACK)
         Com_Error (ERR_FATAL, "%s has %i files", packfile, numpackfiles);
 
     newfiles = Z_Malloc (numpackfiles * sizeof(packfile_t));
+    info = Z_Malloc (numpackfiles * sizeof(dpackfile_t));
 
     fseek (packhandle, header.dirofs, SEEK_SET);
-    fread (info, 1, header.dirlen, packhandle);
+    if (fread (info, 1, numpackfiles * sizeof(dpackfile_t), packhandle) != numpackfiles * sizeof(dpackfile_t))
+        Com_Error (ERR_FATAL, "%s has a bad directory", packfile);
 
 // crc the directory to check for modifications
-    checksum = Com_BlockChecksum ((void *)info, header.dirlen);
+    checksum = Com_BlockChecksum ((void *)info, numpackfiles * sizeof(dpackfile_t));
 
 #ifdef NO_ADDONS
     if (checksum != PAK0_CHECKSUM)
+    {
+        Z_Free (info);
+        Z_Free (newfiles);
+        fclose (packhandle);
         return NULL;
+    }
 #endif
 // parse the directory
     for (i=0 ; i<numpackfiles ; i++)
@@ -478,13 +1601,15 @@ pack_t *FS_LoadPackFile (char *packfile)
         strcpy (newfiles[i].name, info[i].name);
         newfiles[i].filepos = LittleLong(info[i].filepos);
         newfiles[i].filelen = LittleLong(info[i].filelen);
+        newfiles[i].complen = newfiles[i].filelen;
+        newfiles[i].method = PACK_STORED;
     }
+    Z_Free (info);
 
-    pack = Z_Malloc (sizeof (pack_t));
-    strcpy (pack->filename, packfile);
-    pack->handle = packhandle;
+    pack = FS_NewPack (packfile, packhandle);
     pack->numfiles = numpackfiles;
     pack->files = newfiles;
+    FS_FinishPack (pack);
     
     Com_Printf ("Added packfile %s (%i files)\n", packfile, numpackfiles);
     return pack;
@@ -499,12 +1624,19 @@ Adds the directory to the head of the path,
 then loads and adds pak1.pak pak2.pak ... 
 ================
 */
+static int FS_SortNames (const void *a, const void *b)
+{
+    return strcmp (*(char **)a, *(char **)b);
+}
+
 void FS_AddGameDirectory (char *dir)
 {
     int                i;
     searchpath_t    *search;
     pack_t            *pak;
     char            pakfile[MAX_OSPATH];
+    char            **zipfiles;
+    int                numzipfiles;
 
     //
     // add the base directory to the search path
@@ -530,6 +1662,30 @@ void FS_AddGameDirectory (char *dir)
       search->next = fs_searchpaths;
       fs_searchpaths = search;        
     }
+
+    //
+    // then any *.pk3 zip files, in alphabetical order so later
+    // ones override earlier ones
+    //
+    Com_sprintf (pakfile, sizeof(pakfile), "%s/*.pk3", dir);
+    zipfiles = FS_ListFiles (pakfile, &numzipfiles, 0, SFF_SUBDIR | SFF_HIDDEN | SFF_SYSTEM);
+    if (zipfiles)
+    {
+        numzipfiles--;        // the guard
+        qsort (zipfiles, numzipfiles, sizeof(char *), FS_SortNames);
+        for (i=0 ; i<numzipfiles ; i++)
+        {
+            pak = FS_LoadZipFile (zipfiles[i]);
+            free (zipfiles[i]);
+            if (!pak)
+                continue;
+            search = Z_Malloc (sizeof(searchpath_t));
+            search->pack = pak;
+            search->next = fs_searchpaths;
+            fs_searchpaths = search;
+        }
+        free (zipfiles);
+    }
 #ifdef QMAX
     Com_sprintf (pakfile, sizeof(pakfile), "%s/maxpak.pak", dir);
     pak = FS_LoadPackFile (pakfile);
@@ -635,17 +1791,15 @@ void FS_SetGamedir (char *dir)
         return;
     }
 
+    FS_PrefetchFlush ();
+
     //
     // free up any current game dir info
     //
     while (fs_searchpaths != fs_base_searchpaths)
     {
         if (fs_searchpaths->pack)
-        {
-            fclose (fs_searchpaths->pack->handle);
-            Z_Free (fs_searchpaths->pack->files);
-            Z_Free (fs_searchpaths->pack);
-        }
+            FS_FreePack (fs_searchpaths->pack);
         next = fs_searchpaths->next;
         Z_Free (fs_searchpaths);
         fs_searchpaths = next;
@@ -694,6 +1848,8 @@ void FS_Link_f (void)
         return;
     }
 
+    FS_PrefetchFlush ();
+
     // see if the link already exists
     prev = &fs_links;
     for (l=fs_links ; l ; l=l->next)
@@ -874,6 +2030,176 @@ char *FS_NextPath (char *prevpath)
 }
 
 
+/*
+============
+FS_BenchRead
+
+Reads one pak entry the way FS_LoadFile would, into a scratch buffer
+============
+*/
+static qboolean FS_BenchRead (pack_t *pak, packfile_t *f, byte **data)
+{
+    *data = Z_Malloc (f->filelen + 1);
+    if (f->method == PACK_STORED)
+        return FS_ReadPackBytes (pak, f->filepos, *data, f->filelen);
+    return FS_InflatePackFile (pak, f, *data);
+}
+
+/*
+============
+FS_BenchMap
+
+Loads a map's bsp and every wall texture it names out of one pack,
+returning the seconds it took, or -1 if the pack doesn't have
+the map.  Textures are only counted once, like the renderer does.
+============
+*/
+static double FS_BenchMap (pack_t *pak, char *mapname, double *bytes, int *stored, int *deflated)
+{
+    char        path[MAX_QPATH+16];
+    packfile_t    *f;
+    byte        *bsp, *wal;
+    dheader_t    *header;
+    texinfo_t    *tex;
+    int            i, j, ofs, count;
+    double        start;
+
+    Com_sprintf (path, sizeof(path), "maps/%s.bsp", mapname);
+    f = FS_PackLookup (pak, path);
+    if (!f)
+        return -1;
+
+    *bytes = 0;
+    *stored = *deflated = 0;
+    start = Sys_FloatTime ();
+
+    if (!FS_BenchRead (pak, f, &bsp) || f->filelen < sizeof(dheader_t))
+    {
+        Z_Free (bsp);
+        return -1;
+    }
+    *bytes += f->filelen;
+    if (f->method == PACK_STORED)
+        (*stored)++;
+    else
+        (*deflated)++;
+
+    header = (dheader_t *)bsp;
+    ofs = LittleLong (header->lumps[LUMP_TEXINFO].fileofs);
+    count = LittleLong (header->lumps[LUMP_TEXINFO].filelen) / sizeof(texinfo_t);
+    if (LittleLong (header->ident) != IDBSPHEADER || ofs < 0 || count < 0
+        || ofs + count * sizeof(texinfo_t) > f->filelen)
+        count = 0;
+    tex = (texinfo_t *)(bsp + ofs);
+
+    for (i=0 ; i<count ; i++)
+    {
+        for (j=0 ; j<i ; j++)
+            if (!strncmp (tex[j].texture, tex[i].texture, sizeof(tex->texture)))
+                break;
+        if (j < i)
+            continue;
+
+        snprintf (path, sizeof(path), "textures/%.*s.wal", (int)sizeof(tex->texture), tex[i].texture);
+        f = FS_PackLookup (pak, path);
+        if (!f)
+            continue;
+        if (FS_BenchRead (pak, f, &wal))
+            *bytes += f->filelen;
+        Z_Free (wal);
+        if (f->method == PACK_STORED)
+            (*stored)++;
+        else
+            (*deflated)++;
+    }
+
+    Z_Free (bsp);
+    return Sys_FloatTime () - start;
+}
+
+/*
+============
+FS_Bench_f
+
+fs_bench <map> times loading the map from every pack that has it, so
+the same content can be compared as a .pak, a stored .pk3 and a
+deflated .pk3.  Without a map, reads and decompresses every entry of
+every pack in the search path.
+============
+*/
+#define    FS_BENCH_PASSES    5
+
+void FS_Bench_f (void)
+{
+    searchpath_t    *search;
+    pack_t            *pak;
+    packfile_t        *f;
+    byte            *buf;
+    char            *kind;
+    int                i, start, msec, failed, stored, deflated;
+    double            bytes, compbytes, sec, bestsec;
+
+    if (Cmd_Argc () == 2)
+    {
+        for (search = fs_searchpaths ; search ; search = search->next)
+        {
+            pak = search->pack;
+            if (!pak)
+                continue;
+
+            // the first pass warms the page cache, keep the best of the rest
+            bestsec = -1;
+            for (i=0 ; i<=FS_BENCH_PASSES ; i++)
+            {
+                sec = FS_BenchMap (pak, Cmd_Argv(1), &bytes, &stored, &deflated);
+                if (sec == -1)
+                    break;
+                if (i && (bestsec == -1 || sec < bestsec))
+                    bestsec = sec;
+            }
+            if (bestsec == -1)
+                continue;
+
+            if (!deflated && strstr (pak->filename, ".pak"))
+                kind = "pak";
+            else if (!deflated)
+                kind = "stored pk3";
+            else if (!stored)
+                kind = "deflated pk3";
+            else
+                kind = "mixed pk3";
+            Com_Printf ("%s (%s): %i files, %.1f MB in %.2f ms\n",
+                pak->filename, kind, stored + deflated, bytes / (1024*1024), bestsec * 1000);
+        }
+        return;
+    }
+
+    for (search = fs_searchpaths ; search ; search = search->next)
+    {
+        pak = search->pack;
+        if (!pak)
+            continue;
+
+        bytes = compbytes = 0;
+        failed = 0;
+        start = Sys_Milliseconds ();
+        for (i=0, f=pak->files ; i<pak->numfiles ; i++, f++)
+        {
+            failed += !FS_BenchRead (pak, f, &buf);
+            Z_Free (buf);
+            bytes += f->filelen;
+            compbytes += f->complen;
+        }
+        msec = Sys_Milliseconds () - start;
+
+        Com_Printf ("%s: %i files, %.1f MB (%.1f MB packed) in %i ms, %.1f MB/s\n",
+            pak->filename, pak->numfiles, bytes / (1024*1024), compbytes / (1024*1024),
+            msec, msec ? bytes / (1024*1024) * 1000 / msec : 0);
+        if (failed)
+            Com_Printf ("%i files failed to read\n", failed);
+    }
+}
+
 /*
 ================
 FS_InitFilesystem
@@ -884,6 +2210,11 @@ void FS_InitFilesystem (void)
     Cmd_AddCommand ("path", FS_Path_f);
     Cmd_AddCommand ("link", FS_Link_f);
     Cmd_AddCommand ("dir", FS_Dir_f );
+    Cmd_AddCommand ("fs_stats", FS_Stats_f);
+    Cmd_AddCommand ("fs_bench", FS_Bench_f);
+
+    // megabytes the prefetch thread may read ahead, 0 to turn it off
+    fs_prefetch = Cvar_Get ("fs_prefetch", "32", 0);
 
     //
     // basedir <path>
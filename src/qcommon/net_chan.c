@@ -72,15 +72,37 @@ If there is no information that needs to be transfered on a given frame,
 such as during the connection stage while waiting for the client to load,
 then a packet only needs to be delivered if there is something in the
 unacknowledged reliable
+
+
+fragments
+---------
+If both ends asked for it at connect time, a message too big for one
+datagram is split into up to MAX_FRAGMENTS of them.  Each carries the
+packet header with bit 30 of the sequence set, then
+
+8    fragment number
+8    fragment count
+     FRAGMENT_SIZE bytes of the message, or the rest in the last one
+
+Fragments of a message can arrive in any order.  When the last missing
+one comes in, the message is handled like any other packet of that
+sequence.  Losing one loses the whole message, and reliable data in it
+is resent the usual way.
 */
 
+#define    FRAGMENT_BIT    (1<<30)
+
 cvar_t        *showpackets;
 cvar_t        *showdrop;
 cvar_t        *qport;
+cvar_t        *net_fragments;
 
 netadr_t    net_from;
 sizebuf_t    net_message;
-byte        net_message_buffer[MAX_MSGLEN];
+byte        net_message_buffer[PACKET_HEADER+MAX_FRAGMSGLEN];
+
+// netchan_test catches the datagrams here instead of sending them
+static void    (*netchan_capture) (int length, byte *data);
 
 /*
 ===============
@@ -98,6 +120,9 @@ void Netchan_Init (void)
     showpackets = Cvar_Get ("showpackets", "0", 0);
     showdrop = Cvar_Get ("showdrop", "0", 0);
     qport = Cvar_Get ("qport", va("%i", port), CVAR_NOSET);
+    net_fragments = Cvar_Get ("net_fragments", "1", 0);
+
+    Cmd_AddCommand ("netchan_test", Netchan_FragmentTest_f);
 }
 
 /*
@@ -200,6 +225,56 @@ qboolean Netchan_NeedReliable (netchan_t *chan)
     return send_reliable;
 }
 
+/*
+===============
+Netchan_SendDatagram
+================
+*/
+static void Netchan_SendDatagram (netchan_t *chan, int length, byte *data)
+{
+    if (netchan_capture)
+        netchan_capture (length, data);
+    else
+        NET_SendPacket (chan->sock, length, data, chan->remote_address);
+}
+
+/*
+===============
+Netchan_SendFragments
+
+Splits everything in a packet after the header over as many
+datagrams as it takes
+================
+*/
+static void Netchan_SendFragments (netchan_t *chan, sizebuf_t *send, int headerlen, unsigned w1, unsigned w2)
+{
+    sizebuf_t    frag;
+    byte        frag_buf[MAX_MSGLEN];
+    int            i, count, ofs, len;
+
+    len = send->cursize - headerlen;
+    count = (len + FRAGMENT_SIZE-1) / FRAGMENT_SIZE;
+
+    for (i=0 ; i<count ; i++)
+    {
+        ofs = i*FRAGMENT_SIZE;
+        len = send->cursize - headerlen - ofs;
+        if (len > FRAGMENT_SIZE)
+            len = FRAGMENT_SIZE;
+
+        SZ_Init (&frag, frag_buf, sizeof(frag_buf));
+        MSG_WriteLong (&frag, w1 | FRAGMENT_BIT);
+        MSG_WriteLong (&frag, w2);
+        if (chan->sock == NS_CLIENT)
+            MSG_WriteShort (&frag, qport->value);
+        MSG_WriteByte (&frag, i);
+        MSG_WriteByte (&frag, count);
+        SZ_Write (&frag, send->data + headerlen + ofs, len);
+
+        Netchan_SendDatagram (chan, frag.cursize, frag.data);
+    }
+}
+
 /*
 ===============
 Netchan_Transmit
@@ -213,9 +288,10 @@ A 0 length will still generate a packet and deal with the reliable messages.
 void Netchan_Transmit (netchan_t *chan, int length, byte *data)
 {
     sizebuf_t    send;
-    byte        send_buf[MAX_MSGLEN];
+    byte        send_buf[PACKET_HEADER+MAX_FRAGMSGLEN];
     qboolean    send_reliable;
     unsigned    w1, w2;
+    int            headerlen;
 
 // check for message overflow
     if (chan->message.overflowed)
@@ -253,6 +329,13 @@ void Netchan_Transmit (netchan_t *chan, int length, byte *data)
     if (chan->sock == NS_CLIENT)
         MSG_WriteShort (&send, qport->value);
 
+    // only one datagram's worth without fragments
+    headerlen = send.cursize;
+    if (chan->fragments)
+        send.maxsize = headerlen + MAX_FRAGMSGLEN;
+    else
+        send.maxsize = MAX_MSGLEN;
+
 // copy the reliable message to the packet first
     if (send_reliable)
     {
@@ -266,8 +349,11 @@ void Netchan_Transmit (netchan_t *chan, int length, byte *data)
     else
         Com_Printf ("Netchan_Transmit: dumped unreliable\n");
 
-// send the datagram
-    NET_SendPacket (chan->sock, send.cursize, send.data, chan->remote_address);
+// send the datagram, or datagrams
+    if (send.cursize >= MAX_MSGLEN && chan->fragments)
+        Netchan_SendFragments (chan, &send, headerlen, w1, w2);
+    else
+        Netchan_SendDatagram (chan, send.cursize, send.data);
 
     if (showpackets->value)
     {
@@ -287,6 +373,71 @@ void Netchan_Transmit (netchan_t *chan, int length, byte *data)
     }
 }
 
+/*
+=================
+Netchan_Reassemble
+
+Files a fragment away.  Once all of its message is in, puts the whole
+message into msg after the header and returns true.
+=================
+*/
+static qboolean Netchan_Reassemble (netchan_t *chan, sizebuf_t *msg, int sequence)
+{
+    int        headerlen;
+    int        index, count, len;
+
+    headerlen = msg->readcount;
+    index = MSG_ReadByte (msg);
+    count = MSG_ReadByte (msg);
+    len = msg->cursize - msg->readcount;
+
+    if (len < 0 || index < 0 || index >= count || count > MAX_FRAGMENTS
+        || len > FRAGMENT_SIZE || (index < count-1 && len != FRAGMENT_SIZE))
+    {
+        if (showdrop->value)
+            Com_Printf ("%s:Bad fragment %i/%i at %i\n"
+                , NET_AdrToString (chan->remote_address)
+                , index
+                , count
+                , sequence);
+        return false;
+    }
+
+    if (sequence < chan->fragment_sequence)
+        return false;        // late, a newer message is coming together
+    if (sequence > chan->fragment_sequence)
+    {    // forget what there was of the last one
+        chan->fragment_sequence = sequence;
+        chan->fragment_count = count;
+        chan->fragment_have = 0;
+    }
+    else if (count != chan->fragment_count)
+        return false;
+
+    if (chan->fragment_have & (1<<index))
+        return false;        // duplicated
+    chan->fragment_have |= 1<<index;
+    memcpy (chan->fragment_buf + index*FRAGMENT_SIZE, msg->data + msg->readcount, len);
+    if (index == count-1)
+        chan->fragment_length = index*FRAGMENT_SIZE + len;
+
+    if (chan->fragment_have != (1<<count)-1)
+        return false;        // still waiting for some
+
+    if (headerlen + chan->fragment_length > msg->maxsize)
+    {
+        Com_Printf ("%s:Fragmented message too long for %i byte buffer\n"
+            , NET_AdrToString (chan->remote_address)
+            , msg->maxsize);
+        return false;
+    }
+
+    memcpy (msg->data + headerlen, chan->fragment_buf, chan->fragment_length);
+    msg->cursize = headerlen + chan->fragment_length;
+    msg->readcount = headerlen;
+    return true;
+}
+
 /*
 =================
 Netchan_Process
@@ -299,6 +450,7 @@ qboolean Netchan_Process (netchan_t *chan, sizebuf_t *msg)
 {
     unsigned    sequence, sequence_ack;
     unsigned    reliable_ack, reliable_message;
+    qboolean    fragment;
     int            qport;
 
 // get sequence numbers        
@@ -312,8 +464,11 @@ qboolean Netchan_Process (netchan_t *chan, sizebuf_t *msg)
 
     reliable_message = sequence >> 31;
     reliable_ack = sequence_ack >> 31;
+    fragment = chan->fragments && (sequence & FRAGMENT_BIT);
 
     sequence &= ~(1<<31);
+    if (chan->fragments)
+        sequence &= ~FRAGMENT_BIT;
     sequence_ack &= ~(1<<31);    
 
     if (showpackets->value)
@@ -346,6 +501,9 @@ qboolean Netchan_Process (netchan_t *chan, sizebuf_t *msg)
         return false;
     }
 
+    if (fragment && !Netchan_Reassemble (chan, msg, sequence))
+        return false;
+
 //
 // dropped packets don't keep the message from being used
 //
@@ -385,3 +543,154 @@ qboolean Netchan_Process (netchan_t *chan, sizebuf_t *msg)
     return true;
 }
 
+
+//============================================================================
+
+static byte        nt_packets[MAX_FRAGMENTS*2][MAX_MSGLEN];
+static int        nt_lengths[MAX_FRAGMENTS*2];
+static int        nt_numpackets;
+
+static void Netchan_CapturePacket (int length, byte *data)
+{
+    if (nt_numpackets == MAX_FRAGMENTS*2)
+        return;
+    memcpy (nt_packets[nt_numpackets], data, length);
+    nt_lengths[nt_numpackets] = length;
+    nt_numpackets++;
+}
+
+/*
+===============
+Netchan_FragmentTest_f
+
+netchan_test [loss percent] [messages]
+
+Sends messages of every size up to MAX_FRAGMSGLEN between two channels
+with fragments, in memory.  On the way datagrams are lost, shuffled,
+and held back to arrive after the next message.  Checks that every
+message that gets through is whole, and that the share that does
+matches what the loss should allow.
+===============
+*/
+void Netchan_FragmentTest_f (void)
+{
+    static byte    data[MAX_FRAGMSGLEN];
+    static byte    buf[PACKET_HEADER+MAX_FRAGMSGLEN];
+    static byte    held[MAX_FRAGMENTS*2][MAX_MSGLEN];
+    int            heldlen[MAX_FRAGMENTS*2];
+    int            sentlen[64];            // of recent messages, by number
+    int            numheld, newheld;
+    netchan_t    *from, *to;
+    netadr_t    adr;
+    sizebuf_t    msg;
+    unsigned    seed;
+    int            loss, count;
+    int            i, j, k, len, id;
+    int            datagrams, delivered, corrupt;
+    double        expected, fragments;
+
+    loss = Cmd_Argc() > 1 ? atoi (Cmd_Argv(1)) : 10;
+    count = Cmd_Argc() > 2 ? atoi (Cmd_Argv(2)) : 10000;
+    if (loss < 0 || loss > 100 || count < 1)
+    {
+        Com_Printf ("usage: netchan_test [loss percent] [messages]\n");
+        return;
+    }
+
+    from = Z_Malloc (sizeof(*from));
+    to = Z_Malloc (sizeof(*to));
+    memset (&adr, 0, sizeof(adr));
+    adr.type = NA_LOOPBACK;
+    Netchan_Setup (NS_CLIENT, from, adr, qport->value);
+    Netchan_Setup (NS_SERVER, to, adr, qport->value);
+    from->fragments = to->fragments = true;
+
+    SZ_Init (&msg, buf, sizeof(buf));
+    netchan_capture = Netchan_CapturePacket;
+    seed = 1;
+    numheld = 0;
+    datagrams = delivered = corrupt = 0;
+    expected = 0;
+
+    for (i=0 ; i<count ; i++)
+    {
+        // a message tagged with its number, filled from it
+        seed = seed * 1103515245 + 12345;
+        len = 4 + (seed >> 8) % (MAX_FRAGMSGLEN - 4 + 1);
+        *(int *)data = i;
+        for (j=4 ; j<len ; j++)
+            data[j] = (i*7 + j) & 255;
+        sentlen[i & 63] = len;
+
+        nt_numpackets = 0;
+        Netchan_Transmit (from, len, data);
+        datagrams += nt_numpackets;
+        fragments = nt_numpackets;
+        // a late datagram only gets its message through if it beats the
+        // next message, so count it as lost for a lower bound
+        expected += pow ((1 - loss/100.0) * 0.98, fragments);
+
+        // the ones held back last time arrive first
+        for (j=0 ; j<numheld && nt_numpackets < MAX_FRAGMENTS*2 ; j++)
+        {
+            memcpy (nt_packets[nt_numpackets], held[j], heldlen[j]);
+            nt_lengths[nt_numpackets++] = heldlen[j];
+        }
+        numheld = 0;
+
+        // shuffled
+        for (j=nt_numpackets-1 ; j>0 ; j--)
+        {
+            seed = seed * 1103515245 + 12345;
+            k = (seed >> 8) % (j+1);
+            memcpy (held[0], nt_packets[j], nt_lengths[j]);
+            memcpy (nt_packets[j], nt_packets[k], nt_lengths[k]);
+            memcpy (nt_packets[k], held[0], nt_lengths[j]);
+            len = nt_lengths[j];
+            nt_lengths[j] = nt_lengths[k];
+            nt_lengths[k] = len;
+        }
+
+        newheld = 0;
+        for (j=0 ; j<nt_numpackets ; j++)
+        {
+            seed = seed * 1103515245 + 12345;
+            if ((seed >> 8) % 100 < loss)
+                continue;        // lost
+            seed = seed * 1103515245 + 12345;
+            if ((seed >> 8) % 100 < 2)
+            {    // late
+                memcpy (held[newheld], nt_packets[j], nt_lengths[j]);
+                heldlen[newheld++] = nt_lengths[j];
+                continue;
+            }
+
+            memcpy (msg.data, nt_packets[j], nt_lengths[j]);
+            msg.cursize = nt_lengths[j];
+            if (!Netchan_Process (to, &msg))
+                continue;
+
+            // a late one from the last message can still be the newest
+            delivered++;
+            memcpy (&id, msg.data + msg.readcount, 4);
+            if (id < i-1 || id > i || msg.cursize - msg.readcount != sentlen[id & 63])
+            {
+                corrupt++;
+                continue;
+            }
+            for (k=msg.readcount+4 ; k<msg.cursize ; k++)
+                if (msg.data[k] != ((id*7 + k - msg.readcount) & 255))
+                    break;
+            if (k != msg.cursize)
+                corrupt++;
+        }
+        numheld = newheld;
+    }
+
+    netchan_capture = NULL;
+    Z_Free (from);
+    Z_Free (to);
+
+    Com_Printf ("%i messages in %i datagrams, %i%% lost\n", count, datagrams, loss);
+    Com_Printf ("%i delivered, at least about %.0f expected, %i corrupt\n", delivered, expected, corrupt);
+}
@@ -0,0 +1,332 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// prof.c -- frame profiler
+
+#include "qcommon.h"
+
+/*
+==============================================================================
+
+Every zone's time is summed over a frame and kept for the last
+PROF_HISTORY frames, so prof can give percentiles of the per frame cost.
+Nested calls to the same zone only count once.  "prof trace" also
+records every outermost zone call as a Chrome trace event, for loading
+into chrome://tracing or Perfetto.
+
+Zones must only be entered from the main thread.
+
+==============================================================================
+*/
+
+#define    MAX_PROF_ZONES        64
+#define    PROF_HISTORY        1024        // frames
+#define    MAX_TRACE_EVENTS    0x100000
+
+typedef struct
+{
+    char    name[32];
+    int        depth;                    // only the outermost call is timed
+    double    start;
+    double    frametime;                // seconds so far this frame
+    int        framecalls;
+    float    history[PROF_HISTORY];    // microseconds per frame
+    int        calls;                    // since the last reset
+} profzone_t;
+
+typedef struct
+{
+    int        zone;
+    double    start, time;
+} profevent_t;
+
+static char        *prof_enginezones[NUM_PROF_ENGINEZONES] = {
+    NULL,
+    "frame",
+    "SV_Frame",
+    "SV_ReadPackets",
+    "SV_RunGameFrame",
+    "SV_BuildClientFrame",
+    "SV_SendClientMessages",
+    "CM_BoxTrace",
+    "CL_Frame",
+    "SCR_UpdateScreen"
+};
+
+cvar_t            *prof_enable;
+
+int                prof_active;        // checked by Prof_Begin / Prof_End
+
+static profzone_t    prof_zones[MAX_PROF_ZONES];
+static int            prof_numzones = 1;    // zone 0 is never timed
+static int            prof_frames;        // frames recorded since the last reset
+
+static profevent_t    *prof_events;
+static int            prof_numevents;
+static int            prof_traceframes;    // left to record
+static double        prof_tracestart;
+static char            prof_tracename[MAX_QPATH];
+
+/*
+================
+Prof_Zone
+
+Returns the zone for a name, adding it the first time.  Returns 0 if
+there is no room, which Prof_Begin and Prof_End ignore.
+================
+*/
+int Prof_Zone (char *name)
+{
+    int        i;
+
+    for (i=1 ; i<prof_numzones ; i++)
+        if (!strcmp (prof_zones[i].name, name))
+            return i;
+
+    if (prof_numzones == MAX_PROF_ZONES)
+        return 0;
+    strncpy (prof_zones[prof_numzones].name, name, sizeof(prof_zones[0].name)-1);
+    return prof_numzones++;
+}
+
+/*
+================
+Prof_Begin
+================
+*/
+void Prof_Begin (int zone)
+{
+    profzone_t    *z;
+
+    if (!prof_active || zone <= 0)
+        return;
+
+    z = &prof_zones[zone];
+    if (z->depth++)
+        return;
+    z->start = Sys_FloatTime ();
+}
+
+/*
+================
+Prof_End
+================
+*/
+void Prof_End (int zone)
+{
+    profzone_t    *z;
+    profevent_t    *e;
+    double        time;
+
+    if (!prof_active || zone <= 0)
+        return;
+
+    z = &prof_zones[zone];
+    if (z->depth <= 0 || --z->depth)
+        return;
+
+    time = Sys_FloatTime () - z->start;
+    z->frametime += time;
+    z->framecalls++;
+
+    if (prof_traceframes && prof_numevents < MAX_TRACE_EVENTS)
+    {
+        e = &prof_events[prof_numevents++];
+        e->zone = zone;
+        e->start = z->start;
+        e->time = time;
+    }
+}
+
+/*
+================
+Prof_WriteTrace
+================
+*/
+static void Prof_WriteTrace (void)
+{
+    char        name[MAX_OSPATH];
+    FILE        *f;
+    profevent_t    *e;
+    int            i;
+
+    Com_sprintf (name, sizeof(name), "%s/%s", FS_Gamedir(), prof_tracename);
+    FS_CreatePath (name);
+    f = fopen (name, "w");
+    if (!f)
+    {
+        Com_Printf ("Couldn't write %s\n", name);
+        return;
+    }
+
+    // microseconds, as the format wants
+    fprintf (f, "{\"traceEvents\":[\n");
+    for (i=0, e=prof_events ; i<prof_numevents ; i++, e++)
+        fprintf (f, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1}%s\n",
+            prof_zones[e->zone].name, (e->start - prof_tracestart) * 1000000,
+            e->time * 1000000, i == prof_numevents-1 ? "" : ",");
+    fprintf (f, "],\"displayTimeUnit\":\"ms\"}\n");
+    fclose (f);
+
+    Com_Printf ("Wrote %i events to %s%s\n", prof_numevents, name,
+        prof_numevents == MAX_TRACE_EVENTS ? ", the rest were dropped" : "");
+}
+
+/*
+================
+Prof_Frame
+
+Called at the start of every frame to file the last one.  Anything
+still open was cut short by an error, so it is forgotten.
+================
+*/
+void Prof_Frame (void)
+{
+    profzone_t    *z;
+    int            i, slot;
+
+    if (prof_active)
+    {
+        slot = prof_frames++ % PROF_HISTORY;
+        for (i=1, z=prof_zones+1 ; i<prof_numzones ; i++, z++)
+        {
+            z->history[slot] = z->frametime * 1000000;
+            z->calls += z->framecalls;
+            z->frametime = 0;
+            z->framecalls = 0;
+            z->depth = 0;
+        }
+
+        if (prof_traceframes && !--prof_traceframes)
+        {
+            Prof_WriteTrace ();
+            Z_Free (prof_events);
+            prof_events = NULL;
+        }
+    }
+
+    prof_active = prof_enable->value || prof_traceframes;
+}
+
+static int Prof_SortFloats (const void *a, const void *b)
+{
+    float    fa = *(float *)a, fb = *(float *)b;
+
+    return fa < fb ? -1 : fa > fb;
+}
+
+/*
+================
+Prof_Reset
+================
+*/
+static void Prof_Reset (void)
+{
+    int        i;
+
+    for (i=1 ; i<prof_numzones ; i++)
+    {
+        memset (prof_zones[i].history, 0, sizeof(prof_zones[i].history));
+        prof_zones[i].calls = 0;
+    }
+    prof_frames = 0;
+}
+
+/*
+================
+Prof_f
+
+prof                        per zone percentiles over the recent frames
+prof reset
+prof trace [frames] [file]    write a Chrome trace of the next frames
+================
+*/
+void Prof_f (void)
+{
+    static float    sorted[PROF_HISTORY];
+    profzone_t        *z;
+    int                i, j, n;
+    float            total;
+
+    if (!strcmp (Cmd_Argv(1), "reset"))
+    {
+        Prof_Reset ();
+        return;
+    }
+
+    if (!strcmp (Cmd_Argv(1), "trace"))
+    {
+        if (prof_traceframes)
+        {
+            Com_Printf ("Already tracing\n");
+            return;
+        }
+        prof_traceframes = Cmd_Argc() > 2 ? atoi (Cmd_Argv(2)) : 100;
+        if (prof_traceframes < 1)
+            prof_traceframes = 1;
+        prof_traceframes++;        // the rest of this one doesn't count
+        strncpy (prof_tracename, Cmd_Argc() > 3 ? Cmd_Argv(3) : "trace.json", sizeof(prof_tracename)-1);
+        prof_events = Z_Malloc (MAX_TRACE_EVENTS * sizeof(profevent_t));
+        prof_numevents = 0;
+        prof_tracestart = Sys_FloatTime ();
+        Com_Printf ("Tracing %i frames\n", prof_traceframes-1);
+        return;
+    }
+
+    n = prof_frames < PROF_HISTORY ? prof_frames : PROF_HISTORY;
+    if (!n)
+    {
+        Com_Printf ("No frames profiled, set prof_enable 1\n");
+        return;
+    }
+
+    Com_Printf ("%i frames, microseconds per frame\n", n);
+    Com_Printf ("zone                                   p50       p99       max  calls/frame\n");
+    for (i=1, z=prof_zones+1 ; i<prof_numzones ; i++, z++)
+    {
+        total = 0;
+        for (j=0 ; j<n ; j++)
+        {
+            sorted[j] = z->history[j];
+            total += sorted[j];
+        }
+        if (!total)
+            continue;
+        qsort (sorted, n, sizeof(float), Prof_SortFloats);
+
+        Com_Printf ("%-32s %9.1f %9.1f %9.1f %12.1f\n", z->name,
+            sorted[n/2], sorted[(n*99)/100], sorted[n-1], (float)z->calls / prof_frames);
+    }
+}
+
+/*
+================
+Prof_Init
+================
+*/
+void Prof_Init (void)
+{
+    int        i;
+
+    for (i=1 ; i<NUM_PROF_ENGINEZONES ; i++)
+        Prof_Zone (prof_enginezones[i]);
+
+    prof_enable = Cvar_Get ("prof_enable", "0", 0);
+    Cmd_AddCommand ("prof", Prof_f);
+}
@@ -76,10 +76,13 @@ typedef struct sizebuf_s
 {
     qboolean    allowoverflow;    // if false, do a Com_Error
     qboolean    overflowed;        // set to true if the buffer size failed
+    qboolean    quietoverflow;    // don't print it, for buffers filled off the main thread
     byte    *data;
     int        maxsize;
     int        cursize;
     int        readcount;
+    int        writebit;        // bits MSG_WriteBits has used of the last byte
+    int        readbit;        // bits MSG_ReadBits has used of the last byte read
 } sizebuf_t;
 
 void SZ_Init (sizebuf_t *buf, byte *data, int length);
@@ -105,7 +108,13 @@ void MSG_WriteAngle (sizebuf_t *sb, float f);
 void MSG_WriteAngle16 (sizebuf_t *sb, float f);
 void MSG_WriteDeltaUsercmd (sizebuf_t *sb, struct usercmd_s *from, struct usercmd_s *cmd);
 void MSG_WriteDeltaEntity (struct entity_state_s *from, struct entity_state_s *to, sizebuf_t *msg, qboolean force, qboolean newentity);
+void MSG_WriteDeltaPlayerstate (player_state_t *from, player_state_t *to, sizebuf_t *msg);
 void MSG_WriteDir (sizebuf_t *sb, vec3_t vector);
+void MSG_RoundDeltaEntity (struct entity_state_s *s);
+
+void MSG_WriteBits (sizebuf_t *sb, unsigned value, int bits);
+void MSG_WriteGolomb (sizebuf_t *sb, unsigned value, int k);
+void MSG_WriteVarBits (sizebuf_t *sb, unsigned value);
 
 
 void    MSG_BeginReading (sizebuf_t *sb);
@@ -128,6 +137,11 @@ void    MSG_ReadDir (sizebuf_t *sb, vec3_t vector);
 
 void    MSG_ReadData (sizebuf_t *sb, void *buffer, int size);
 
+unsigned    MSG_ReadBits (sizebuf_t *sb, int bits);
+unsigned    MSG_ReadGolomb (sizebuf_t *sb, int k);
+unsigned    MSG_ReadVarBits (sizebuf_t *sb);
+void    MSG_ReadAlign (sizebuf_t *sb);
+
 //============================================================================
 
 extern    qboolean        bigendien;
@@ -226,7 +240,9 @@ enum svc_ops_e
     svc_playerinfo,                // variable
     svc_packetentities,            // [...]
     svc_deltapacketentities,    // [...]
-    svc_frame
+    svc_frame,
+    svc_bitentities,            // bit stream, see MSG_WriteBitEntities
+    svc_projectiles                // [...], see MSG_WriteDeltaProjectile
 };
 
 //==============================================
@@ -329,6 +345,89 @@ enum clc_ops_e
 #define    U_SOUND        (1<<26)
 #define    U_SOLID        (1<<27)
 
+// entity_state_t communication for clients that connect with "bitents",
+// see MSG_WriteBitEntities
+#define    BE_REMOVE        (1<<0)
+#define    BE_MODEL        (1<<1)
+#define    BE_MODEL2        (1<<2)
+#define    BE_MODEL3        (1<<3)
+#define    BE_MODEL4        (1<<4)
+#define    BE_FRAME        (1<<5)        // change from the base
+#define    BE_SKIN            (1<<6)
+#define    BE_EFFECTS        (1<<7)        // bits flipped from the base
+#define    BE_RENDERFX        (1<<8)        // bits flipped from the base
+#define    BE_ORIGIN1        (1<<9)        // change from the base
+#define    BE_ORIGIN2        (1<<10)
+#define    BE_ORIGIN3        (1<<11)
+#define    BE_ANGLE1        (1<<12)
+#define    BE_ANGLE2        (1<<13)
+#define    BE_ANGLE3        (1<<14)
+#define    BE_OLDORIGIN    (1<<15)        // three coordinates from origin
+#define    BE_SOUND        (1<<16)
+#define    BE_EVENT        (1<<17)
+#define    BE_SOLID        (1<<18)
+#define    BE_NEW            (1<<19)        // not in the frame delta'd from, base follows
+#define    BE_BITS            20
+
+#define    BE_MAXMASKS        15            // in the table of a frame's common masks
+#define    BE_MAXBASE        15            // frames back a new entity's base can be
+#define    BE_OLDBASE        7            // what a client that doesn't say "bitbase" keeps
+
+// one entity's change for MSG_WriteBitEntities
+typedef struct
+{
+    struct entity_state_s    *from;    // what the client has now
+    struct entity_state_s    *to;    // NULL to remove, left as what the client will have
+    int            number;
+    qboolean    newentity;            // not in the frame being delta'd from
+    int            base;                // frames back that from is in, 0 for the baseline
+    qboolean    oldorigin;            // send old_origin even if it isn't a beam
+
+    int            mask;                // BE_* bits, set by MSG_WriteBitEntities
+    unsigned    values[BE_BITS+2];    // with two more for old_origin
+} bitdelta_t;
+
+void MSG_WriteBitEntities (sizebuf_t *msg, bitdelta_t *deltas, int count, int coordbits, int anglebits);
+
+// projectile_t communication for clients that connect with "projectiles"
+#define    PR_REMOVE        (1<<0)
+#define    PR_TRAJECTORY    (1<<1)        // origin and velocity, starting this frame
+#define    PR_GRAVITY        (1<<2)        // the trajectory falls, a short follows it
+#define    PR_ANGLES        (1<<3)
+#define    PR_MODEL        (1<<4)
+#define    PR_EFFECTS        (1<<5)
+#define    PR_MOREBITS        (1<<6)        // read one additional byte
+#define    PR_NUMBER16        (1<<7)
+
+// second byte
+#define    PR_FRAME        (1<<8)
+#define    PR_SKIN            (1<<9)
+#define    PR_RENDERFX        (1<<10)
+#define    PR_SOUND        (1<<11)
+
+// an entity flagged SVF_PROJECTILE as the client sees it: a path it
+// follows on its own until the server sends a new one
+typedef struct
+{
+    int            number;
+    int            modelindex;
+    int            frame;
+    int            skinnum;
+    unsigned int    effects;
+    int            renderfx;
+    int            sound;
+    vec3_t        angles;
+
+    vec3_t        origin;                // where it was at basetime
+    vec3_t        velocity;            // units per second
+    int            gravity;            // 0 for a straight line
+    int            basetime;            // server frame the trajectory starts at
+} projectile_t;
+
+void MSG_RoundProjectile (projectile_t *p);
+void MSG_ProjectileOrigin (projectile_t *p, float framenum, vec3_t origin);
+void MSG_WriteDeltaProjectile (projectile_t *from, projectile_t *to, sizebuf_t *msg, qboolean force);
+
 
 /*
 ==============================================================
@@ -527,6 +626,12 @@ NET
 #define    MAX_MSGLEN        1400        // max length of a message
 #define    PACKET_HEADER    10            // two ints and a short
 
+// with the fragments extension a netchan message can be split over
+// several datagrams
+#define    FRAGMENT_SIZE    (MAX_MSGLEN-16)                    // message bytes in each
+#define    MAX_FRAGMENTS    16
+#define    MAX_FRAGMSGLEN    (FRAGMENT_SIZE*MAX_FRAGMENTS)    // max length of a fragmented message
+
 #ifdef HAVE_IPV6
 typedef enum {NA_LOOPBACK, NA_BROADCAST, NA_IP, NA_IPX, NA_BROADCAST_IPX, NA_IP6, NA_MULTICAST6} netadrtype_t;
 #else
@@ -556,7 +661,12 @@ void        NET_Shutdown (void);
 void        NET_Config (qboolean multiplayer);
 
 qboolean    NET_GetPacket (netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message);
+qboolean    NET_GetLoopPacket (netsrc_t sock, netadr_t *net_from, sizebuf_t *net_message);
+int            NET_RecvFrom (netsrc_t sock, netadr_t *net_from, byte *data, int maxsize, int msec);
+int            NET_SendTo (netsrc_t sock, netadr_t to, void *data, int length);
 void        NET_SendPacket (netsrc_t sock, int length, void *data, netadr_t to);
+void        NET_BeginPackets (void);    // queue sends until NET_FlushPackets
+void        NET_FlushPackets (void);
 
 qboolean    NET_CompareAdr (netadr_t a, netadr_t b);
 qboolean    NET_CompareBaseAdr (netadr_t a, netadr_t b);
@@ -603,11 +713,23 @@ typedef struct
 // message is copied to this buffer when it is first transfered
     int            reliable_length;
     byte        reliable_buf[MAX_MSGLEN-16];    // unacked reliable message
+
+// both ends negotiated the fragments extension at connect time
+    qboolean    fragments;
+
+// the incoming fragmented message being put back together
+    int            fragment_sequence;
+    int            fragment_count;
+    unsigned    fragment_have;            // bit for each fragment received
+    int            fragment_length;
+    byte        fragment_buf[MAX_FRAGMSGLEN];
 } netchan_t;
 
 extern    netadr_t    net_from;
 extern    sizebuf_t    net_message;
-extern    byte        net_message_buffer[MAX_MSGLEN];
+extern    byte        net_message_buffer[PACKET_HEADER+MAX_FRAGMSGLEN];    // room for a reassembled message
+
+extern    cvar_t        *net_fragments;
 
 
 void Netchan_Init (void);
@@ -620,6 +742,7 @@ void Netchan_OutOfBandPrint (int net_socket, netadr_t adr, char *format, ...);
 qboolean Netchan_Process (netchan_t *chan, sizebuf_t *msg);
 
 qboolean Netchan_CanReliable (netchan_t *chan);
+void Netchan_FragmentTest_f (void);
 
 
 /*
@@ -656,8 +779,25 @@ trace_t        CM_TransformedBoxTrace (vec3_t start, vec3_t end,
                           int headnode, int brushmask,
                           vec3_t origin, vec3_t angles);
 
+// traces from one start point to several end points with a single
+// walk of the BSP, filling in traces[numtraces]
+void        CM_BoxTraceMany (vec3_t start, vec3_t *ends, int numtraces,
+                          vec3_t mins, vec3_t maxs,
+                          int headnode, int brushmask, trace_t *traces);
+
+// forget the remembered CM_BoxTrace results
+void        CM_ClearTraceCache (void);
+
+// compares the scalar and SSE2 brush clipping on the loaded map
+void        CM_ClipTest_f (void);
+
+extern    int    c_traces, c_brush_traces;
+extern    int    c_trace_hits, c_trace_misses, c_trace_batched;
+
 byte        *CM_ClusterPVS (int cluster);
 byte        *CM_ClusterPHS (int cluster);
+// the returned rows are only valid until the next call, don't write to them
+void        CM_OrVis (byte *dest, byte *src, int numbytes);
 
 int            CM_PointLeafnum (vec3_t p);
 
@@ -722,6 +862,84 @@ void    FS_FreeFile (void *buffer);
 
 void    FS_CreatePath (char *path);
 
+void    FS_PrefetchConfigstrings (char configstrings[][MAX_QPATH]);
+// starts reading ahead the models, sounds and images a level will load
+void    FS_PrefetchFlush (void);
+// drops whatever was read ahead and not loaded
+
+typedef struct
+{
+    double    time;            // seconds spent in FS_LoadFile, waits included
+    int        files;
+    int        bytes;
+    int        prefetched;        // buffers handed over by the prefetch thread
+    int        warmed;            // pak data the prefetch thread had already touched
+    int        missed;            // queued, but the prefetch thread hadn't got there
+} fsloadstats_t;
+
+extern    fsloadstats_t    fs_loadstats;
+
+
+/*
+==============================================================
+
+PROFILER
+
+==============================================================
+*/
+
+#define    PROF_FRAME            1        // all of Qcommon_Frame
+#define    PROF_SERVER            2
+#define    PROF_READPACKETS    3
+#define    PROF_GAMEFRAME        4
+#define    PROF_BUILDFRAME        5
+#define    PROF_SENDMESSAGES    6
+#define    PROF_BOXTRACE        7
+#define    PROF_CLIENT            8
+#define    PROF_REFRESH        9
+#define    NUM_PROF_ENGINEZONES    10    // game zones are added after these
+
+void    Prof_Init (void);
+void    Prof_Frame (void);
+int        Prof_Zone (char *name);
+void    Prof_Begin (int zone);
+void    Prof_End (int zone);
+
+
+/*
+==============================================================
+
+DEMO FILES
+
+==============================================================
+*/
+
+typedef struct demofile_s demofile_t;
+
+void        Demo_Init (void);
+void        Demo_Shutdown (void);
+demofile_t    *Demo_Open (char *name);
+// adds ".gz" to name with demo_compress, NULL if it couldn't be created
+qboolean    Demo_WriteMessage (demofile_t *demo, void *data, int len);
+// false if dropped because the disk is behind, len -1 ends the demo
+int            Demo_Tell (demofile_t *demo);
+// where the next message goes, uncompressed
+void        Demo_Close (demofile_t *demo);
+
+// an indexed demo has its keyframes after the end mark, followed by
+// their count and DEMO_INDEXID, all little endian
+#define    DEMO_INDEXID    (('X'<<24)+('D'<<16)+('I'<<8)+'D')    // "DIDX"
+
+typedef struct
+{
+    int        serverframe;
+    int        offset;            // of the message the keyframe starts in
+} demoindex_t;
+
+void        Demo_WriteIndex (demofile_t *demo, demoindex_t *index, int count);
+demoindex_t    *Demo_LoadIndex (FILE *f, int length, int *count);
+// Z_Malloc'd, NULL if the demo f is at the start of has no index
+
 
 /*
 ==============================================================
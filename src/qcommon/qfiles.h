@@ -46,7 +46,7 @@ typedef struct
     int        dirlen;
 } dpackheader_t;
 
-#define    MAX_FILES_IN_PACK    4096
+#define    MAX_FILES_IN_PACK    65536
 
 
 /*
@@ -25,13 +25,13 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // current entity info
 //
 qboolean        insubmodel;
-entity_t        *currententity;
-vec3_t            modelorg;        // modelorg is the viewpoint reletive to
+BANDLOCAL entity_t    *currententity;
+BANDLOCAL vec3_t    modelorg;        // modelorg is the viewpoint reletive to
                                 // the currently rendering entity
 vec3_t            r_entorigin;    // the currently rendering entity in world
                                 // coordinates
 
-float            entity_rotation[3][3];
+BANDLOCAL float    entity_rotation[3][3];
 
 int                r_currentbkey;
 
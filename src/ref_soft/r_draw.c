@@ -162,9 +162,11 @@ void Draw_GetPicSize (int *w, int *h, char *pic)
 /*
 =============
 Draw_StretchPicImplementation
+
+Copies every texel, so in truecolor a 255 is turned into holecolor
 =============
 */
-void Draw_StretchPicImplementation (int x, int y, int w, int h, image_t    *pic)
+void Draw_StretchPicImplementation (int x, int y, int w, int h, image_t    *pic, int holecolor)
 {
     byte            *dest, *source;
     int                v, u, sv;
@@ -213,6 +215,8 @@ void Draw_StretchPicImplementation (int x, int y, int w, int h, image_t    *pic)
                 f += fstep;
             }
         }
+        if (r_truecolor)    // the stretch writes up to three past w
+            R_FillHoles (dest, w == pic->width ? w : (w+3)&~3, holecolor);
     }
 }
 
@@ -235,7 +239,7 @@ void Draw_StretchPic (int x, int y, int w, int h, char *name)
         ri.Con_Printf (PRINT_ALL, "Can't find pic: %s\n", name);
         return;
     }
-    Draw_StretchPicImplementation (x, y, w, h, pic);
+    Draw_StretchPicImplementation (x, y, w, h, pic, r_holecolor);
 }
 
 /*
@@ -250,7 +254,7 @@ void Draw_StretchRaw (int x, int y, int w, int h, int cols, int rows, byte *data
     pic.pixels[0] = data;
     pic.width = cols;
     pic.height = rows;
-    Draw_StretchPicImplementation (x, y, w, h, &pic);
+    Draw_StretchPicImplementation (x, y, w, h, &pic, r_rawholecolor);
 }
 
 /*
@@ -388,6 +392,8 @@ void Draw_TileClear (int x, int y, int w, int h, char *name)
         psrc = pic->pixels[0] + pic->width * ((i+y)&63);
         for (j=x ; j<x2 ; j++)
             pdest[j] = psrc[j&63];
+        if (r_truecolor)
+            R_FillHoles (pdest + x, w, r_holecolor);
     }
 }
 
@@ -420,6 +426,8 @@ void Draw_Fill (int x, int y, int w, int h, int c)
     }
     if (w < 0 || h < 0)
         return;
+    if (r_truecolor && c == TRUECOLOR_HOLE)
+        c = r_holecolor;
     dest = vid.buffer + y*vid.rowbytes + x;
     for (v=0 ; v<h ; v++, dest += vid.rowbytes)
         for (u=0 ; u<w ; u++)
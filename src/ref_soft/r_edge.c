@@ -19,6 +19,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // r_edge.c
 
+#include <pthread.h>
+
 #include "r_local.h"
 
 #ifndef id386
@@ -48,7 +50,8 @@ have a sentinal at both ends?
 edge_t    *auxedges;
 edge_t    *r_edges, *edge_p, *edge_max;
 
-surf_t    *surfaces, *surface_p, *surf_max;
+BANDLOCAL surf_t    *surfaces, *surface_p;
+surf_t    *surf_max;
 
 // surfaces are generated in back to front order by the bsp, so if a surf
 // pointer is greater than another one, it should be drawn in front
@@ -57,24 +60,60 @@ surf_t    *surfaces, *surface_p, *surf_max;
 edge_t    *newedges[MAXHEIGHT];
 edge_t    *removeedges[MAXHEIGHT];
 
-espan_t    *span_p, *max_span_p;
+BANDLOCAL espan_t    *span_p, *max_span_p;
 
 int        r_currentkey;
 
-int    current_iv;
+BANDLOCAL int    current_iv;
 
-int    edge_head_u_shift20, edge_tail_u_shift20;
+BANDLOCAL int    edge_head_u_shift20, edge_tail_u_shift20;
 
 static void (*pdrawfunc)(void);
 
-edge_t    edge_head;
-edge_t    edge_tail;
-edge_t    edge_aftertail;
-edge_t    edge_sentinel;
+BANDLOCAL edge_t    edge_head;
+BANDLOCAL edge_t    edge_tail;
+BANDLOCAL edge_t    edge_aftertail;
+BANDLOCAL edge_t    edge_sentinel;
+
+BANDLOCAL float    fv;
+
+BANDLOCAL int    miplevel;
+
+/*
+** sw_threads splits the scan into horizontal bands.  Each band works on
+** its own copy of the edges and surfaces, since scanning links and steps
+** them, and only the surface cache is shared.
+*/
+#define MIN_BANDHEIGHT    16
 
-float    fv;
+typedef struct
+{
+    edge_t    *edge;
+    int        seq;                // keeps the sort stable
+} activeedge_t;
 
-static int    miplevel;
+typedef struct
+{
+    int        top, bottom;        // scan lines top through bottom-1
+    edge_t    *edges;
+    activeedge_t    *active;
+    int        maxedges;
+    surf_t    *surfs;
+    int        maxsurfs;
+} scanband_t;
+
+static scanband_t        scan_bands[MAX_SCANBANDS];
+static surf_t            *scan_surfaces;        // the surfaces filled in by the bsp
+static int                scan_numsurfs;
+static qboolean            scan_threaded;
+BANDLOCAL int            r_scanband;
+static pthread_mutex_t    scan_cachelock = PTHREAD_MUTEX_INITIALIZER;
+
+// newedges[] and removeedges[] point into r_edges; a band follows them
+// into its own copy
+BANDLOCAL edge_t    *scan_edges;
+
+#define SCANEDGE(e)    (scan_edges + ((e) - r_edges))
 
 float        scale_for_mip;
 int            ubasestep, errorterm, erroradjustup, erroradjustdown;
@@ -622,30 +661,13 @@ void R_GenerateSpansBackward (void)
 
 /*
 ==============
-R_ScanEdges
-
-Input: 
-newedges[] array
-    this has links to edges, which have links to surfaces
+R_ClearActiveEdges
 
-Output:
-Each surface has a linked list of its visible spans
+Clears the active edges to just the background edges around the whole screen
 ==============
 */
-void R_ScanEdges (void)
+static void R_ClearActiveEdges (void)
 {
-    int        iv, bottom;
-    byte    basespans[MAXSPANS*sizeof(espan_t)+CACHE_SIZE];
-    espan_t    *basespan_p;
-    surf_t    *s;
-
-    basespan_p = (espan_t *)
-            ((long)(basespans + CACHE_SIZE - 1) & ~(CACHE_SIZE - 1));
-    max_span_p = &basespan_p[MAXSPANS - r_refdef.vrect.width];
-
-    span_p = basespan_p;
-
-// clear active edges to just the background edges around the whole screen
 // FIXME: most of this only needs to be set up once
     edge_head.u = r_refdef.vrect.x << 20;
     edge_head_u_shift20 = edge_head.u >> 20;
@@ -672,13 +694,34 @@ void R_ScanEdges (void)
     // shamaz: previous value was 2000 << 24 which seems like nonsense.
     edge_sentinel.u = 0x7fffffff; // make sure nothing sorts past this
     edge_sentinel.prev = &edge_aftertail;
+}
+
+
+/*
+==============
+R_ScanLines
+
+Generates and draws the spans of scan lines top through bottom-1, starting
+from the active edges that are already set up for top
+==============
+*/
+static void R_ScanLines (int top, int bottom)
+{
+    int        iv;
+    byte    basespans[MAXSPANS*sizeof(espan_t)+CACHE_SIZE];
+    espan_t    *basespan_p;
+    surf_t    *s;
+
+    basespan_p = (espan_t *)
+            ((long)(basespans + CACHE_SIZE - 1) & ~(CACHE_SIZE - 1));
+    max_span_p = &basespan_p[MAXSPANS - r_refdef.vrect.width];
+
+    span_p = basespan_p;
 
 //    
 // process all scan lines
 //
-    bottom = r_refdef.vrectbottom - 1;
-
-    for (iv=r_refdef.vrect.y ; iv<bottom ; iv++)
+    for (iv=top ; iv<bottom ; iv++)
     {
         current_iv = iv;
         fv = (float)iv;
@@ -688,11 +731,15 @@ void R_ScanEdges (void)
 
         if (newedges[iv])
         {
-            R_InsertNewEdges (newedges[iv], edge_head.next);
+            R_InsertNewEdges (SCANEDGE(newedges[iv]), edge_head.next);
         }
 
         (*pdrawfunc) ();
 
+    // no need to step or sort or remove on the last scan
+        if (iv == bottom - 1)
+            break;
+
     // flush the span list if we can't be sure we have enough spans left for
     // the next scan
         if (span_p > max_span_p)
@@ -707,27 +754,231 @@ void R_ScanEdges (void)
         }
 
         if (removeedges[iv])
-            R_RemoveEdges (removeedges[iv]);
+            R_RemoveEdges (SCANEDGE(removeedges[iv]));
 
         if (edge_head.next != &edge_tail)
             R_StepActiveU (edge_head.next);
     }
 
-// do the last scan (no need to step or sort or remove on the last scan)
+// draw whatever's left in the span list
+    D_DrawSurfaces ();
+}
 
-    current_iv = iv;
-    fv = (float)iv;
 
-// mark that the head (background start) span is pre-included
-    surfaces[1].spanstate = 1;
+/*
+==============
+R_SortActiveEdge
+==============
+*/
+static int R_SortActiveEdge (const void *a, const void *b)
+{
+    const activeedge_t    *ea = a, *eb = b;
 
-    if (newedges[iv])
-        R_InsertNewEdges (newedges[iv], edge_head.next);
+    if (ea->edge->u != eb->edge->u)
+        return ea->edge->u < eb->edge->u ? -1 : 1;
+    return ea->seq - eb->seq;
+}
 
-    (*pdrawfunc) ();
 
-// draw whatever's left in the span list
-    D_DrawSurfaces ();
+/*
+==============
+R_BandActiveEdges
+
+Sets up the active edges for the first line of a band without scanning the
+lines above it: every edge that started above the band and is still alive
+is stepped down to the band in one go, and the lot is sorted on u.
+==============
+*/
+static void R_BandActiveEdges (scanband_t *band)
+{
+    activeedge_t    *active;
+    edge_t            *edge, *e, *prev;
+    int                v, i, count;
+
+// edges removed above the band are never looked at again; mark them
+    for (v=r_refdef.vrect.y ; v<band->top ; v++)
+        for (edge = removeedges[v] ; edge ; edge = edge->nextremove)
+            SCANEDGE(edge)->prev = SCANEDGE(edge);
+
+    active = band->active;
+    count = 0;
+    for (v=r_refdef.vrect.y ; v<band->top ; v++)
+    {
+        for (edge = newedges[v] ; edge ; edge = edge->next)
+        {
+            e = SCANEDGE(edge);
+            if (e->prev == e)
+                continue;
+            e->u = (unsigned)e->u + (unsigned)(band->top - v) * (unsigned)e->u_step;
+            active[count].edge = e;
+            active[count].seq = count;
+            count++;
+        }
+    }
+
+    qsort (active, count, sizeof(*active), R_SortActiveEdge);
+
+    prev = &edge_head;
+    for (i=0 ; i<count ; i++)
+    {
+        e = active[i].edge;
+        e->prev = prev;
+        prev->next = e;
+        prev = e;
+    }
+    prev->next = &edge_tail;
+    edge_tail.prev = prev;
+}
+
+
+/*
+==============
+R_ScanBand
+
+One sw_threads job: copy the edges and surfaces, then scan the band's lines
+==============
+*/
+static void R_ScanBand (int job, void *data)
+{
+    scanband_t    *band = &scan_bands[job];
+    edge_t        *edge;
+    int            numedges;
+
+    r_scanband = job;
+
+    numedges = edge_p - r_edges;
+    memcpy (band->edges, r_edges, numedges * sizeof(edge_t));
+    for (edge = band->edges ; edge < band->edges + numedges ; edge++)
+    {
+        if (edge->next)
+            edge->next = band->edges + (edge->next - r_edges);
+        if (edge->nextremove)
+            edge->nextremove = band->edges + (edge->nextremove - r_edges);
+        edge->prev = NULL;
+    }
+    scan_edges = band->edges;
+
+    memcpy (&band->surfs[1], &scan_surfaces[1], (scan_numsurfs - 1) * sizeof(surf_t));
+    surfaces = band->surfs;
+    surface_p = &band->surfs[scan_numsurfs];
+
+    // the surface drawers start from the unrotated world view
+    VectorCopy (base_vpn, vpn);
+    VectorCopy (base_vup, vup);
+    VectorCopy (base_vright, vright);
+
+    R_ClearActiveEdges ();
+    R_BandActiveEdges (band);
+    R_ScanLines (band->top, band->bottom);
+}
+
+
+/*
+==============
+R_ScanBands
+
+Splits the view into numbands bands of lines and scans them on the
+sw_threads workers
+==============
+*/
+static void R_ScanBands (int numbands)
+{
+    scanband_t    *band;
+    surf_t        *savesurfaces, *savesurface_p;
+    int            i, height, numedges;
+
+    numedges = edge_p - r_edges;
+    height = r_refdef.vrectbottom - r_refdef.vrect.y;
+
+    scan_surfaces = surfaces;
+    scan_numsurfs = surface_p - surfaces;
+
+    for (i=0, band=scan_bands ; i<numbands ; i++, band++)
+    {
+        band->top = r_refdef.vrect.y + height * i / numbands;
+        band->bottom = r_refdef.vrect.y + height * (i + 1) / numbands;
+
+        if (band->maxedges < numedges)
+        {
+            free (band->edges);
+            free (band->active);
+            band->maxedges = r_numallocatededges;
+            band->edges = malloc (band->maxedges * sizeof(edge_t));
+            band->active = malloc (band->maxedges * sizeof(activeedge_t));
+        }
+        if (band->maxsurfs < scan_numsurfs)
+        {
+            free (band->surfs);
+            band->maxsurfs = r_cnumsurfs + 1;    // surfaces[0] is the dummy
+            band->surfs = malloc (band->maxsurfs * sizeof(surf_t));
+        }
+    }
+
+    // the calling thread scans bands too
+    savesurfaces = surfaces;
+    savesurface_p = surface_p;
+
+    scan_threaded = true;
+    Sys_RunJobs (R_ScanBand, numbands, NULL, sw_threads->value);
+    scan_threaded = false;
+    r_scanband = 0;
+
+    surfaces = savesurfaces;
+    surface_p = savesurface_p;
+    scan_edges = r_edges;
+}
+
+
+/*
+==============
+R_FreeScanBands
+==============
+*/
+void R_FreeScanBands (void)
+{
+    scanband_t    *band;
+
+    for (band = scan_bands ; band < scan_bands + MAX_SCANBANDS ; band++)
+    {
+        free (band->edges);
+        free (band->active);
+        free (band->surfs);
+        memset (band, 0, sizeof(*band));
+    }
+}
+
+
+/*
+==============
+R_ScanEdges
+
+Input: 
+newedges[] array
+    this has links to edges, which have links to surfaces
+
+Output:
+Each surface has a linked list of its visible spans
+==============
+*/
+void R_ScanEdges (void)
+{
+    int        numbands;
+
+    numbands = sw_threads->value;
+    if (numbands > MAX_SCANBANDS)
+        numbands = MAX_SCANBANDS;
+    if (numbands > r_refdef.vrect.height / MIN_BANDHEIGHT)
+        numbands = r_refdef.vrect.height / MIN_BANDHEIGHT;
+
+    if (numbands > 1)
+    {
+        R_ScanBands (numbands);
+        return;
+    }
+
+    scan_edges = r_edges;
+    R_ClearActiveEdges ();
+    R_ScanLines (r_refdef.vrect.y, r_refdef.vrectbottom);
 }
 
 
@@ -739,11 +990,11 @@ SURFACE FILLING
 =========================================================================
 */
 
-msurface_t        *pface;
-surfcache_t        *pcurrentcache;
-vec3_t            transformed_modelorg;
-vec3_t            world_transformed_modelorg;
-vec3_t            local_modelorg;
+BANDLOCAL msurface_t        *pface;
+BANDLOCAL surfcache_t    *pcurrentcache;
+BANDLOCAL vec3_t        transformed_modelorg;
+BANDLOCAL vec3_t        world_transformed_modelorg;
+BANDLOCAL vec3_t        local_modelorg;
 
 /*
 =============
@@ -781,8 +1032,23 @@ void D_FlatFillSurface (surf_t *surf, int color)
 {
     espan_t    *span;
     byte    *pdest;
+    unsigned    *pdest32, color32;
     int        u, u2;
     
+    if (r_truecolor)
+    {
+        color32 = d_8to32table[color];
+        for (span=surf->spans ; span ; span=span->pnext)
+        {
+            pdest32 = d_viewbuffer32 + r_screenwidth*span->v;
+            u = span->u;
+            u2 = span->u + span->count - 1;
+            for ( ; u <= u2 ; u++)
+                pdest32[u] = color32;
+        }
+        return;
+    }
+
     for (span=surf->spans ; span ; span=span->pnext)
     {
         pdest = (byte *)d_viewbuffer + r_screenwidth*span->v;
@@ -871,7 +1137,7 @@ void D_BackgroundSurf (surf_t *s)
     d_ziorigin = -0.9;
 
     D_FlatFillSurface (s, (int)sw_clearcolor->value & 0xFF);
-    D_DrawZSpans (s->spans);
+    (*d_drawzspans) (s->spans);
 }
 
 /*
@@ -916,7 +1182,7 @@ void D_TurbulentSurf (surf_t *s)
 //PGM
 //============
 
-    D_DrawZSpans (s->spans);
+    (*d_drawzspans) (s->spans);
 
     if (s->insubmodel)
     {
@@ -955,7 +1221,11 @@ void D_SkySurf (surf_t *s)
 
     D_CalcGradients (pface);
 
-    D_DrawSpans16 (s->spans);
+    // not a surface cache block, so no d_drawspans
+    if (r_truecolor)
+        D_DrawSpans8to32 (s->spans);
+    else
+        D_DrawSpans16 (s->spans);
 
 // set up a gradient for the background surface that places it
 // effectively at infinity distance from the viewpoint
@@ -963,7 +1233,7 @@ void D_SkySurf (surf_t *s)
     d_zistepv = 0;
     d_ziorigin = -0.9;
 
-    D_DrawZSpans (s->spans);
+    (*d_drawzspans) (s->spans);
 }
 
 /*
@@ -1025,16 +1295,24 @@ void D_SolidSurf (surf_t *s)
 #endif
 
 // FIXME: make this passed in to D_CacheSurface
+    if (scan_threaded)
+        pthread_mutex_lock (&scan_cachelock);
+
     pcurrentcache = D_CacheSurface (pface, miplevel);
 
     cacheblock = (pixel_t *)pcurrentcache->data;
     cachewidth = pcurrentcache->width;
 
+    // the block stays put until the next frame (see D_SCAlloc), so the
+    // spans can be drawn from it without the lock
+    if (scan_threaded)
+        pthread_mutex_unlock (&scan_cachelock);
+
     D_CalcGradients (pface);
 
-    D_DrawSpans16 (s->spans);
+    (*d_drawspans) (s->spans);
 
-    D_DrawZSpans (s->spans);
+    (*d_drawzspans) (s->spans);
 
     if (s->insubmodel)
     {
@@ -1076,7 +1354,7 @@ void D_DrawflatSurfaces (void)
         // make a stable color for each surface by taking the low
         // bits of the msurface pointer
         D_FlatFillSurface (s, (uintptr_t)s->msurf & 0xFF);
-        D_DrawZSpans (s->spans);
+        (*d_drawzspans) (s->spans);
     }
 }
 
@@ -1104,7 +1382,7 @@ void D_DrawSurfaces (void)
             if (!s->spans)
                 continue;
 
-            r_drawnpolycount++;
+            __sync_fetch_and_add (&r_drawnpolycount, 1);
 
             if (! (s->flags & (SURF_DRAWSKYBOX|SURF_DRAWBACKGROUND|SURF_DRAWTURB) ) )
                 D_SolidSurf (s);
@@ -439,7 +439,13 @@ image_t *GL_LoadPic (char *name, byte *pic, int width, int height, imagetype_t t
     {
         b = pic[i];
         if (b == 255)
-            image->transparent = true;
+        {
+            // skins draw every texel, and a 255 would be a hole in truecolor
+            if (r_truecolor && type == it_skin)
+                b = r_holecolor;
+            else
+                image->transparent = true;
+        }
         image->pixels[0][i] = b;
     }
 
@@ -32,6 +32,12 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #define REF_VERSION     "SOFT 0.01"
 
+// state that each sw_threads scan band keeps for itself while it generates
+// and draws its spans; every other thread sees its own copy
+#define BANDLOCAL       __thread __attribute__((visibility("hidden"), tls_model("local-dynamic")))
+
+#define MAX_SCANBANDS   32
+
 // up / down
 #define PITCH   0
 
@@ -90,6 +96,8 @@ typedef struct
     pixel_t                 *buffer;                // invisible buffer
     pixel_t                 *colormap;              // 256 * VID_GRADES size
     pixel_t                 *alphamap;              // 256 * 256 translucency map
+    unsigned                *buffer32;              // world layer for sw_truecolor, rowbytes
+                                                    // pixels apart, NULL in 8 bit mode
     int                             rowbytes;               // may be > width if displayed in a window
                                     // can be negative for stupid dibs
     int                        width;          
@@ -328,6 +336,7 @@ typedef struct
 {
     byte            *surfdat;       // destination for generated surface
     int                     rowbytes;       // destination logical width in bytes
+    qboolean        truecolor;      // surfdat holds 32 bit texels
     msurface_t      *surf;          // description for surface to generate
     fixed8_t        lightadj[MAXLIGHTMAPS];
                             // adjust for lightmap levels for dynamic lighting
@@ -368,8 +377,10 @@ typedef struct clipplane_s
 
 typedef struct surfcache_s
 {
-    struct surfcache_s      *next;
+    struct surfcache_s      *next, *prev;           // recency list of the size class
     struct surfcache_s      **owner;                // NULL is an empty chunk of memory
+    struct scsegment_s      *segment;
+    int                                     frame;          // r_framecount when last drawn
     int                                     lightadj[MAXLIGHTMAPS]; // checked for strobe flush
     int                                     dlight;
     int                                     size;           // including header
@@ -475,28 +486,36 @@ extern drawsurf_t       r_drawsurf;
 void R_DrawSurface (void);
 
 extern int              c_surf;
+extern int              c_surfhits, c_surfevicts, c_surfbytes;
+extern int              sc_size, sc_allocated;
+extern qboolean         r_cache_thrash;
+extern BANDLOCAL int    r_scanband;     // the band being scanned, 0 outside of them
 
 extern byte             *r_warpbuffer;
+extern unsigned         *r_warpbuffer32;
 
 
 
 
 extern float    scale_for_mip;
 
-extern qboolean         d_roverwrapped;
-extern surfcache_t      *sc_rover;
-extern surfcache_t      *d_initial_rover;
 
-extern float    d_sdivzstepu, d_tdivzstepu, d_zistepu;
-extern float    d_sdivzstepv, d_tdivzstepv, d_zistepv;
-extern float    d_sdivzorigin, d_tdivzorigin, d_ziorigin;
+extern BANDLOCAL float   d_sdivzstepu, d_tdivzstepu, d_zistepu;
+extern BANDLOCAL float   d_sdivzstepv, d_tdivzstepv, d_zistepv;
+extern BANDLOCAL float   d_sdivzorigin, d_tdivzorigin, d_ziorigin;
 
-extern  fixed16_t       sadjust, tadjust;
-extern  fixed16_t       bbextents, bbextentt;
+extern BANDLOCAL fixed16_t      sadjust, tadjust;
+extern BANDLOCAL fixed16_t      bbextents, bbextentt;
 
 
 void D_DrawSpans16 (espan_t *pspans);
 void D_DrawZSpans (espan_t *pspans);
+extern void (*d_drawspans) (espan_t *pspan);
+extern void (*d_drawzspans) (espan_t *pspan);
+void D_InitSpans (void);
+void D_SpanTest_f (void);
+void D_DrawSpans32 (espan_t *pspan);
+void D_DrawSpans8to32 (espan_t *pspan);
 void Turbulent8 (espan_t *pspan);
 void NonTurbulent8 (espan_t *pspan);    //PGM
 
@@ -507,6 +526,7 @@ extern int      d_vrectx, d_vrecty, d_vrectright_particle, d_vrectbottom_particl
 extern int      d_pix_min, d_pix_max, d_pix_shift;
 
 extern pixel_t  *d_viewbuffer;
+extern unsigned *d_viewbuffer32;
 extern short *d_pzbuffer;
 extern unsigned int d_zrowbytes, d_zwidth;
 extern short    *zspantable[MAXHEIGHT];
@@ -517,8 +537,8 @@ extern float    d_scalemip[3];
 
 //===================================================================
 
-extern int              cachewidth;
-extern pixel_t  *cacheblock;
+extern BANDLOCAL int    cachewidth;
+extern BANDLOCAL pixel_t        *cacheblock;
 extern int              r_screenwidth;
 
 extern int              r_drawnpolycount;
@@ -527,11 +547,11 @@ extern int      sintable[1280];
 extern int      intsintable[1280];
 extern int        blanktable[1280];        // PGM
 
-extern  vec3_t  vup, base_vup;
-extern  vec3_t  vpn, base_vpn;
-extern  vec3_t  vright, base_vright;
+extern BANDLOCAL vec3_t  vup, vpn, vright;
+extern  vec3_t  base_vup, base_vpn, base_vright;
 
-extern  surf_t  *surfaces, *surface_p, *surf_max;
+extern BANDLOCAL surf_t *surfaces, *surface_p;
+extern  surf_t  *surf_max;
 
 // surfaces are generated in back to front order by the bsp, so if a surf
 // pointer is greater than another one, it should be drawn in front
@@ -571,6 +591,9 @@ extern cvar_t   *sw_reportedgeout;
 extern cvar_t   *sw_stipplealpha;
 extern cvar_t   *sw_surfcacheoverride;
 extern cvar_t   *sw_waterwarp;
+extern cvar_t   *sw_threads;
+extern cvar_t   *sw_simd;
+extern cvar_t   *sw_truecolor;
 
 extern cvar_t   *r_fullbright;
 extern cvar_t    *r_lefthand;
@@ -587,7 +610,7 @@ extern cvar_t    *vid_fullscreen;
 extern    cvar_t    *vid_gamma;
 
 
-extern  clipplane_t     view_clipplanes[4];
+extern BANDLOCAL clipplane_t    view_clipplanes[4];
 extern int              *pfrustum_indexes[4];
 
 
@@ -603,8 +626,8 @@ extern  vec3_t  r_origin;
 
 extern    entity_t    r_worldentity;
 extern  model_t         *currentmodel;
-extern  entity_t                *currententity;
-extern  vec3_t  modelorg;
+extern BANDLOCAL entity_t       *currententity;
+extern BANDLOCAL vec3_t modelorg;
 extern  vec3_t  r_entorigin;
 
 extern  float   verticalFieldOfView;
@@ -657,6 +680,7 @@ surf_t *R_GetSurf (void);
 void R_AliasDrawModel (void);
 void R_BeginEdgeFrame (void);
 void R_ScanEdges (void);
+void R_FreeScanBands (void);
 void D_DrawSurfaces (void);
 void R_InsertNewEdges (edge_t *edgestoadd, edge_t *edgelist);
 void R_StepActiveU (edge_t *pedge);
@@ -678,12 +702,12 @@ extern int      r_wholepolycount;
 
 extern int                      ubasestep, errorterm, erroradjustup, erroradjustdown;
 
-extern fixed16_t        sadjust, tadjust;
-extern fixed16_t        bbextents, bbextentt;
+extern BANDLOCAL fixed16_t       sadjust, tadjust;
+extern BANDLOCAL fixed16_t       bbextents, bbextentt;
 
 extern mvertex_t        *r_ptverts, *r_ptvertsmax;
 
-extern float                    entity_rotation[3][3];
+extern BANDLOCAL float          entity_rotation[3][3];
 
 extern int              r_currentkey;
 extern int              r_currentbkey;
@@ -702,9 +726,9 @@ extern  edge_t  *newedges[MAXHEIGHT];
 extern  edge_t  *removeedges[MAXHEIGHT];
 
 // FIXME: make stack vars when debugging done
-extern  edge_t  edge_head;
-extern  edge_t  edge_tail;
-extern  edge_t  edge_aftertail;
+extern BANDLOCAL edge_t edge_head;
+extern BANDLOCAL edge_t edge_tail;
+extern BANDLOCAL edge_t edge_aftertail;
 
 extern    int    r_aliasblendcolor;
 
@@ -732,6 +756,7 @@ extern float    r_time1;
 extern float    da_time1, da_time2;
 extern float    dp_time1, dp_time2, db_time1, db_time2, rw_time1, rw_time2;
 extern float    se_time1, se_time2, de_time1, de_time2, dv_time1, dv_time2;
+extern float    sw_presenttime;
 extern int              r_frustum_indexes[4*6];
 extern int              r_maxsurfsseen, r_maxedgesseen, r_cnumsurfs;
 extern qboolean r_surfsonstack;
@@ -759,8 +784,6 @@ void R_SplitEntityOnNode2 (mnode_t *node);
 
 extern  refdef_t        r_newrefdef;
 
-extern  surfcache_t     *sc_rover, *sc_base;
-
 extern  void            *colormap;
 
 //====================================================================
@@ -775,6 +798,7 @@ int R_Init( void *hInstance, void *wndProc );
 void R_Shutdown (void);
 void R_InitCaches (void);
 void D_FlushCaches (void);
+void D_FreeCaches (void);
 
 void    R_ScreenShot_f( void );
 void    R_BeginRegistration (char *map);
@@ -807,6 +831,48 @@ void    R_CinematicSetPalette( const unsigned char *palette );
 
 extern unsigned d_8to24table[256]; // base
 
+/*
+====================================================================
+
+TRUECOLOR
+
+With sw_truecolor the world is drawn into a 32 bit layer (vid.buffer32,
+0x00RRGGBB) and everything else keeps drawing palette indices into the 8 bit
+buffer on top of it. Where the world shows through, the 8 bit buffer holds
+TRUECOLOR_HOLE; SWimp_EndFrame composites the two.
+
+Nothing opaque may draw TRUECOLOR_HOLE itself, so the colormap, skins,
+particles and the 2D copies have it swapped for r_holecolor, the closest
+other palette color.
+
+====================================================================
+*/
+
+#define TRUECOLOR_HOLE      255     // the transparent index, rarely drawn otherwise
+
+extern qboolean         r_truecolor;
+extern byte             r_holecolor;                // nearest other index, drawn for an opaque 255
+extern byte             r_rawholecolor;             // the same for the cinematic palette
+extern unsigned         d_8to32table[256];          // gamma corrected
+extern unsigned short   r_lightscale[VID_GRADES*256];   // 8.8, by blocklights value
+extern byte             r_fullbrights[256];
+
+void R_InitTrueColor (void);
+int  R_HoleColor (const byte *pal, int stride);
+void R_FillHoles (byte *dest, int count, int color);
+void R_Build8to32Table (void);
+void R_ClearTrueColorView (void);
+void R_TintTrueColor (vec3_t premult, float one_minus_alpha);
+void R_Blend32 (pixel_t *pdest, int color, int alpha);
+
+// blend color over an 8 bit view pixel with 33% or 66% opacity
+#define R_BLEND33(pdest, color) \
+    (r_truecolor ? R_Blend32 ((pdest), (color), 85) \
+                 : (void)(*(pdest) = vid.alphamap[(color) + *(pdest)*256]))
+#define R_BLEND66(pdest, color) \
+    (r_truecolor ? R_Blend32 ((pdest), (color), 170) \
+                 : (void)(*(pdest) = vid.alphamap[(color)*256 + *(pdest)]))
+
 void    Sys_MakeCodeWriteable (unsigned long startaddr, unsigned long length);
 void    Sys_SetFPCW (void);
 
@@ -40,6 +40,8 @@ model_t        *currentmodel;
 model_t        *r_worldmodel;
 
 byte        *r_warpbuffer;
+unsigned    *r_warpbuffer32;
+qboolean    r_truecolor;        // latched from sw_truecolor in R_Init
 
 swstate_t sw_state;
 
@@ -64,9 +66,8 @@ int            r_clipflags;
 //
 // view origin
 //
-vec3_t    vup, base_vup;
-vec3_t    vpn, base_vpn;
-vec3_t    vright, base_vright;
+BANDLOCAL vec3_t    vup, vpn, vright;
+vec3_t    base_vup, base_vpn, base_vright;
 vec3_t    r_origin;
 
 //
@@ -106,6 +107,7 @@ image_t      *r_notexture_mip;
 
 float    da_time1, da_time2, dp_time1, dp_time2, db_time1, db_time2, rw_time1, rw_time2;
 float    se_time1, se_time2, de_time1, de_time2;
+float    sw_presenttime;    // ms spent in the last SWimp_EndFrame
 
 void R_MarkLeaves (void);
 
@@ -123,6 +125,9 @@ cvar_t    *sw_reportsurfout;
 cvar_t  *sw_stipplealpha;
 cvar_t    *sw_surfcacheoverride;
 cvar_t    *sw_waterwarp;
+cvar_t    *sw_threads;
+cvar_t    *sw_simd;
+cvar_t    *sw_truecolor;
 
 cvar_t    *r_drawworld;
 cvar_t    *r_drawentities;
@@ -171,15 +176,16 @@ cvar_t    *sw_lockpvs;
 // FIXME: make into one big structure, like cl or sv
 // FIXME: do separately for refresh engine and driver
 
-float    d_sdivzstepu, d_tdivzstepu, d_zistepu;
-float    d_sdivzstepv, d_tdivzstepv, d_zistepv;
-float    d_sdivzorigin, d_tdivzorigin, d_ziorigin;
+BANDLOCAL float    d_sdivzstepu, d_tdivzstepu, d_zistepu;
+BANDLOCAL float    d_sdivzstepv, d_tdivzstepv, d_zistepv;
+BANDLOCAL float    d_sdivzorigin, d_tdivzorigin, d_ziorigin;
 
-fixed16_t    sadjust, tadjust, bbextents, bbextentt;
+BANDLOCAL fixed16_t    sadjust, tadjust, bbextents, bbextentt;
 
-pixel_t            *cacheblock;
-int                cachewidth;
+BANDLOCAL pixel_t    *cacheblock;
+BANDLOCAL int        cachewidth;
 pixel_t            *d_viewbuffer;
+unsigned        *d_viewbuffer32;
 short            *d_pzbuffer;
 unsigned int    d_zrowbytes;
 unsigned int    d_zwidth;
@@ -259,6 +265,9 @@ void R_Register (void)
     sw_stipplealpha = ri.Cvar_Get( "sw_stipplealpha", "0", CVAR_ARCHIVE );
     sw_surfcacheoverride = ri.Cvar_Get ("sw_surfcacheoverride", "0", 0);
     sw_waterwarp = ri.Cvar_Get ("sw_waterwarp", "1", 0);
+    sw_threads = ri.Cvar_Get ("sw_threads", "0", 0);
+    sw_simd = ri.Cvar_Get ("sw_simd", "1", 0);
+    sw_truecolor = ri.Cvar_Get ("sw_truecolor", "0", CVAR_ARCHIVE);
     sw_mode = ri.Cvar_Get( "sw_mode", "0", CVAR_ARCHIVE );
 
     r_lefthand = ri.Cvar_Get( "hand", "0", CVAR_USERINFO | CVAR_ARCHIVE );
@@ -277,9 +286,11 @@ void R_Register (void)
     ri.Cmd_AddCommand ("modellist", Mod_Modellist_f);
     ri.Cmd_AddCommand( "screenshot", R_ScreenShot_f );
     ri.Cmd_AddCommand( "imagelist", R_ImageList_f );
+    ri.Cmd_AddCommand ("sw_spantest", D_SpanTest_f);
 
     sw_mode->modified = true; // force us to do mode specific stuff later
     vid_gamma->modified = true; // force us to rebuild the gamma table later
+    sw_simd->modified = true; // force us to pick the span drawers later
 
 //PGM
     sw_lockpvs = ri.Cvar_Get ("sw_lockpvs", "0", 0);
@@ -291,6 +302,7 @@ void R_UnRegister (void)
     ri.Cmd_RemoveCommand( "screenshot" );
     ri.Cmd_RemoveCommand ("modellist");
     ri.Cmd_RemoveCommand( "imagelist" );
+    ri.Cmd_RemoveCommand ("sw_spantest");
 }
 
 /*
@@ -328,6 +340,12 @@ int R_Init( void *hInstance, void *wndProc )
 
     R_Register ();
     Draw_GetPalette ();
+
+    // the pixel depth can only change with a restart of the refresh
+    r_truecolor = sw_truecolor->value != 0;
+    if (r_truecolor)
+        R_InitTrueColor ();
+
     if (SWimp_Init( hInstance, wndProc ) == false)
         return -1;
 
@@ -353,12 +371,7 @@ void R_Shutdown (void)
         d_pzbuffer = NULL;
     }
     // free surface cache
-    if (sc_base)
-    {
-        D_FlushCaches ();
-        free (sc_base);
-        sc_base = NULL;
-    }
+    D_FreeCaches ();
 
     // free colormap
     if (vid.colormap)
@@ -372,6 +385,9 @@ void R_Shutdown (void)
         free (r_warpbuffer);
         r_warpbuffer = NULL;
     }
+    free (r_warpbuffer32);
+    r_warpbuffer32 = NULL;
+    R_FreeScanBands ();
     R_UnRegister ();
     Mod_FreeAll ();
     R_ShutdownImages ();
@@ -867,6 +883,9 @@ void R_EdgeDrawing (void)
     if ( r_newrefdef.rdflags & RDF_NOWORLDMODEL )
         return;
 
+    if (r_truecolor)
+        R_ClearTrueColorView ();
+
     if (auxedges)
     {
         r_edges = auxedges;
@@ -954,6 +973,10 @@ void R_CalcPalette (void)
 
     one_minus_alpha = (1.0 - alpha);
 
+    // the palette only reaches the 8 bit layer
+    if (r_truecolor)
+        R_TintTrueColor (premult, one_minus_alpha);
+
     in = (byte *)d_8to24table;
     out = palette[0];
     for (i=0 ; i<256 ; i++, in+=4, out+=4)
@@ -997,6 +1020,10 @@ static void R_MaybeAllocWarpBuffer (int w, int h)
         int warp_h = r_newrefdef.height / WARP_SCALE;
         // sizeof(byte) == 1 lol
         r_warpbuffer = malloc (warp_w * warp_h * sizeof (byte)); 
+        if (r_truecolor) {
+            free (r_warpbuffer32);
+            r_warpbuffer32 = malloc (warp_w * warp_h * sizeof (unsigned));
+        }
     }
 }
 
@@ -1104,12 +1131,7 @@ void R_InitGraphics( int width, int height )
     }
 
     // free surface cache
-    if ( sc_base )
-    {
-        D_FlushCaches ();
-        free( sc_base );
-        sc_base = NULL;
-    }
+    D_FreeCaches();
 
     d_pzbuffer = malloc(vid.width*vid.height*2);
 
@@ -1137,10 +1159,17 @@ void R_BeginFrame( float camera_separation )
     {
         Draw_BuildGammaTable();
         R_GammaCorrectAndSetPalette( ( const unsigned char * ) d_8to24table );
+        R_Build8to32Table();
 
         vid_gamma->modified = false;
     }
 
+    if ( sw_simd->modified )
+    {
+        D_InitSpans();
+        sw_simd->modified = false;
+    }
+
     while ( sw_mode->modified || vid_fullscreen->modified )
     {
         rserr_t err;
@@ -1230,10 +1259,12 @@ void R_CinematicSetPalette( const unsigned char *palette )
         }
 
         R_GammaCorrectAndSetPalette( palette32 );
+        r_rawholecolor = R_HoleColor (palette, 3);
     }
     else
     {
         R_GammaCorrectAndSetPalette( ( const unsigned char * ) d_8to24table );
+        r_rawholecolor = r_holecolor;
     }
 }
 
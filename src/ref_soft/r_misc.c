@@ -26,8 +26,6 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 cvar_t    *sw_mipcap;
 cvar_t    *sw_mipscale;
 
-surfcache_t        *d_initial_rover;
-qboolean        d_roverwrapped;
 int                d_minmip;
 float            d_scalemip[NUM_MIPS-1];
 
@@ -137,9 +135,10 @@ void R_PrintTimes (void)
 
     ms = r_time2 - r_time1;
     
-    ri.Con_Printf (PRINT_ALL,"%5i ms %3i/%3i/%3i poly %3i surf\n",
-                ms, c_faceclip, r_polycount, r_drawnpolycount, c_surf);
-    c_surf = 0;
+    ri.Con_Printf (PRINT_ALL,"%5i ms %3i/%3i/%3i poly %3i/%3i/%3i surf %4ik built %5ik/%5ik cache %4.1f present\n",
+                ms, c_faceclip, r_polycount, r_drawnpolycount,
+                c_surf, c_surfhits, c_surfevicts, c_surfbytes/1024,
+                sc_allocated/1024, sc_size/1024, sw_presenttime);
 }
 
 
@@ -463,6 +462,7 @@ void R_SetupFrame (void)
         vrect.height = r_newrefdef.height / WARP_SCALE;
 
         d_viewbuffer = r_warpbuffer;
+        d_viewbuffer32 = r_warpbuffer32;
         r_screenwidth = vrect.width;
     }
     else
@@ -473,6 +473,7 @@ void R_SetupFrame (void)
         vrect.height = r_newrefdef.height;
 
         d_viewbuffer = (void *)vid.buffer;
+        d_viewbuffer32 = vid.buffer32;
         r_screenwidth = vid.rowbytes;
     }
     
@@ -497,9 +498,13 @@ void R_SetupFrame (void)
     r_outofsurfaces = 0;
     r_outofedges = 0;
 
+    c_surf = 0;
+    c_surfhits = 0;
+    c_surfevicts = 0;
+    c_surfbytes = 0;
+    r_cache_thrash = false;
+
 // d_setup
-    d_roverwrapped = false;
-    d_initial_rover = sc_rover;
 
     d_minmip = sw_mipcap->value;
     if (d_minmip > 3)
@@ -529,6 +534,230 @@ void R_SurfacePatch (void)
 #endif    // !id386
 
 
+/*
+==============================================================================
+
+                        TRUECOLOR
+
+==============================================================================
+*/
+
+unsigned        d_8to32table[256];
+unsigned short  r_lightscale[VID_GRADES*256];
+byte            r_fullbrights[256];
+byte            r_holecolor;
+byte            r_rawholecolor;
+
+/*
+===============
+R_HoleColor
+
+The color other than TRUECOLOR_HOLE that is closest to it in a palette
+with stride bytes per color
+===============
+*/
+int R_HoleColor (const byte *pal, int stride)
+{
+    int        i, j, d, dist, best, color;
+
+    best = 0x7fffffff;
+    color = 0;
+    for (i=0 ; i<TRUECOLOR_HOLE ; i++)
+    {
+        dist = 0;
+        for (j=0 ; j<3 ; j++)
+        {
+            d = pal[i*stride+j] - pal[TRUECOLOR_HOLE*stride+j];
+            dist += d*d;
+        }
+        if (dist < best)
+        {
+            best = dist;
+            color = i;
+        }
+    }
+    return color;
+}
+
+/*
+===============
+R_InitTrueColor
+
+32 bit surfaces are lit with a multiply, so measure how bright each colormap
+row is against the plain palette; r_lightscale interpolates between rows so
+the light doesn't band. Colors the colormap never changes are fullbright.
+
+Then TRUECOLOR_HOLE is taken out of the colormap and alphamap, so lit and
+blended 8 bit pixels can't open a hole by accident.
+===============
+*/
+void R_InitTrueColor (void)
+{
+    byte    *pal, *cmap;
+    float    rowscale[VID_GRADES], base, lit;
+    int        i, c, row, frac, s0, s1;
+
+    pal = (byte *)d_8to24table;
+    cmap = vid.colormap;
+
+    for (i=0 ; i<256 ; i++)
+        r_fullbrights[i] = cmap[i] == i && cmap[(VID_GRADES-1)*256 + i] == i;
+
+    base = 0;
+    for (i=0 ; i<256 ; i++)
+        if (!r_fullbrights[i])
+            base += pal[i*4+0] + pal[i*4+1] + pal[i*4+2];
+
+    for (row=0 ; row<VID_GRADES ; row++)
+    {
+        lit = 0;
+        for (i=0 ; i<256 ; i++)
+        {
+            if (r_fullbrights[i])
+                continue;
+            c = cmap[row*256 + i];
+            lit += pal[c*4+0] + pal[c*4+1] + pal[c*4+2];
+        }
+        rowscale[row] = base ? lit / base : 1;
+    }
+
+    for (i=0 ; i<VID_GRADES*256 ; i++)
+    {
+        row = i >> 8;
+        frac = i & 255;
+        s0 = rowscale[row] * 256;
+        s1 = rowscale[row < VID_GRADES-1 ? row+1 : row] * 256;
+        r_lightscale[i] = s0 + (((s1 - s0) * frac) >> 8);
+    }
+
+    r_holecolor = r_rawholecolor = R_HoleColor (pal, 4);
+
+    // VID_GRADES light rows, then the 256 alphamap rows
+    for (i=0 ; i<(VID_GRADES+256)*256 ; i++)
+        if (cmap[i] == TRUECOLOR_HOLE)
+            cmap[i] = r_holecolor;
+}
+
+/*
+===============
+R_Build8to32Table
+===============
+*/
+void R_Build8to32Table (void)
+{
+    byte    *pal;
+    int        i;
+
+    pal = (byte *)d_8to24table;
+    for (i=0 ; i<256 ; i++)
+        d_8to32table[i] = (sw_state.gammatable[pal[i*4+0]] << 16)
+                | (sw_state.gammatable[pal[i*4+1]] << 8)
+                | sw_state.gammatable[pal[i*4+2]];
+
+    // lit surfaces are cached with the old gamma baked in
+    if (r_truecolor)
+        D_FlushCaches ();
+}
+
+/*
+===============
+R_FillHoles
+
+Swaps TRUECOLOR_HOLE for color in pixels that were copied in opaque
+===============
+*/
+void R_FillHoles (byte *dest, int count, int color)
+{
+    byte    *hole, *end;
+
+    end = dest + count;
+    while ((hole = memchr (dest, TRUECOLOR_HOLE, end - dest)) != NULL)
+    {
+        *hole = color;
+        dest = hole + 1;
+    }
+}
+
+/*
+===============
+R_ClearTrueColorView
+
+Opens up the view in the 8 bit layer; the world is drawn underneath
+===============
+*/
+void R_ClearTrueColorView (void)
+{
+    int        v;
+
+    for (v=r_refdef.vrect.y ; v<r_refdef.vrectbottom ; v++)
+        memset (d_viewbuffer + v*r_screenwidth + r_refdef.vrect.x,
+                TRUECOLOR_HOLE, r_refdef.vrect.width);
+}
+
+/*
+===============
+R_TintTrueColor
+
+Applies the R_CalcPalette screen blend to the visible world layer
+===============
+*/
+void R_TintTrueColor (vec3_t premult, float one_minus_alpha)
+{
+    int            x, y, x2, y2, a, j, v;
+    int            add[3];
+    byte        *p8;
+    unsigned    *p32, c, out;
+
+    a = one_minus_alpha * 256;
+    for (j=0 ; j<3 ; j++)
+        add[j] = premult[j];
+
+    x2 = r_newrefdef.x + r_newrefdef.width;
+    y2 = r_newrefdef.y + r_newrefdef.height;
+    for (y=r_newrefdef.y ; y<y2 ; y++)
+    {
+        p8 = vid.buffer + y*vid.rowbytes;
+        p32 = vid.buffer32 + y*vid.rowbytes;
+        for (x=r_newrefdef.x ; x<x2 ; x++)
+        {
+            if (p8[x] != TRUECOLOR_HOLE)
+                continue;
+            c = p32[x];
+            out = 0;
+            for (j=0 ; j<3 ; j++)
+            {
+                v = add[j] + ((((c >> (16 - j*8)) & 255) * a) >> 8);
+                if (v > 255)
+                    v = 255;
+                out |= v << (16 - j*8);
+            }
+            p32[x] = out;
+        }
+    }
+}
+
+/*
+===============
+R_Blend32
+
+Blends palette color over a view pixel at alpha/256 opacity in 32 bits,
+whichever layer the pixel is in, and leaves it in the world layer
+===============
+*/
+void R_Blend32 (pixel_t *pdest, int color, int alpha)
+{
+    unsigned    *p32, src, dst;
+
+    p32 = d_viewbuffer32 + (pdest - d_viewbuffer);
+    dst = *pdest == TRUECOLOR_HOLE ? *p32 : d_8to32table[*pdest];
+    src = d_8to32table[color];
+
+    *p32 = ((((src & 0xff00ff) * alpha + (dst & 0xff00ff) * (256 - alpha)) >> 8) & 0xff00ff)
+         | ((((src & 0x00ff00) * alpha + (dst & 0x00ff00) * (256 - alpha)) >> 8) & 0x00ff00);
+    *pdest = TRUECOLOR_HOLE;
+}
+
+
 /* 
 ============================================================================== 
  
@@ -611,6 +840,66 @@ void WritePCXfile (char *filename, byte *data, int width, int height,
  
 
 
+/* 
+============== 
+WriteTrueColorTGAfile
+
+The palette can't describe the world layer, so sw_truecolor shots are
+composited into a 24 bit targa
+============== 
+*/ 
+void WriteTrueColorTGAfile (char *filename)
+{
+    byte        *buffer, *out, *pal, *p8;
+    unsigned    *p32;
+    int            x, y;
+    FILE        *f;
+
+    buffer = malloc (vid.width*vid.height*3 + 18);
+    memset (buffer, 0, 18);
+    buffer[2] = 2;        // uncompressed type
+    buffer[12] = vid.width&255;
+    buffer[13] = vid.width>>8;
+    buffer[14] = vid.height&255;
+    buffer[15] = vid.height>>8;
+    buffer[16] = 24;    // pixel size
+    buffer[17] = 0x20;    // top to bottom
+
+    out = buffer + 18;
+    pal = sw_state.currentpalette;
+    for (y=0 ; y<vid.height ; y++)
+    {
+        p8 = vid.buffer + y*vid.rowbytes;
+        p32 = vid.buffer32 + y*vid.rowbytes;
+        for (x=0 ; x<vid.width ; x++)
+        {
+            if (p8[x] == TRUECOLOR_HOLE)
+            {
+                *out++ = p32[x] & 255;
+                *out++ = (p32[x] >> 8) & 255;
+                *out++ = (p32[x] >> 16) & 255;
+            }
+            else
+            {
+                *out++ = pal[p8[x]*4+2];
+                *out++ = pal[p8[x]*4+1];
+                *out++ = pal[p8[x]*4+0];
+            }
+        }
+    }
+
+    f = fopen (filename, "wb");
+    if (!f)
+        ri.Con_Printf (PRINT_ALL, "Failed to open to %s\n", filename);
+    else
+    {
+        fwrite (buffer, 1, out - buffer, f);
+        fclose (f);
+    }
+
+    free (buffer);
+}
+
 /* 
 ================== 
 R_ScreenShot_f
@@ -631,7 +920,7 @@ void R_ScreenShot_f (void)
 // 
 // find a file name to save it to 
 // 
-    strcpy(pcxname,"quake00.pcx");
+    strcpy(pcxname, r_truecolor ? "quake00.tga" : "quake00.pcx");
         
     for (i=0 ; i<=99 ; i++) 
     { 
@@ -661,8 +950,11 @@ void R_ScreenShot_f (void)
 // save the pcx file 
 // 
 
-    WritePCXfile (checkname, vid.buffer, vid.width, vid.height, vid.rowbytes,
-                  palette);
+    if (r_truecolor)
+        WriteTrueColorTGAfile (checkname);
+    else
+        WritePCXfile (checkname, vid.buffer, vid.width, vid.height, vid.rowbytes,
+                      palette);
 
     ri.Con_Printf (PRINT_ALL, "Wrote %s\n", checkname);
 } 
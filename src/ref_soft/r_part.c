@@ -476,6 +476,9 @@ void R_DrawParticle( void )
     int        i, izi, pix, count, u, v;
     byte  (*blendparticle)( int, int );
 
+    if (r_truecolor && color == TRUECOLOR_HOLE)
+        color = r_holecolor;
+
     /*
     ** transform the particle
     */
@@ -547,7 +550,7 @@ void R_DrawParticle( void )
                 if (pz[i] <= izi)
                 {
                     pz[i]    = izi;
-                    pdest[i] = vid.alphamap[color + ((int)pdest[i]<<8)];
+                    R_BLEND33 (&pdest[i], color);
                 }
             }
         }
@@ -561,7 +564,7 @@ void R_DrawParticle( void )
                 if (pz[i] <= izi)
                 {
                     pz[i]    = izi;
-                    pdest[i] = vid.alphamap[(color<<8) + (int)pdest[i]];
+                    R_BLEND66 (&pdest[i], color);
                 }
             }
         }
@@ -42,7 +42,7 @@ polydesc_t    r_polydesc;
 
 msurface_t *r_alpha_surfaces;
 
-extern int *r_turb_turb;
+extern BANDLOCAL int *r_turb_turb;
 
 static int        clip_current;
 vec5_t    r_clip_verts[2][MAXWORKINGVERTS+2];
@@ -243,7 +243,7 @@ void R_DrawSpanletTurbulentBlended66( void )
         btemp = *( s_spanletvars.pbase + ( sturb ) + ( tturb << 6 ) );
 
         if ( *s_spanletvars.pz <= ( s_spanletvars.izi >> 16 ) )
-            *s_spanletvars.pdest = vid.alphamap[btemp*256+*s_spanletvars.pdest];
+            R_BLEND66 (s_spanletvars.pdest, btemp);
 
         s_spanletvars.izi += s_spanletvars.izistep;
         s_spanletvars.pdest++;
@@ -267,7 +267,7 @@ void R_DrawSpanletTurbulentBlended33( void )
         btemp = *( s_spanletvars.pbase + ( sturb ) + ( tturb << 6 ) );
 
         if ( *s_spanletvars.pz <= ( s_spanletvars.izi >> 16 ) )
-            *s_spanletvars.pdest = vid.alphamap[btemp+*s_spanletvars.pdest*256];
+            R_BLEND33 (s_spanletvars.pdest, btemp);
 
         s_spanletvars.izi += s_spanletvars.izistep;
         s_spanletvars.pdest++;
@@ -298,7 +298,7 @@ void R_DrawSpanlet33( void )
         {
             if (*s_spanletvars.pz <= (s_spanletvars.izi >> 16))
             {
-                *s_spanletvars.pdest = vid.alphamap[btemp+*s_spanletvars.pdest*256];
+                R_BLEND33 (s_spanletvars.pdest, btemp);
             }
         }
 
@@ -316,7 +316,7 @@ void R_DrawSpanletConstant33( void )
     {
         if (*s_spanletvars.pz <= (s_spanletvars.izi >> 16))
         {
-            *s_spanletvars.pdest = vid.alphamap[r_polyblendcolor+*s_spanletvars.pdest*256];
+            R_BLEND33 (s_spanletvars.pdest, r_polyblendcolor);
         }
 
         s_spanletvars.izi += s_spanletvars.izistep;
@@ -345,7 +345,7 @@ void R_DrawSpanlet66( void )
         {
             if (*s_spanletvars.pz <= (s_spanletvars.izi >> 16))
             {
-                *s_spanletvars.pdest = vid.alphamap[btemp*256+*s_spanletvars.pdest];
+                R_BLEND66 (s_spanletvars.pdest, btemp);
             }
         }
 
@@ -858,7 +858,7 @@ void R_PolysetDrawSpans8_33( spanpackage_t *pspanpackage)
                 {
                     int temp = vid.colormap[*lptex + ( llight & 0xFF00 )];
 
-                    *lpdest = vid.alphamap[temp+ *lpdest*256];
+                    R_BLEND33 (lpdest, temp);
                 }
                 lpdest++;
                 lzi += r_zistepx;
@@ -913,7 +913,7 @@ void R_PolysetDrawSpansConstant8_33( spanpackage_t *pspanpackage)
             {
                 if ((lzi >> 16) >= *lpz)
                 {
-                    *lpdest = vid.alphamap[r_aliasblendcolor + *lpdest*256];
+                    R_BLEND33 (lpdest, r_aliasblendcolor);
                 }
                 lpdest++;
                 lzi += r_zistepx;
@@ -966,7 +966,7 @@ void R_PolysetDrawSpans8_66(spanpackage_t *pspanpackage)
                 {
                     int temp = vid.colormap[*lptex + ( llight & 0xFF00 )];
 
-                    *lpdest = vid.alphamap[temp*256 + *lpdest];
+                    R_BLEND66 (lpdest, temp);
                     *lpz = lzi >> 16;
                 }
                 lpdest++;
@@ -1022,7 +1022,7 @@ void R_PolysetDrawSpansConstant8_66( spanpackage_t *pspanpackage)
             {
                 if ((lzi >> 16) >= *lpz)
                 {
-                    *lpdest = vid.alphamap[r_aliasblendcolor*256 + *lpdest];
+                    R_BLEND66 (lpdest, r_aliasblendcolor);
                 }
                 lpdest++;
                 lzi += r_zistepx;
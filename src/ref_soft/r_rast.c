@@ -35,7 +35,7 @@ int            c_faceclip;                    // number of faces clipped
 
 
 clipplane_t    *entity_clipplanes;
-clipplane_t    view_clipplanes[4];
+BANDLOCAL clipplane_t    view_clipplanes[4];
 clipplane_t    world_clipplanes[16];
 
 medge_t            *r_pedge;
@@ -23,10 +23,17 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "r_local.h"
 
-unsigned char    *r_turb_pbase, *r_turb_pdest;
-fixed16_t        r_turb_s, r_turb_t, r_turb_sstep, r_turb_tstep;
-int                *r_turb_turb;
-int                r_turb_spancount;
+#if !id386 && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define D_SIMD 1
+#else
+#define D_SIMD 0
+#endif
+
+BANDLOCAL unsigned char    *r_turb_pbase, *r_turb_pdest;
+BANDLOCAL fixed16_t        r_turb_s, r_turb_t, r_turb_sstep, r_turb_tstep;
+BANDLOCAL int            *r_turb_turb;
+BANDLOCAL int            r_turb_spancount;
 
 void D_DrawTurbulent8Span (void);
 
@@ -60,6 +67,7 @@ void D_WarpScreen (void)
 
     dest = vid.buffer + r_newrefdef.y * vid.rowbytes + r_newrefdef.x;
     src = r_warpbuffer;
+    int dest_32 = dest - vid.buffer;    // same layout in vid.buffer32
 
     int x, y, src_x, src_y, src_p, dst_p = 0;
     int turb_start =  (int)(r_newrefdef.time*SPEED)&(CYCLE-1);
@@ -74,6 +82,8 @@ void D_WarpScreen (void)
             src_x += intsintable[(x + turb_start) % 1280];
             src_x = clamp_val (src_x, 0, src_w-1);
             dest[dst_p + x] = src[src_p + src_x];
+            if (r_truecolor)
+                vid.buffer32[dest_32 + dst_p + x] = r_warpbuffer32[src_p + src_x];
         }
         dst_p += vid.rowbytes;
     }
@@ -90,6 +100,22 @@ D_DrawTurbulent8Span
 void D_DrawTurbulent8Span (void)
 {
     int        sturb, tturb;
+    unsigned    *pdest32;
+
+    if (r_truecolor)
+    {
+        pdest32 = d_viewbuffer32 + (r_turb_pdest - d_viewbuffer);
+        r_turb_pdest += r_turb_spancount;
+        do
+        {
+            sturb = ((r_turb_s + r_turb_turb[(r_turb_t>>16)&(CYCLE-1)])>>16)&63;
+            tturb = ((r_turb_t + r_turb_turb[(r_turb_s>>16)&(CYCLE-1)])>>16)&63;
+            *pdest32++ = d_8to32table[*(r_turb_pbase + (tturb<<6) + sturb)];
+            r_turb_s += r_turb_sstep;
+            r_turb_t += r_turb_tstep;
+        } while (--r_turb_spancount > 0);
+        return;
+    }
 
     do
     {
@@ -515,6 +541,166 @@ void D_DrawSpans16 (espan_t *pspan)
 #endif
 
 
+/*
+=============
+D_DrawSpans32Source
+
+D_DrawSpans16 into the sw_truecolor world layer, from 32 bit surface cache
+blocks or, for the sky, through d_8to32table from palette indices
+=============
+*/
+static void D_DrawSpans32Source (espan_t *pspan, qboolean indexed)
+{
+    int                count, spancount;
+    unsigned char    *pbase;
+    unsigned        *pbase32, *pdest;
+    fixed16_t        s, t, snext, tnext, sstep, tstep;
+    float            sdivz, tdivz, zi, z, du, dv, spancountminus1;
+    float            sdivz8stepu, tdivz8stepu, zi8stepu;
+
+    sstep = 0;    // keep compiler happy
+    tstep = 0;    // ditto
+
+    pbase = (unsigned char *)cacheblock;
+    pbase32 = (unsigned *)cacheblock;
+
+    sdivz8stepu = d_sdivzstepu * 8;
+    tdivz8stepu = d_tdivzstepu * 8;
+    zi8stepu = d_zistepu * 8;
+
+    do
+    {
+        pdest = d_viewbuffer32 + (r_screenwidth * pspan->v) + pspan->u;
+
+        count = pspan->count;
+
+    // calculate the initial s/z, t/z, 1/z, s, and t and clamp
+        du = (float)pspan->u;
+        dv = (float)pspan->v;
+
+        sdivz = d_sdivzorigin + dv*d_sdivzstepv + du*d_sdivzstepu;
+        tdivz = d_tdivzorigin + dv*d_tdivzstepv + du*d_tdivzstepu;
+        zi = d_ziorigin + dv*d_zistepv + du*d_zistepu;
+        z = (float)0x10000 / zi;    // prescale to 16.16 fixed-point
+
+        s = (int)(sdivz * z) + sadjust;
+        if (s > bbextents)
+            s = bbextents;
+        else if (s < 0)
+            s = 0;
+
+        t = (int)(tdivz * z) + tadjust;
+        if (t > bbextentt)
+            t = bbextentt;
+        else if (t < 0)
+            t = 0;
+
+        do
+        {
+        // calculate s and t at the far end of the span
+            if (count >= 8)
+                spancount = 8;
+            else
+                spancount = count;
+
+            count -= spancount;
+
+            if (count)
+            {
+                sdivz += sdivz8stepu;
+                tdivz += tdivz8stepu;
+                zi += zi8stepu;
+                z = (float)0x10000 / zi;    // prescale to 16.16 fixed-point
+
+                snext = (int)(sdivz * z) + sadjust;
+                if (snext > bbextents)
+                    snext = bbextents;
+                else if (snext < 8)
+                    snext = 8;
+
+                tnext = (int)(tdivz * z) + tadjust;
+                if (tnext > bbextentt)
+                    tnext = bbextentt;
+                else if (tnext < 8)
+                    tnext = 8;
+
+                sstep = (snext - s) >> 3;
+                tstep = (tnext - t) >> 3;
+            }
+            else
+            {
+                spancountminus1 = (float)(spancount - 1);
+                sdivz += d_sdivzstepu * spancountminus1;
+                tdivz += d_tdivzstepu * spancountminus1;
+                zi += d_zistepu * spancountminus1;
+                z = (float)0x10000 / zi;    // prescale to 16.16 fixed-point
+                snext = (int)(sdivz * z) + sadjust;
+                if (snext > bbextents)
+                    snext = bbextents;
+                else if (snext < 8)
+                    snext = 8;
+
+                tnext = (int)(tdivz * z) + tadjust;
+                if (tnext > bbextentt)
+                    tnext = bbextentt;
+                else if (tnext < 8)
+                    tnext = 8;
+
+                if (spancount > 1)
+                {
+                    sstep = (snext - s) / (spancount - 1);
+                    tstep = (tnext - t) / (spancount - 1);
+                }
+            }
+
+            if (indexed)
+            {
+                do
+                {
+                    *pdest++ = d_8to32table[*(pbase + (s >> 16) + (t >> 16) * cachewidth)];
+                    s += sstep;
+                    t += tstep;
+                } while (--spancount > 0);
+            }
+            else
+            {
+                do
+                {
+                    *pdest++ = *(pbase32 + (s >> 16) + (t >> 16) * cachewidth);
+                    s += sstep;
+                    t += tstep;
+                } while (--spancount > 0);
+            }
+
+            s = snext;
+            t = tnext;
+
+        } while (count > 0);
+
+    } while ((pspan = pspan->pnext) != NULL);
+}
+
+/*
+=============
+D_DrawSpans32
+=============
+*/
+void D_DrawSpans32 (espan_t *pspan)
+{
+    D_DrawSpans32Source (pspan, false);
+}
+
+/*
+=============
+D_DrawSpans8to32
+=============
+*/
+void D_DrawSpans8to32 (espan_t *pspan)
+{
+    D_DrawSpans32Source (pspan, true);
+}
+
+
 #if    !id386
 
 /*
@@ -577,3 +763,748 @@ void D_DrawZSpans (espan_t *pspan)
 
 #endif
 
+
+/*
+=============================================================================
+
+SIMD SPAN DRAWERS
+
+The vector drawers produce exactly the same pixels and z values as the C
+ones: the per-segment perspective divide and clamping are still done in
+scalar code, only the affine stepping inside a segment is done eight lanes
+at a time.
+
+=============================================================================
+*/
+
+void (*d_drawspans) (espan_t *pspan) = D_DrawSpans16;
+void (*d_drawzspans) (espan_t *pspan) = D_DrawZSpans;
+
+#if D_SIMD
+
+/*
+=============
+D_DrawZSpansSSE2
+
+Like D_DrawZSpans this writes dword aligned pairs, and keeps its quirk:
+ltemp = izi >> 16 sign extends, so the second z of a pair reads 0xffff
+whenever the first one is negative (the sky's backdrop, for one).
+=============
+*/
+__attribute__((target("sse2")))
+static void D_DrawZSpansSSE2 (espan_t *pspan)
+{
+    int                count, doublecount, izistep;
+    int                izi;
+    short            *pdest;
+    unsigned        ltemp;
+    float            zi;
+    float            du, dv;
+    __m128i            lo, hi, step8, odd;
+
+    izistep = (int)(d_zistepu * 0x8000 * 0x10000);
+    step8 = _mm_set1_epi32 ((int)(8u * (unsigned)izistep));
+    odd = _mm_set_epi32 (-1, 0, -1, 0);
+
+    do
+    {
+        pdest = d_pzbuffer + (d_zwidth * pspan->v) + pspan->u;
+
+        count = pspan->count;
+
+        du = (float)pspan->u;
+        dv = (float)pspan->v;
+
+        zi = d_ziorigin + dv*d_zistepv + du*d_zistepu;
+        izi = (int)(zi * 0x8000 * 0x10000);
+
+        if ((long)pdest & 0x02)
+        {
+            *pdest++ = (short)(izi >> 16);
+            izi += izistep;
+            count--;
+        }
+
+        if (count >= 8)
+        {
+            lo = _mm_set_epi32 ((int)((unsigned)izi + 3u*(unsigned)izistep),
+                                (int)((unsigned)izi + 2u*(unsigned)izistep),
+                                (int)((unsigned)izi + (unsigned)izistep),
+                                izi);
+            hi = _mm_add_epi32 (lo, _mm_set1_epi32 ((int)(4u * (unsigned)izistep)));
+
+            do
+            {
+            // the high halves are already in short range, so the
+            // saturating pack is an exact truncation
+                _mm_storeu_si128 ((__m128i *)pdest, _mm_packs_epi32 (
+                        _mm_or_si128 (_mm_srai_epi32 (lo, 16),
+                            _mm_and_si128 (_mm_slli_si128 (_mm_srai_epi32 (lo, 31), 4), odd)),
+                        _mm_or_si128 (_mm_srai_epi32 (hi, 16),
+                            _mm_and_si128 (_mm_slli_si128 (_mm_srai_epi32 (hi, 31), 4), odd))));
+                lo = _mm_add_epi32 (lo, step8);
+                hi = _mm_add_epi32 (hi, step8);
+                pdest += 8;
+                count -= 8;
+            } while (count >= 8);
+
+            izi = _mm_cvtsi128_si32 (lo);
+        }
+
+        if ((doublecount = count >> 1) > 0)
+        {
+            do
+            {
+                ltemp = izi >> 16;
+                izi += izistep;
+                ltemp |= izi & 0xFFFF0000;
+                izi += izistep;
+                *(int *)pdest = ltemp;
+                pdest += 2;
+            } while (--doublecount > 0);
+        }
+
+        if (count & 1)
+            *pdest = (short)(izi >> 16);
+
+    } while ((pspan = pspan->pnext) != NULL);
+}
+
+/*
+=============
+D_DrawZSpansAVX2
+
+D_DrawZSpansSSE2 sixteen at a time.
+=============
+*/
+__attribute__((target("avx2")))
+static void D_DrawZSpansAVX2 (espan_t *pspan)
+{
+    int                count, doublecount, izistep;
+    int                izi;
+    short            *pdest;
+    unsigned        ltemp;
+    float            zi;
+    float            du, dv;
+    __m256i            lo, hi, step16, odd;
+
+    izistep = (int)(d_zistepu * 0x8000 * 0x10000);
+    step16 = _mm256_set1_epi32 ((int)(16u * (unsigned)izistep));
+    odd = _mm256_setr_epi32 (0, -1, 0, -1, 0, -1, 0, -1);
+
+    do
+    {
+        pdest = d_pzbuffer + (d_zwidth * pspan->v) + pspan->u;
+
+        count = pspan->count;
+
+        du = (float)pspan->u;
+        dv = (float)pspan->v;
+
+        zi = d_ziorigin + dv*d_zistepv + du*d_zistepu;
+        izi = (int)(zi * 0x8000 * 0x10000);
+
+        if ((long)pdest & 0x02)
+        {
+            *pdest++ = (short)(izi >> 16);
+            izi += izistep;
+            count--;
+        }
+
+        if (count >= 16)
+        {
+        // packs works within 128 bit lanes, so lo holds pixels 0-3 and 8-11
+        // and hi holds 4-7 and 12-15
+            lo = _mm256_add_epi32 (_mm256_set1_epi32 (izi),
+                    _mm256_mullo_epi32 (_mm256_setr_epi32 (0, 1, 2, 3, 8, 9, 10, 11),
+                                        _mm256_set1_epi32 (izistep)));
+            hi = _mm256_add_epi32 (lo, _mm256_set1_epi32 ((int)(4u * (unsigned)izistep)));
+
+            do
+            {
+                _mm256_storeu_si256 ((__m256i *)pdest, _mm256_packs_epi32 (
+                        _mm256_or_si256 (_mm256_srai_epi32 (lo, 16),
+                            _mm256_and_si256 (_mm256_slli_si256 (_mm256_srai_epi32 (lo, 31), 4), odd)),
+                        _mm256_or_si256 (_mm256_srai_epi32 (hi, 16),
+                            _mm256_and_si256 (_mm256_slli_si256 (_mm256_srai_epi32 (hi, 31), 4), odd))));
+                lo = _mm256_add_epi32 (lo, step16);
+                hi = _mm256_add_epi32 (hi, step16);
+                pdest += 16;
+                count -= 16;
+            } while (count >= 16);
+
+            izi = _mm_cvtsi128_si32 (_mm256_castsi256_si128 (lo));
+        }
+
+        if ((doublecount = count >> 1) > 0)
+        {
+            do
+            {
+                ltemp = izi >> 16;
+                izi += izistep;
+                ltemp |= izi & 0xFFFF0000;
+                izi += izistep;
+                *(int *)pdest = ltemp;
+                pdest += 2;
+            } while (--doublecount > 0);
+        }
+
+        if (count & 1)
+            *pdest = (short)(izi >> 16);
+
+    } while ((pspan = pspan->pnext) != NULL);
+}
+
+/*
+=============
+D_DrawSpans16AVX2
+
+Full eight pixel segments fetch their texels with one gather. A gather
+can't load single bytes, so each lane loads the dword that ends on its texel
+and keeps the top byte; that reads up to three bytes before the texel, which
+is still inside the surfcache_t header of the block. Only use this on
+surface cache blocks.
+=============
+*/
+// the gather's pre-read has to land in the header, not before the block
+typedef char d_spanheadercheck[offsetof(surfcache_t, data) >= 3 ? 1 : -1];
+
+__attribute__((target("avx2")))
+static void D_DrawSpans16AVX2 (espan_t *pspan)
+{
+    int                count, spancount;
+    unsigned char    *pbase, *pdest;
+    fixed16_t        s, t, snext, tnext, sstep, tstep;
+    float            sdivz, tdivz, zi, z, du, dv, spancountminus1;
+    float            sdivz8stepu, tdivz8stepu, zi8stepu;
+    __m256i            lanes, width, hibytes, vs, vt, offs, texels;
+    __m128i            packed;
+
+    sstep = 0;    // keep compiler happy
+    tstep = 0;    // ditto
+
+    pbase = (unsigned char *)cacheblock;
+
+    sdivz8stepu = d_sdivzstepu * 8;
+    tdivz8stepu = d_tdivzstepu * 8;
+    zi8stepu = d_zistepu * 8;
+
+    lanes = _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7);
+    width = _mm256_set1_epi32 (cachewidth);
+    hibytes = _mm256_setr_epi8 (3, 7, 11, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                3, 7, 11, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+
+    do
+    {
+        pdest = (unsigned char *)((byte *)d_viewbuffer +
+                (r_screenwidth * pspan->v) + pspan->u);
+
+        count = pspan->count;
+
+    // calculate the initial s/z, t/z, 1/z, s, and t and clamp
+        du = (float)pspan->u;
+        dv = (float)pspan->v;
+
+        sdivz = d_sdivzorigin + dv*d_sdivzstepv + du*d_sdivzstepu;
+        tdivz = d_tdivzorigin + dv*d_tdivzstepv + du*d_tdivzstepu;
+        zi = d_ziorigin + dv*d_zistepv + du*d_zistepu;
+        z = (float)0x10000 / zi;    // prescale to 16.16 fixed-point
+
+        s = (int)(sdivz * z) + sadjust;
+        if (s > bbextents)
+            s = bbextents;
+        else if (s < 0)
+            s = 0;
+
+        t = (int)(tdivz * z) + tadjust;
+        if (t > bbextentt)
+            t = bbextentt;
+        else if (t < 0)
+            t = 0;
+
+        do
+        {
+        // calculate s and t at the far end of the span
+            if (count >= 8)
+                spancount = 8;
+            else
+                spancount = count;
+
+            count -= spancount;
+
+            if (count)
+            {
+                sdivz += sdivz8stepu;
+                tdivz += tdivz8stepu;
+                zi += zi8stepu;
+                z = (float)0x10000 / zi;    // prescale to 16.16 fixed-point
+
+                snext = (int)(sdivz * z) + sadjust;
+                if (snext > bbextents)
+                    snext = bbextents;
+                else if (snext < 8)
+                    snext = 8;
+
+                tnext = (int)(tdivz * z) + tadjust;
+                if (tnext > bbextentt)
+                    tnext = bbextentt;
+                else if (tnext < 8)
+                    tnext = 8;
+
+                sstep = (snext - s) >> 3;
+                tstep = (tnext - t) >> 3;
+            }
+            else
+            {
+                spancountminus1 = (float)(spancount - 1);
+                sdivz += d_sdivzstepu * spancountminus1;
+                tdivz += d_tdivzstepu * spancountminus1;
+                zi += d_zistepu * spancountminus1;
+                z = (float)0x10000 / zi;    // prescale to 16.16 fixed-point
+                snext = (int)(sdivz * z) + sadjust;
+                if (snext > bbextents)
+                    snext = bbextents;
+                else if (snext < 8)
+                    snext = 8;
+
+                tnext = (int)(tdivz * z) + tadjust;
+                if (tnext > bbextentt)
+                    tnext = bbextentt;
+                else if (tnext < 8)
+                    tnext = 8;
+
+                if (spancount > 1)
+                {
+                    sstep = (snext - s) / (spancount - 1);
+                    tstep = (tnext - t) / (spancount - 1);
+                }
+            }
+
+            if (spancount == 8)
+            {
+                vs = _mm256_add_epi32 (_mm256_set1_epi32 (s),
+                        _mm256_mullo_epi32 (lanes, _mm256_set1_epi32 (sstep)));
+                vt = _mm256_add_epi32 (_mm256_set1_epi32 (t),
+                        _mm256_mullo_epi32 (lanes, _mm256_set1_epi32 (tstep)));
+                offs = _mm256_add_epi32 (_mm256_srai_epi32 (vs, 16),
+                        _mm256_mullo_epi32 (_mm256_srai_epi32 (vt, 16), width));
+                texels = _mm256_i32gather_epi32 ((const int *)(pbase - 3), offs, 1);
+                texels = _mm256_shuffle_epi8 (texels, hibytes);
+                packed = _mm_unpacklo_epi32 (_mm256_castsi256_si128 (texels),
+                                             _mm256_extracti128_si256 (texels, 1));
+                _mm_storel_epi64 ((__m128i *)pdest, packed);
+                pdest += 8;
+            }
+            else
+            {
+                do
+                {
+                    *pdest++ = *(pbase + (s >> 16) + (t >> 16) * cachewidth);
+                    s += sstep;
+                    t += tstep;
+                } while (--spancount > 0);
+            }
+
+            s = snext;
+            t = tnext;
+
+        } while (count > 0);
+
+    } while ((pspan = pspan->pnext) != NULL);
+}
+
+/*
+=============
+D_DrawSpans32AVX2
+
+D_DrawSpans16AVX2 for 32 bit surface cache blocks; texels are whole dwords,
+so the gather reads exactly the texels and nothing of the header.
+=============
+*/
+__attribute__((target("avx2")))
+static void D_DrawSpans32AVX2 (espan_t *pspan)
+{
+    int                count, spancount;
+    unsigned        *pbase, *pdest;
+    fixed16_t        s, t, snext, tnext, sstep, tstep;
+    float            sdivz, tdivz, zi, z, du, dv, spancountminus1;
+    float            sdivz8stepu, tdivz8stepu, zi8stepu;
+    __m256i            lanes, width, vs, vt, offs, texels;
+
+    sstep = 0;    // keep compiler happy
+    tstep = 0;    // ditto
+
+    pbase = (unsigned *)cacheblock;
+
+    sdivz8stepu = d_sdivzstepu * 8;
+    tdivz8stepu = d_tdivzstepu * 8;
+    zi8stepu = d_zistepu * 8;
+
+    lanes = _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7);
+    width = _mm256_set1_epi32 (cachewidth);
+
+    do
+    {
+        pdest = d_viewbuffer32 + (r_screenwidth * pspan->v) + pspan->u;
+
+        count = pspan->count;
+
+    // calculate the initial s/z, t/z, 1/z, s, and t and clamp
+        du = (float)pspan->u;
+        dv = (float)pspan->v;
+
+        sdivz = d_sdivzorigin + dv*d_sdivzstepv + du*d_sdivzstepu;
+        tdivz = d_tdivzorigin + dv*d_tdivzstepv + du*d_tdivzstepu;
+        zi = d_ziorigin + dv*d_zistepv + du*d_zistepu;
+        z = (float)0x10000 / zi;    // prescale to 16.16 fixed-point
+
+        s = (int)(sdivz * z) + sadjust;
+        if (s > bbextents)
+            s = bbextents;
+        else if (s < 0)
+            s = 0;
+
+        t = (int)(tdivz * z) + tadjust;
+        if (t > bbextentt)
+            t = bbextentt;
+        else if (t < 0)
+            t = 0;
+
+        do
+        {
+        // calculate s and t at the far end of the span
+            if (count >= 8)
+                spancount = 8;
+            else
+                spancount = count;
+
+            count -= spancount;
+
+            if (count)
+            {
+                sdivz += sdivz8stepu;
+                tdivz += tdivz8stepu;
+                zi += zi8stepu;
+                z = (float)0x10000 / zi;    // prescale to 16.16 fixed-point
+
+                snext = (int)(sdivz * z) + sadjust;
+                if (snext > bbextents)
+                    snext = bbextents;
+                else if (snext < 8)
+                    snext = 8;
+
+                tnext = (int)(tdivz * z) + tadjust;
+                if (tnext > bbextentt)
+                    tnext = bbextentt;
+                else if (tnext < 8)
+                    tnext = 8;
+
+                sstep = (snext - s) >> 3;
+                tstep = (tnext - t) >> 3;
+            }
+            else
+            {
+                spancountminus1 = (float)(spancount - 1);
+                sdivz += d_sdivzstepu * spancountminus1;
+                tdivz += d_tdivzstepu * spancountminus1;
+                zi += d_zistepu * spancountminus1;
+                z = (float)0x10000 / zi;    // prescale to 16.16 fixed-point
+                snext = (int)(sdivz * z) + sadjust;
+                if (snext > bbextents)
+                    snext = bbextents;
+                else if (snext < 8)
+                    snext = 8;
+
+                tnext = (int)(tdivz * z) + tadjust;
+                if (tnext > bbextentt)
+                    tnext = bbextentt;
+                else if (tnext < 8)
+                    tnext = 8;
+
+                if (spancount > 1)
+                {
+                    sstep = (snext - s) / (spancount - 1);
+                    tstep = (tnext - t) / (spancount - 1);
+                }
+            }
+
+            if (spancount == 8)
+            {
+                vs = _mm256_add_epi32 (_mm256_set1_epi32 (s),
+                        _mm256_mullo_epi32 (lanes, _mm256_set1_epi32 (sstep)));
+                vt = _mm256_add_epi32 (_mm256_set1_epi32 (t),
+                        _mm256_mullo_epi32 (lanes, _mm256_set1_epi32 (tstep)));
+                offs = _mm256_add_epi32 (_mm256_srai_epi32 (vs, 16),
+                        _mm256_mullo_epi32 (_mm256_srai_epi32 (vt, 16), width));
+                texels = _mm256_i32gather_epi32 ((const int *)pbase, offs, 4);
+                _mm256_storeu_si256 ((__m256i *)pdest, texels);
+                pdest += 8;
+            }
+            else
+            {
+                do
+                {
+                    *pdest++ = *(pbase + (s >> 16) + (t >> 16) * cachewidth);
+                    s += sstep;
+                    t += tstep;
+                } while (--spancount > 0);
+            }
+
+            s = snext;
+            t = tnext;
+
+        } while (count > 0);
+
+    } while ((pspan = pspan->pnext) != NULL);
+}
+
+
+#endif    // D_SIMD
+
+
+/*
+=============
+D_InitSpans
+
+Picks the span drawers for this CPU; sw_simd 0 forces the C ones.
+=============
+*/
+void D_InitSpans (void)
+{
+    d_drawspans = r_truecolor ? D_DrawSpans32 : D_DrawSpans16;
+    d_drawzspans = D_DrawZSpans;
+
+#if D_SIMD
+    if (!sw_simd->value)
+        return;
+
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx2"))
+    {
+        d_drawspans = r_truecolor ? D_DrawSpans32AVX2 : D_DrawSpans16AVX2;
+        d_drawzspans = D_DrawZSpansAVX2;
+    }
+    else if (__builtin_cpu_supports ("sse2"))
+        d_drawzspans = D_DrawZSpansSSE2;
+#endif
+}
+
+
+/*
+=============================================================================
+
+SPAN DRAWER TEST
+
+=============================================================================
+*/
+
+#define    SPANTEST_WIDTH    640
+#define    SPANTEST_HEIGHT    480
+
+typedef struct
+{
+    char    *name;
+    void    (*draw) (espan_t *pspan);
+    int        kind;            // SPANTEST_8, SPANTEST_32 or SPANTEST_Z
+    int        differ;
+} spantest_t;
+
+#define    SPANTEST_8        0
+#define    SPANTEST_32        1
+#define    SPANTEST_Z        2
+
+static unsigned    spantest_seed;
+
+static int SpanTest_Rand (int n)
+{
+    spantest_seed = spantest_seed * 1103515245 + 12345;
+    return (spantest_seed >> 8) % n;
+}
+
+static float SpanTest_Frand (float lo, float hi)
+{
+    return lo + (hi - lo) * (SpanTest_Rand (1000000) / 1000000.0f);
+}
+
+/*
+=============
+D_SpanTest_f
+
+sw_spantest [planes]: draws the same random perspective spans over random
+surface cache blocks with the C drawers and with each SSE2 and AVX2 drawer
+this CPU can run, and reports every pixel and z value that came out
+different.  They are meant to be bit exact.
+=============
+*/
+void D_SpanTest_f (void)
+{
+    static espan_t    spans[SPANTEST_HEIGHT];
+    spantest_t        tests[8];
+    int                numtests, planes, plane, i, j, v, cw, ch, size;
+    surfcache_t        *block;
+    byte            *ref8, *test8;
+    unsigned        *ref32, *test32;
+    short            *refz, *testz;
+    pixel_t            *oldview;
+    unsigned        *oldview32;
+    short            *oldz;
+    int                oldwidth, oldzwidth;
+
+    numtests = 0;
+#if D_SIMD
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("sse2"))
+    {
+        tests[numtests].name = "D_DrawZSpansSSE2";
+        tests[numtests].draw = D_DrawZSpansSSE2;
+        tests[numtests++].kind = SPANTEST_Z;
+    }
+    if (__builtin_cpu_supports ("avx2"))
+    {
+        tests[numtests].name = "D_DrawZSpansAVX2";
+        tests[numtests].draw = D_DrawZSpansAVX2;
+        tests[numtests++].kind = SPANTEST_Z;
+        tests[numtests].name = "D_DrawSpans16AVX2";
+        tests[numtests].draw = D_DrawSpans16AVX2;
+        tests[numtests++].kind = SPANTEST_8;
+        tests[numtests].name = "D_DrawSpans32AVX2";
+        tests[numtests].draw = D_DrawSpans32AVX2;
+        tests[numtests++].kind = SPANTEST_32;
+    }
+#endif
+    if (!numtests)
+    {
+        ri.Con_Printf (PRINT_ALL, "no SIMD span drawers on this CPU or build\n");
+        return;
+    }
+    for (i=0 ; i<numtests ; i++)
+        tests[i].differ = 0;
+
+    planes = 100;
+    if (ri.Cmd_Argc () > 1)
+        planes = atoi (ri.Cmd_Argv (1));
+    if (planes < 1)
+        planes = 1;
+
+    size = SPANTEST_WIDTH * SPANTEST_HEIGHT;
+    ref8 = malloc (size);
+    test8 = malloc (size);
+    ref32 = malloc (size * 4);
+    test32 = malloc (size * 4);
+    refz = malloc (size * 2);
+    testz = malloc (size * 2);
+    block = malloc (sizeof(surfcache_t) + 512*512*4);
+    if (!ref8 || !test8 || !ref32 || !test32 || !refz || !testz || !block)
+    {
+        ri.Con_Printf (PRINT_ALL, "sw_spantest: out of memory\n");
+        goto done;
+    }
+
+    oldview = d_viewbuffer;
+    oldview32 = d_viewbuffer32;
+    oldz = d_pzbuffer;
+    oldwidth = r_screenwidth;
+    oldzwidth = d_zwidth;
+    r_screenwidth = d_zwidth = SPANTEST_WIDTH;
+
+    spantest_seed = 7;
+    for (plane=0 ; plane<planes ; plane++)
+    {
+        // a random block, big enough for 32 bit texels
+        cw = 8 + SpanTest_Rand (505);
+        ch = 8 + SpanTest_Rand (505);
+        for (i=0 ; i<cw*ch*4 ; i++)
+            block->data[i] = SpanTest_Rand (256);
+        cacheblock = (pixel_t *)block->data;
+        cachewidth = cw;
+        bbextents = (cw << 16) - 1;
+        bbextentt = (ch << 16) - 1;
+        sadjust = SpanTest_Rand (cw << 15);
+        tadjust = SpanTest_Rand (ch << 15);
+
+        // a plane seen in perspective, so 1/z is linear on the screen;
+        // every fourth one has a negative 1/z like the sky's backdrop
+        d_ziorigin = SpanTest_Frand (0.001f, 0.02f);
+        d_zistepu = SpanTest_Frand (-1e-5f, 1e-5f);
+        d_zistepv = SpanTest_Frand (-1e-5f, 1e-5f);
+        if (d_ziorigin + SPANTEST_WIDTH*d_zistepu + SPANTEST_HEIGHT*d_zistepv < 1e-4f)
+        {
+            d_zistepu = fabs (d_zistepu);
+            d_zistepv = fabs (d_zistepv);
+        }
+        if (!(plane & 3))
+        {
+            d_ziorigin = -0.9f;
+            d_zistepu = d_zistepv = 0;
+        }
+        d_sdivzorigin = SpanTest_Frand (-1, 1);
+        d_sdivzstepu = SpanTest_Frand (-1e-3f, 1e-3f);
+        d_sdivzstepv = SpanTest_Frand (-1e-3f, 1e-3f);
+        d_tdivzorigin = SpanTest_Frand (-1, 1);
+        d_tdivzstepu = SpanTest_Frand (-1e-3f, 1e-3f);
+        d_tdivzstepv = SpanTest_Frand (-1e-3f, 1e-3f);
+
+        // one span a line, with plenty of short ones for the tails
+        for (v=0 ; v<SPANTEST_HEIGHT ; v++)
+        {
+            spans[v].u = SpanTest_Rand (SPANTEST_WIDTH - 1);
+            spans[v].v = v;
+            spans[v].count = 1 + SpanTest_Rand (SPANTEST_WIDTH - spans[v].u);
+            if (!SpanTest_Rand (5) && spans[v].count > 9)
+                spans[v].count = 1 + SpanTest_Rand (9);
+            spans[v].pnext = v < SPANTEST_HEIGHT-1 ? &spans[v+1] : NULL;
+        }
+
+        memset (ref8, 0, size);
+        memset (ref32, 0, size * 4);
+        memset (refz, 0, size * 2);
+        d_viewbuffer = (pixel_t *)ref8;
+        d_viewbuffer32 = ref32;
+        d_pzbuffer = refz;
+        D_DrawSpans16 (spans);
+        D_DrawSpans32 (spans);
+        D_DrawZSpans (spans);
+
+        for (i=0 ; i<numtests ; i++)
+        {
+            memset (test8, 0, size);
+            memset (test32, 0, size * 4);
+            memset (testz, 0, size * 2);
+            d_viewbuffer = (pixel_t *)test8;
+            d_viewbuffer32 = test32;
+            d_pzbuffer = testz;
+            tests[i].draw (spans);
+
+            for (j=0 ; j<size ; j++)
+            {
+                if (tests[i].kind == SPANTEST_8 ? test8[j] == ref8[j]
+                    : tests[i].kind == SPANTEST_32 ? test32[j] == ref32[j]
+                    : testz[j] == refz[j])
+                    continue;
+                if (!tests[i].differ)
+                    ri.Con_Printf (PRINT_ALL, "%s: first mismatch on plane %i at %i,%i\n",
+                        tests[i].name, plane, j % SPANTEST_WIDTH, j / SPANTEST_WIDTH);
+                tests[i].differ++;
+            }
+        }
+    }
+
+    d_viewbuffer = oldview;
+    d_viewbuffer32 = oldview32;
+    d_pzbuffer = oldz;
+    r_screenwidth = oldwidth;
+    d_zwidth = oldzwidth;
+
+    for (i=0 ; i<numtests ; i++)
+        ri.Con_Printf (PRINT_ALL, "%s: %i %s differ over %i planes\n", tests[i].name,
+            tests[i].differ, tests[i].kind == SPANTEST_Z ? "z values" : "pixels", planes);
+
+done:
+    free (ref8);
+    free (test8);
+    free (ref32);
+    free (test32);
+    free (refz);
+    free (testz);
+    free (block);
+}
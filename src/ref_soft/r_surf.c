@@ -40,6 +40,7 @@ void R_DrawSurfaceBlock8_mip0 (void);
 void R_DrawSurfaceBlock8_mip1 (void);
 void R_DrawSurfaceBlock8_mip2 (void);
 void R_DrawSurfaceBlock8_mip3 (void);
+void R_DrawSurfaceBlock32 (void);
 
 static void    (*surfmiptable[4])(void) = {
     R_DrawSurfaceBlock8_mip0,
@@ -54,8 +55,11 @@ extern    unsigned        blocklights[1024];    // allow some very large lightma
 float           surfscale;
 qboolean        r_cache_thrash;         // set if surface cache is thrashing
 
-int         sc_size;
-surfcache_t    *sc_rover, *sc_base;
+int         sc_size;                    // budget in bytes, may grow up to sc_maxsize
+int         sc_maxsize;
+int         sc_allocated;               // bytes held by segments
+
+int         c_surfhits, c_surfevicts, c_surfbytes;
 
 /*
 ===============
@@ -123,6 +127,11 @@ void R_DrawSurface (void)
     pblockdrawer = surfmiptable[r_drawsurf.surfmip];
 // TODO: only needs to be set when there is a display settings change
     horzblockstep = blocksize;
+    if (r_drawsurf.truecolor)
+    {
+        pblockdrawer = R_DrawSurfaceBlock32;
+        horzblockstep = blocksize * 4;
+    }
 
     smax = mt->width >> r_drawsurf.surfmip;
     twidth = texwidth;
@@ -367,9 +376,131 @@ void R_DrawSurfaceBlock8_mip3 (void)
 #endif
 
 
+/*
+================
+R_LightTexel
+================
+*/
+static unsigned R_LightTexel (int pix, int light)
+{
+    byte        *c;
+    unsigned    scale, r, g, b;
+
+    if (r_fullbrights[pix])
+        return d_8to32table[pix];
+
+    c = (byte *)&d_8to24table[pix];
+    scale = r_lightscale[light];
+    r = (c[0] * scale) >> 8;
+    g = (c[1] * scale) >> 8;
+    b = (c[2] * scale) >> 8;
+    if (r > 255)
+        r = 255;
+    if (g > 255)
+        g = 255;
+    if (b > 255)
+        b = 255;
+
+    return (sw_state.gammatable[r] << 16) | (sw_state.gammatable[g] << 8)
+            | sw_state.gammatable[b];
+}
+
+/*
+================
+R_DrawSurfaceBlock32
+
+R_DrawSurfaceBlock8_mip* for any mip level, lighting with a multiply
+instead of the colormap
+================
+*/
+void R_DrawSurfaceBlock32 (void)
+{
+    int                v, i, b, lightstep, lighttemp, light;
+    unsigned char    *psource;
+    unsigned        *prowdest;
+
+    psource = pbasesource;
+    prowdest = prowdestbase;
+
+    for (v=0 ; v<r_numvblocks ; v++)
+    {
+        lightleft = r_lightptr[0];
+        lightright = r_lightptr[1];
+        r_lightptr += r_lightwidth;
+        lightleftstep = (r_lightptr[0] - lightleft) >> blockdivshift;
+        lightrightstep = (r_lightptr[1] - lightright) >> blockdivshift;
+
+        for (i=0 ; i<blocksize ; i++)
+        {
+            lighttemp = lightleft - lightright;
+            lightstep = lighttemp >> blockdivshift;
+
+            light = lightright;
+
+            for (b=blocksize-1; b>=0; b--)
+            {
+                // the steps carry whole multiples of 1<<24 when the light
+                // falls, which the mask drops like the colormap's 0xFF00
+                prowdest[b] = R_LightTexel (psource[b], light & (VID_GRADES*256-1));
+                light += lightstep;
+            }
+    
+            psource += sourcetstep;
+            lightright += lightrightstep;
+            lightleft += lightleftstep;
+            prowdest = (unsigned *)((byte *)prowdest + surfrowbytes);
+        }
+
+        if (psource >= r_sourcemax)
+            psource -= r_stepback;
+    }
+}
+
+
 //============================================================================
 
 
+/*
+=============================================================================
+
+SURFACE CACHE
+
+Blocks come out of segments, and a segment only ever holds blocks of one
+size class, so big and small surfaces don't fragment each other. Each class
+keeps its blocks on a list ordered by last use with free blocks at the tail.
+When a class runs dry it takes a free block, then a new segment while the
+budget allows, then its least recently used block. If that block was drawn
+this frame it takes over the coldest segment of another class instead, or
+grows the budget, before it settles for thrashing.
+
+A block drawn this frame is never freed or handed out again until the next
+one, since another sw_threads band may still be reading it. Thrashing
+builds the surface into the band's own scratch block, which isn't cached.
+
+=============================================================================
+*/
+
+#define SC_NUMCLASSES       22          // 256 bytes to 384k, two per octave
+#define SC_SEGMENTSIZE      0x10000     // smaller blocks are grouped this big
+
+typedef struct scsegment_s
+{
+    struct scsegment_s  *next;
+    int                 sizeclass;
+    int                 numblocks;
+    byte                *data;
+} scsegment_t;
+
+typedef struct
+{
+    int            blocksize;
+    surfcache_t    blocks;              // sentinel, blocks.next is the most recent
+} scclass_t;
+
+static scclass_t    sc_classes[SC_NUMCLASSES];
+static scsegment_t  *sc_segments;
+static surfcache_t  *sc_scratch[MAX_SCANBANDS];    // one per band, for thrashing
+
 /*
 ================
 R_InitCaches
@@ -380,6 +511,7 @@ void R_InitCaches (void)
 {
     int        size;
     int        pix;
+    int        i;
 
     // calculate size to allocate
     if (sw_surfcacheoverride->value)
@@ -393,6 +525,9 @@ void R_InitCaches (void)
         pix = vid.width*vid.height;
         if (pix > 64000)
             size += (pix-64000)*3;
+
+        if (r_truecolor)
+            size *= 4;
     }        
 
     // round up to page size
@@ -400,15 +535,271 @@ void R_InitCaches (void)
 
     ri.Con_Printf (PRINT_ALL,"%ik surface cache\n", size/1024);
 
+    for (i=0 ; i<SC_NUMCLASSES ; i++)
+    {
+        sc_classes[i].blocksize = (i & 1 ? 3 : 2) << (7 + i/2);
+        sc_classes[i].blocks.next = sc_classes[i].blocks.prev = &sc_classes[i].blocks;
+    }
+
+    // there must always be room for the largest block
+    if (size < sc_classes[SC_NUMCLASSES-1].blocksize)
+        size = sc_classes[SC_NUMCLASSES-1].blocksize;
+
     sc_size = size;
-    sc_base = (surfcache_t *)malloc(size);
-    sc_rover = sc_base;
-    
-    sc_base->next = NULL;
-    sc_base->owner = NULL;
-    sc_base->size = sc_size;
+    // an explicit size is a hard limit, otherwise let busy scenes grow it
+    sc_maxsize = sw_surfcacheoverride->value ? size : size * 4;
+    sc_allocated = 0;
+    sc_segments = NULL;
+}
+
+
+/*
+================
+D_UnlinkBlock
+================
+*/
+static void D_UnlinkBlock (surfcache_t *block)
+{
+    block->prev->next = block->next;
+    block->next->prev = block->prev;
+}
+
+/*
+================
+D_LinkBlock
+
+Puts the block at the recent end of the list, or at the tail if it is free
+================
+*/
+static void D_LinkBlock (surfcache_t *block, scclass_t *class)
+{
+    surfcache_t    *after;
+
+    after = block->owner ? &class->blocks : class->blocks.prev;
+    block->prev = after;
+    block->next = after->next;
+    after->next->prev = block;
+    after->next = block;
+}
+
+/*
+================
+D_EvictBlock
+================
+*/
+static void D_EvictBlock (surfcache_t *block)
+{
+    if (!block->owner)
+        return;
+    *block->owner = NULL;
+    block->owner = NULL;
+    c_surfevicts++;
+}
+
+/*
+================
+D_SegmentBlock
+================
+*/
+static surfcache_t *D_SegmentBlock (scsegment_t *seg, int i)
+{
+    return (surfcache_t *)(seg->data + i * sc_classes[seg->sizeclass].blocksize);
+}
+
+/*
+================
+D_SegmentBlocks
+================
+*/
+static int D_SegmentBlocks (int sizeclass)
+{
+    int    numblocks;
+
+    numblocks = SC_SEGMENTSIZE / sc_classes[sizeclass].blocksize;
+    return numblocks < 1 ? 1 : numblocks;
+}
+
+/*
+================
+D_NewSegment
+
+Returns the first block of a new segment for sizeclass
+================
+*/
+static surfcache_t *D_NewSegment (int sizeclass)
+{
+    scclass_t      *class;
+    scsegment_t    *seg;
+    surfcache_t    *block;
+    int            i, bytes;
+
+    class = &sc_classes[sizeclass];
+
+    seg = malloc (sizeof(*seg));
+    if (!seg)
+        ri.Sys_Error (ERR_FATAL,"D_NewSegment: couldn't allocate a segment");
+    seg->sizeclass = sizeclass;
+    seg->numblocks = D_SegmentBlocks (sizeclass);
+    bytes = seg->numblocks * class->blocksize;
+    seg->data = malloc (bytes);
+    if (!seg->data)
+        ri.Sys_Error (ERR_FATAL,"D_NewSegment: couldn't allocate %i bytes", bytes);
+    seg->next = sc_segments;
+    sc_segments = seg;
+    sc_allocated += bytes;
+
+    for (i=0 ; i<seg->numblocks ; i++)
+    {
+        block = D_SegmentBlock (seg, i);
+        block->owner = NULL;
+        block->frame = 0;
+        block->segment = seg;
+        block->size = class->blocksize;
+        D_LinkBlock (block, class);
+    }
+
+    return D_SegmentBlock (seg, 0);
+}
+
+/*
+================
+D_FreeSegment
+================
+*/
+static void D_FreeSegment (scsegment_t *seg)
+{
+    scsegment_t    **prev;
+    surfcache_t    *block;
+    int            i;
+
+    for (i=0 ; i<seg->numblocks ; i++)
+    {
+        block = D_SegmentBlock (seg, i);
+        D_EvictBlock (block);
+        D_UnlinkBlock (block);
+    }
+
+    for (prev = &sc_segments ; *prev != seg ; prev = &(*prev)->next)
+        ;
+    *prev = seg->next;
+
+    sc_allocated -= seg->numblocks * sc_classes[seg->sizeclass].blocksize;
+    free (seg->data);
+    free (seg);
+}
+
+/*
+================
+D_ColdestSegment
+
+Finds the segment of another class whose most recently used block is
+oldest, the natural one to give up when everything of our own is in use
+================
+*/
+static scsegment_t *D_ColdestSegment (int sizeclass, int *newest)
+{
+    scsegment_t    *seg, *best;
+    surfcache_t    *block;
+    int            i, frame;
+
+    best = NULL;
+    *newest = 0x7fffffff;
+    for (seg = sc_segments ; seg ; seg = seg->next)
+    {
+        if (seg->sizeclass == sizeclass)
+            continue;
+        frame = 0;
+        for (i=0 ; i<seg->numblocks ; i++)
+        {
+            block = D_SegmentBlock (seg, i);
+            if (block->owner && block->frame > frame)
+                frame = block->frame;
+        }
+        if (frame < *newest)
+        {
+            *newest = frame;
+            best = seg;
+        }
+    }
+    return best;
+}
+
+/*
+================
+D_MakeRoom
+
+Gives up segments of other classes until bytes more fit in the budget.
+Only segments that weren't drawn this frame are taken.
+================
+*/
+static qboolean D_MakeRoom (int sizeclass, int bytes)
+{
+    scsegment_t    *seg;
+    int            newest;
+
+    while (sc_allocated + bytes > sc_size)
+    {
+        seg = D_ColdestSegment (sizeclass, &newest);
+        if (!seg || newest == r_framecount)
+            return false;
+        D_FreeSegment (seg);
+    }
+    return true;
+}
+
+/*
+================
+D_ScratchBlock
+
+The calling band's block for a surface that can't be cached this frame
+================
+*/
+static surfcache_t *D_ScratchBlock (void)
+{
+    surfcache_t    *block;
+    int            size;
+
+    block = sc_scratch[r_scanband];
+    if (!block)
+    {
+        size = sc_classes[SC_NUMCLASSES-1].blocksize;
+        block = malloc (size);
+        if (!block)
+            ri.Sys_Error (ERR_FATAL,"D_ScratchBlock: couldn't allocate %i bytes", size);
+        block->segment = NULL;
+        block->size = size;
+        sc_scratch[r_scanband] = block;
+    }
+    return block;
 }
 
+/*
+================
+D_FreeCaches
+================
+*/
+void D_FreeCaches (void)
+{
+    scsegment_t    *seg, *next;
+    int            i;
+
+    D_FlushCaches ();
+
+    for (i=0 ; i<MAX_SCANBANDS ; i++)
+    {
+        free (sc_scratch[i]);
+        sc_scratch[i] = NULL;
+    }
+
+    for (seg = sc_segments ; seg ; seg = next)
+    {
+        next = seg->next;
+        free (seg->data);
+        free (seg);
+    }
+    sc_segments = NULL;
+    sc_allocated = 0;
+}
 
 /*
 ==================
@@ -417,21 +808,23 @@ D_FlushCaches
 */
 void D_FlushCaches (void)
 {
-    surfcache_t     *c;
-    
-    if (!sc_base)
-        return;
+    scsegment_t    *seg;
+    surfcache_t    *block;
+    int            i;
 
-    for (c = sc_base ; c ; c = c->next)
+    for (seg = sc_segments ; seg ; seg = seg->next)
     {
-        if (c->owner)
-            *c->owner = NULL;
+        for (i=0 ; i<seg->numblocks ; i++)
+        {
+            block = D_SegmentBlock (seg, i);
+            if (!block->owner)
+                continue;
+            *block->owner = NULL;
+            block->owner = NULL;
+            D_UnlinkBlock (block);
+            D_LinkBlock (block, &sc_classes[seg->sizeclass]);
+        }
     }
-    
-    sc_rover = sc_base;
-    sc_base->next = NULL;
-    sc_base->owner = NULL;
-    sc_base->size = sc_size;
 }
 
 /*
@@ -442,79 +835,56 @@ D_SCAlloc
 surfcache_t     *D_SCAlloc (int width, int size)
 {
     surfcache_t             *new;
-    qboolean                wrapped_this_time;
+    scclass_t               *class;
+    int                     sizeclass, bytes;
 
     if ((width < 0) || (width > 256))
         ri.Sys_Error (ERR_FATAL,"D_SCAlloc: bad cache width %d\n", width);
 
-    if ((size <= 0) || (size > 0x10000))
+    if ((size <= 0) || (size > 0x40000))
         ri.Sys_Error (ERR_FATAL,"D_SCAlloc: bad cache size %d\n", size);
     
     size = offsetof (surfcache_t, data[size]);
     size = (size + 3) & ~3;
-    if (size > sc_size)
-        ri.Sys_Error (ERR_FATAL,"D_SCAlloc: %i > cache size of %i",size, sc_size);
-
-// if there is not size bytes after the rover, reset to the start
-    wrapped_this_time = false;
 
-    if ( !sc_rover || (byte *)sc_rover - (byte *)sc_base > sc_size - size)
+    for (sizeclass=0 ; sc_classes[sizeclass].blocksize < size ; sizeclass++)
+        ;
+    class = &sc_classes[sizeclass];
+    bytes = D_SegmentBlocks (sizeclass) * class->blocksize;
+    new = class->blocks.prev;
+
+    if (new != &class->blocks && !new->owner)
+        ;    // a free block
+    else if (sc_allocated + bytes <= sc_size)
+        new = D_NewSegment (sizeclass);
+    else if (new != &class->blocks && new->frame != r_framecount)
+        ;    // the least recently used block
+    else if (D_MakeRoom (sizeclass, bytes))
+        new = D_NewSegment (sizeclass);    // everything of this size was drawn this frame
+    else if (sc_size + bytes <= sc_maxsize)
     {
-        if (sc_rover)
-        {
-            wrapped_this_time = true;
-        }
-        sc_rover = sc_base;
+        sc_size += bytes;
+        D_MakeRoom (sizeclass, bytes);
+        new = D_NewSegment (sizeclass);
     }
-        
-// colect and free surfcache_t blocks until the rover block is large enough
-    new = sc_rover;
-    if (sc_rover->owner)
-        *sc_rover->owner = NULL;
-    
-    while (new->size < size)
+    else
     {
-    // free another
-        sc_rover = sc_rover->next;
-        if (!sc_rover)
-            ri.Sys_Error (ERR_FATAL,"D_SCAlloc: hit the end of memory");
-        if (sc_rover->owner)
-            *sc_rover->owner = NULL;
-            
-        new->size += sc_rover->size;
-        new->next = sc_rover->next;
+        r_cache_thrash = true;
+        new = D_ScratchBlock ();
+        new->owner = NULL;
+        new->width = width;
+        new->frame = r_framecount;
+        new->next = new->prev = new;
+        return new;
     }
 
-// create a fragment out of any leftovers
-    if (new->size - size > 256)
-    {
-        sc_rover = (surfcache_t *)( (byte *)new + size);
-        sc_rover->size = new->size - size;
-        sc_rover->next = new->next;
-        sc_rover->width = 0;
-        sc_rover->owner = NULL;
-        new->next = sc_rover;
-        new->size = size;
-    }
-    else
-        sc_rover = new->next;
-    
-    new->width = width;
-// DEBUG
-    if (width > 0)
-        new->height = (size - sizeof(*new) + sizeof(new->data)) / width;
+    D_EvictBlock (new);
+    D_UnlinkBlock (new);
 
+    new->width = width;
     new->owner = NULL;              // should be set properly after return
-
-    if (d_roverwrapped)
-    {
-        if (wrapped_this_time || (sc_rover >= d_initial_rover))
-            r_cache_thrash = true;
-    }
-    else if (wrapped_this_time)
-    {       
-        d_roverwrapped = true;
-    }
+    new->frame = r_framecount;
+    new->next = new->prev = new;    // linked by D_CacheSurface once owned
 
     return new;
 }
@@ -527,14 +897,26 @@ D_SCDump
 */
 void D_SCDump (void)
 {
-    surfcache_t             *test;
+    scsegment_t    *seg;
+    int            i, j, segments, used;
 
-    for (test = sc_base ; test ; test = test->next)
+    for (i=0 ; i<SC_NUMCLASSES ; i++)
     {
-        if (test == sc_rover)
-            ri.Con_Printf (PRINT_ALL,"ROVER:\n");
-        ri.Con_Printf (PRINT_ALL,"%p : %i bytes     %i width\n",test, test->size, test->width);
+        segments = used = 0;
+        for (seg = sc_segments ; seg ; seg = seg->next)
+        {
+            if (seg->sizeclass != i)
+                continue;
+            segments++;
+            for (j=0 ; j<seg->numblocks ; j++)
+                if (D_SegmentBlock (seg, j)->owner)
+                    used++;
+        }
+        ri.Con_Printf (PRINT_ALL,"%6i bytes: %3i segments, %4i blocks used\n",
+                sc_classes[i].blocksize, segments, used);
     }
+    ri.Con_Printf (PRINT_ALL,"%ik of %ik (max %ik)\n",
+            sc_allocated/1024, sc_size/1024, sc_maxsize/1024);
 }
 
 //=============================================================================
@@ -567,6 +949,20 @@ int D_log2 (int num)
 
 //=============================================================================
 
+/*
+================
+D_TouchBlock
+
+Marks an owned block as the most recently used of its class
+================
+*/
+static void D_TouchBlock (surfcache_t *block)
+{
+    block->frame = r_framecount;
+    D_UnlinkBlock (block);
+    D_LinkBlock (block, &sc_classes[block->segment->sizeclass]);
+}
+
 /*
 ================
 D_CacheSurface
@@ -590,13 +986,20 @@ surfcache_t *D_CacheSurface (msurface_t *surface, int miplevel)
 //
     cache = surface->cachespots[miplevel];
 
-    if (cache && !cache->dlight && surface->dlightframe != r_framecount
+    // a dynamically lit block is good for the rest of the frame it was
+    // built in, so the other bands crossing the surface can share it
+    if (cache && (cache->dlight ? cache->frame == r_framecount
+                                : surface->dlightframe != r_framecount)
             && cache->image == r_drawsurf.image
             && cache->lightadj[0] == r_drawsurf.lightadj[0]
             && cache->lightadj[1] == r_drawsurf.lightadj[1]
             && cache->lightadj[2] == r_drawsurf.lightadj[2]
             && cache->lightadj[3] == r_drawsurf.lightadj[3] )
+    {
+        D_TouchBlock (cache);
+        c_surfhits++;
         return cache;
+    }
 
 //
 // determine shape of surface
@@ -604,20 +1007,40 @@ surfcache_t *D_CacheSurface (msurface_t *surface, int miplevel)
     surfscale = 1.0 / (1<<miplevel);
     r_drawsurf.surfmip = miplevel;
     r_drawsurf.surfwidth = surface->extents[0] >> miplevel;
-    r_drawsurf.rowbytes = r_drawsurf.surfwidth;
     r_drawsurf.surfheight = surface->extents[1] >> miplevel;
+    // translucent surfaces are drawn by r_poly.c, which wants palette indices
+    r_drawsurf.truecolor = r_truecolor &&
+            !(surface->texinfo->flags & (SURF_TRANS33|SURF_TRANS66));
+    r_drawsurf.rowbytes = r_drawsurf.surfwidth * (r_drawsurf.truecolor ? 4 : 1);
     
 //
 // allocate memory if needed
 //
-    if (!cache)     // if a texture just animated, don't reallocate it
+    // another band may still be drawing from a block used this frame, so
+    // that one can't be rebuilt in place
+    if (cache && cache->frame == r_framecount)
+    {
+        cache = D_ScratchBlock ();
+        cache->owner = NULL;
+        cache->width = r_drawsurf.surfwidth;
+        cache->height = r_drawsurf.surfheight;
+        cache->mipscale = surfscale;
+        cache->frame = r_framecount;
+    }
+    else if (!cache)     // if a texture just animated, don't reallocate it
     {
         cache = D_SCAlloc (r_drawsurf.surfwidth,
-                           r_drawsurf.surfwidth * r_drawsurf.surfheight);
-        surface->cachespots[miplevel] = cache;
-        cache->owner = &surface->cachespots[miplevel];
+                           r_drawsurf.rowbytes * r_drawsurf.surfheight);
+        cache->height = r_drawsurf.surfheight;
         cache->mipscale = surfscale;
+        if (cache->segment)     // not a scratch block
+        {
+            surface->cachespots[miplevel] = cache;
+            cache->owner = &surface->cachespots[miplevel];
+        }
     }
+    if (cache->segment)
+        D_TouchBlock (cache);
     
     if (surface->dlightframe == r_framecount)
         cache->dlight = 1;
@@ -638,6 +1061,7 @@ surfcache_t *D_CacheSurface (msurface_t *surface, int miplevel)
     r_drawsurf.surf = surface;
 
     c_surf++;
+    c_surfbytes += cache->size;
 
     // calculate the lightings
     R_BuildLightMap ();
@@ -55,6 +55,7 @@ typedef struct
 
     char        configstrings[MAX_CONFIGSTRINGS][MAX_QPATH];
     entity_state_t    baselines[MAX_EDICTS];
+    entity_state_t    clientbaselines[MAX_EDICTS];    // baselines as clients get them
 
     // the multicast buffer is used to send a message to a set of clients
     // it is only used to marshall data until SV_Multicast is called
@@ -63,6 +64,9 @@ typedef struct
 
     // demo server information
     FILE        *demofile;
+    int            demostart;        // where the demo starts in demofile, which can be a pak
+    demoindex_t    *demoindex;        // its keyframes, if it has them
+    int            numdemoindex;
     qboolean    timedemo;        // don't time sync
 } server_t;
 
@@ -87,6 +91,9 @@ typedef struct
     int                    num_entities;
     int                    first_entity;        // into the circular sv_packet_entities[]
     int                    senttime;            // for ping calculations
+    int                    deltaframe;            // what it was delta'd from, -1 for nothing
+    int                    num_projectiles;
+    int                    first_projectile;    // into the circular client_projectiles[]
 } client_frame_t;
 
 #define    LATENCY_COUNTS    16
@@ -121,6 +128,15 @@ typedef struct client_s
     byte            datagram_buf[MAX_MSGLEN];
 
     client_frame_t    frames[UPDATE_BACKUP];    // updates can be delta'd from here
+    qboolean        bitents;            // takes svc_bitentities
+    int                bitbase;            // frames back the client keeps states for
+    qboolean        projectiles;        // takes svc_projectiles
+    qboolean        bigedicts;            // takes entity numbers past MAX_EDICTS_OLD
+
+    // where edict->s.origin was when SV_Multicast last looked
+    qboolean        mcast_stale;        // moved since
+    int                mcast_cluster;
+    int                mcast_area;
 
     byte            *download;            // file being downloaded
     int                downloadsize;        // total bytes (can't use EOF because of paks)
@@ -140,6 +156,35 @@ typedef struct client_s
 // getting kicked off by the server operator
 // a program error, like an overflowed reliable buffer
 
+// what SV_CullClientEntities needs to know about a client's view
+typedef struct
+{
+    vec3_t        org;
+    int            clientarea;
+    byte        fatpvs[MAX_MAP_LEAFS/8];
+    byte        phs[MAX_MAP_LEAFS/8];
+} clientview_t;
+
+// room for the threaded encoder to build a frame in; anything bigger than
+// MAX_FRAGMSGLEN is dropped anyway, so an overflow past this is too
+#define    MAX_JOBMSGLEN    65536
+
+// room for a serverrecord frame, every entity without deltas at a typical
+// dozen bytes each; a bigger frame is left out of the demo
+#define    MAX_DEMOFRAMELEN    (MAX_EDICTS*12)
+
+// per client scratch space for building frames with sv_threads
+typedef struct
+{
+    qboolean    send;                    // build and transmit a frame this time
+    qboolean    setup;                    // SV_SetupClientFrame succeeded
+    clientview_t    view;
+    int            num_visible;
+    int            visible[MAX_EDICTS];
+    sizebuf_t    msg;
+    byte        msg_buf[MAX_JOBMSGLEN];
+} clientjob_t;
+
 //=============================================================================
 
 // MAX_CHALLENGES is made large to prevent a denial
@@ -159,6 +204,7 @@ typedef struct
 {
     qboolean    initialized;                // sv_init has completed
     int            realtime;                    // always increasing, no clamping, etc
+    int            packettime;                    // realtime when net_message arrived
 
     char        mapcmd[MAX_TOKEN_CHARS];    // ie: *intro.cin+base 
 
@@ -166,16 +212,21 @@ typedef struct
                                             // used to check late spawns
 
     client_t    *clients;                    // [maxclients->value];
-    int            num_client_entities;        // maxclients->value*UPDATE_BACKUP*MAX_PACKET_ENTITIES
+    int            num_client_entities;        // maxclients->value*UPDATE_BACKUP*64, grown as needed
     int            next_client_entities;        // next client_entity to use
     entity_state_t    *client_entities;        // [num_client_entities]
+    int            next_client_projectiles;    // next client_projectile to use
+    projectile_t    *client_projectiles;    // [num_client_entities]
+    clientjob_t    *clientjobs;                // [maxclients->value], allocated for sv_threads
+    int            num_bitdeltas;                // per client, grown to ge->num_edicts
+    bitdelta_t    *bitdeltas;                    // [maxclients->value*num_bitdeltas] for SV_EmitBitEntities
 
     int            last_heartbeat;
 
     challenge_t    challenges[MAX_CHALLENGES];    // to prevent invalid IPs from connecting
 
     // serverrecord values
-    FILE        *demofile;
+    demofile_t    *demofile;
     sizebuf_t    demo_multicast;
     byte        demo_multicast_buf[MAX_MSGLEN];
 } server_static_t;
@@ -196,6 +247,14 @@ extern    cvar_t        *sv_noreload;            // don't reload level state whe
 extern    cvar_t        *sv_airaccelerate;        // don't reload level state when reentering
                                             // development tool
 extern    cvar_t        *sv_enforcetime;
+extern    cvar_t        *sv_areacell;            // wanted area tree leaf size
+extern    cvar_t        *sv_threads;            // threads for building client frames
+extern    cvar_t        *sv_mcastbuckets;        // bucket clients by cluster for SV_Multicast
+extern    cvar_t        *sv_bitents;            // offer svc_bitentities to clients
+extern    cvar_t        *sv_coordbits;            // svc_bitentities coordinate fraction bits
+extern    cvar_t        *sv_anglebits;            // svc_bitentities angle bits
+extern    cvar_t        *sv_projectiles;        // offer svc_projectiles to clients
+extern    cvar_t        *sv_bigedicts;            // offer entity numbers past MAX_EDICTS_OLD
 
 extern    client_t    *sv_client;
 extern    edict_t        *sv_player;
@@ -224,6 +283,22 @@ void SV_UserinfoChanged (client_t *cl);
 void Master_Heartbeat (void);
 void Master_Packet (void);
 
+char *SV_StatusString (void);
+int SV_GetChallenge (netadr_t adr);
+
+//
+// sv_net.c
+//
+extern    cvar_t        *sv_netthread;
+
+void SV_NetLock (void);
+void SV_NetUnlock (void);
+void SV_NetStart (void);
+void SV_NetStop (void);
+void SV_NetFrame (void);
+qboolean SV_NetGetPacket (void);
+void SV_NetSleep (int msec);
+
 //
 // sv_init.c
 //
@@ -250,6 +325,9 @@ void SV_DemoCompleted (void);
 void SV_SendClientMessages (void);
 
 void SV_Multicast (vec3_t origin, multicast_t to);
+void SV_MulticastMoved (client_t *cl);
+void SV_MulticastFrame (void);
+void SV_MulticastBench_f (void);
 void SV_StartSound (vec3_t origin, edict_t *entity, int channel,
                     int soundindex, float volume,
                     float attenuation, float timeofs);
@@ -275,6 +353,9 @@ void SV_Status_f (void);
 void SV_WriteFrameToClient (client_t *client, sizebuf_t *msg);
 void SV_RecordDemoMessage (void);
 void SV_BuildClientFrame (client_t *client);
+qboolean SV_SetupClientFrame (client_t *client, clientview_t *view);
+int SV_CullClientEntities (client_t *client, clientview_t *view, int *list);
+void SV_StoreClientEntities (client_t *client, int *list, int count);
 
 
 void SV_Error (char *error, ...);
@@ -299,6 +380,9 @@ void SV_InitEdict (edict_t *e);
 void SV_ClearWorld (void);
 // called after the world model has been loaded, before linking any entities
 
+void SV_AreaStats_f (void);
+// prints the area tree shape and the list lengths walked since the last call
+
 void SV_UnlinkEdict (edict_t *ent);
 // call before removing an entity, and before trying to move one,
 // so it doesn't clip against itself
@@ -339,3 +423,9 @@ trace_t SV_Trace (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edict_t *p
 
 // passedict is explicitly excluded from clipping checks (normally NULL)
 
+void SV_TraceMany (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t *ends, int numtraces, edict_t *passedict, int contentmask, trace_t *traces);
+// SV_Trace from one start to each of ends[numtraces], walking the world once
+
+void SV_TraceStats_f (void);
+// prints the trace cache hit rate since the last call
+
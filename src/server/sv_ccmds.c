@@ -884,7 +884,6 @@ void SV_ServerRecord_f (void)
     char    name[MAX_OSPATH];
     byte    buf_data[32768];
     sizebuf_t    buf;
-    int        len;
     int        i;
 
     if (Cmd_Argc() != 2)
@@ -910,20 +909,23 @@ void SV_ServerRecord_f (void)
     //
     Com_sprintf (name, sizeof(name), "%s/demos/%s.dm2", FS_Gamedir(), Cmd_Argv(1));
 
-    Com_Printf ("recording to %s.\n", name);
     FS_CreatePath (name);
-    svs.demofile = fopen (name, "wb");
+    svs.demofile = Demo_Open (name);
     if (!svs.demofile)
     {
-        Com_Printf ("ERROR: couldn't open.\n");
+        Com_Printf ("ERROR: couldn't open %s.\n", name);
         return;
     }
+    Com_Printf ("recording to %s.\n", name);
 
-    // setup a buffer to catch all multicasts
+    // setup a buffer to catch all multicasts, a busy frame's are
+    // left out rather than taking the server down
     SZ_Init (&svs.demo_multicast, svs.demo_multicast_buf, sizeof(svs.demo_multicast_buf));
+    svs.demo_multicast.allowoverflow = true;
 
     //
-    // write a single giant fake message with all the startup info
+    // write fake messages with all the startup info, split up the way
+    // the client's own demos do it so any number of configstrings fit
     //
     SZ_Init (&buf, buf_data, sizeof(buf_data));
 
@@ -945,6 +947,11 @@ void SV_ServerRecord_f (void)
     for (i=0 ; i<MAX_CONFIGSTRINGS ; i++)
         if (sv.configstrings[i][0])
         {
+            if (buf.cursize + strlen (sv.configstrings[i]) + 32 > buf.maxsize)
+            {
+                Demo_WriteMessage (svs.demofile, buf.data, buf.cursize);
+                SZ_Clear (&buf);
+            }
             MSG_WriteByte (&buf, svc_configstring);
             MSG_WriteShort (&buf, i);
             MSG_WriteString (&buf, sv.configstrings[i]);
@@ -952,9 +959,7 @@ void SV_ServerRecord_f (void)
 
     // write it to the demo file
     Com_DPrintf ("signon message length: %i\n", buf.cursize);
-    len = LittleLong (buf.cursize);
-    fwrite (&len, 4, 1, svs.demofile);
-    fwrite (buf.data, buf.cursize, 1, svs.demofile);
+    Demo_WriteMessage (svs.demofile, buf.data, buf.cursize);
 
     // the rest of the demo file will be individual frames
 }
@@ -974,12 +979,91 @@ void SV_ServerStop_f (void)
         Com_Printf ("Not doing a serverrecord.\n");
         return;
     }
-    fclose (svs.demofile);
+    Demo_Close (svs.demofile);
     svs.demofile = NULL;
     Com_Printf ("Recording completed.\n");
 }
 
 
+/*
+==================
+SV_DemoKeyframe
+
+The last keyframe at or before both serverframe and offset, or the
+first one
+==================
+*/
+static int SV_DemoKeyframe (int serverframe, int offset)
+{
+    int        lo, hi, mid;
+
+    lo = 0;
+    hi = sv.numdemoindex - 1;
+    while (lo < hi)
+    {
+        mid = (lo + hi + 1) / 2;
+        if (sv.demoindex[mid].serverframe <= serverframe && sv.demoindex[mid].offset <= offset)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+/*
+==================
+SV_DemoSeek_f
+
+demoseek [+|-]<seconds>
+
+Moves demo playback to the keyframe at or before a time from the
+start, or from the current keyframe with + or -
+==================
+*/
+void SV_DemoSeek_f (void)
+{
+    demoindex_t    *first, *last;
+    char    *s;
+    int        pos, cur, key, frame;
+
+    if (sv.state != ss_demo || !sv.demofile)
+    {
+        Com_Printf ("Not playing a demo.\n");
+        return;
+    }
+    if (!sv.numdemoindex)
+    {
+        Com_Printf ("%s has no keyframes, make a copy with democonvert.\n", sv.name);
+        return;
+    }
+
+    first = &sv.demoindex[0];
+    last = &sv.demoindex[sv.numdemoindex-1];
+
+    // the keyframe the next message is past
+    pos = ftell (sv.demofile) - sv.demostart;
+    cur = SV_DemoKeyframe (0x7fffffff, pos);
+
+    if (Cmd_Argc() != 2)
+    {
+        Com_Printf ("demoseek [+|-]<seconds>\n");
+        Com_Printf ("%i keyframes over %i seconds, at %i\n", sv.numdemoindex,
+            (last->serverframe - first->serverframe) / 10,
+            (sv.demoindex[cur].serverframe - first->serverframe) / 10);
+        return;
+    }
+
+    s = Cmd_Argv(1);
+    if (s[0] == '+' || s[0] == '-')
+        frame = sv.demoindex[cur].serverframe + atof(s)*10;
+    else
+        frame = first->serverframe + atof(s)*10;
+
+    key = SV_DemoKeyframe (frame, 0x7fffffff);
+    fseek (sv.demofile, sv.demostart + sv.demoindex[key].offset, SEEK_SET);
+    Com_Printf ("demo at %i seconds\n", (sv.demoindex[key].serverframe - first->serverframe) / 10);
+}
+
 /*
 ===============
 SV_KillServer_f
@@ -1039,6 +1123,7 @@ void SV_InitOperatorCommands (void)
 
     Cmd_AddCommand ("serverrecord", SV_ServerRecord_f);
     Cmd_AddCommand ("serverstop", SV_ServerStop_f);
+    Cmd_AddCommand ("demoseek", SV_DemoSeek_f);
 
     Cmd_AddCommand ("save", SV_Savegame_f);
     Cmd_AddCommand ("load", SV_Loadgame_f);
@@ -1046,5 +1131,9 @@ void SV_InitOperatorCommands (void)
     Cmd_AddCommand ("killserver", SV_KillServer_f);
 
     Cmd_AddCommand ("sv", SV_ServerCommand_f);
+
+    Cmd_AddCommand ("sv_areastats", SV_AreaStats_f);
+    Cmd_AddCommand ("sv_tracestats", SV_TraceStats_f);
+    Cmd_AddCommand ("sv_mcastbench", SV_MulticastBench_f);
 }
 
@@ -28,93 +28,6 @@ Encode a client frame onto the network channel
 =============================================================================
 */
 
-#if 0
-
-// because there can be a lot of projectiles, there is a special
-// network protocol for them
-#define    MAX_PROJECTILES        64
-edict_t    *projectiles[MAX_PROJECTILES];
-int        numprojs;
-cvar_t  *sv_projectiles;
-
-qboolean SV_AddProjectileUpdate (edict_t *ent)
-{
-    if (!sv_projectiles)
-        sv_projectiles = Cvar_Get("sv_projectiles", "1", 0);
-
-    if (!sv_projectiles->value)
-        return false;
-
-    if (!(ent->svflags & SVF_PROJECTILE))
-        return false;
-    if (numprojs == MAX_PROJECTILES)
-        return true;
-
-    projectiles[numprojs++] = ent;
-    return true;
-}
-
-void SV_EmitProjectileUpdate (sizebuf_t *msg)
-{
-    byte    bits[16];    // [modelindex] [48 bits] xyz p y 12 12 12 8 8 [entitynum] [e2]
-    int        n, i;
-    edict_t    *ent;
-    int        x, y, z, p, yaw;
-    int len;
-
-    if (!numprojs)
-        return;
-
-    MSG_WriteByte (msg, numprojs);
-
-    for (n=0 ; n<numprojs ; n++)
-    {
-        ent = projectiles[n];
-        x = (int)(ent->s.origin[0]+4096)>>1;
-        y = (int)(ent->s.origin[1]+4096)>>1;
-        z = (int)(ent->s.origin[2]+4096)>>1;
-        p = (int)(256*ent->s.angles[0]/360)&255;
-        yaw = (int)(256*ent->s.angles[1]/360)&255;
-
-        len = 0;
-        bits[len++] = x;
-        bits[len++] = (x>>8) | (y<<4);
-        bits[len++] = (y>>4);
-        bits[len++] = z;
-        bits[len++] = (z>>8);
-        if (ent->s.effects & EF_BLASTER)
-            bits[len-1] |= 64;
-
-        if (ent->s.old_origin[0] != ent->s.origin[0] ||
-            ent->s.old_origin[1] != ent->s.origin[1] ||
-            ent->s.old_origin[2] != ent->s.origin[2]) {
-            bits[len-1] |= 128;
-            x = (int)(ent->s.old_origin[0]+4096)>>1;
-            y = (int)(ent->s.old_origin[1]+4096)>>1;
-            z = (int)(ent->s.old_origin[2]+4096)>>1;
-            bits[len++] = x;
-            bits[len++] = (x>>8) | (y<<4);
-            bits[len++] = (y>>4);
-            bits[len++] = z;
-            bits[len++] = (z>>8);
-        }
-
-        bits[len++] = p;
-        bits[len++] = yaw;
-        bits[len++] = ent->s.modelindex;
-
-        bits[len++] = (ent->s.number & 0x7f);
-        if (ent->s.number > 255) {
-            bits[len-1] |= 128;
-            bits[len++] = (ent->s.number >> 7);
-        }
-
-        for (i=0 ; i<len ; i++)
-            MSG_WriteByte (msg, bits[i]);
-    }
-}
-#endif
-
 /*
 =============
 SV_EmitPacketEntities
@@ -130,12 +43,7 @@ void SV_EmitPacketEntities (client_frame_t *from, client_frame_t *to, sizebuf_t
     int        from_num_entities;
     int        bits;
 
-#if 0
-    if (numprojs)
-        MSG_WriteByte (msg, svc_packetentities2);
-    else
-#endif
-        MSG_WriteByte (msg, svc_packetentities);
+    MSG_WriteByte (msg, svc_packetentities);
 
     if (!from)
         from_num_entities = 0;
@@ -204,206 +112,338 @@ void SV_EmitPacketEntities (client_frame_t *from, client_frame_t *to, sizebuf_t
     }
 
     MSG_WriteShort (msg, 0);    // end of packetentities
-
-#if 0
-    if (numprojs)
-        SV_EmitProjectileUpdate(msg);
-#endif
 }
 
 
+/*
+=============
+SV_FindFrameEntity
+
+Binary search of a frame's entities, which are in number order
+=============
+*/
+static entity_state_t *SV_FindFrameEntity (client_frame_t *frame, int number)
+{
+    entity_state_t    *state;
+    int        lo, hi, mid;
+
+    lo = 0;
+    hi = frame->num_entities - 1;
+    while (lo <= hi)
+    {
+        mid = (lo + hi) / 2;
+        state = &svs.client_entities[(frame->first_entity+mid)%svs.num_client_entities];
+        if (state->number == number)
+            return state;
+        if (state->number < number)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return NULL;
+}
 
 /*
 =============
-SV_WritePlayerstateToClient
+SV_BitEntityBase
 
+For an entity that isn't in the frame being delta'd from, finds the
+newest state the client has for it in the frames that one was delta'd
+from in turn, which the client must have had to read it, no further back
+than the client said it keeps.  Falls back on the baseline.  Sets base to
+how many frames back the state is.
 =============
 */
-void SV_WritePlayerstateToClient (client_frame_t *from, client_frame_t *to, sizebuf_t *msg)
+static entity_state_t *SV_BitEntityBase (client_t *client, client_frame_t *oldframe, int number, int *base)
 {
-    int                i;
-    int                pflags;
-    player_state_t    *ps, *ops;
-    player_state_t    dummy;
-    int                statbits;
+    client_frame_t    *frame;
+    entity_state_t    *state;
+    int        framenum;
 
-    ps = &to->ps;
-    if (!from)
+    for (framenum = oldframe->deltaframe ; framenum > 0 ; framenum = frame->deltaframe)
     {
-        memset (&dummy, 0, sizeof(dummy));
-        ops = &dummy;
+        if (sv.framenum - framenum > client->bitbase || sv.framenum - framenum >= UPDATE_BACKUP - 3)
+            break;
+        frame = &client->frames[framenum & UPDATE_MASK];
+        if (svs.next_client_entities - frame->first_entity > svs.num_client_entities)
+            break;        // overwritten since
+
+        state = SV_FindFrameEntity (frame, number);
+        if (state)
+        {
+            *base = sv.framenum - framenum;
+            return state;
+        }
     }
+
+    *base = 0;
+    return &sv.clientbaselines[number];
+}
+
+/*
+=============
+SV_EmitBitEntities
+
+SV_EmitPacketEntities for clients that connected with "bitents".  Every
+entity new to the client is delta'd from the last state it had, instead
+of always from the baseline, and the frame's states are left as exactly
+what the client will have, so later frames can be delta'd from them.
+
+Builds the deltas in the client's own part of svs.bitdeltas, which
+SV_StoreClientEntities has grown on the main thread, so this is safe on
+the sv_threads workers.  There is one delta per entity number in either
+frame, and none of those reach ge->num_edicts.
+=============
+*/
+void SV_EmitBitEntities (client_t *client, client_frame_t *from, client_frame_t *to, sizebuf_t *msg)
+{
+    bitdelta_t        *deltas;
+    bitdelta_t        *d;
+    entity_state_t    *oldent, *newent;
+    int        oldindex, newindex;
+    int        oldnum, newnum;
+    int        from_num_entities;
+    int        count;
+
+    if (!from)
+        from_num_entities = 0;
     else
-        ops = &from->ps;
+        from_num_entities = from->num_entities;
 
-    //
-    // determine what needs to be sent
-    //
-    pflags = 0;
+    deltas = svs.bitdeltas + (client - svs.clients)*svs.num_bitdeltas;
 
-    if (ps->pmove.pm_type != ops->pmove.pm_type)
-        pflags |= PS_M_TYPE;
+    newindex = 0;
+    oldindex = 0;
+    newent = NULL;
+    oldent = NULL;
+    count = 0;
+    while (newindex < to->num_entities || oldindex < from_num_entities)
+    {
+        if (newindex >= to->num_entities)
+            newnum = 9999;
+        else
+        {
+            newent = &svs.client_entities[(to->first_entity+newindex)%svs.num_client_entities];
+            newnum = newent->number;
+        }
 
-    if (ps->pmove.origin[0] != ops->pmove.origin[0]
-        || ps->pmove.origin[1] != ops->pmove.origin[1]
-        || ps->pmove.origin[2] != ops->pmove.origin[2] )
-        pflags |= PS_M_ORIGIN;
+        if (oldindex >= from_num_entities)
+            oldnum = 9999;
+        else
+        {
+            oldent = &svs.client_entities[(from->first_entity+oldindex)%svs.num_client_entities];
+            oldnum = oldent->number;
+        }
 
-    if (ps->pmove.velocity[0] != ops->pmove.velocity[0]
-        || ps->pmove.velocity[1] != ops->pmove.velocity[1]
-        || ps->pmove.velocity[2] != ops->pmove.velocity[2] )
-        pflags |= PS_M_VELOCITY;
+        d = &deltas[count++];
+        d->newentity = false;
+        d->base = 0;
 
-    if (ps->pmove.pm_time != ops->pmove.pm_time)
-        pflags |= PS_M_TIME;
+        if (newnum == oldnum)
+        {    // delta update from old position
+            // players are always 'newentities', this updates their oldorigin always
+            d->number = newnum;
+            d->from = oldent;
+            d->to = newent;
+            d->oldorigin = newnum <= maxclients->value;
+            oldindex++;
+            newindex++;
+            continue;
+        }
 
-    if (ps->pmove.pm_flags != ops->pmove.pm_flags)
-        pflags |= PS_M_FLAGS;
+        if (newnum < oldnum)
+        {    // this is a new entity, send it from the last state the client had
+            d->number = newnum;
+            d->from = from ? SV_BitEntityBase (client, from, newnum, &d->base) : &sv.clientbaselines[newnum];
+            d->to = newent;
+            d->newentity = true;
+            d->oldorigin = true;
+            newindex++;
+            continue;
+        }
 
-    if (ps->pmove.gravity != ops->pmove.gravity)
-        pflags |= PS_M_GRAVITY;
+        // the old entity isn't present in the new message
+        d->number = oldnum;
+        d->from = oldent;
+        d->to = NULL;
+        oldindex++;
+    }
 
-    if (ps->pmove.delta_angles[0] != ops->pmove.delta_angles[0]
-        || ps->pmove.delta_angles[1] != ops->pmove.delta_angles[1]
-        || ps->pmove.delta_angles[2] != ops->pmove.delta_angles[2] )
-        pflags |= PS_M_DELTA_ANGLES;
+    MSG_WriteBitEntities (msg, deltas, count, sv_coordbits->value, sv_anglebits->value);
+}
 
 
-    if (ps->viewoffset[0] != ops->viewoffset[0]
-        || ps->viewoffset[1] != ops->viewoffset[1]
-        || ps->viewoffset[2] != ops->viewoffset[2] )
-        pflags |= PS_VIEWOFFSET;
+/*
+=============================================================================
 
-    if (ps->viewangles[0] != ops->viewangles[0]
-        || ps->viewangles[1] != ops->viewangles[1]
-        || ps->viewangles[2] != ops->viewangles[2] )
-        pflags |= PS_VIEWANGLES;
+PROJECTILES
 
-    if (ps->kick_angles[0] != ops->kick_angles[0]
-        || ps->kick_angles[1] != ops->kick_angles[1]
-        || ps->kick_angles[2] != ops->kick_angles[2] )
-        pflags |= PS_KICKANGLES;
+Clients that connect with "projectiles" get entities flagged
+SVF_PROJECTILE in svc_projectiles after the frame's entities instead.
+Each is a trajectory the client follows on its own, so a rocket or a
+bolt in flight costs nothing until it hits something, and a grenade
+nothing between bounces.  A new trajectory is only sent when the
+projectile strays from the one the client has.
 
-    if (ps->blend[0] != ops->blend[0]
-        || ps->blend[1] != ops->blend[1]
-        || ps->blend[2] != ops->blend[2]
-        || ps->blend[3] != ops->blend[3] )
-        pflags |= PS_BLEND;
+=============================================================================
+*/
 
-    if (ps->fov != ops->fov)
-        pflags |= PS_FOV;
+#define    PROJECTILE_ERROR    1.0        // units off the trajectory before it is resent
+#define    PROJECTILE_SPEED    4000    // faster than this is taken as a jump
 
-    if (ps->rdflags != ops->rdflags)
-        pflags |= PS_RDFLAGS;
+/*
+=============
+SV_StoreProjectile
 
-    if (ps->gunframe != ops->gunframe)
-        pflags |= PS_WEAPONFRAME;
+Fills in a projectile from the edict, with its origin and velocity as
+they are this frame.  SV_EmitProjectiles decides what trajectory the
+client gets.
+=============
+*/
+static void SV_StoreProjectile (edict_t *ent, projectile_t *p)
+{
+    p->number = ent->s.number;
+    p->modelindex = ent->s.modelindex;
+    p->frame = ent->s.frame;
+    p->skinnum = ent->s.skinnum;
+    p->effects = ent->s.effects;
+    p->renderfx = ent->s.renderfx;
+    p->sound = ent->s.sound;
+    VectorCopy (ent->s.angles, p->angles);
+
+    // the game sets old_origin at the start of every frame
+    VectorCopy (ent->s.origin, p->origin);
+    VectorSubtract (ent->s.origin, ent->s.old_origin, p->velocity);
+    VectorScale (p->velocity, 10, p->velocity);
+    if (VectorLength (p->velocity) > PROJECTILE_SPEED)
+        VectorClear (p->velocity);
+    p->gravity = 0;
+    p->basetime = sv.framenum;
+}
 
-    pflags |= PS_WEAPONINDEX;
+/*
+=============
+SV_ProjectileTrajectory
 
-    //
-    // write it
-    //
-    MSG_WriteByte (msg, svc_playerinfo);
-    MSG_WriteShort (msg, pflags);
+Leaves p as what the client will have: the trajectory it already has
+if that is still good enough, or a new one from here.
+=============
+*/
+static void SV_ProjectileTrajectory (client_frame_t *frame, projectile_t *from, projectile_t *p)
+{
+    projectile_t    fall;
+    vec3_t    org, lin;
+    int        i;
 
-    //
-    // write the pmove_state_t
-    //
-    if (pflags & PS_M_TYPE)
-        MSG_WriteByte (msg, ps->pmove.pm_type);
+    MSG_RoundProjectile (p);
+    if (!from)
+        return;
 
-    if (pflags & PS_M_ORIGIN)
-    {
-        MSG_WriteShort (msg, ps->pmove.origin[0]);
-        MSG_WriteShort (msg, ps->pmove.origin[1]);
-        MSG_WriteShort (msg, ps->pmove.origin[2]);
+    MSG_ProjectileOrigin (from, sv.framenum, org);
+    for (i=0 ; i<3 ; i++)
+        if (fabs (org[i] - p->origin[i]) > PROJECTILE_ERROR)
+            break;
+    if (i == 3)
+    {    // still on course
+        VectorCopy (from->origin, p->origin);
+        VectorCopy (from->velocity, p->velocity);
+        p->gravity = from->gravity;
+        p->basetime = from->basetime;
+        return;
     }
 
-    if (pflags & PS_M_VELOCITY)
-    {
-        MSG_WriteShort (msg, ps->pmove.velocity[0]);
-        MSG_WriteShort (msg, ps->pmove.velocity[1]);
-        MSG_WriteShort (msg, ps->pmove.velocity[2]);
-    }
+    // if it fell since, the new trajectory falls too
+    fall = *from;
+    fall.gravity = 0;
+    MSG_ProjectileOrigin (&fall, sv.framenum, lin);
+    fall.gravity = frame->ps.pmove.gravity;
+    MSG_ProjectileOrigin (&fall, sv.framenum, org);
+    if (fabs (org[2] - p->origin[2]) < fabs (lin[2] - p->origin[2]))
+        p->gravity = fall.gravity;
+}
 
-    if (pflags & PS_M_TIME)
-        MSG_WriteByte (msg, ps->pmove.pm_time);
+/*
+=============
+SV_EmitProjectiles
 
-    if (pflags & PS_M_FLAGS)
-        MSG_WriteByte (msg, ps->pmove.pm_flags);
+Writes a delta update of the frame's projectiles, if it or the frame
+delta'd from has any
+=============
+*/
+void SV_EmitProjectiles (client_frame_t *from, client_frame_t *to, sizebuf_t *msg)
+{
+    static projectile_t    nullprojectile;
+    projectile_t    *oldp, *newp;
+    int        oldindex, newindex;
+    int        oldnum, newnum;
+    int        from_num_projectiles;
+    int        bits;
 
-    if (pflags & PS_M_GRAVITY)
-        MSG_WriteShort (msg, ps->pmove.gravity);
+    if (!from)
+        from_num_projectiles = 0;
+    else
+        from_num_projectiles = from->num_projectiles;
+    if (!to->num_projectiles && !from_num_projectiles)
+        return;
 
-    if (pflags & PS_M_DELTA_ANGLES)
-    {
-        MSG_WriteShort (msg, ps->pmove.delta_angles[0]);
-        MSG_WriteShort (msg, ps->pmove.delta_angles[1]);
-        MSG_WriteShort (msg, ps->pmove.delta_angles[2]);
-    }
+    MSG_WriteByte (msg, svc_projectiles);
 
-    //
-    // write the rest of the player_state_t
-    //
-    if (pflags & PS_VIEWOFFSET)
+    newindex = 0;
+    oldindex = 0;
+    newp = oldp = NULL;
+    while (newindex < to->num_projectiles || oldindex < from_num_projectiles)
     {
-        MSG_WriteChar (msg, ps->viewoffset[0]*4);
-        MSG_WriteChar (msg, ps->viewoffset[1]*4);
-        MSG_WriteChar (msg, ps->viewoffset[2]*4);
-    }
+        if (newindex >= to->num_projectiles)
+            newnum = 9999;
+        else
+        {
+            newp = &svs.client_projectiles[(to->first_projectile+newindex)%svs.num_client_entities];
+            newnum = newp->number;
+        }
 
-    if (pflags & PS_VIEWANGLES)
-    {
-        MSG_WriteAngle16 (msg, ps->viewangles[0]);
-        MSG_WriteAngle16 (msg, ps->viewangles[1]);
-        MSG_WriteAngle16 (msg, ps->viewangles[2]);
-    }
+        if (oldindex >= from_num_projectiles)
+            oldnum = 9999;
+        else
+        {
+            oldp = &svs.client_projectiles[(from->first_projectile+oldindex)%svs.num_client_entities];
+            oldnum = oldp->number;
+        }
 
-    if (pflags & PS_KICKANGLES)
-    {
-        MSG_WriteChar (msg, ps->kick_angles[0]*4);
-        MSG_WriteChar (msg, ps->kick_angles[1]*4);
-        MSG_WriteChar (msg, ps->kick_angles[2]*4);
-    }
+        if (newnum == oldnum)
+        {    // delta update from old position
+            SV_ProjectileTrajectory (to, oldp, newp);
+            MSG_WriteDeltaProjectile (oldp, newp, msg, false);
+            oldindex++;
+            newindex++;
+            continue;
+        }
 
-    if (pflags & PS_WEAPONINDEX)
-    {
-        MSG_WriteByte (msg, ps->gunindex);
-    }
+        if (newnum < oldnum)
+        {    // this is a new projectile, send it from scratch
+            SV_ProjectileTrajectory (to, NULL, newp);
+            MSG_WriteDeltaProjectile (&nullprojectile, newp, msg, true);
+            newindex++;
+            continue;
+        }
 
-    if (pflags & PS_WEAPONFRAME)
-    {
-        MSG_WriteByte (msg, ps->gunframe);
-        MSG_WriteChar (msg, ps->gunoffset[0]*4);
-        MSG_WriteChar (msg, ps->gunoffset[1]*4);
-        MSG_WriteChar (msg, ps->gunoffset[2]*4);
-        MSG_WriteChar (msg, ps->gunangles[0]*4);
-        MSG_WriteChar (msg, ps->gunangles[1]*4);
-        MSG_WriteChar (msg, ps->gunangles[2]*4);
-    }
+        if (newnum > oldnum)
+        {    // the old projectile isn't present in the new message
+            bits = PR_REMOVE;
+            if (oldnum >= 256)
+                bits |= PR_NUMBER16;
 
-    if (pflags & PS_BLEND)
-    {
-        MSG_WriteByte (msg, ps->blend[0]*255);
-        MSG_WriteByte (msg, ps->blend[1]*255);
-        MSG_WriteByte (msg, ps->blend[2]*255);
-        MSG_WriteByte (msg, ps->blend[3]*255);
+            MSG_WriteByte (msg, bits);
+            if (bits & PR_NUMBER16)
+                MSG_WriteShort (msg, oldnum);
+            else
+                MSG_WriteByte (msg, oldnum);
+
+            oldindex++;
+            continue;
+        }
     }
-    if (pflags & PS_FOV)
-        MSG_WriteByte (msg, ps->fov);
-    if (pflags & PS_RDFLAGS)
-        MSG_WriteByte (msg, ps->rdflags);
-
-    // send stats
-    statbits = 0;
-    for (i=0 ; i<MAX_STATS ; i++)
-        if (ps->stats[i] != ops->stats[i])
-            statbits |= 1<<i;
-    MSG_WriteLong (msg, statbits);
-    for (i=0 ; i<MAX_STATS ; i++)
-        if (statbits & (1<<i) )
-            MSG_WriteShort (msg, ps->stats[i]);
+
+    MSG_WriteShort (msg, 0);    // end of projectiles
 }
 
 
@@ -432,12 +472,20 @@ void SV_WriteFrameToClient (client_t *client, sizebuf_t *msg)
         oldframe = NULL;
         lastframe = -1;
     }
+    else if (svs.next_client_entities - client->frames[client->lastframe & UPDATE_MASK].first_entity > svs.num_client_entities
+        || svs.next_client_projectiles - client->frames[client->lastframe & UPDATE_MASK].first_projectile > svs.num_client_entities)
+    {    // its states have been overwritten in client_entities since
+        oldframe = NULL;
+        lastframe = -1;
+    }
     else
     {    // we have a valid message to delta from
         oldframe = &client->frames[client->lastframe & UPDATE_MASK];
         lastframe = client->lastframe;
     }
 
+    frame->deltaframe = lastframe;
+
     MSG_WriteByte (msg, svc_frame);
     MSG_WriteLong (msg, sv.framenum);
     MSG_WriteLong (msg, lastframe);    // what we are delta'ing from
@@ -449,10 +497,14 @@ void SV_WriteFrameToClient (client_t *client, sizebuf_t *msg)
     SZ_Write (msg, frame->areabits, frame->areabytes);
 
     // delta encode the playerstate
-    SV_WritePlayerstateToClient (oldframe, frame, msg);
+    MSG_WriteDeltaPlayerstate (oldframe ? &oldframe->ps : NULL, &frame->ps, msg);
 
     // delta encode the entities
-    SV_EmitPacketEntities (oldframe, frame, msg);
+    if (client->bitents)
+        SV_EmitBitEntities (client, oldframe, frame, msg);
+    else
+        SV_EmitPacketEntities (oldframe, frame, msg);
+    SV_EmitProjectiles (oldframe, frame, msg);
 }
 
 
@@ -464,7 +516,8 @@ Build a client frame structure
 =============================================================================
 */
 
-byte        fatpvs[65536/8];    // 32767 is MAX_MAP_LEAFS
+clientview_t    sv_view;                // for the unthreaded SV_BuildClientFrame
+int            sv_visible[MAX_EDICTS];
 
 /*
 ============
@@ -474,12 +527,11 @@ The client will interpolate the view position,
 so we can't use a single PVS point
 ===========
 */
-void SV_FatPVS (vec3_t org)
+void SV_FatPVS (vec3_t org, byte *fatpvs)
 {
     int        leafs[64];
     int        i, j, count;
-    int        longs;
-    byte    *src;
+    int        bytes;
     vec3_t    mins, maxs;
 
     for (i=0 ; i<3 ; i++)
@@ -491,13 +543,13 @@ void SV_FatPVS (vec3_t org)
     count = CM_BoxLeafnums (mins, maxs, leafs, 64, NULL);
     if (count < 1)
         Com_Error (ERR_FATAL, "SV_FatPVS: count < 1");
-    longs = (CM_NumClusters()+31)>>5;
+    bytes = (CM_NumClusters()+7)>>3;
 
     // convert leafs to clusters
     for (i=0 ; i<count ; i++)
         leafs[i] = CM_LeafCluster(leafs[i]);
 
-    memcpy (fatpvs, CM_ClusterPVS(leafs[0]), longs<<2);
+    memcpy (fatpvs, CM_ClusterPVS(leafs[0]), bytes);
     // or in all the other leaf bits
     for (i=1 ; i<count ; i++)
     {
@@ -506,43 +558,32 @@ void SV_FatPVS (vec3_t org)
                 break;
         if (j != i)
             continue;        // already have the cluster we want
-        src = CM_ClusterPVS(leafs[i]);
-        for (j=0 ; j<longs ; j++)
-            ((long *)fatpvs)[j] |= ((long *)src)[j];
+        CM_OrVis (fatpvs, CM_ClusterPVS(leafs[i]), bytes);
     }
 }
 
 
 /*
 =============
-SV_BuildClientFrame
+SV_SetupClientFrame
 
-Decides which entities are going to be visible to the client, and
-copies off the playerstat and areabits.
+Copies off the playerstate and areabits, and works out everything the
+entity culling needs to know about the client's view.  The collision
+model queries in here are not reentrant, so this stays on the main thread.
+Returns false if the client isn't in the game yet.
 =============
 */
-void SV_BuildClientFrame (client_t *client)
+qboolean SV_SetupClientFrame (client_t *client, clientview_t *view)
 {
-    int        e, i;
-    vec3_t    org;
-    edict_t    *ent;
+    int        i;
     edict_t    *clent;
     client_frame_t    *frame;
-    entity_state_t    *state;
-    int        l;
-    int        clientarea, clientcluster;
     int        leafnum;
-    int        c_fullsend;
-    byte    *clientphs;
-    byte    *bitvector;
+    int        clientcluster;
 
     clent = client->edict;
     if (!clent->client)
-        return;        // not in game yet
-
-#if 0
-    numprojs = 0; // no projectiles yet
-#endif
+        return false;        // not in game yet
 
     // this is the frame we are creating
     frame = &client->frames[sv.framenum & UPDATE_MASK];
@@ -551,29 +592,53 @@ void SV_BuildClientFrame (client_t *client)
 
     // find the client's PVS
     for (i=0 ; i<3 ; i++)
-        org[i] = clent->client->ps.pmove.origin[i]*0.125 + clent->client->ps.viewoffset[i];
+        view->org[i] = clent->client->ps.pmove.origin[i]*0.125 + clent->client->ps.viewoffset[i];
 
-    leafnum = CM_PointLeafnum (org);
-    clientarea = CM_LeafArea (leafnum);
+    leafnum = CM_PointLeafnum (view->org);
+    view->clientarea = CM_LeafArea (leafnum);
     clientcluster = CM_LeafCluster (leafnum);
 
     // calculate the visible areas
-    frame->areabytes = CM_WriteAreaBits (frame->areabits, clientarea);
+    frame->areabytes = CM_WriteAreaBits (frame->areabits, view->clientarea);
 
     // grab the current player_state_t
     frame->ps = clent->client->ps;
 
+    SV_FatPVS (view->org, view->fatpvs);
+    memcpy (view->phs, CM_ClusterPHS (clientcluster), (CM_NumClusters()+7)>>3);
+
+    return true;
+}
 
-    SV_FatPVS (org);
-    clientphs = CM_ClusterPHS (clientcluster);
 
-    // build up the list of visible entities
-    frame->num_entities = 0;
-    frame->first_entity = svs.next_client_entities;
+/*
+=============
+SV_CullClientEntities
 
-    c_fullsend = 0;
+Fills list with the numbers of the entities that are visible to the
+client.  Only reads the world, so it is safe to run for several
+clients at once.
+=============
+*/
+int SV_CullClientEntities (client_t *client, clientview_t *view, int *list)
+{
+    int        e, i;
+    edict_t    *ent;
+    edict_t    *clent;
+    int        l;
+    int        count;
+    int        num_edicts;
+    byte    *bitvector;
+
+    clent = client->edict;
+    count = 0;
+
+    // older clients can't take the high entity numbers
+    num_edicts = ge->num_edicts;
+    if (!client->bigedicts && num_edicts > MAX_EDICTS_OLD)
+        num_edicts = MAX_EDICTS_OLD;
 
-    for (e=1 ; e<ge->num_edicts ; e++)
+    for (e=1 ; e<num_edicts ; e++)
     {
         ent = EDICT_NUM(e);
 
@@ -590,11 +655,11 @@ void SV_BuildClientFrame (client_t *client)
         if (ent != clent)
         {
             // check area
-            if (!CM_AreasConnected (clientarea, ent->areanum))
+            if (!CM_AreasConnected (view->clientarea, ent->areanum))
             {    // doors can legally straddle two areas, so
                 // we may need to check another one
                 if (!ent->areanum2
-                    || !CM_AreasConnected (clientarea, ent->areanum2))
+                    || !CM_AreasConnected (view->clientarea, ent->areanum2))
                     continue;        // blocked by a door
             }
 
@@ -602,7 +667,7 @@ void SV_BuildClientFrame (client_t *client)
             if (ent->s.renderfx & RF_BEAM)
             {
                 l = ent->clusternums[0];
-                if ( !(clientphs[l >> 3] & (1 << (l&7) )) )
+                if ( !(view->phs[l >> 3] & (1 << (l&7) )) )
                     continue;
             }
             else
@@ -611,16 +676,15 @@ void SV_BuildClientFrame (client_t *client)
                 // in the PVS, only the PHS, clear the model
                 if (ent->s.sound)
                 {
-                    bitvector = fatpvs;    //clientphs;
+                    bitvector = view->fatpvs;    //view->phs;
                 }
                 else
-                    bitvector = fatpvs;
+                    bitvector = view->fatpvs;
 
                 if (ent->num_clusters == -1)
                 {    // too many leafs for individual check, go by headnode
                     if (!CM_HeadnodeVisible (ent->headnode, bitvector))
                         continue;
-                    c_fullsend++;
                 }
                 else
                 {    // check individual leafs
@@ -639,7 +703,7 @@ void SV_BuildClientFrame (client_t *client)
                     vec3_t    delta;
                     float    len;
 
-                    VectorSubtract (org, ent->s.origin, delta);
+                    VectorSubtract (view->org, ent->s.origin, delta);
                     len = VectorLength (delta);
                     if (len > 400)
                         continue;
@@ -647,10 +711,124 @@ void SV_BuildClientFrame (client_t *client)
             }
         }
 
-#if 0
-        if (SV_AddProjectileUpdate(ent))
-            continue; // added as a special projectile
-#endif
+        list[count++] = e;
+    }
+
+    return count;
+}
+
+
+/*
+=============
+SV_GrowClientEntities
+
+Doubles the circular client_entities and client_projectiles arrays
+until count states per client frame fit UPDATE_BACKUP times over.
+Everything still in the old arrays keeps its index, and frames that
+were already overwritten stay that way.
+=============
+*/
+static void SV_GrowClientEntities (int count)
+{
+    int        size, oldsize;
+    int        i, j;
+    entity_state_t    *entities;
+    projectile_t    *projectiles;
+    client_t        *cl;
+    client_frame_t    *frame;
+
+    oldsize = svs.num_client_entities;
+    size = oldsize;
+    while (size < count*UPDATE_BACKUP*maxclients->value
+        && size < MAX_EDICTS*UPDATE_BACKUP*maxclients->value)
+        size *= 2;
+    if (size == oldsize)
+        return;
+
+    Com_DPrintf ("client_entities grown to %i\n", size);
+
+    entities = Z_Malloc (sizeof(entity_state_t)*size);
+    projectiles = Z_Malloc (sizeof(projectile_t)*size);
+    for (i = svs.next_client_entities - oldsize ; i < svs.next_client_entities ; i++)
+        if (i >= 0)
+            entities[i%size] = svs.client_entities[i%oldsize];
+    for (i = svs.next_client_projectiles - oldsize ; i < svs.next_client_projectiles ; i++)
+        if (i >= 0)
+            projectiles[i%size] = svs.client_projectiles[i%oldsize];
+    Z_Free (svs.client_entities);
+    Z_Free (svs.client_projectiles);
+    svs.client_entities = entities;
+    svs.client_projectiles = projectiles;
+    svs.num_client_entities = size;
+
+    for (i=0, cl=svs.clients ; i<maxclients->value ; i++, cl++)
+    {
+        for (j=0, frame=cl->frames ; j<UPDATE_BACKUP ; j++, frame++)
+        {
+            if (svs.next_client_entities - frame->first_entity > oldsize)
+                frame->first_entity = svs.next_client_entities - size - 1;
+            if (svs.next_client_projectiles - frame->first_projectile > oldsize)
+                frame->first_projectile = svs.next_client_projectiles - size - 1;
+        }
+    }
+}
+
+/*
+=============
+SV_GrowBitDeltas
+
+Makes room in svs.bitdeltas for every client to have a delta for each
+edict.  Only ever called on the main thread, between frames.
+=============
+*/
+static void SV_GrowBitDeltas (void)
+{
+    if (svs.bitdeltas)
+        Z_Free (svs.bitdeltas);
+    svs.num_bitdeltas = ge->num_edicts;
+    svs.bitdeltas = Z_Malloc (sizeof(bitdelta_t)*svs.num_bitdeltas*maxclients->value);
+}
+
+/*
+=============
+SV_StoreClientEntities
+
+Copies the visible entities into the circular client_entities array
+for the frame being built, and the projectiles into client_projectiles.
+=============
+*/
+void SV_StoreClientEntities (client_t *client, int *list, int count)
+{
+    int        i, e;
+    edict_t    *ent;
+    client_frame_t    *frame;
+    entity_state_t    *state;
+
+    if (count*UPDATE_BACKUP*maxclients->value > svs.num_client_entities)
+        SV_GrowClientEntities (count);
+    if (client->bitents && ge->num_edicts > svs.num_bitdeltas)
+        SV_GrowBitDeltas ();
+
+    frame = &client->frames[sv.framenum & UPDATE_MASK];
+
+    frame->num_entities = 0;
+    frame->first_entity = svs.next_client_entities;
+    frame->num_projectiles = 0;
+    frame->first_projectile = svs.next_client_projectiles;
+
+    for (i=0 ; i<count ; i++)
+    {
+        e = list[i];
+        ent = EDICT_NUM(e);
+
+        if (client->projectiles && (ent->svflags & SVF_PROJECTILE))
+        {    // goes in svc_projectiles instead
+            ent->s.number = e;
+            SV_StoreProjectile (ent, &svs.client_projectiles[svs.next_client_projectiles%svs.num_client_entities]);
+            svs.next_client_projectiles++;
+            frame->num_projectiles++;
+            continue;
+        }
 
         // add it to the circular client_entities array
         state = &svs.client_entities[svs.next_client_entities%svs.num_client_entities];
@@ -671,6 +849,28 @@ void SV_BuildClientFrame (client_t *client)
 }
 
 
+/*
+=============
+SV_BuildClientFrame
+
+Decides which entities are going to be visible to the client, and
+copies off the playerstat and areabits.
+=============
+*/
+void SV_BuildClientFrame (client_t *client)
+{
+    int        count;
+
+    Prof_Begin (PROF_BUILDFRAME);
+    if (SV_SetupClientFrame (client, &sv_view))
+    {
+        count = SV_CullClientEntities (client, &sv_view, sv_visible);
+        SV_StoreClientEntities (client, sv_visible, count);
+    }
+    Prof_End (PROF_BUILDFRAME);
+}
+
+
 /*
 ==================
 SV_RecordDemoMessage
@@ -685,14 +885,14 @@ void SV_RecordDemoMessage (void)
     edict_t        *ent;
     entity_state_t    nostate;
     sizebuf_t    buf;
-    byte        buf_data[32768];
-    int            len;
+    static byte    buf_data[MAX_DEMOFRAMELEN];
 
     if (!svs.demofile)
         return;
 
     memset (&nostate, 0, sizeof(nostate));
     SZ_Init (&buf, buf_data, sizeof(buf_data));
+    buf.allowoverflow = true;
 
     // write a frame message that doesn't contain a player_state_t
     MSG_WriteByte (&buf, svc_frame);
@@ -717,13 +917,22 @@ void SV_RecordDemoMessage (void)
 
     MSG_WriteShort (&buf, 0);        // end of packetentities
 
+    // a frame can't be split, so one too big for a demo message is lost
+    if (buf.overflowed)
+    {
+        Com_Printf ("serverrecord: frame %i overflowed, left out\n", sv.framenum);
+        SZ_Clear (&svs.demo_multicast);
+        return;
+    }
+
     // now add the accumulated multicast information
-    SZ_Write (&buf, svs.demo_multicast.data, svs.demo_multicast.cursize);
+    if (svs.demo_multicast.overflowed)
+        Com_DPrintf ("serverrecord: multicasts overflowed, left out\n");
+    else if (buf.cursize + svs.demo_multicast.cursize <= buf.maxsize)
+        SZ_Write (&buf, svs.demo_multicast.data, svs.demo_multicast.cursize);
     SZ_Clear (&svs.demo_multicast);
 
-    // now write the entire message to the file, prefixed by the length
-    len = LittleLong (buf.cursize);
-    fwrite (&len, 4, 1, svs.demofile);
-    fwrite (buf.data, buf.cursize, 1, svs.demofile);
+    // now hand the entire message to the demo writer
+    Demo_WriteMessage (svs.demofile, buf.data, buf.cursize);
 }
 
@@ -385,6 +385,11 @@ void SV_InitGameProgs (void)
     import.SetAreaPortalState = CM_SetAreaPortalState;
     import.AreasConnected = CM_AreasConnected;
 
+    import.ProfZone = Prof_Zone;
+    import.ProfBegin = Prof_Begin;
+    import.ProfEnd = Prof_End;
+    import.tracemany = SV_TraceMany;
+
     ge = (game_export_t *)Sys_GetGameAPI (&import);
 
     if (!ge)
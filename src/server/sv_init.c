@@ -105,6 +105,10 @@ void SV_CreateBaseline (void)
         //
         VectorCopy (svent->s.origin, svent->s.old_origin);
         sv.baselines[entnum] = svent->s;
+
+        // what svc_spawnbaseline will leave clients with
+        sv.clientbaselines[entnum] = svent->s;
+        MSG_RoundDeltaEntity (&sv.clientbaselines[entnum]);
     }
 }
 
@@ -179,6 +183,8 @@ void SV_SpawnServer (char *server, char *spawnpoint, server_state_t serverstate,
     Com_DPrintf ("SpawnServer: %s\n",server);
     if (sv.demofile)
         fclose (sv.demofile);
+    if (sv.demoindex)
+        Z_Free (sv.demoindex);
 
     svs.spawncount++;        // any partially connected client will be
                             // restarted
@@ -239,6 +245,7 @@ void SV_SpawnServer (char *server, char *spawnpoint, server_state_t serverstate,
     // clear physics interaction links
     //
     SV_ClearWorld ();
+    SV_MulticastFrame ();
     
     for (i=1 ; i< CM_NumInlineModels() ; i++)
     {
@@ -266,6 +273,9 @@ void SV_SpawnServer (char *server, char *spawnpoint, server_state_t serverstate,
     // all precaches are complete
     sv.state = serverstate;
     Com_SetServerState (sv.state);
+
+    // a local client is about to load all of it, so start reading ahead
+    FS_PrefetchConfigstrings (sv.configstrings);
     
     // create a baseline for more efficient communications
     SV_CreateBaseline ();
@@ -349,13 +359,19 @@ void SV_InitGame (void)
 #endif
     }
 
+    // the game sizes g_edicts from maxentities
+    if (Cvar_VariableValue ("maxentities") > MAX_EDICTS)
+        Cvar_FullSet ("maxentities", va("%i", MAX_EDICTS), CVAR_LATCH);
+
     svs.spawncount = rand();
     svs.clients = Z_Malloc (sizeof(client_t)*maxclients->value);
     svs.num_client_entities = maxclients->value*UPDATE_BACKUP*64;
     svs.client_entities = Z_Malloc (sizeof(entity_state_t)*svs.num_client_entities);
+    svs.client_projectiles = Z_Malloc (sizeof(projectile_t)*svs.num_client_entities);
 
     // init network stuff
     NET_Config ( (maxclients->value > 1) );
+    SV_NetStart ();
 
     // heartbeats will always be sent to the id master
     svs.last_heartbeat = -99999;        // send immediately
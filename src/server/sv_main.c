@@ -28,6 +28,14 @@ cvar_t    *sv_paused;
 cvar_t    *sv_timedemo;
 
 cvar_t    *sv_enforcetime;
+cvar_t    *sv_areacell;
+cvar_t    *sv_threads;
+cvar_t    *sv_mcastbuckets;
+cvar_t    *sv_bitents;
+cvar_t    *sv_coordbits;
+cvar_t    *sv_anglebits;
+cvar_t    *sv_projectiles;
+cvar_t    *sv_bigedicts;
 
 cvar_t    *timeout;                // seconds without any message
 cvar_t    *zombietime;            // seconds to sink messages after disconnect
@@ -214,16 +222,13 @@ void SVC_Ping (void)
 
 /*
 =================
-SVC_GetChallenge
+SV_GetChallenge
 
-Returns a challenge number that can be used
-in a subsequent client_connect command.
-We do this to prevent denial of service attacks that
-flood the server with invalid connection IPs.  With a
-challenge, they must give a valid IP address.
+Returns the challenge for an address, making a new one if needed.
+Also called by the network thread, so the caller holds SV_NetLock.
 =================
 */
-void SVC_GetChallenge (void)
+int SV_GetChallenge (netadr_t adr)
 {
     int        i;
     int        oldest;
@@ -235,7 +240,7 @@ void SVC_GetChallenge (void)
     // see if we already have a challenge for this ip
     for (i = 0 ; i < MAX_CHALLENGES ; i++)
     {
-        if (NET_CompareBaseAdr (net_from, svs.challenges[i].adr))
+        if (NET_CompareBaseAdr (adr, svs.challenges[i].adr))
             break;
         if (svs.challenges[i].time < oldestTime)
         {
@@ -248,13 +253,35 @@ void SVC_GetChallenge (void)
     {
         // overwrite the oldest
         svs.challenges[oldest].challenge = rand() & 0x7fff;
-        svs.challenges[oldest].adr = net_from;
+        svs.challenges[oldest].adr = adr;
         svs.challenges[oldest].time = curtime;
         i = oldest;
     }
 
+    return svs.challenges[i].challenge;
+}
+
+/*
+=================
+SVC_GetChallenge
+
+Returns a challenge number that can be used
+in a subsequent client_connect command.
+We do this to prevent denial of service attacks that
+flood the server with invalid connection IPs.  With a
+challenge, they must give a valid IP address.
+=================
+*/
+void SVC_GetChallenge (void)
+{
+    int        challenge;
+
+    SV_NetLock ();
+    challenge = SV_GetChallenge (net_from);
+    SV_NetUnlock ();
+
     // send it back
-    Netchan_OutOfBandPrint (NS_SERVER, net_from, "challenge %i", svs.challenges[i].challenge);
+    Netchan_OutOfBandPrint (NS_SERVER, net_from, "challenge %i", challenge);
 }
 
 /*
@@ -276,6 +303,8 @@ void SVC_DirectConnect (void)
     int            version;
     int            qport;
     int            challenge;
+    qboolean    fragments, bitents, projectiles, bigedicts;
+    int            bitbase;
 
     adr = net_from;
 
@@ -297,6 +326,23 @@ void SVC_DirectConnect (void)
     strncpy (userinfo, Cmd_Argv(4), sizeof(userinfo)-32);
     userinfo[sizeof(userinfo) - 32] = 0;
 
+    // clients list the protocol extensions they know after the userinfo
+    fragments = bitents = projectiles = bigedicts = false;
+    bitbase = BE_OLDBASE;
+    for (i=5 ; i<Cmd_Argc() ; i++)
+    {
+        if (!strcmp (Cmd_Argv(i), "fragments"))
+            fragments = net_fragments->value != 0;
+        else if (!strcmp (Cmd_Argv(i), "bitents"))
+            bitents = sv_bitents->value != 0;
+        else if (!strcmp (Cmd_Argv(i), "bitbase") && i+1 < Cmd_Argc())
+            bitbase = atoi (Cmd_Argv(++i));
+        else if (!strcmp (Cmd_Argv(i), "projectiles"))
+            projectiles = sv_projectiles->value != 0;
+        else if (!strcmp (Cmd_Argv(i), "bigedicts"))
+            bigedicts = sv_bigedicts->value != 0;
+    }
+
     // force the IP key/value pair so the game can filter based on ip
     Info_SetValueForKey (userinfo, "ip", NET_AdrToString(net_from));
 
@@ -314,16 +360,19 @@ void SVC_DirectConnect (void)
     // see if the challenge is valid
     if (!NET_IsLocalAddress (adr))
     {
+        SV_NetLock ();
         for (i=0 ; i<MAX_CHALLENGES ; i++)
         {
             if (NET_CompareBaseAdr (net_from, svs.challenges[i].adr))
             {
                 if (challenge == svs.challenges[i].challenge)
                     break;        // good
+                SV_NetUnlock ();
                 Netchan_OutOfBandPrint (NS_SERVER, adr, "print\nBad challenge.\n");
                 return;
             }
         }
+        SV_NetUnlock ();
         if (i == MAX_CHALLENGES)
         {
             Netchan_OutOfBandPrint (NS_SERVER, adr, "print\nNo challenge for address.\n");
@@ -404,9 +453,16 @@ gotnewcl:
     SV_UserinfoChanged (newcl);
 
     // send the connect packet to the client
-    Netchan_OutOfBandPrint (NS_SERVER, adr, "client_connect");
+    Netchan_OutOfBandPrint (NS_SERVER, adr, "client_connect%s%s%s%s",
+        fragments ? " fragments" : "", bitents ? " bitents" : "",
+        projectiles ? " projectiles" : "", bigedicts ? " bigedicts" : "");
 
     Netchan_Setup (NS_SERVER, &newcl->netchan , adr, qport);
+    newcl->netchan.fragments = fragments;
+    newcl->bitents = bitents;
+    newcl->bitbase = bitbase < 0 ? 0 : bitbase > BE_MAXBASE ? BE_MAXBASE : bitbase;
+    newcl->projectiles = projectiles;
+    newcl->bigedicts = bigedicts;
 
     newcl->state = cs_connected;
     
@@ -606,7 +662,7 @@ void SV_ReadPackets (void)
     client_t    *cl;
     int            qport;
 
-    while (NET_GetPacket (NS_SERVER, &net_from, &net_message))
+    while (SV_NetGetPacket ())
     {
         // check for connectionless packet (0xffffffff) first
         if (*(int *)net_message.data == -1)
@@ -738,6 +794,9 @@ void SV_RunGameFrame (void)
     sv.framenum++;
     sv.time = sv.framenum*100;
 
+    CM_ClearTraceCache ();
+    SV_MulticastFrame ();
+
     // don't run if paused
     if (!sv_paused->value || maxclients->value > 1)
     {
@@ -780,7 +839,9 @@ void SV_Frame (int msec)
     SV_CheckTimeouts ();
 
     // get packets from clients
+    Prof_Begin (PROF_READPACKETS);
     SV_ReadPackets ();
+    Prof_End (PROF_READPACKETS);
 
     // move autonomous things around if enough time has passed
     if (!sv_timedemo->value && svs.realtime < sv.time)
@@ -792,21 +853,26 @@ void SV_Frame (int msec)
                 Com_Printf ("sv lowclamp\n");
             svs.realtime = sv.time - 100;
         }
-        NET_Sleep(sv.time - svs.realtime);
+        SV_NetSleep(sv.time - svs.realtime);
         return;
     }
 
     // update ping based on the last known frame from all clients
     SV_CalcPings ();
+    SV_NetFrame ();
 
     // give the clients some timeslices
     SV_GiveMsec ();
 
     // let everything in the world think and move
+    Prof_Begin (PROF_GAMEFRAME);
     SV_RunGameFrame ();
+    Prof_End (PROF_GAMEFRAME);
 
     // send messages back to the clients that had packets read this frame
+    Prof_Begin (PROF_SENDMESSAGES);
     SV_SendClientMessages ();
+    Prof_End (PROF_SENDMESSAGES);
 
     // save the entire world state if recording a serverdemo
     SV_RecordDemoMessage ();
@@ -972,6 +1038,15 @@ void SV_Init (void)
     sv_paused = Cvar_Get ("paused", "0", 0);
     sv_timedemo = Cvar_Get ("timedemo", "0", 0);
     sv_enforcetime = Cvar_Get ("sv_enforcetime", "0", 0);
+    sv_areacell = Cvar_Get ("sv_areacell", "512", 0);
+    sv_threads = Cvar_Get ("sv_threads", "0", 0);
+    sv_netthread = Cvar_Get ("sv_netthread", "0", CVAR_LATCH);
+    sv_mcastbuckets = Cvar_Get ("sv_mcastbuckets", "1", 0);
+    sv_bitents = Cvar_Get ("sv_bitents", "1", 0);
+    sv_coordbits = Cvar_Get ("sv_coordbits", "3", 0);
+    sv_anglebits = Cvar_Get ("sv_anglebits", "8", 0);
+    sv_projectiles = Cvar_Get ("sv_projectiles", "1", 0);
+    sv_bigedicts = Cvar_Get ("sv_bigedicts", "1", 0);
     allow_download = Cvar_Get ("allow_download", "1", CVAR_ARCHIVE);
     allow_download_players  = Cvar_Get ("allow_download_players", "0", CVAR_ARCHIVE);
     allow_download_models = Cvar_Get ("allow_download_models", "1", CVAR_ARCHIVE);
@@ -1040,6 +1115,8 @@ before Sys_Quit or Sys_Error
 */
 void SV_Shutdown (char *finalmsg, qboolean reconnect)
 {
+    SV_NetStop ();
+
     if (svs.clients)
         SV_FinalMessage (finalmsg, reconnect);
 
@@ -1049,6 +1126,8 @@ void SV_Shutdown (char *finalmsg, qboolean reconnect)
     // free current level
     if (sv.demofile)
         fclose (sv.demofile);
+    if (sv.demoindex)
+        Z_Free (sv.demoindex);
     memset (&sv, 0, sizeof(sv));
     Com_SetServerState (sv.state);
 
@@ -1057,8 +1136,14 @@ void SV_Shutdown (char *finalmsg, qboolean reconnect)
         Z_Free (svs.clients);
     if (svs.client_entities)
         Z_Free (svs.client_entities);
+    if (svs.client_projectiles)
+        Z_Free (svs.client_projectiles);
+    if (svs.clientjobs)
+        Z_Free (svs.clientjobs);
+    if (svs.bitdeltas)
+        Z_Free (svs.bitdeltas);
     if (svs.demofile)
-        fclose (svs.demofile);
+        Demo_Close (svs.demofile);
     memset (&svs, 0, sizeof(svs));
 }
 
@@ -0,0 +1,391 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// sv_net.c -- network thread
+
+#include "server.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <time.h>
+#endif
+
+/*
+=============================================================================
+
+With sv_netthread set, a thread reads the server socket all the time
+instead of SV_ReadPackets reading it once a frame.  Every packet is
+timestamped when it arrives, so a long game frame no longer shows up in
+the pings.  Pings, status requests and challenges are answered by the
+thread itself, so floods of them cost the server frame nothing.
+Everything else goes through a single producer, single consumer queue
+to SV_ReadPackets.
+
+The thread only touches the socket, the queue, and the status string and
+challenges under sv_netlock.  Loopback packets are still read by the
+main thread.
+
+=============================================================================
+*/
+
+#if !defined(_WIN32)
+#define    SV_NETTHREAD
+#endif
+
+#define    NET_QUEUE    256        // packets waiting for SV_ReadPackets
+
+typedef struct
+{
+    netadr_t    from;
+    double        time;            // Sys_FloatTime when it arrived
+    int            cursize;
+    byte        data[MAX_MSGLEN];
+} netpacket_t;
+
+cvar_t    *sv_netthread;
+
+#ifdef SV_NETTHREAD
+
+static netpacket_t        nt_queue[NET_QUEUE];
+static unsigned            nt_head;            // only written by the thread
+static unsigned            nt_tail;            // only written by SV_NetGetPacket
+static qboolean            nt_running;
+static int                nt_quit;
+static qboolean            nt_sleeping;        // SV_NetSleep is waiting for a packet
+static int                nt_answered, nt_dropped;
+
+static char                nt_status[MAX_MSGLEN - 16];
+
+static pthread_t        nt_thread;
+static pthread_mutex_t    sv_netlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t    nt_arrived = PTHREAD_COND_INITIALIZER;
+
+/*
+=================
+SV_NetLock
+
+Guards svs.challenges against the network thread
+=================
+*/
+void SV_NetLock (void)
+{
+    if (nt_running)
+        pthread_mutex_lock (&sv_netlock);
+}
+
+void SV_NetUnlock (void)
+{
+    if (nt_running)
+        pthread_mutex_unlock (&sv_netlock);
+}
+
+/*
+=================
+SV_NetReply
+
+Netchan_OutOfBandPrint for the network thread
+=================
+*/
+static void SV_NetReply (netadr_t to, char *format, ...)
+{
+    va_list        argptr;
+    byte        data[MAX_MSGLEN];
+    int            len;
+
+    *(int *)data = -1;
+    va_start (argptr, format);
+    len = vsnprintf ((char *)data+4, sizeof(data)-4, format, argptr);
+    va_end (argptr);
+    if (len < 0)
+        return;
+    if (len > sizeof(data)-5)
+        len = sizeof(data)-5;
+
+    NET_SendTo (NS_SERVER, to, data, len+4);
+}
+
+/*
+=================
+SV_NetConnectionless
+
+Answers the connectionless packets that don't need the server,
+returning false for anything SV_ConnectionlessPacket has to see
+=================
+*/
+static qboolean SV_NetConnectionless (netpacket_t *p)
+{
+    char    cmd[16];
+    int        i, challenge;
+
+    if (p->cursize < 4 || *(int *)p->data != -1)
+        return false;
+
+    // the first word on the line, like Cmd_Argv(0)
+    for (i=0 ; i<sizeof(cmd)-1 && i+4<p->cursize ; i++)
+    {
+        cmd[i] = p->data[i+4];
+        if (cmd[i] <= ' ')
+            break;
+    }
+    cmd[i] = 0;
+
+    if (!strcmp (cmd, "ping"))
+        SV_NetReply (p->from, "ack");
+    else if (!strcmp (cmd, "status"))
+    {
+        pthread_mutex_lock (&sv_netlock);
+        SV_NetReply (p->from, "print\n%s", nt_status);
+        pthread_mutex_unlock (&sv_netlock);
+    }
+    else if (!strcmp (cmd, "getchallenge"))
+    {
+        pthread_mutex_lock (&sv_netlock);
+        challenge = SV_GetChallenge (p->from);
+        pthread_mutex_unlock (&sv_netlock);
+        SV_NetReply (p->from, "challenge %i", challenge);
+    }
+    else
+        return false;
+
+    nt_answered++;
+    return true;
+}
+
+/*
+=================
+SV_NetThread
+=================
+*/
+static void *SV_NetThread (void *arg)
+{
+    static netpacket_t    overflow;
+    netpacket_t    *p;
+    unsigned    head;
+
+    head = nt_head;
+    while (!__atomic_load_n (&nt_quit, __ATOMIC_ACQUIRE))
+    {
+        // read straight into the queue when there's room, so a full
+        // queue still gets its pings answered
+        if (head - __atomic_load_n (&nt_tail, __ATOMIC_ACQUIRE) < NET_QUEUE)
+            p = &nt_queue[head & (NET_QUEUE-1)];
+        else
+            p = &overflow;
+
+        p->cursize = NET_RecvFrom (NS_SERVER, &p->from, p->data, sizeof(p->data), 50);
+        if (p->cursize <= 0)
+            continue;
+        p->time = Sys_FloatTime ();
+
+        if (SV_NetConnectionless (p))
+            continue;
+        if (p == &overflow)
+        {
+            nt_dropped++;
+            continue;
+        }
+
+        // both sequentially consistent, against SV_NetSleep setting
+        // nt_sleeping and then looking at nt_head
+        __atomic_store_n (&nt_head, ++head, __ATOMIC_SEQ_CST);
+
+        if (__atomic_load_n (&nt_sleeping, __ATOMIC_SEQ_CST))
+        {
+            pthread_mutex_lock (&sv_netlock);
+            pthread_cond_signal (&nt_arrived);
+            pthread_mutex_unlock (&sv_netlock);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+=================
+SV_NetStart
+
+Called by SV_InitGame once the sockets are open
+=================
+*/
+void SV_NetStart (void)
+{
+    if (nt_running || !sv_netthread->value)
+        return;
+    if (maxclients->value <= 1)
+        return;        // loopback only
+
+    strcpy (nt_status, SV_StatusString ());
+    nt_head = nt_tail = 0;
+    nt_quit = 0;
+    nt_answered = nt_dropped = 0;
+    if (pthread_create (&nt_thread, NULL, SV_NetThread, NULL))
+    {
+        Com_Printf ("Couldn't start the network thread\n");
+        return;
+    }
+    nt_running = true;
+}
+
+/*
+=================
+SV_NetStop
+
+Called by SV_Shutdown before the sockets are closed
+=================
+*/
+void SV_NetStop (void)
+{
+    if (!nt_running)
+        return;
+
+    __atomic_store_n (&nt_quit, 1, __ATOMIC_RELEASE);
+    pthread_join (nt_thread, NULL);
+    nt_running = false;
+    Com_DPrintf ("Network thread answered %i packets, dropped %i\n", nt_answered, nt_dropped);
+}
+
+/*
+=================
+SV_NetFrame
+
+Gives the thread a fresh status string, after SV_CalcPings
+=================
+*/
+void SV_NetFrame (void)
+{
+    if (!nt_running)
+        return;
+
+    pthread_mutex_lock (&sv_netlock);
+    strcpy (nt_status, SV_StatusString ());
+    pthread_mutex_unlock (&sv_netlock);
+}
+
+/*
+=================
+SV_NetGetPacket
+
+NET_GetPacket for the server, taking the network thread's queue into
+account.  Sets svs.packettime to when the packet arrived.
+=================
+*/
+qboolean SV_NetGetPacket (void)
+{
+    netpacket_t    *p;
+    unsigned    tail;
+    int            ago;
+
+    svs.packettime = svs.realtime;
+    if (!nt_running)
+        return NET_GetPacket (NS_SERVER, &net_from, &net_message);
+
+    if (NET_GetLoopPacket (NS_SERVER, &net_from, &net_message))
+        return true;
+
+    tail = nt_tail;
+    if (tail == __atomic_load_n (&nt_head, __ATOMIC_ACQUIRE))
+        return false;
+
+    p = &nt_queue[tail & (NET_QUEUE-1)];
+    net_from = p->from;
+    memcpy (net_message.data, p->data, p->cursize);
+    net_message.cursize = p->cursize;
+    ago = (Sys_FloatTime () - p->time) * 1000;
+    svs.packettime = svs.realtime - ago;
+
+    __atomic_store_n (&nt_tail, tail+1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/*
+=================
+SV_NetSleep
+
+NET_Sleep, woken by the network thread instead of the socket
+=================
+*/
+void SV_NetSleep (int msec)
+{
+    struct timespec    ts;
+    double            end;
+
+    if (!nt_running)
+    {
+        NET_Sleep (msec);
+        return;
+    }
+    if (!dedicated || !dedicated->value)
+        return; // we're not a server, just run full speed
+
+    end = Sys_FloatTime () + msec * 0.001;
+    clock_gettime (CLOCK_REALTIME, &ts);
+    ts.tv_sec += msec / 1000;
+    ts.tv_nsec += (msec % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock (&sv_netlock);
+    __atomic_store_n (&nt_sleeping, true, __ATOMIC_SEQ_CST);
+    while (nt_tail == __atomic_load_n (&nt_head, __ATOMIC_SEQ_CST)
+        && Sys_FloatTime () < end)
+    {
+        if (pthread_cond_timedwait (&nt_arrived, &sv_netlock, &ts))
+            break;
+    }
+    __atomic_store_n (&nt_sleeping, false, __ATOMIC_RELEASE);
+    pthread_mutex_unlock (&sv_netlock);
+}
+
+#else    // !SV_NETTHREAD
+
+void SV_NetLock (void)
+{
+}
+
+void SV_NetUnlock (void)
+{
+}
+
+void SV_NetStart (void)
+{
+}
+
+void SV_NetStop (void)
+{
+}
+
+void SV_NetFrame (void)
+{
+}
+
+qboolean SV_NetGetPacket (void)
+{
+    svs.packettime = svs.realtime;
+    return NET_GetPacket (NS_SERVER, &net_from, &net_message);
+}
+
+void SV_NetSleep (int msec)
+{
+    NET_Sleep (msec);
+}
+
+#endif    // SV_NETTHREAD
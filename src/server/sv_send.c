@@ -146,6 +146,188 @@ void SV_BroadcastCommand (char *fmt, ...)
 }
 
 
+/*
+=============================================================================
+
+MULTICAST CLUSTER BUCKETS
+
+Each client's origin is looked up in the bsp once a frame, or again when
+it is relinked, instead of on every multicast.  The clients are also
+bucketed by cluster, so a PVS or PHS multicast tests the mask once for
+every occupied cluster and only visits the clients in the ones that
+pass.
+
+=============================================================================
+*/
+
+static int        mc_numbuckets;
+static int        mc_cluster[MAX_CLIENTS];    // of each bucket
+static int        mc_first[MAX_CLIENTS];        // first client in each bucket
+static int        mc_next[MAX_CLIENTS];        // next client in the same bucket, -1 at the end
+static qboolean    mc_dirty;                    // a client moved since the buckets were made
+static qboolean    mc_bigedict;                // sv.multicast names an entity past MAX_EDICTS_OLD
+
+/*
+=================
+SV_MulticastMoved
+
+Called when a client's edict is relinked
+=================
+*/
+void SV_MulticastMoved (client_t *cl)
+{
+    cl->mcast_stale = true;
+    mc_dirty = true;
+}
+
+/*
+=================
+SV_MulticastFrame
+
+Looks every client up again before the next multicast, in case
+something moved one without relinking it, or the map changed
+=================
+*/
+void SV_MulticastFrame (void)
+{
+    int        i;
+
+    for (i=0 ; i<maxclients->value ; i++)
+        svs.clients[i].mcast_stale = true;
+    mc_dirty = true;
+}
+
+/*
+=================
+SV_MulticastBuckets
+=================
+*/
+static void SV_MulticastBuckets (void)
+{
+    client_t    *cl;
+    int            i, b, leafnum;
+
+    mc_numbuckets = 0;
+    for (i=0, cl=svs.clients ; i<maxclients->value ; i++, cl++)
+    {
+        if (cl->mcast_stale)
+        {
+            leafnum = CM_PointLeafnum (cl->edict->s.origin);
+            cl->mcast_cluster = CM_LeafCluster (leafnum);
+            cl->mcast_area = CM_LeafArea (leafnum);
+            cl->mcast_stale = false;
+        }
+        if (cl->mcast_cluster < 0)
+            continue;        // in a solid, can't see anything
+
+        for (b=0 ; b<mc_numbuckets ; b++)
+            if (mc_cluster[b] == cl->mcast_cluster)
+                break;
+        if (b == mc_numbuckets)
+        {
+            mc_cluster[b] = cl->mcast_cluster;
+            mc_first[b] = -1;
+            mc_numbuckets++;
+        }
+        mc_next[i] = mc_first[b];
+        mc_first[b] = i;
+    }
+
+    mc_dirty = false;
+}
+
+/*
+=================
+SV_MulticastEntity
+
+Returns the entity number the message in sv.multicast refers to, or 0
+if it doesn't.  Clients without "bigedicts" would drop on the ones
+past MAX_EDICTS_OLD, and never see those entities anyway.
+=================
+*/
+static int SV_MulticastEntity (void)
+{
+    byte    *data;
+    int        ofs, flags;
+
+    data = sv.multicast.data;
+    if (sv.multicast.cursize < 3)
+        return 0;
+
+    switch (data[0])
+    {
+    case svc_muzzleflash:
+    case svc_muzzleflash2:
+        ofs = 1;
+        break;
+
+    case svc_sound:
+        flags = data[1];
+        if (!(flags & SND_ENT))
+            return 0;
+        ofs = 3;
+        if (flags & SND_VOLUME)
+            ofs++;
+        if (flags & SND_ATTENUATION)
+            ofs++;
+        if (flags & SND_OFFSET)
+            ofs++;
+        if (ofs+2 > sv.multicast.cursize)
+            return 0;
+        return (data[ofs] | (data[ofs+1]<<8)) >> 3;
+
+    case svc_temp_entity:
+        switch (data[1])
+        {
+        case TE_PARASITE_ATTACK:
+        case TE_MEDIC_CABLE_ATTACK:
+        case TE_GRAPPLE_CABLE:
+        case TE_HEATBEAM:
+        case TE_MONSTER_HEATBEAM:
+            ofs = 2;
+            break;
+        case TE_LIGHTNING:        // source and destination, the high bytes tell which is past MAX_EDICTS_OLD
+            ofs = 2;
+            if (sv.multicast.cursize >= 6 && data[5] > data[3])
+                ofs = 4;
+            break;
+        case TE_FLASHLIGHT:
+            ofs = 8;
+            break;
+        default:
+            return 0;
+        }
+        break;
+
+    default:
+        return 0;
+    }
+
+    if (ofs+2 > sv.multicast.cursize)
+        return 0;
+    return data[ofs] | (data[ofs+1]<<8);
+}
+
+/*
+=================
+SV_MulticastTo
+=================
+*/
+static void SV_MulticastTo (client_t *client, qboolean reliable)
+{
+    if (client->state == cs_free || client->state == cs_zombie)
+        return;
+    if (client->state != cs_spawned && !reliable)
+        return;
+    if (mc_bigedict && !client->bigedicts)
+        return;
+
+    if (reliable)
+        SZ_Write (&client->netchan.message, sv.multicast.data, sv.multicast.cursize);
+    else
+        SZ_Write (&client->datagram, sv.multicast.data, sv.multicast.cursize);
+}
+
 /*
 =================
 SV_Multicast
@@ -163,7 +345,7 @@ void SV_Multicast (vec3_t origin, multicast_t to)
     client_t    *client;
     byte        *mask;
     int            leafnum, cluster;
-    int            j;
+    int            j, b;
     qboolean    reliable;
     int            area1, area2;
 
@@ -183,6 +365,8 @@ void SV_Multicast (vec3_t origin, multicast_t to)
     // if doing a serverrecord, store everything
     if (svs.demofile)
         SZ_Write (&svs.demo_multicast, sv.multicast.data, sv.multicast.cursize);
+
+    mc_bigedict = ge->num_edicts > MAX_EDICTS_OLD && SV_MulticastEntity () >= MAX_EDICTS_OLD;
     
     switch (to)
     {
@@ -214,6 +398,28 @@ void SV_Multicast (vec3_t origin, multicast_t to)
         Com_Error (ERR_FATAL, "SV_Multicast: bad to:%i", to);
     }
 
+    if (mask && sv_mcastbuckets->value)
+    {
+        // only the clients in clusters the mask has
+        if (mc_dirty)
+            SV_MulticastBuckets ();
+        for (b=0 ; b<mc_numbuckets ; b++)
+        {
+            cluster = mc_cluster[b];
+            if (!(mask[cluster>>3] & (1<<(cluster&7))))
+                continue;
+            for (j=mc_first[b] ; j != -1 ; j=mc_next[j])
+            {
+                client = &svs.clients[j];
+                if (CM_AreasConnected (area1, client->mcast_area))
+                    SV_MulticastTo (client, reliable);
+            }
+        }
+
+        SZ_Clear (&sv.multicast);
+        return;
+    }
+
     // send the data to all relevent clients
     for (j = 0, client = svs.clients; j < maxclients->value; j++, client++)
     {
@@ -221,6 +427,8 @@ void SV_Multicast (vec3_t origin, multicast_t to)
             continue;
         if (client->state != cs_spawned && !reliable)
             continue;
+        if (mc_bigedict && !client->bigedicts)
+            continue;
 
         if (mask)
         {
@@ -243,6 +451,140 @@ void SV_Multicast (vec3_t origin, multicast_t to)
 }
 
 
+/*
+=================
+SV_MulticastBench_f
+
+sv_mcastbench [multicasts] [bots]
+
+Stands a crowd of fake clients (64 by default) at entity origins around
+the current map and sets off rocket explosions near them, through the
+bucketed and the per client paths, reporting microseconds per
+multicast.  Every 32 multicasts is a new frame where all the bots move.
+=================
+*/
+void SV_MulticastBench_f (void)
+{
+    client_t    *saved, *bots;
+    edict_t        *botedicts, *ent;
+    vec3_t        *spots;
+    vec3_t        org;
+    char        savedmax[32], savedbuckets[32];
+    int            count, numbots, numspots;
+    int            i, j, pass, bytes;
+    unsigned    seed;
+    double        start, time;
+
+    if (sv.state != ss_game)
+    {
+        Com_Printf ("No map running\n");
+        return;
+    }
+    if (svs.demofile)
+    {
+        Com_Printf ("Not while recording a serverdemo\n");
+        return;
+    }
+
+    count = Cmd_Argc() > 1 ? atoi (Cmd_Argv(1)) : 100000;
+    numbots = Cmd_Argc() > 2 ? atoi (Cmd_Argv(2)) : 64;
+    if (count < 1)
+        count = 1;
+    if (numbots < 1)
+        numbots = 1;
+    if (numbots > MAX_CLIENTS)
+        numbots = MAX_CLIENTS;
+
+    // somewhere to stand
+    spots = Z_Malloc (ge->num_edicts * sizeof(vec3_t));
+    numspots = 0;
+    for (i=1 ; i<ge->num_edicts ; i++)
+    {
+        ent = EDICT_NUM(i);
+        if (ent->inuse)
+            VectorCopy (ent->s.origin, spots[numspots++]);
+    }
+    if (!numspots)
+    {
+        Z_Free (spots);
+        Com_Printf ("No entities to stand the bots at\n");
+        return;
+    }
+
+    bots = Z_Malloc (numbots * sizeof(client_t));
+    botedicts = Z_Malloc (numbots * sizeof(edict_t));
+    for (i=0 ; i<numbots ; i++)
+    {
+        bots[i].state = cs_spawned;
+        bots[i].edict = &botedicts[i];
+        SZ_Init (&bots[i].datagram, bots[i].datagram_buf, sizeof(bots[i].datagram_buf));
+    }
+
+    // maxclients is latched, so it has to be forced for the bots
+    saved = svs.clients;
+    Com_sprintf (savedmax, sizeof(savedmax), "%s", maxclients->string);
+    Com_sprintf (savedbuckets, sizeof(savedbuckets), "%s", sv_mcastbuckets->string);
+    svs.clients = bots;
+    Cvar_FullSet ("maxclients", va("%i", numbots), maxclients->flags);
+
+    for (pass=0 ; pass<2 ; pass++)
+    {
+        Cvar_Set ("sv_mcastbuckets", pass ? "0" : "1");
+        seed = 1;
+        time = 0;
+        bytes = 0;
+
+        for (i=0 ; i<count ; i++)
+        {
+            if (!(i & 31))
+            {    // a new frame, and everyone has moved
+                for (j=0 ; j<numbots ; j++)
+                {
+                    seed = seed * 1103515245 + 12345;
+                    VectorCopy (spots[(seed >> 8) % numspots], botedicts[j].s.origin);
+                    bytes += bots[j].datagram.cursize;
+                    SZ_Clear (&bots[j].datagram);
+                }
+                SV_MulticastFrame ();
+            }
+
+            seed = seed * 1103515245 + 12345;
+            VectorCopy (spots[(seed >> 8) % numspots], org);
+            for (j=0 ; j<3 ; j++)
+            {
+                seed = seed * 1103515245 + 12345;
+                org[j] += (int)((seed >> 8) & 255) - 128;
+            }
+
+            MSG_WriteByte (&sv.multicast, svc_temp_entity);
+            MSG_WriteByte (&sv.multicast, TE_ROCKET_EXPLOSION);
+            MSG_WritePos (&sv.multicast, org);
+
+            start = Sys_FloatTime ();
+            SV_Multicast (org, MULTICAST_PHS);
+            time += Sys_FloatTime () - start;
+        }
+
+        for (j=0 ; j<numbots ; j++)
+        {
+            bytes += bots[j].datagram.cursize;
+            SZ_Clear (&bots[j].datagram);
+        }
+
+        Com_Printf ("%s: %.2f microseconds per multicast, %.1f clients reached per multicast\n",
+            pass ? "per client" : "bucketed", time * 1000000 / count, bytes / 8.0 / count);
+    }
+
+    svs.clients = saved;
+    Cvar_FullSet ("maxclients", savedmax, maxclients->flags);
+    Cvar_Set ("sv_mcastbuckets", savedbuckets);
+    SV_MulticastFrame ();
+
+    Z_Free (botedicts);
+    Z_Free (bots);
+    Z_Free (spots);
+}
+
 /*  
 ==================
 SV_StartSound
@@ -394,12 +736,13 @@ SV_SendClientDatagram
 */
 qboolean SV_SendClientDatagram (client_t *client)
 {
-    byte        msg_buf[MAX_MSGLEN];
+    byte        msg_buf[MAX_FRAGMSGLEN];
     sizebuf_t    msg;
 
     SV_BuildClientFrame (client);
 
-    SZ_Init (&msg, msg_buf, sizeof(msg_buf));
+    // a client with fragments can take a frame too big for one packet
+    SZ_Init (&msg, msg_buf, client->netchan.fragments ? MAX_FRAGMSGLEN : MAX_MSGLEN);
     msg.allowoverflow = true;
 
     // send over all the relevant entity_state_t
@@ -432,6 +775,111 @@ qboolean SV_SendClientDatagram (client_t *client)
 }
 
 
+/*
+=======================
+SV_CullClientJob / SV_EncodeClientJob
+
+The parts of SV_SendClientDatagram that only read the world, run on
+the sv_threads workers.  Each job works on one client and writes only
+to that client's frame and clientjob_t.
+=======================
+*/
+void SV_CullClientJob (int job, void *data)
+{
+    clientjob_t    *cj;
+
+    cj = &svs.clientjobs[job];
+    if (!cj->send || !cj->setup)
+        return;
+
+    cj->num_visible = SV_CullClientEntities (&svs.clients[job], &cj->view, cj->visible);
+}
+
+void SV_EncodeClientJob (int job, void *data)
+{
+    clientjob_t    *cj;
+
+    cj = &svs.clientjobs[job];
+    if (!cj->send)
+        return;
+
+    // a big frame can still overflow; SV_SendClientDatagrams drops it
+    // on the main thread, never Com_Error or Com_Printf out here
+    SZ_Init (&cj->msg, cj->msg_buf, sizeof(cj->msg_buf));
+    cj->msg.allowoverflow = true;
+    cj->msg.quietoverflow = true;
+
+    // send over all the relevant entity_state_t
+    // and the player_state_t
+    SV_WriteFrameToClient (&svs.clients[job], &cj->msg);
+}
+
+/*
+=======================
+SV_SendClientDatagrams
+
+Same as calling SV_SendClientDatagram for every client that has
+send set in its clientjob_t, but culls and delta compresses the frames
+on sv_threads threads.  Only the things that touch shared state stay
+serialized: the collision model queries, storing into the circular
+client_entities array, and the Netchan_Transmit calls.
+=======================
+*/
+void SV_SendClientDatagrams (void)
+{
+    int            i;
+    client_t    *c;
+    clientjob_t    *cj;
+    int            numclients;
+
+    numclients = maxclients->value;
+
+    // all of the clients' frames at once
+    Prof_Begin (PROF_BUILDFRAME);
+    for (i=0, c = svs.clients, cj = svs.clientjobs ; i<numclients ; i++, c++, cj++)
+        if (cj->send)
+            cj->setup = SV_SetupClientFrame (c, &cj->view);
+
+    Sys_RunJobs (SV_CullClientJob, numclients, NULL, sv_threads->value);
+
+    for (i=0, c = svs.clients, cj = svs.clientjobs ; i<numclients ; i++, c++, cj++)
+        if (cj->send && cj->setup)
+            SV_StoreClientEntities (c, cj->visible, cj->num_visible);
+    Prof_End (PROF_BUILDFRAME);
+
+    Sys_RunJobs (SV_EncodeClientJob, numclients, NULL, sv_threads->value);
+
+    for (i=0, c = svs.clients, cj = svs.clientjobs ; i<numclients ; i++, c++, cj++)
+    {
+        if (!cj->send)
+            continue;
+
+        // copy the accumulated multicast datagram
+        // for this client out to the message
+        // it is necessary for this to be after the WriteEntities
+        // so that entity references will be current
+        if (c->datagram.overflowed)
+            Com_Printf ("WARNING: datagram overflowed for %s\n", c->name);
+        else
+            SZ_Write (&cj->msg, c->datagram.data, c->datagram.cursize);
+        SZ_Clear (&c->datagram);
+
+        if (cj->msg.overflowed
+            || cj->msg.cursize > (c->netchan.fragments ? MAX_FRAGMSGLEN : MAX_MSGLEN))
+        {    // must have room left for the packet header
+            Com_Printf ("WARNING: msg overflowed for %s\n", c->name);
+            SZ_Clear (&cj->msg);
+        }
+
+        // send the datagram
+        Netchan_Transmit (&c->netchan, cj->msg.cursize, cj->msg.data);
+
+        // record the size for rate estimation
+        c->message_size[sv.framenum % RATE_MESSAGES] = cj->msg.cursize;
+    }
+}
+
+
 /*
 ==================
 SV_DemoCompleted
@@ -444,6 +892,11 @@ void SV_DemoCompleted (void)
         fclose (sv.demofile);
         sv.demofile = NULL;
     }
+    if (sv.demoindex)
+    {
+        Z_Free (sv.demoindex);
+        sv.demoindex = NULL;
+    }
     SV_Nextserver ();
 }
 
@@ -492,11 +945,21 @@ void SV_SendClientMessages (void)
     int            i;
     client_t    *c;
     int            msglen;
-    byte        msgbuf[MAX_MSGLEN];
+    byte        msgbuf[MAX_FRAGMSGLEN];
     int            r;
+    qboolean    threaded;
 
     msglen = 0;
 
+    threaded = sv_threads->value > 0 && sv.state == ss_game;
+    if (threaded)
+    {
+        if (!svs.clientjobs)
+            svs.clientjobs = Z_Malloc (sizeof(clientjob_t)*maxclients->value);
+        for (i=0 ; i<maxclients->value ; i++)
+            svs.clientjobs[i].send = false;
+    }
+
     // read the next demo message if needed
     if (sv.state == ss_demo && sv.demofile)
     {
@@ -517,8 +980,9 @@ void SV_SendClientMessages (void)
                 SV_DemoCompleted ();
                 return;
             }
-            if (msglen > MAX_MSGLEN)
-                Com_Error (ERR_DROP, "SV_SendClientMessages: msglen > MAX_MSGLEN");
+            // demos recorded over fragments can have bigger messages
+            if (msglen > MAX_FRAGMSGLEN)
+                Com_Error (ERR_DROP, "SV_SendClientMessages: msglen > MAX_FRAGMSGLEN");
             r = fread (msgbuf, msglen, 1, sv.demofile);
             if (r != 1)
             {
@@ -528,7 +992,9 @@ void SV_SendClientMessages (void)
         }
     }
 
-    // send a message to each connected client
+    // send a message to each connected client, all in as few
+    // system calls as possible
+    NET_BeginPackets ();
     for (i=0, c = svs.clients ; i<maxclients->value; i++, c++)
     {
         if (!c->state)
@@ -554,7 +1020,10 @@ void SV_SendClientMessages (void)
             if (SV_RateDrop (c))
                 continue;
 
-            SV_SendClientDatagram (c);
+            if (threaded)
+                svs.clientjobs[i].send = true;    // sent below
+            else
+                SV_SendClientDatagram (c);
         }
         else
         {
@@ -563,5 +1032,9 @@ void SV_SendClientMessages (void)
                 Netchan_Transmit (&c->netchan, 0, NULL);
         }
     }
+
+    if (threaded)
+        SV_SendClientDatagrams ();
+    NET_FlushPackets ();
 }
 
@@ -40,11 +40,18 @@ SV_BeginDemoServer
 void SV_BeginDemoserver (void)
 {
     char        name[MAX_OSPATH];
+    int            len;
 
     Com_sprintf (name, sizeof(name), "demos/%s", sv.name);
-    FS_FOpenFile (name, &sv.demofile);
+    len = FS_FOpenFile (name, &sv.demofile);
     if (!sv.demofile)
         Com_Error (ERR_DROP, "Couldn't open %s\n", name);
+
+    // keyframes to seek to
+    sv.demostart = ftell (sv.demofile);
+    if (sv.demoindex)
+        Z_Free (sv.demoindex);
+    sv.demoindex = Demo_LoadIndex (sv.demofile, len, &sv.numdemoindex);
 }
 
 /*
@@ -190,7 +197,7 @@ SV_Baselines_f
 */
 void SV_Baselines_f (void)
 {
-    int        start;
+    int        start, end;
     entity_state_t    nullstate;
     entity_state_t    *base;
 
@@ -217,10 +224,13 @@ void SV_Baselines_f (void)
 
     memset (&nullstate, 0, sizeof(nullstate));
 
+    // entities past what the client can take are never sent to it
+    end = sv_client->bigedicts ? MAX_EDICTS : MAX_EDICTS_OLD;
+
     // write a packet full of data
 
     while ( sv_client->netchan.message.cursize <  MAX_MSGLEN/2
-        && start < MAX_EDICTS)
+        && start < end)
     {
         base = &sv.baselines[start];
         if (base->modelindex || base->sound || base->effects)
@@ -233,7 +243,7 @@ void SV_Baselines_f (void)
 
     // send next command
 
-    if (start == MAX_EDICTS)
+    if (start >= end)
     {
         MSG_WriteByte (&sv_client->netchan.message, svc_stufftext);
         MSG_WriteString (&sv_client->netchan.message, va("precache %i\n", svs.spawncount) );
@@ -612,7 +622,7 @@ void SV_ExecuteClientMessage (client_t *cl)
                 cl->lastframe = lastframe;
                 if (cl->lastframe > 0) {
                     cl->frame_latency[cl->lastframe&(LATENCY_COUNTS-1)] = 
-                        svs.realtime - cl->frames[cl->lastframe & UPDATE_MASK].senttime;
+                        svs.packettime - cl->frames[cl->lastframe & UPDATE_MASK].senttime;
                 }
             }
 
@@ -41,22 +41,36 @@ typedef struct areanode_s
 {
     int        axis;        // -1 = leaf node
     float    dist;
+    float    loose;        // children overlap by this much across dist
     struct areanode_s    *children[2];
     link_t    trigger_edicts;
     link_t    solid_edicts;
 } areanode_t;
 
-#define    AREA_DEPTH    4
-#define    AREA_NODES    32
+// the tree depth is picked per map in SV_ClearWorld, so big open maps
+// get small cells instead of hundreds of edicts sharing one list
+#define    AREA_MIN_DEPTH    4
+#define    AREA_MAX_DEPTH    10
+#define    AREA_NODES        ((2<<AREA_MAX_DEPTH)-1)
+
+#define    AREA_EDICTS_PER_LEAF    16        // wanted density at max_edicts
+#define    AREA_MAX_LOOSE        64        // never overlap children more than this
 
 areanode_t    sv_areanodes[AREA_NODES];
 int            sv_numareanodes;
+int            sv_areadepth;
 
 float    *area_mins, *area_maxs;
 edict_t    **area_list;
 int        area_count, area_maxcount;
 int        area_type;
 
+// sv_areastats counters
+int        area_queries;
+int        area_checked;            // links walked by all queries
+int        area_maxchecked;        // most links walked by a single query
+int        area_found;                // edicts returned by all queries
+
 int SV_HullForEntity (edict_t *ent);
 
 
@@ -84,7 +98,9 @@ void InsertLinkBefore (link_t *l, link_t *before)
 ===============
 SV_CreateAreaNode
 
-Builds a uniformly subdivided tree for the given world size
+Builds a uniformly subdivided tree for the given world size.
+The children of each node are loose: an edict that straddles the
+split by less than anode->loose still goes down to a child.
 ===============
 */
 areanode_t *SV_CreateAreaNode (int depth, vec3_t mins, vec3_t maxs)
@@ -92,6 +108,7 @@ areanode_t *SV_CreateAreaNode (int depth, vec3_t mins, vec3_t maxs)
     areanode_t    *anode;
     vec3_t        size;
     vec3_t        mins1, maxs1, mins2, maxs2;
+    float        loose;
 
     anode = &sv_areanodes[sv_numareanodes];
     sv_numareanodes++;
@@ -99,7 +116,7 @@ areanode_t *SV_CreateAreaNode (int depth, vec3_t mins, vec3_t maxs)
     ClearLink (&anode->trigger_edicts);
     ClearLink (&anode->solid_edicts);
     
-    if (depth == AREA_DEPTH)
+    if (depth == sv_areadepth)
     {
         anode->axis = -1;
         anode->children[0] = anode->children[1] = NULL;
@@ -113,12 +130,19 @@ areanode_t *SV_CreateAreaNode (int depth, vec3_t mins, vec3_t maxs)
         anode->axis = 1;
     
     anode->dist = 0.5 * (maxs[anode->axis] + mins[anode->axis]);
+
+    loose = size[anode->axis] / 8;
+    if (loose > AREA_MAX_LOOSE)
+        loose = AREA_MAX_LOOSE;
+    anode->loose = loose;
+
     VectorCopy (mins, mins1);    
     VectorCopy (mins, mins2);    
     VectorCopy (maxs, maxs1);    
     VectorCopy (maxs, maxs2);    
     
-    maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
+    maxs1[anode->axis] = anode->dist + loose;
+    mins2[anode->axis] = anode->dist - loose;
     
     anode->children[0] = SV_CreateAreaNode (depth+1, mins2, maxs2);
     anode->children[1] = SV_CreateAreaNode (depth+1, mins1, maxs1);
@@ -126,6 +150,52 @@ areanode_t *SV_CreateAreaNode (int depth, vec3_t mins, vec3_t maxs)
     return anode;
 }
 
+/*
+===============
+SV_AreaDepth
+
+Picks a tree depth that gets the leaf cells down to sv_areacell units
+across, and deep enough that a full edict list spreads out to about
+AREA_EDICTS_PER_LEAF edicts per leaf.
+===============
+*/
+int SV_AreaDepth (vec3_t mins, vec3_t maxs)
+{
+    int        depth;
+    int        max_edicts;
+    float    cell;
+    vec3_t    size;
+
+    cell = sv_areacell->value;
+    if (cell < 64)
+        cell = 64;
+
+    max_edicts = ge ? ge->max_edicts : MAX_EDICTS;
+
+    VectorSubtract (maxs, mins, size);
+    for (depth=0 ; depth < AREA_MIN_DEPTH ; depth++)
+    {
+        if (size[0] > size[1])
+            size[0] *= 0.5;
+        else
+            size[1] *= 0.5;
+    }
+
+    while (depth < AREA_MAX_DEPTH)
+    {
+        if (size[0] <= cell && size[1] <= cell
+        && (1<<depth) * AREA_EDICTS_PER_LEAF >= max_edicts)
+            break;
+        if (size[0] > size[1])
+            size[0] *= 0.5;
+        else
+            size[1] *= 0.5;
+        depth++;
+    }
+
+    return depth;
+}
+
 /*
 ===============
 SV_ClearWorld
@@ -136,7 +206,43 @@ void SV_ClearWorld (void)
 {
     memset (sv_areanodes, 0, sizeof(sv_areanodes));
     sv_numareanodes = 0;
+    sv_areadepth = SV_AreaDepth (sv.models[1]->mins, sv.models[1]->maxs);
     SV_CreateAreaNode (0, sv.models[1]->mins, sv.models[1]->maxs);
+
+    area_queries = area_checked = area_maxchecked = area_found = 0;
+}
+
+/*
+===============
+SV_AreaStats_f
+
+Reports how long the lists walked by SV_AreaEdicts were since the
+last call, then starts counting again.
+===============
+*/
+void SV_AreaStats_f (void)
+{
+    int        i, leafs;
+
+    leafs = 0;
+    for (i=0 ; i<sv_numareanodes ; i++)
+        if (sv_areanodes[i].axis == -1)
+            leafs++;
+
+    Com_Printf ("area tree: depth %i, %i nodes, %i leafs\n",
+        sv_areadepth, sv_numareanodes, leafs);
+
+    if (!area_queries)
+    {
+        Com_Printf ("no area queries\n");
+        return;
+    }
+
+    Com_Printf ("%i queries: %.1f avg / %i max edicts checked, %.1f avg returned\n",
+        area_queries, (float)area_checked / area_queries, area_maxchecked,
+        (float)area_found / area_queries);
+
+    area_queries = area_checked = area_maxchecked = area_found = 0;
 }
 
 
@@ -181,6 +287,11 @@ void SV_LinkEdict (edict_t *ent)
     if (!ent->inuse)
         return;
 
+    // a client's multicast cluster has to be looked up again
+    i = NUM_FOR_EDICT(ent);
+    if (i <= maxclients->value)
+        SV_MulticastMoved (&svs.clients[i-1]);
+
     // set the size
     VectorSubtract (ent->maxs, ent->mins, ent->size);
     
@@ -328,9 +439,9 @@ void SV_LinkEdict (edict_t *ent)
     {
         if (node->axis == -1)
             break;
-        if (ent->absmin[node->axis] > node->dist)
+        if (ent->absmin[node->axis] > node->dist - node->loose)
             node = node->children[0];
-        else if (ent->absmax[node->axis] < node->dist)
+        else if (ent->absmax[node->axis] < node->dist + node->loose)
             node = node->children[1];
         else
             break;        // crosses the node
@@ -369,6 +480,7 @@ void SV_AreaEdicts_r (areanode_t *node)
     {
         next = l->next;
         check = EDICT_FROM_AREA(l);
+        area_checked++;
 
         if (check->solid == SOLID_NOT)
             continue;        // deactivated
@@ -394,9 +506,9 @@ void SV_AreaEdicts_r (areanode_t *node)
         return;        // terminal node
 
     // recurse down both sides
-    if ( area_maxs[node->axis] > node->dist )
+    if ( area_maxs[node->axis] > node->dist - node->loose )
         SV_AreaEdicts_r ( node->children[0] );
-    if ( area_mins[node->axis] < node->dist )
+    if ( area_mins[node->axis] < node->dist + node->loose )
         SV_AreaEdicts_r ( node->children[1] );
 }
 
@@ -408,6 +520,8 @@ SV_AreaEdicts
 int SV_AreaEdicts (vec3_t mins, vec3_t maxs, edict_t **list,
     int maxcount, int areatype)
 {
+    int        checked;
+
     area_mins = mins;
     area_maxs = maxs;
     area_list = list;
@@ -415,8 +529,15 @@ int SV_AreaEdicts (vec3_t mins, vec3_t maxs, edict_t **list,
     area_maxcount = maxcount;
     area_type = areatype;
 
+    checked = area_checked;
     SV_AreaEdicts_r (sv_areanodes);
 
+    checked = area_checked - checked;
+    if (checked > area_maxchecked)
+        area_maxchecked = checked;
+    area_queries++;
+    area_found += area_count;
+
     return area_count;
 }
 
@@ -657,3 +778,76 @@ trace_t SV_Trace (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edict_t *p
     return clip.trace;
 }
 
+
+/*
+==================
+SV_TraceMany
+
+Like SV_Trace from one start point to each of the ends, but the world
+is only walked once for all of them.  Each move is still clipped to
+the entities on its own.
+==================
+*/
+void SV_TraceMany (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t *ends, int numtraces, edict_t *passedict, int contentmask, trace_t *traces)
+{
+    moveclip_t    clip;
+    int            i;
+
+    if (!mins)
+        mins = vec3_origin;
+    if (!maxs)
+        maxs = vec3_origin;
+
+    // clip to world
+    CM_BoxTraceMany (start, ends, numtraces, mins, maxs, 0, contentmask, traces);
+
+    for (i=0 ; i<numtraces ; i++)
+    {
+        traces[i].ent = ge->edicts;
+        if (traces[i].fraction == 0)
+            continue;        // blocked by the world
+
+        memset ( &clip, 0, sizeof ( moveclip_t ) );
+        clip.trace = traces[i];
+        clip.contentmask = contentmask;
+        clip.start = start;
+        clip.end = ends[i];
+        clip.mins = mins;
+        clip.maxs = maxs;
+        clip.passedict = passedict;
+
+        VectorCopy (mins, clip.mins2);
+        VectorCopy (maxs, clip.maxs2);
+
+        // create the bounding box of the entire move
+        SV_TraceBounds ( start, clip.mins2, clip.maxs2, ends[i], clip.boxmins, clip.boxmaxs );
+
+        // clip to other solid entities
+        SV_ClipMoveToEntities ( &clip );
+
+        traces[i] = clip.trace;
+    }
+}
+
+
+/*
+==================
+SV_TraceStats_f
+
+Reports how well the collision trace cache has done since the last call
+==================
+*/
+void SV_TraceStats_f (void)
+{
+    int        lookups;
+
+    lookups = c_trace_hits + c_trace_misses;
+
+    Com_Printf ("%i traces, %i brush traces\n", c_traces, c_brush_traces);
+    Com_Printf ("trace cache: %i hits, %i misses", c_trace_hits, c_trace_misses);
+    if (lookups)
+        Com_Printf (" (%.1f%% hit rate)", 100.0 * c_trace_hits / lookups);
+    Com_Printf ("\n%i batched traces\n", c_trace_batched);
+
+    c_trace_hits = c_trace_misses = c_trace_batched = 0;
+}